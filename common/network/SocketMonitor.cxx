@@ -0,0 +1,277 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include <rdr/Exception.h>
+#include <network/SocketMonitor.h>
+#include <rfb/LogWriter.h>
+
+using namespace network;
+
+static rfb::LogWriter vlog("SocketMonitor");
+
+// Maximum number of events fetched from the kernel in one go
+static const int MaxEvents = 256;
+
+SocketMonitor::SocketMonitor()
+  : epollFd(-1)
+{
+#ifdef HAVE_EPOLL
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd == -1)
+    vlog.error("Unable to create epoll instance: %s", strerror(errno));
+#endif
+}
+
+SocketMonitor::~SocketMonitor()
+{
+  if (epollFd != -1)
+    close(epollFd);
+}
+
+void SocketMonitor::add(int fd, bool edgeTriggered)
+{
+  assert(fd >= 0);
+  assert(!isMonitored(fd));
+
+  if ((size_t)fd >= state.size())
+    state.resize(fd + 1, 0);
+
+  state[fd] = stateMonitored;
+  if (edgeTriggered)
+    state[fd] |= stateEdgeTriggered | stateWritable;
+  else
+    levelTriggered.insert(fd);
+
+  monitored.insert(fd);
+
+#ifdef HAVE_EPOLL
+  if (epollFd != -1) {
+    struct epoll_event ev;
+
+    ev.data.fd = fd;
+    if (edgeTriggered)
+      ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    else
+      ev.events = EPOLLIN;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+      remove(fd);
+      throw rdr::SystemException("epoll_ctl", errno);
+    }
+  }
+#endif
+}
+
+void SocketMonitor::remove(int fd)
+{
+  if (!isMonitored(fd))
+    return;
+
+#ifdef HAVE_EPOLL
+  if (epollFd != -1)
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
+  state[fd] = 0;
+  monitored.erase(fd);
+  levelTriggered.erase(fd);
+  readable.erase(fd);
+}
+
+bool SocketMonitor::isMonitored(int fd) const
+{
+  return getState(fd) & stateMonitored;
+}
+
+bool SocketMonitor::wait(int timeoutMs)
+{
+  std::set<int>::const_iterator iter;
+
+  // Level triggered descriptors are only readable if the kernel says
+  // so right now
+  for (iter = levelTriggered.begin(); iter != levelTriggered.end(); ++iter)
+    state[*iter] &= ~stateReadable;
+
+  // Someone still has work to do, so don't block
+  if (!readable.empty())
+    timeoutMs = 0;
+
+  if (epollFd != -1)
+    return waitEpoll(timeoutMs);
+
+  return waitPoll(timeoutMs);
+}
+
+bool SocketMonitor::isReadable(int fd) const
+{
+  return getState(fd) & stateReadable;
+}
+
+bool SocketMonitor::isWritable(int fd) const
+{
+  return getState(fd) & stateWritable;
+}
+
+void SocketMonitor::checkReadable(int fd)
+{
+  int pending;
+
+  if (!isReadable(fd))
+    return;
+
+  if ((ioctl(fd, FIONREAD, &pending) == 0) && (pending > 0))
+    return;
+
+  state[fd] &= ~stateReadable;
+  readable.erase(fd);
+}
+
+void SocketMonitor::clearWritable(int fd)
+{
+  if (!isMonitored(fd))
+    return;
+
+  state[fd] &= ~stateWritable;
+}
+
+const char* SocketMonitor::getMethod() const
+{
+  if (epollFd != -1)
+    return "epoll";
+  return "poll";
+}
+
+unsigned SocketMonitor::getState(int fd) const
+{
+  if ((fd < 0) || ((size_t)fd >= state.size()))
+    return 0;
+  return state[fd];
+}
+
+void SocketMonitor::setReady(int fd, bool canRead, bool canWrite)
+{
+  if (!isMonitored(fd))
+    return;
+
+  if (canRead) {
+    state[fd] |= stateReadable;
+    if (state[fd] & stateEdgeTriggered)
+      readable.insert(fd);
+  }
+
+  if (canWrite && (state[fd] & stateEdgeTriggered))
+    state[fd] |= stateWritable;
+}
+
+bool SocketMonitor::waitEpoll(int timeoutMs)
+{
+#ifdef HAVE_EPOLL
+  struct epoll_event events[MaxEvents];
+  int count;
+
+  count = epoll_wait(epollFd, events, MaxEvents, timeoutMs);
+  if (count < 0) {
+    if (errno == EINTR) {
+      vlog.debug("Interrupted epoll_wait() system call");
+      return false;
+    }
+    throw rdr::SystemException("epoll_wait", errno);
+  }
+
+  for (int i = 0; i < count; i++) {
+    uint32_t ev;
+
+    ev = events[i].events;
+
+    // Errors and hang ups are discovered by reading
+    setReady(events[i].data.fd,
+             ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR),
+             ev & EPOLLOUT);
+  }
+
+  return true;
+#else
+  (void)timeoutMs;
+  assert(false);
+  return false;
+#endif
+}
+
+bool SocketMonitor::waitPoll(int timeoutMs)
+{
+  std::vector<struct pollfd> fds;
+  std::set<int>::const_iterator iter;
+  int count;
+
+  // Without a way to keep state in the kernel we have to describe
+  // every descriptor on every wait
+  fds.reserve(monitored.size());
+  for (iter = monitored.begin(); iter != monitored.end(); ++iter) {
+    struct pollfd pfd;
+
+    pfd.fd = *iter;
+    pfd.events = POLLIN;
+    // Edge triggered semantics for writes, i.e. we only care once a
+    // write has blocked
+    if ((state[*iter] & stateEdgeTriggered) &&
+        !(state[*iter] & stateWritable))
+      pfd.events |= POLLOUT;
+    pfd.revents = 0;
+
+    fds.push_back(pfd);
+  }
+
+  count = poll(fds.empty() ? NULL : &fds[0], fds.size(), timeoutMs);
+  if (count < 0) {
+    if (errno == EINTR) {
+      vlog.debug("Interrupted poll() system call");
+      return false;
+    }
+    throw rdr::SystemException("poll", errno);
+  }
+
+  for (size_t i = 0; (i < fds.size()) && (count > 0); i++) {
+    short ev;
+
+    ev = fds[i].revents;
+    if (ev == 0)
+      continue;
+    count--;
+
+    setReady(fds[i].fd,
+             ev & (POLLIN | POLLHUP | POLLERR),
+             ev & POLLOUT);
+  }
+
+  return true;
+}
@@ -0,0 +1,107 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+// -=- SocketMonitor.h - waits for activity on a large number of file
+//     descriptors, without rebuilding any state on every wait
+//
+//     Sockets are normally monitored edge triggered. The monitor
+//     remembers that a socket is readable or writable until the
+//     caller says otherwise, which it should do once it has seen the
+//     socket block. This means that the kernel only has to report
+//     changes, and an idle socket costs nothing per wait.
+//
+//     Level triggered monitoring is also available, for descriptors
+//     where someone else might consume the data, such as the X
+//     connection or listening sockets.
+//
+//     epoll is used where available, otherwise poll().
+
+#ifndef __NETWORK_SOCKET_MONITOR_H__
+#define __NETWORK_SOCKET_MONITOR_H__
+
+#include <set>
+#include <vector>
+
+namespace network {
+
+  class SocketMonitor {
+  public:
+    SocketMonitor();
+    ~SocketMonitor();
+
+    // Start monitoring fd. Edge triggered descriptors start out as
+    // writable, but not readable.
+    void add(int fd, bool edgeTriggered=true);
+    void remove(int fd);
+    bool isMonitored(int fd) const;
+
+    // wait()
+    //   Waits for at least one descriptor to become ready, or for
+    //   timeoutMs milliseconds (-1 waits forever). Returns right away
+    //   if an edge triggered descriptor is still readable from
+    //   before. Returns false if interrupted by a signal.
+    bool wait(int timeoutMs);
+
+    bool isReadable(int fd) const;
+    bool isWritable(int fd) const;
+
+    // checkReadable()
+    //   Should be called after reading from an edge triggered
+    //   descriptor. Asks the kernel if there is more data waiting,
+    //   and if not, considers the descriptor no longer readable.
+    void checkReadable(int fd);
+
+    // clearWritable()
+    //   Should be called when a write to an edge triggered descriptor
+    //   would have blocked. It will be writable again once the kernel
+    //   reports that there is space.
+    void clearWritable(int fd);
+
+    // Which mechanism is used, for logging
+    const char* getMethod() const;
+
+  protected:
+    enum {
+      stateMonitored = 1 << 0,
+      stateEdgeTriggered = 1 << 1,
+      stateReadable = 1 << 2,
+      stateWritable = 1 << 3,
+    };
+
+    unsigned getState(int fd) const;
+    void setReady(int fd, bool canRead, bool canWrite);
+
+    bool waitEpoll(int timeoutMs);
+    bool waitPoll(int timeoutMs);
+
+  private:
+    int epollFd;
+
+    // Indexed by file descriptor
+    std::vector<unsigned char> state;
+    std::set<int> monitored;
+    std::set<int> levelTriggered;
+
+    // Edge triggered descriptors that were readable the last time
+    // we checked
+    std::set<int> readable;
+  };
+
+}
+
+#endif
@@ -21,8 +21,14 @@
 #include <config.h>
 #endif
 
+#include <assert.h>
 #include <stdio.h>
+#include <string.h>
 
+#include <list>
+
+#include <os/Mutex.h>
+#include <os/Thread.h>
 #include <rdr/ZlibOutStream.h>
 #include <rdr/Exception.h>
 #include <rfb/LogWriter.h>
@@ -35,8 +41,75 @@ static rfb::LogWriter vlog("ZlibOutStream");
 
 using namespace rdr;
 
+// How much data each thread compresses at a time. Every chunk costs a
+// few bytes of output, and it starts out knowing only the 32 KiB
+// before it. Small enough that a full Tight rect is split in a few.
+static const size_t ChunkSize = 64 * 1024;
+
+// Anything smaller is compressed in one go on the calling thread
+static const size_t MinParallelSize = 2 * ChunkSize;
+
+// The largest window zlib can refer back to
+static const size_t HistorySize = 32 * 1024;
+
+// Worker threads shared by every stream in the process, which queue
+// up their chunks here. Created when a stream first needs it, and
+// removed again with the last such stream.
+class ZlibOutStream::DeflatePool {
+public:
+  static DeflatePool* acquire(int threadCount);
+  static void release();
+
+  // Compresses all of the stream's chunks, helping out on the
+  // calling thread
+  void deflate(ZlibOutStream* stream);
+
+private:
+  DeflatePool();
+  ~DeflatePool();
+
+  os::Mutex mutex;
+  os::Condition producerCond;
+  os::Condition consumerCond;
+
+  // Streams that still have chunks that nobody has started on
+  std::list<ZlibOutStream*> streams;
+
+  class DeflateThread : public os::Thread {
+  public:
+    DeflateThread(DeflatePool* pool);
+    ~DeflateThread();
+
+    void stop();
+
+  protected:
+    void worker();
+
+  private:
+    DeflatePool* pool;
+    z_stream_s* zs;
+    int level;
+
+    bool stopRequested;
+  };
+
+  std::list<DeflateThread*> threads;
+
+  static os::Mutex instanceMutex;
+  static DeflatePool* instance;
+  static int users;
+};
+
+os::Mutex ZlibOutStream::DeflatePool::instanceMutex;
+ZlibOutStream::DeflatePool* ZlibOutStream::DeflatePool::instance = NULL;
+int ZlibOutStream::DeflatePool::users = 0;
+
 ZlibOutStream::ZlibOutStream(OutStream* os, int compressLevel)
-  : underlying(os), compressionLevel(compressLevel), newLevel(compressLevel)
+  : underlying(os), compressionLevel(compressLevel), newLevel(compressLevel),
+    threadCount(0), headerPending(false), zsStale(false),
+    history(NULL), historyLength(0), chunkCount(0),
+    nextChunk(0), pendingChunks(0), chunkLevel(compressLevel),
+    pool(NULL)
 {
   zs = new z_stream;
   zs->zalloc    = Z_NULL;
@@ -56,6 +129,17 @@ ZlibOutStream::~ZlibOutStream()
     flush();
   } catch (Exception&) {
   }
+
+  if (pool != NULL)
+    DeflatePool::release();
+
+  while (!chunks.empty()) {
+    delete chunks.back();
+    chunks.pop_back();
+  }
+
+  delete [] history;
+
   deflateEnd(zs);
   delete zs;
 }
@@ -75,6 +159,34 @@ void ZlibOutStream::setCompressionLevel(int level)
   newLevel = level;
 }
 
+void ZlibOutStream::setThreadCount(int count)
+{
+  if (count < 0) {
+    count = os::Thread::getSystemCPUCount();
+    if (count == 0) {
+      vlog.error("Unable to determine the number of CPU cores on this system");
+      count = 1;
+    }
+  }
+
+  if ((count == 0) || (threadCount != 0))
+    return;
+
+  // The chunks are raw deflate data, so we have to write the zlib
+  // header ourselves
+  deflateEnd(zs);
+  if (deflateInit2(zs, compressionLevel, Z_DEFLATED, -MAX_WBITS,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK)
+    throw Exception("ZlibOutStream: deflateInit2 failed");
+
+  threadCount = count;
+  headerPending = true;
+
+  history = new uint8_t[HistorySize];
+
+  // The threads are started once there is something for them to do
+}
+
 void ZlibOutStream::flush()
 {
   BufferedOutStream::flush();
@@ -91,10 +203,47 @@ void ZlibOutStream::cork(bool enable)
 
 bool ZlibOutStream::flushBuffer()
 {
+  size_t length;
+
+  length = ptr - sentUpTo;
+
+  if (threadCount > 0) {
+    // Collect enough data to give every thread something to do
+    if (corked && (length < ChunkSize * (threadCount + 1)))
+      return false;
+
+    checkCompressionLevel();
+
+    if (length >= MinParallelSize) {
+      deflateParallel();
+      updateHistory(sentUpTo, length);
+      sentUpTo = ptr;
+      return true;
+    }
+
+    // Our window has to continue from whatever the chunks ended with
+    if (zsStale) {
+      if (deflateSetDictionary(zs, history, historyLength) != Z_OK)
+        throw Exception("ZlibOutStream: deflateSetDictionary failed");
+      zsStale = false;
+    }
+
+    zs->next_in = sentUpTo;
+    zs->avail_in = length;
+
+    // Every chunk has to end on a byte boundary
+    deflate(Z_SYNC_FLUSH);
+
+    updateHistory(sentUpTo, length);
+    sentUpTo = zs->next_in;
+
+    return true;
+  }
+
   checkCompressionLevel();
 
   zs->next_in = sentUpTo;
-  zs->avail_in = ptr - sentUpTo;
+  zs->avail_in = length;
 
 #ifdef ZLIBOUT_DEBUG
   vlog.debug("flush: avail_in %d",zs->avail_in);
@@ -118,6 +267,9 @@ void ZlibOutStream::deflate(int flush)
   if ((flush == Z_NO_FLUSH) && (zs->avail_in == 0))
     return;
 
+  if (headerPending)
+    writeHeader();
+
   do {
     size_t chunk;
     zs->next_out = underlying->getptr(1);
@@ -174,3 +326,303 @@ void ZlibOutStream::checkCompressionLevel()
     compressionLevel = newLevel;
   }
 }
+
+void ZlibOutStream::writeHeader()
+{
+  int level;
+  unsigned header;
+
+  // Same as zlib, although the level is just for information
+  level = compressionLevel;
+  if (level == Z_DEFAULT_COMPRESSION)
+    level = 6;
+
+  header = (Z_DEFLATED + ((MAX_WBITS - 8) << 4)) << 8;
+  if (level < 2)
+    header |= 0 << 6;
+  else if (level < 6)
+    header |= 1 << 6;
+  else if (level == 6)
+    header |= 2 << 6;
+  else
+    header |= 3 << 6;
+  header += 31 - (header % 31);
+
+  underlying->writeU16(header);
+
+  headerPending = false;
+}
+
+void ZlibOutStream::deflateParallel()
+{
+  size_t length;
+  std::vector<Chunk*>::iterator iter;
+
+  if (!underlying)
+    throw Exception("ZlibOutStream: underlying OutStream has not been set");
+
+  if (pool == NULL)
+    pool = DeflatePool::acquire(threadCount);
+
+  length = ptr - sentUpTo;
+
+  chunkCount = (length + ChunkSize - 1) / ChunkSize;
+  while (chunks.size() < chunkCount)
+    chunks.push_back(new Chunk);
+
+  for (size_t i = 0; i < chunkCount; i++) {
+    Chunk* chunk;
+
+    chunk = chunks[i];
+
+    chunk->data = sentUpTo + i * ChunkSize;
+    chunk->length = ChunkSize;
+    if (i == chunkCount - 1)
+      chunk->length = length - i * ChunkSize;
+
+    // The first chunk continues from the previous data, the rest
+    // from the chunk before
+    if (i == 0) {
+      chunk->dict = history;
+      chunk->dictLength = historyLength;
+    } else {
+      chunk->dict = chunk->data - HistorySize;
+      chunk->dictLength = HistorySize;
+    }
+
+    chunk->out.clear();
+  }
+
+  chunkLevel = compressionLevel;
+  nextChunk = 0;
+  pendingChunks = chunkCount;
+
+  // Our own stream is used to help out, so it will need a new window
+  // afterwards
+  zsStale = true;
+  pool->deflate(this);
+
+  if (headerPending)
+    writeHeader();
+
+  for (iter = chunks.begin(); iter != chunks.begin() + chunkCount; ++iter) {
+    if ((*iter)->length == 0)
+      throw Exception("ZlibOutStream: deflate failed");
+    underlying->writeBytes((*iter)->out.data(), (*iter)->out.length());
+  }
+}
+
+void ZlibOutStream::deflateChunk(z_stream* zs, int* level, int newLevel,
+                                 Chunk* chunk)
+{
+  if (deflateReset(zs) != Z_OK)
+    throw Exception("ZlibOutStream: deflateReset failed");
+
+  if (*level != newLevel) {
+    if (deflateParams(zs, newLevel, Z_DEFAULT_STRATEGY) != Z_OK)
+      throw Exception("ZlibOutStream: deflateParams failed");
+    *level = newLevel;
+  }
+
+  if (chunk->dictLength > 0) {
+    if (deflateSetDictionary(zs, chunk->dict, chunk->dictLength) != Z_OK)
+      throw Exception("ZlibOutStream: deflateSetDictionary failed");
+  }
+
+  zs->next_in = (uint8_t*)chunk->data;
+  zs->avail_in = chunk->length;
+
+  do {
+    size_t avail;
+
+    // Enough for most cases in one go
+    avail = deflateBound(zs, zs->avail_in) + 16;
+
+    zs->next_out = chunk->out.getptr(avail);
+    zs->avail_out = avail;
+
+    if (::deflate(zs, Z_SYNC_FLUSH) < 0)
+      throw Exception("ZlibOutStream: deflate failed");
+
+    chunk->out.setptr(avail - zs->avail_out);
+  } while (zs->avail_out == 0);
+}
+
+void ZlibOutStream::updateHistory(const uint8_t* data, size_t length)
+{
+  if (length >= HistorySize) {
+    memcpy(history, data + length - HistorySize, HistorySize);
+    historyLength = HistorySize;
+    return;
+  }
+
+  if (historyLength + length > HistorySize) {
+    size_t keep;
+
+    keep = HistorySize - length;
+    memmove(history, history + historyLength - keep, keep);
+    historyLength = keep;
+  }
+
+  memcpy(history + historyLength, data, length);
+  historyLength += length;
+}
+
+ZlibOutStream::DeflatePool::DeflatePool()
+  : producerCond(&mutex), consumerCond(&mutex)
+{
+}
+
+ZlibOutStream::DeflatePool::~DeflatePool()
+{
+  while (!threads.empty()) {
+    delete threads.back();
+    threads.pop_back();
+  }
+}
+
+ZlibOutStream::DeflatePool* ZlibOutStream::DeflatePool::acquire(int threadCount)
+{
+  os::AutoMutex a(&instanceMutex);
+
+  if (instance == NULL)
+    instance = new DeflatePool();
+
+  // Streams asking for fewer threads still get to use all of them
+  while (instance->threads.size() < (size_t)threadCount)
+    instance->threads.push_back(new DeflateThread(instance));
+
+  users++;
+
+  return instance;
+}
+
+void ZlibOutStream::DeflatePool::release()
+{
+  os::AutoMutex a(&instanceMutex);
+
+  assert(users > 0);
+
+  users--;
+  if (users > 0)
+    return;
+
+  delete instance;
+  instance = NULL;
+}
+
+void ZlibOutStream::DeflatePool::deflate(ZlibOutStream* stream)
+{
+  os::AutoMutex a(&mutex);
+
+  streams.push_back(stream);
+  consumerCond.broadcast();
+
+  // Help out rather than just waiting, but only with our own chunks
+  // so that we don't end up waiting for other streams
+  while (stream->pendingChunks > 0) {
+    Chunk* chunk;
+    int level;
+
+    if (stream->nextChunk >= stream->chunkCount) {
+      producerCond.wait();
+      continue;
+    }
+
+    chunk = stream->chunks[stream->nextChunk++];
+    if (stream->nextChunk >= stream->chunkCount)
+      streams.remove(stream);
+
+    mutex.unlock();
+    level = stream->compressionLevel;
+    try {
+      deflateChunk(stream->zs, &level, stream->chunkLevel, chunk);
+    } catch (Exception& e) {
+      vlog.error("%s", e.str());
+      // Checked for once all chunks are done
+      chunk->length = 0;
+    }
+    mutex.lock();
+
+    stream->pendingChunks--;
+  }
+}
+
+ZlibOutStream::DeflatePool::DeflateThread::DeflateThread(DeflatePool* pool_)
+  : pool(pool_), level(Z_DEFAULT_COMPRESSION), stopRequested(false)
+{
+  zs = new z_stream;
+  zs->zalloc    = Z_NULL;
+  zs->zfree     = Z_NULL;
+  zs->opaque    = Z_NULL;
+  zs->next_in   = Z_NULL;
+  zs->avail_in  = 0;
+  if (deflateInit2(zs, level, Z_DEFLATED, -MAX_WBITS,
+                   8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    delete zs;
+    throw Exception("ZlibOutStream: deflateInit2 failed");
+  }
+
+  start();
+}
+
+ZlibOutStream::DeflatePool::DeflateThread::~DeflateThread()
+{
+  stop();
+  wait();
+
+  deflateEnd(zs);
+  delete zs;
+}
+
+void ZlibOutStream::DeflatePool::DeflateThread::stop()
+{
+  os::AutoMutex a(&pool->mutex);
+
+  if (!isRunning())
+    return;
+
+  stopRequested = true;
+
+  // We can't wake just this thread, so wake everyone
+  pool->consumerCond.broadcast();
+}
+
+void ZlibOutStream::DeflatePool::DeflateThread::worker()
+{
+  pool->mutex.lock();
+
+  while (!stopRequested) {
+    ZlibOutStream* stream;
+    Chunk* chunk;
+
+    if (pool->streams.empty()) {
+      // Wait and try again
+      pool->consumerCond.wait();
+      continue;
+    }
+
+    stream = pool->streams.front();
+
+    chunk = stream->chunks[stream->nextChunk++];
+    if (stream->nextChunk >= stream->chunkCount)
+      pool->streams.remove(stream);
+
+    pool->mutex.unlock();
+    try {
+      deflateChunk(zs, &level, stream->chunkLevel, chunk);
+    } catch (Exception& e) {
+      vlog.error("%s", e.str());
+      // Tells the stream that this chunk failed
+      chunk->length = 0;
+    }
+    pool->mutex.lock();
+
+    // Several streams might be waiting, and we can't tell which
+    stream->pendingChunks--;
+    if (stream->pendingChunks == 0)
+      pool->producerCond.broadcast();
+  }
+
+  pool->mutex.unlock();
+}
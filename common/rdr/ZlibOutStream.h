@@ -25,7 +25,10 @@
 #ifndef __RDR_ZLIBOUTSTREAM_H__
 #define __RDR_ZLIBOUTSTREAM_H__
 
+#include <vector>
+
 #include <rdr/BufferedOutStream.h>
+#include <rdr/MemOutStream.h>
 
 struct z_stream_s;
 
@@ -43,15 +46,60 @@ namespace rdr {
     virtual void flush();
     virtual void cork(bool enable);
 
+    // Large amounts of data can be compressed in chunks, spread over
+    // threadCount extra threads (or one per CPU core if -1). Every
+    // chunk starts from the data just before it, so the output is
+    // still a single zlib stream, if slightly larger. The threads are
+    // shared by every stream in the process, and there are only as
+    // many as the largest count any stream has asked for. Must be set
+    // before anything is written.
+    void setThreadCount(int threadCount);
+
   private:
     virtual bool flushBuffer();
     void deflate(int flush);
     void checkCompressionLevel();
 
+    void writeHeader();
+    void deflateParallel();
+    void updateHistory(const uint8_t* data, size_t length);
+
     OutStream* underlying;
     int compressionLevel;
     int newLevel;
     z_stream_s* zs;
+
+  private:
+    struct Chunk {
+      const uint8_t* data;
+      size_t length;
+      const uint8_t* dict;
+      size_t dictLength;
+      MemOutStream out;
+    };
+
+    static void deflateChunk(z_stream_s* zs, int* level,
+                             int newLevel, Chunk* chunk);
+
+    int threadCount;
+    bool headerPending;
+
+    // Our stream no longer has the data just before as its window
+    bool zsStale;
+
+    // The end of what has been compressed so far
+    uint8_t* history;
+    size_t historyLength;
+
+    // Protected by the pool's mutex whilst the pool is working on them
+    std::vector<Chunk*> chunks;
+    size_t chunkCount;
+    size_t nextChunk;
+    size_t pendingChunks;
+    int chunkLevel;
+
+    class DeflatePool;
+    DeflatePool* pool;
   };
 
 } // end of namespace rdr
@@ -0,0 +1,299 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <rfb/ChangeHeatMap.h>
+#include <rfb/util.h>
+
+using namespace rfb;
+
+// Size of each side of a tile (in pixels)
+static const int TileSize = 64;
+
+// Weight of each new measurement of a tile's behaviour
+static const double Weight = 0.25;
+
+// How long (in ms) since the last change before a tile is static
+// again. Text and UI elements show up as small changes that happen
+// every now and then.
+static const unsigned StaticTimeout = 2000;
+static const double TextMinRate = 0.5;
+static const double TextMaxCoverage = 0.5;
+
+// Motion means most of the tile changing, either often, or in every
+// update of a client that doesn't ask for that many. It is over as
+// soon as the tile has been left alone for a little while.
+static const unsigned MotionTimeout = 250;
+static const double MotionMinCoverage = 0.5;
+static const double MotionMinRate = 8.0;
+static const unsigned MotionMinStreak = 4;
+static const double MotionMinStreakRate = 2.0;
+
+ChangeHeatMap::ChangeHeatMap()
+  : width(0), height(0), updates(0)
+{
+  limits.clear();
+  memset(changedPixels, 0, sizeof(changedPixels));
+}
+
+void ChangeHeatMap::update(const Region& changed, const Rect& limits_)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator rect;
+  std::vector<int>::const_iterator index;
+
+  struct timeval now;
+
+  if (limits_ != limits)
+    reset(limits_);
+
+  getTime(&now);
+
+  updates++;
+
+  // First collect how much of each tile changed, as the region can
+  // have many rects for the same tile
+  changed.get_rects(&rects);
+  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+    Rect r;
+    int tx1, ty1, tx2, ty2;
+
+    r = rect->intersect(limits);
+    if (r.is_empty())
+      continue;
+
+    tx1 = (r.tl.x - limits.tl.x) / TileSize;
+    ty1 = (r.tl.y - limits.tl.y) / TileSize;
+    tx2 = (r.br.x - limits.tl.x - 1) / TileSize;
+    ty2 = (r.br.y - limits.tl.y - 1) / TileSize;
+
+    for (int ty = ty1; ty <= ty2; ty++) {
+      for (int tx = tx1; tx <= tx2; tx++) {
+        Rect tileRect;
+        int i;
+
+        tileRect.setXYWH(limits.tl.x + tx * TileSize,
+                         limits.tl.y + ty * TileSize,
+                         TileSize, TileSize);
+
+        i = ty * width + tx;
+        if (covered[i] == 0)
+          touched.push_back(i);
+        covered[i] += r.intersect(tileRect).area();
+      }
+    }
+  }
+
+  for (index = touched.begin(); index != touched.end(); ++index) {
+    Tile* tile;
+    Rect tileRect;
+    double coverage;
+
+    tile = &tiles[*index];
+
+    changedPixels[classifyTile(*tile, now)] += covered[*index];
+
+    tileRect.setXYWH(limits.tl.x + (*index % width) * TileSize,
+                     limits.tl.y + (*index / width) * TileSize,
+                     TileSize, TileSize);
+    coverage = (double)covered[*index] /
+               tileRect.intersect(limits).area();
+
+    covered[*index] = 0;
+
+    // A tile that has been quiet for a while starts over
+    if (!tile->active ||
+        (msBetween(&tile->lastChange, &now) >= StaticTimeout)) {
+      tile->active = true;
+      tile->rate = 0;
+      tile->coverage = coverage;
+      tile->streak = 1;
+    } else {
+      double rate;
+
+      rate = 1000.0 / __rfbmax(msBetween(&tile->lastChange, &now), 1U);
+
+      tile->rate += (rate - tile->rate) * Weight;
+      tile->coverage += (coverage - tile->coverage) * Weight;
+
+      if (tile->lastUpdate == updates - 1)
+        tile->streak++;
+      else
+        tile->streak = 1;
+    }
+
+    tile->lastChange = now;
+    tile->lastUpdate = updates;
+  }
+
+  touched.clear();
+}
+
+ChangeHeatMap::Class ChangeHeatMap::classify(const Rect& r_) const
+{
+  Rect r;
+  int tx1, ty1, tx2, ty2;
+  struct timeval now;
+  int area[ClassMax];
+  Class result;
+
+  r = r_.intersect(limits);
+  if (r.is_empty())
+    return Static;
+
+  tx1 = (r.tl.x - limits.tl.x) / TileSize;
+  ty1 = (r.tl.y - limits.tl.y) / TileSize;
+  tx2 = (r.br.x - limits.tl.x - 1) / TileSize;
+  ty2 = (r.br.y - limits.tl.y - 1) / TileSize;
+
+  getTime(&now);
+
+  memset(area, 0, sizeof(area));
+  for (int ty = ty1; ty <= ty2; ty++) {
+    for (int tx = tx1; tx <= tx2; tx++) {
+      Rect tileRect;
+
+      tileRect.setXYWH(limits.tl.x + tx * TileSize,
+                       limits.tl.y + ty * TileSize,
+                       TileSize, TileSize);
+
+      area[classifyTile(tiles[ty * width + tx], now)] +=
+        r.intersect(tileRect).area();
+    }
+  }
+
+  // Whatever covers most of the rect, favouring the more active
+  // class if it is a tie
+  result = Static;
+  for (int c = Static + 1; c < ClassMax; c++) {
+    if (area[c] >= area[result])
+      result = (Class)c;
+  }
+
+  return result;
+}
+
+Region ChangeHeatMap::getRegion(Class c) const
+{
+  Region region;
+  struct timeval now;
+
+  getTime(&now);
+
+  for (int ty = 0; ty < height; ty++) {
+    int start;
+
+    // Join up runs of tiles to keep the region simple
+    start = -1;
+    for (int tx = 0; tx <= width; tx++) {
+      bool match;
+
+      match = (tx < width) &&
+              (classifyTile(tiles[ty * width + tx], now) == c);
+
+      if (match && (start == -1))
+        start = tx;
+
+      if (!match && (start != -1)) {
+        Rect run;
+
+        run.setXYWH(limits.tl.x + start * TileSize,
+                    limits.tl.y + ty * TileSize,
+                    (tx - start) * TileSize, TileSize);
+        region.assign_union(Region(run.intersect(limits)));
+
+        start = -1;
+      }
+    }
+  }
+
+  return region;
+}
+
+unsigned long long ChangeHeatMap::getChangedPixels(Class c) const
+{
+  return changedPixels[c];
+}
+
+const char* ChangeHeatMap::className(Class c)
+{
+  switch (c) {
+  case Static:
+    return "static";
+  case TextUI:
+    return "text/UI";
+  case Motion:
+    return "motion";
+  case ClassMax:
+    break;
+  }
+
+  return "unknown";
+}
+
+void ChangeHeatMap::getTime(struct timeval* now) const
+{
+  getMonotonicTime(now);
+}
+
+void ChangeHeatMap::reset(const Rect& limits_)
+{
+  Tile tile;
+
+  limits = limits_;
+
+  width = (limits.width() + TileSize - 1) / TileSize;
+  height = (limits.height() + TileSize - 1) / TileSize;
+
+  memset(&tile, 0, sizeof(tile));
+  tile.active = false;
+
+  tiles.assign(width * height, tile);
+  covered.assign(width * height, 0);
+  touched.clear();
+}
+
+ChangeHeatMap::Class ChangeHeatMap::classifyTile(const Tile& tile,
+                                                 const struct timeval& now) const
+{
+  unsigned age;
+
+  if (!tile.active)
+    return Static;
+
+  age = msBetween(&tile.lastChange, &now);
+
+  if ((age < MotionTimeout) && (tile.coverage >= MotionMinCoverage)) {
+    if (tile.rate >= MotionMinRate)
+      return Motion;
+    if ((tile.streak >= MotionMinStreak) &&
+        (tile.rate >= MotionMinStreakRate))
+      return Motion;
+  }
+
+  if ((age < StaticTimeout) && (tile.rate >= TextMinRate) &&
+      (tile.coverage < TextMaxCoverage))
+    return TextUI;
+
+  return Static;
+}
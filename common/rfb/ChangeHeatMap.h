@@ -0,0 +1,99 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// ChangeHeatMap - keeps track of how often, and how much of, each
+// tile of the screen changes, in order to tell apart areas that are
+// mostly static, areas with text or UI elements that change every now
+// and then, and areas that are in constant motion (e.g. video).
+//
+
+#ifndef __RFB_CHANGEHEATMAP_H__
+#define __RFB_CHANGEHEATMAP_H__
+
+#include <sys/time.h>
+
+#include <vector>
+
+#include <rfb/Rect.h>
+#include <rfb/Region.h>
+
+namespace rfb {
+
+  class ChangeHeatMap {
+  public:
+    enum Class {
+      Static,
+      TextUI,
+      Motion,
+      ClassMax
+    };
+
+    ChangeHeatMap();
+    virtual ~ChangeHeatMap() {}
+
+    // Adds the changes of one update. Everything is forgotten if the
+    // area covered changes.
+    void update(const Region& changed, const Rect& limits);
+
+    // The class of whatever covers most of r
+    Class classify(const Rect& r) const;
+
+    // Every tile currently of the given class
+    Region getRegion(Class c) const;
+
+    // Changed pixels so far, counted by the class of the area just
+    // before the change
+    unsigned long long getChangedPixels(Class c) const;
+
+    static const char* className(Class c);
+
+  protected:
+    // The current time, from a monotonic clock by default. Can be
+    // overridden to test without waiting for real time to pass.
+    virtual void getTime(struct timeval* now) const;
+
+    struct Tile {
+      bool active;
+      struct timeval lastChange;
+      double rate; // Changes per second
+      double coverage; // Share of the tile that changes
+      unsigned lastUpdate;
+      unsigned streak; // Consecutive updates with a change
+    };
+
+    void reset(const Rect& limits);
+    Class classifyTile(const Tile& tile,
+                       const struct timeval& now) const;
+
+  private:
+    Rect limits;
+    int width, height; // In tiles
+    std::vector<Tile> tiles;
+
+    // Changed pixels per tile, whilst processing an update
+    std::vector<int> covered;
+    std::vector<int> touched;
+
+    unsigned updates;
+    unsigned long long changedPixels[ClassMax];
+  };
+
+}
+
+#endif
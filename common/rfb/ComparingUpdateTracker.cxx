@@ -22,10 +22,16 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/time.h>
+
+#include <map>
 #include <vector>
 
+#include <os/Mutex.h>
+
 #include <rfb/Exception.h>
 #include <rfb/LogWriter.h>
+#include <rfb/blockCompare.h>
 #include <rfb/util.h>
 
 #include <rfb/ComparingUpdateTracker.h>
@@ -34,28 +40,117 @@ using namespace rfb;
 
 static LogWriter vlog("ComparingUpdateTracker");
 
-ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer)
+ComparingUpdateTracker::ComparingUpdateTracker(PixelBuffer* buffer,
+                                               int threadCount,
+                                               bool useHashes_)
   : fb(buffer), oldFb(fb->getPF(), 0, 0), firstCompare(true),
-    enabled(true), totalPixels(0), missedPixels(0)
+    enabled(true), useHashes(useHashes_), scrollDetection(false),
+    gridWidth(0), gridHeight(0), totalPixels(0), missedPixels(0),
+    compares(0), compareTime(0), grabs(0), grabTime(0),
+    scrolls(0), scrolledPixels(0), bandRects(NULL), bandHeight(0),
+    bandCount(0), nextBand(0), pendingBands(0), pendingGrab(NULL),
+    grabbedRows(0)
 {
-    changed.assign_union(fb->getRect());
+  changed.assign_union(fb->getRect());
+
+  queueMutex = new os::Mutex();
+  producerCond = new os::Condition(queueMutex);
+  consumerCond = new os::Condition(queueMutex);
+
+  if (threadCount < 0) {
+    threadCount = os::Thread::getSystemCPUCount();
+    if (threadCount == 0) {
+      vlog.error("Unable to determine the number of CPU cores on this system");
+      threadCount = 1;
+    }
+    // The calling thread also does its share of the work
+    threadCount--;
+  }
+
+  if (threadCount > 0)
+    vlog.debug("Creating %d compare thread(s)", threadCount);
+
+  while (threadCount-- > 0)
+    threads.push_back(new CompareThread(this));
 }
 
 ComparingUpdateTracker::~ComparingUpdateTracker()
 {
+  while (!threads.empty()) {
+    delete threads.back();
+    threads.pop_back();
+  }
+
+  delete consumerCond;
+  delete producerCond;
+  delete queueMutex;
 }
 
 
 #define BLOCK_SIZE 64
 
+// Smallest area we look for scrolling in, and the smallest part of it
+// we consider worth turning in to a copy
+#define SCROLL_MIN_SIZE 64
+#define SCROLL_MIN_RUN 8
+
+bool ComparingUpdateTracker::grabAndCompare(const Region& toGrab)
+{
+  bool ret;
+
+  // The grab can only be spread out over the bands if nothing needs
+  // to look at the new contents before the bands are compared
+  if (!enabled || firstCompare || threads.empty() ||
+      (scrollDetection && !useHashes && copied.is_empty())) {
+    grab(toGrab);
+    return compare();
+  }
+
+  pendingGrab = &toGrab;
+  ret = compare();
+
+  // compareBands() normally takes care of it, but make sure
+  if (pendingGrab != NULL) {
+    grab(*pendingGrab);
+    pendingGrab = NULL;
+  }
+
+  return ret;
+}
+
 bool ComparingUpdateTracker::compare()
 {
   std::vector<Rect> rects;
   std::vector<Rect>::iterator i;
+  struct timeval start, end;
+  bool scrolled;
 
   if (!enabled)
     return false;
 
+  if (firstCompare && useHashes) {
+    Region discard;
+
+    // Same as below, but we only need the hashes
+    gridWidth = (fb->width() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    gridHeight = (fb->height() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    rowHashes.assign(gridWidth * gridHeight * BLOCK_SIZE, 0);
+    rowMasks.assign(gridWidth * gridHeight, 0);
+
+    markRect(fb->getRect());
+
+    rects.push_back(fb->getRect());
+    if (threads.empty())
+      compareBlockRows(0, gridHeight, &discard);
+    else
+      compareBands(rects, &discard);
+
+    firstCompare = false;
+
+    return false;
+  }
+
   if (firstCompare) {
     // NB: We leave the change region untouched on this iteration,
     // since in effect the entire framebuffer has changed.
@@ -73,15 +168,50 @@ bool ComparingUpdateTracker::compare()
     return false;
   }
 
-  copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
-  for (i = rects.begin(); i != rects.end(); i++)
-    oldFb.copyRect(*i, copy_delta);
+  gettimeofday(&start, NULL);
+
+  scrolled = false;
+  if (scrollDetection && !useHashes && copied.is_empty())
+    scrolled = detectScroll();
+
+  if (useHashes) {
+    // We can't move hashes around, so just forget what was there
+    copied.get_rects(&rects);
+    for (i = rects.begin(); i != rects.end(); i++)
+      invalidateRect(*i);
+  } else {
+    copied.get_rects(&rects, copy_delta.x<=0, copy_delta.y<=0);
+    for (i = rects.begin(); i != rects.end(); i++)
+      oldFb.copyRect(*i, copy_delta);
+  }
 
   changed.get_rects(&rects);
 
   Region newChanged;
-  for (i = rects.begin(); i != rects.end(); i++)
-    compareRect(*i, &newChanged);
+  if (useHashes) {
+    for (i = rects.begin(); i != rects.end(); i++)
+      markRect(*i);
+
+    if (threads.empty())
+      compareBlockRows(0, gridHeight, &newChanged);
+    else
+      compareBands(rects, &newChanged);
+
+    // Rows are checked in their entirety, but there should be no
+    // changes outside of what we've been told about
+    newChanged.assign_intersect(changed);
+  } else if (threads.empty()) {
+    for (i = rects.begin(); i != rects.end(); i++)
+      compareRect(*i, &newChanged);
+  } else {
+    compareBands(rects, &newChanged);
+  }
+
+  gettimeofday(&end, NULL);
+
+  compares++;
+  compareTime += (end.tv_sec - start.tv_sec) * 1000000ULL +
+                 end.tv_usec - start.tv_usec;
 
   changed.get_rects(&rects);
   for (i = rects.begin(); i != rects.end(); i++)
@@ -91,7 +221,7 @@ bool ComparingUpdateTracker::compare()
     missedPixels += i->area();
 
   if (changed == newChanged)
-    return false;
+    return scrolled;
 
   changed = newChanged;
 
@@ -111,6 +241,427 @@ void ComparingUpdateTracker::disable()
   firstCompare = true;
 }
 
+void ComparingUpdateTracker::setDetectScroll(bool enable)
+{
+  scrollDetection = enable;
+}
+
+bool ComparingUpdateTracker::detectScroll()
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::iterator i;
+  Rect largest;
+  Region dest;
+  Point delta;
+  std::vector<Rect> destRects;
+  int area;
+
+  // Only a single copy can be represented, so focus on the area most
+  // likely to be a scrolling window
+  changed.get_rects(&rects);
+  for (i = rects.begin(); i != rects.end(); i++) {
+    Rect r = i->intersect(fb->getRect());
+    if (r.area() > largest.area())
+      largest = r;
+  }
+
+  if ((largest.width() < SCROLL_MIN_SIZE) ||
+      (largest.height() < SCROLL_MIN_SIZE))
+    return false;
+
+  if (!detectScroll(largest, true, &dest, &delta) &&
+      !detectScroll(largest, false, &dest, &delta))
+    return false;
+
+  copied = dest;
+  copy_delta = delta;
+
+  area = 0;
+  dest.get_rects(&destRects);
+  for (i = destRects.begin(); i != destRects.end(); i++)
+    area += i->area();
+
+  scrolls++;
+  scrolledPixels += area;
+
+  return true;
+}
+
+bool ComparingUpdateTracker::detectScroll(const Rect& r, bool vertical,
+                                          Region* dest, Point* delta)
+{
+  int bytesPerPixel = fb->getPF().bpp/8;
+  int oldStride, newStride;
+  const uint8_t* oldData;
+  const uint8_t* newData;
+
+  int length;
+  std::vector<uint64_t> oldHashes, newHashes;
+
+  std::map<uint64_t, int> oldLines;
+  std::map<uint64_t, int>::iterator line;
+  std::map<int, int> votes;
+  std::map<int, int>::iterator vote;
+  int shift, bestVotes;
+
+  oldData = oldFb.getBuffer(r, &oldStride);
+  newData = fb->getBuffer(r, &newStride);
+
+  // Hash every line, either rows or columns, in both buffers
+  length = vertical ? r.height() : r.width();
+  oldHashes.assign(length, 0);
+  newHashes.assign(length, 0);
+
+  if (vertical) {
+    for (int y = 0; y < length; y++) {
+      oldHashes[y] = hashBytes(oldData + y * oldStride * bytesPerPixel,
+                               r.width() * bytesPerPixel);
+      newHashes[y] = hashBytes(newData + y * newStride * bytesPerPixel,
+                               r.width() * bytesPerPixel);
+    }
+  } else {
+    // Columns are built up a row at a time to keep memory access
+    // sequential
+    for (int y = 0; y < r.height(); y++) {
+      const uint8_t* oldPtr = oldData + y * oldStride * bytesPerPixel;
+      const uint8_t* newPtr = newData + y * newStride * bytesPerPixel;
+
+      for (int x = 0; x < length; x++) {
+        uint32_t oldPixel, newPixel;
+
+        oldPixel = newPixel = 0;
+        memcpy(&oldPixel, oldPtr, bytesPerPixel);
+        memcpy(&newPixel, newPtr, bytesPerPixel);
+
+        oldHashes[x] = (oldHashes[x] ^ oldPixel) * 11400714785074694791ULL;
+        newHashes[x] = (newHashes[x] ^ newPixel) * 11400714785074694791ULL;
+
+        oldPtr += bytesPerPixel;
+        newPtr += bytesPerPixel;
+      }
+    }
+  }
+
+  // Lines that occur multiple times (e.g. blank ones) can't tell us
+  // anything about the movement
+  for (int i = 0; i < length; i++) {
+    line = oldLines.find(oldHashes[i]);
+    if (line == oldLines.end())
+      oldLines[oldHashes[i]] = i;
+    else
+      line->second = -1;
+  }
+
+  // Let every changed line vote for where it came from
+  for (int i = 0; i < length; i++) {
+    if (newHashes[i] == oldHashes[i])
+      continue;
+
+    line = oldLines.find(newHashes[i]);
+    if ((line == oldLines.end()) || (line->second < 0))
+      continue;
+
+    votes[i - line->second]++;
+  }
+
+  shift = 0;
+  bestVotes = 0;
+  for (vote = votes.begin(); vote != votes.end(); ++vote) {
+    if (vote->second > bestVotes) {
+      shift = vote->first;
+      bestVotes = vote->second;
+    }
+  }
+
+  if (bestVotes < SCROLL_MIN_RUN)
+    return false;
+
+  // Find runs of lines that match with this shift, and verify them
+  // properly as hashes can collide
+  dest->clear();
+
+  int runStart = -1;
+  for (int i = __rfbmax(shift, 0); i <= __rfbmin(length, length + shift); i++) {
+    bool match;
+
+    match = (i < __rfbmin(length, length + shift)) &&
+            (newHashes[i] == oldHashes[i - shift]);
+
+    if (match && (runStart < 0))
+      runStart = i;
+
+    if (match || (runStart < 0))
+      continue;
+
+    if (i - runStart >= SCROLL_MIN_RUN) {
+      Rect run;
+      bool verified;
+
+      if (vertical)
+        run = Rect(r.tl.x, r.tl.y + runStart, r.br.x, r.tl.y + i);
+      else
+        run = Rect(r.tl.x + runStart, r.tl.y, r.tl.x + i, r.br.y);
+
+      verified = true;
+      for (int y = 0; y < run.height(); y++) {
+        const uint8_t* oldPtr;
+        const uint8_t* newPtr;
+
+        if (vertical) {
+          oldPtr = oldData + (runStart - shift + y) * oldStride * bytesPerPixel;
+          newPtr = newData + (runStart + y) * newStride * bytesPerPixel;
+        } else {
+          oldPtr = oldData + (y * oldStride + runStart - shift) * bytesPerPixel;
+          newPtr = newData + (y * newStride + runStart) * bytesPerPixel;
+        }
+
+        if (memcmp(oldPtr, newPtr, run.width() * bytesPerPixel) != 0) {
+          verified = false;
+          break;
+        }
+      }
+
+      if (verified)
+        dest->assign_union(run);
+    }
+
+    runStart = -1;
+  }
+
+  if (dest->is_empty())
+    return false;
+
+  if (vertical)
+    *delta = Point(0, shift);
+  else
+    *delta = Point(shift, 0);
+
+  return true;
+}
+
+void ComparingUpdateTracker::compareBands(const std::vector<Rect>& rects,
+                                          Region* newChanged)
+{
+  int band;
+
+  queueMutex->lock();
+
+  // Use more bands than threads, as changes are rarely spread out
+  // evenly over the screen
+  bandRects = &rects;
+  bandCount = (threads.size() + 1) * 4;
+  bandHeight = (fb->height() + bandCount - 1) / bandCount;
+  // Hashes are kept per block, so bands must not split those
+  bandHeight = (bandHeight + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+  bandChanged.assign(bandCount, Region());
+  nextBand = 0;
+  pendingBands = bandCount;
+
+  if (pendingGrab == NULL)
+    grabbedRows = fb->height();
+  else
+    grabbedRows = 0;
+
+  consumerCond->broadcast();
+
+  // Fetch the bands one at a time, so that the compare threads can
+  // get started on the first ones
+  if (pendingGrab != NULL) {
+    for (band = 0; band < bandCount; band++) {
+      Rect r;
+
+      r = Rect(0, band * bandHeight, fb->width(),
+               __rfbmin((band + 1) * bandHeight, fb->height()));
+      if (r.is_empty())
+        break;
+
+      queueMutex->unlock();
+      grab(pendingGrab->intersect(r));
+      queueMutex->lock();
+
+      grabbedRows = r.br.y;
+      consumerCond->broadcast();
+    }
+
+    grabbedRows = fb->height();
+    consumerCond->broadcast();
+
+    pendingGrab = NULL;
+  }
+
+  // Help out whilst we wait
+  while (nextBand < bandCount) {
+    band = nextBand++;
+
+    queueMutex->unlock();
+    compareBand(band, &bandChanged[band]);
+    queueMutex->lock();
+
+    pendingBands--;
+  }
+
+  while (pendingBands > 0)
+    producerCond->wait();
+
+  bandRects = NULL;
+
+  queueMutex->unlock();
+
+  for (band = 0; band < bandCount; band++)
+    newChanged->assign_union(bandChanged[band]);
+}
+
+void ComparingUpdateTracker::compareBand(int band, Region* newChanged)
+{
+  std::vector<Rect>::const_iterator i;
+  int bandTop, bandBottom;
+
+  bandTop = band * bandHeight;
+  bandBottom = bandTop + bandHeight;
+
+  if (useHashes) {
+    compareBlockRows(__rfbmin(bandTop / BLOCK_SIZE, gridHeight),
+                     __rfbmin(bandBottom / BLOCK_SIZE, gridHeight),
+                     newChanged);
+    return;
+  }
+
+  for (i = bandRects->begin(); i != bandRects->end(); i++) {
+    Rect r;
+    int top, bottom;
+
+    r = i->intersect(fb->getRect());
+
+    // Blocks belong to the band they start in, so that the result is
+    // the same as when comparing the entire rect in one go
+    top = r.tl.y;
+    if (top < bandTop)
+      top += (bandTop - top + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    bottom = r.tl.y;
+    if (bottom < bandBottom)
+      bottom += (bandBottom - bottom + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    bottom = __rfbmin(bottom, r.br.y);
+
+    if (top >= bottom)
+      continue;
+
+    compareRect(Rect(r.tl.x, top, r.br.x, bottom), newChanged);
+  }
+}
+
+bool ComparingUpdateTracker::bandGrabbed(int band)
+{
+  int bottom;
+
+  // Blocks that start in the band can extend in to the next one
+  bottom = (band + 1) * bandHeight + BLOCK_SIZE;
+
+  return __rfbmin(bottom, fb->height()) <= grabbedRows;
+}
+
+void ComparingUpdateTracker::grab(const Region& r)
+{
+  struct timeval start, end;
+
+  gettimeofday(&start, NULL);
+  fb->grabRegion(r);
+  gettimeofday(&end, NULL);
+
+  grabs++;
+  grabTime += (end.tv_sec - start.tv_sec) * 1000000ULL +
+              end.tv_usec - start.tv_usec;
+}
+
+void ComparingUpdateTracker::markRect(const Rect& r_)
+{
+  Rect r;
+
+  r = r_.intersect(fb->getRect());
+  if (r.is_empty())
+    return;
+
+  for (int gy = r.tl.y / BLOCK_SIZE; gy * BLOCK_SIZE < r.br.y; gy++) {
+    int top, bottom;
+    uint64_t mask;
+
+    top = __rfbmax(r.tl.y - gy * BLOCK_SIZE, 0);
+    bottom = __rfbmin(r.br.y - gy * BLOCK_SIZE, BLOCK_SIZE);
+
+    if (bottom - top == BLOCK_SIZE)
+      mask = ~0ULL;
+    else
+      mask = ((1ULL << (bottom - top)) - 1) << top;
+
+    for (int gx = r.tl.x / BLOCK_SIZE; gx * BLOCK_SIZE < r.br.x; gx++)
+      rowMasks[gy * gridWidth + gx] |= mask;
+  }
+}
+
+void ComparingUpdateTracker::invalidateRect(const Rect& r_)
+{
+  Rect r;
+
+  r = r_.intersect(fb->getRect());
+
+  for (int y = r.tl.y; y < r.br.y; y++) {
+    int gy = y / BLOCK_SIZE;
+    for (int gx = r.tl.x / BLOCK_SIZE; gx * BLOCK_SIZE < r.br.x; gx++)
+      rowHashes[(gy * gridWidth + gx) * BLOCK_SIZE + y % BLOCK_SIZE] = 0;
+  }
+}
+
+void ComparingUpdateTracker::compareBlockRows(int first, int last,
+                                              Region* newChanged)
+{
+  int bytesPerPixel = fb->getPF().bpp/8;
+
+  for (int gy = first; gy < last; gy++) {
+    for (int gx = 0; gx < gridWidth; gx++) {
+      int index = gy * gridWidth + gx;
+      uint64_t mask = rowMasks[index];
+
+      if (mask == 0)
+        continue;
+
+      rowMasks[index] = 0;
+
+      Rect block(gx * BLOCK_SIZE, gy * BLOCK_SIZE,
+                 __rfbmin((gx + 1) * BLOCK_SIZE, fb->width()),
+                 __rfbmin((gy + 1) * BLOCK_SIZE, fb->height()));
+      int stride;
+      const uint8_t* data = fb->getBuffer(block, &stride);
+      int strideBytes = stride * bytesPerPixel;
+      int widthBytes = block.width() * bytesPerPixel;
+      uint64_t* hashes = &rowHashes[index * BLOCK_SIZE];
+
+      // Collect runs of changed rows
+      int runStart = -1;
+      for (int row = 0; row <= block.height(); row++) {
+        bool rowChanged = false;
+
+        if ((row < block.height()) && (mask & (1ULL << row))) {
+          uint64_t hash = hashBytes(data + row * strideBytes, widthBytes);
+          if (hash != hashes[row]) {
+            hashes[row] = hash;
+            rowChanged = true;
+          }
+        }
+
+        if (rowChanged && (runStart < 0))
+          runStart = row;
+
+        if (!rowChanged && (runStart >= 0)) {
+          newChanged->assign_union(Region(Rect(block.tl.x,
+                                               block.tl.y + runStart,
+                                               block.br.x,
+                                               block.tl.y + row)));
+          runStart = -1;
+        }
+      }
+    }
+  }
+}
+
 void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
 {
   if (!r.enclosed_by(fb->getRect())) {
@@ -129,7 +680,6 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
 
   // Used to efficiently crop the left and right of the change rectangle
   int minCompareWidthInPixels = BLOCK_SIZE / 8;
-  int minCompareWidthInBytes = minCompareWidthInPixels * bytesPerPixel;
 
   for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE)
   {
@@ -144,102 +694,39 @@ void ComparingUpdateTracker::compareRect(const Rect& r, Region* newChanged)
 
     for (int blockLeft = r.tl.x; blockLeft < r.br.x; blockLeft += BLOCK_SIZE)
     {
-      const uint8_t* newPtr = newBlockPtr;
-      uint8_t* oldPtr = oldBlockPtr;
-
       int blockRight = __rfbmin(blockLeft+BLOCK_SIZE, r.br.x);
       int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
 
-      // Scan the block top to bottom, to identify the first row of change
-      for (int y = blockTop; y < blockBottom; y++)
+      // Find the bounding box of the changes and copy them from fb to
+      // oldFb, to allow future changes to be identified
+      Rect diff;
+      if (compareBlock(oldBlockPtr, oldStrideBytes,
+                       newBlockPtr, newStrideBytes,
+                       blockWidthInBytes, blockBottom - blockTop, &diff))
       {
-        if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
-        {
-          // Define the change rectangle using pessimistic values to start
-          int changeHeight = blockBottom - y;
-          int changeLeft = blockLeft;
-          int changeRight = blockRight;
-
-          // For every unchanged row at the bottom of the block, decrement change height
-          {
-            const uint8_t* newRowPtr = newPtr + ((changeHeight - 1) * newStrideBytes);
-            const uint8_t* oldRowPtr = oldPtr + ((changeHeight - 1) * oldStrideBytes);
-            while (changeHeight > 1 && memcmp(oldRowPtr, newRowPtr, blockWidthInBytes) == 0)
-            {
-              newRowPtr -= newStrideBytes;
-              oldRowPtr -= oldStrideBytes;
-
-              changeHeight--;
-            }
-          }
-
-          // For every unchanged column at the left of the block, increment change left
-          {
-            const uint8_t* newColumnPtr = newPtr;
-            const uint8_t* oldColumnPtr = oldPtr;
-            while (changeLeft + minCompareWidthInPixels < changeRight)
-            {
-              const uint8_t* newRowPtr = newColumnPtr;
-              const uint8_t* oldRowPtr = oldColumnPtr;
-              for (int row = 0; row < changeHeight; row++)
-              {
-                if (memcmp(oldRowPtr, newRowPtr, minCompareWidthInBytes) != 0)
-                  goto endOfChangeLeft;
-
-                newRowPtr += newStrideBytes;
-                oldRowPtr += oldStrideBytes;
-              }
-
-              newColumnPtr += minCompareWidthInBytes;
-              oldColumnPtr += minCompareWidthInBytes;
-
-              changeLeft += minCompareWidthInPixels;
-            }
-          }
-        endOfChangeLeft:
-
-          // For every unchanged column at the right of the block, decrement change right
-          {
-            const uint8_t* newColumnPtr = newPtr + blockWidthInBytes;
-            const uint8_t* oldColumnPtr = oldPtr + blockWidthInBytes;
-            while (changeLeft + minCompareWidthInPixels < changeRight)
-            {
-              newColumnPtr -= minCompareWidthInBytes;
-              oldColumnPtr -= minCompareWidthInBytes;
-
-              const uint8_t* newRowPtr = newColumnPtr;
-              const uint8_t* oldRowPtr = oldColumnPtr;
-              for (int row = 0; row < changeHeight; row++)
-              {
-                if (memcmp(oldRowPtr, newRowPtr, minCompareWidthInBytes) != 0)
-                  goto endOfChangeRight;
-
-                newRowPtr += newStrideBytes;
-                oldRowPtr += oldStrideBytes;
-              }
-
-              changeRight -= minCompareWidthInPixels;
-            }
-          }
-        endOfChangeRight:
-
-          // Block change extends from (changeLeft, y) to (changeRight, y + changeHeight)
-          newChanged->assign_union(Region(Rect(changeLeft, y, changeRight, y + changeHeight)));
-
-          // Copy the change from fb to oldFb to allow future changes to be identified
-          for (int row = 0; row < changeHeight; row++)
-          {
-            memcpy(oldPtr, newPtr, blockWidthInBytes);
-            newPtr += newStrideBytes;
-            oldPtr += oldStrideBytes;
-          }
-
-          // No further processing is required for this block
-          break;
-        }
-
-        newPtr += newStrideBytes;
-        oldPtr += oldStrideBytes;
+        int firstChangedPixel = diff.tl.x / bytesPerPixel;
+        int lastChangedPixel = (diff.br.x - 1) / bytesPerPixel;
+
+        // Crop the left and right edges in steps of
+        // minCompareWidthInPixels, to avoid fragmenting the region
+        int changeLeft = blockLeft;
+        int changeRight = blockRight;
+
+        while ((changeLeft + minCompareWidthInPixels < changeRight) &&
+               (changeLeft + minCompareWidthInPixels <=
+                blockLeft + firstChangedPixel))
+          changeLeft += minCompareWidthInPixels;
+
+        while ((changeLeft + minCompareWidthInPixels < changeRight) &&
+               (changeRight - minCompareWidthInPixels >
+                blockLeft + lastChangedPixel))
+          changeRight -= minCompareWidthInPixels;
+
+        // Block change extends from (changeLeft, top) to (changeRight, bottom)
+        newChanged->assign_union(Region(Rect(changeLeft,
+                                             blockTop + diff.tl.y,
+                                             changeRight,
+                                             blockTop + diff.br.y)));
       }
 
       oldBlockPtr += blockWidthInBytes;
@@ -263,5 +750,94 @@ void ComparingUpdateTracker::logStats()
             siPrefix(missedPixels, "pixels").c_str());
   vlog.info("(1:%g ratio)", ratio);
 
+  if (useHashes) {
+    size_t hashSize, copySize;
+
+    hashSize = rowHashes.size() * sizeof(uint64_t);
+    copySize = (size_t)fb->width() * fb->height() * (fb->getPF().bpp/8);
+
+    vlog.info("%s of hashes instead of %s copy (%s saved)",
+              iecPrefix(hashSize, "B").c_str(),
+              iecPrefix(copySize, "B").c_str(),
+              iecPrefix(copySize > hashSize ? copySize - hashSize : 0,
+                        "B").c_str());
+  }
+
+  if (compares != 0) {
+    vlog.info("%s in %g ms (%g ms per compare)",
+              siPrefix(compares, "compares").c_str(),
+              compareTime / 1000.0,
+              (double)compareTime / compares / 1000.0);
+  }
+
+  if (grabs != 0) {
+    vlog.info("%s in %g ms (%g ms per grab)",
+              siPrefix(grabs, "grabs").c_str(),
+              grabTime / 1000.0,
+              (double)grabTime / grabs / 1000.0);
+  }
+
+  if (scrolls != 0) {
+    vlog.info("%s detected, moving %s",
+              siPrefix(scrolls, "scrolls").c_str(),
+              siPrefix(scrolledPixels, "pixels").c_str());
+  }
+
   totalPixels = missedPixels = 0;
+  compares = compareTime = 0;
+  grabs = grabTime = 0;
+  scrolls = scrolledPixels = 0;
+}
+
+ComparingUpdateTracker::CompareThread::CompareThread(ComparingUpdateTracker* tracker_)
+  : tracker(tracker_), stopRequested(false)
+{
+  start();
+}
+
+ComparingUpdateTracker::CompareThread::~CompareThread()
+{
+  stop();
+  wait();
+}
+
+void ComparingUpdateTracker::CompareThread::stop()
+{
+  os::AutoMutex a(tracker->queueMutex);
+
+  if (!isRunning())
+    return;
+
+  stopRequested = true;
+
+  // We can't wake just this thread, so wake everyone
+  tracker->consumerCond->broadcast();
+}
+
+void ComparingUpdateTracker::CompareThread::worker()
+{
+  tracker->queueMutex->lock();
+
+  while (!stopRequested) {
+    int band;
+
+    if ((tracker->nextBand >= tracker->bandCount) ||
+        !tracker->bandGrabbed(tracker->nextBand)) {
+      // Wait and try again
+      tracker->consumerCond->wait();
+      continue;
+    }
+
+    band = tracker->nextBand++;
+
+    tracker->queueMutex->unlock();
+    tracker->compareBand(band, &tracker->bandChanged[band]);
+    tracker->queueMutex->lock();
+
+    tracker->pendingBands--;
+    if (tracker->pendingBands == 0)
+      tracker->producerCond->signal();
+  }
+
+  tracker->queueMutex->unlock();
 }
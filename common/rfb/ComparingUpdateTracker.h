@@ -19,13 +19,30 @@
 #ifndef __RFB_COMPARINGUPDATETRACKER_H__
 #define __RFB_COMPARINGUPDATETRACKER_H__
 
+#include <stdint.h>
+
+#include <list>
+#include <vector>
+
+#include <os/Thread.h>
+
 #include <rfb/UpdateTracker.h>
 
+namespace os {
+  class Condition;
+  class Mutex;
+}
+
 namespace rfb {
 
   class ComparingUpdateTracker : public SimpleUpdateTracker {
   public:
-    ComparingUpdateTracker(PixelBuffer* buffer);
+    // The comparison is split in to horizontal bands that are processed
+    // by threadCount extra threads, or one per CPU core if -1. If
+    // useHashes is set then only a hash of each row of every block is
+    // kept, rather than a copy of the entire framebuffer.
+    ComparingUpdateTracker(PixelBuffer* buffer, int threadCount=0,
+                           bool useHashes=false);
     ~ComparingUpdateTracker();
 
     // compare() does the comparison and reduces its changed and copied regions
@@ -33,6 +50,13 @@ namespace rfb {
 
     virtual bool compare();
 
+    // grabAndCompare() first has the framebuffer grab the given region,
+    // and then does the same as compare(). With compare threads the
+    // grab is done one band at a time, and the bands already grabbed
+    // are compared whilst the next one is being fetched.
+
+    bool grabAndCompare(const Region& toGrab);
+
     // enable()/disable() turns the comparing functionality on/off. With it
     // disabled, the object will behave like a dumb update tracker (i.e.
     // compare() will be a no-op). It is harmless to repeatedly call these
@@ -41,16 +65,72 @@ namespace rfb {
     virtual void enable();
     virtual void disable();
 
+    // setDetectScroll() controls if compare() also looks for content
+    // that has moved, and turns that in to a copy. Only possible when
+    // a copy of the framebuffer is kept, and there are no other copies
+    // in the update.
+
+    void setDetectScroll(bool enable);
+
     void logStats();
 
   private:
     void compareRect(const Rect& r, Region* newchanged);
+    void compareBands(const std::vector<Rect>& rects, Region* newchanged);
+    void compareBand(int band, Region* newchanged);
+    bool bandGrabbed(int band);
+    void grab(const Region& r);
+    void markRect(const Rect& r);
+    void invalidateRect(const Rect& r);
+    void compareBlockRows(int first, int last, Region* newchanged);
+    bool detectScroll();
+    bool detectScroll(const Rect& r, bool vertical,
+                      Region* dest, Point* delta);
     PixelBuffer* fb;
     ManagedPixelBuffer oldFb;
     bool firstCompare;
     bool enabled;
 
+    bool useHashes;
+    bool scrollDetection;
+    int gridWidth, gridHeight;
+    std::vector<uint64_t> rowHashes;
+    std::vector<uint64_t> rowMasks;
+
     unsigned long long totalPixels, missedPixels;
+    unsigned long long compares, compareTime;
+    unsigned long long grabs, grabTime;
+    unsigned long long scrolls, scrolledPixels;
+
+  private:
+    os::Mutex* queueMutex;
+    os::Condition* producerCond;
+    os::Condition* consumerCond;
+
+    const std::vector<Rect>* bandRects;
+    int bandHeight;
+    int bandCount, nextBand, pendingBands;
+    const Region* pendingGrab;
+    int grabbedRows;
+    std::vector<Region> bandChanged;
+
+    class CompareThread : public os::Thread {
+    public:
+      CompareThread(ComparingUpdateTracker* tracker);
+      ~CompareThread();
+
+      void stop();
+
+    protected:
+      void worker();
+
+    private:
+      ComparingUpdateTracker* tracker;
+
+      bool stopRequested;
+    };
+
+    std::list<CompareThread*> threads;
   };
 
 }
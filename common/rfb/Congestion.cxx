@@ -83,7 +83,7 @@ static LogWriter vlog("Congestion");
 Congestion::Congestion() :
     lastPosition(0), extraBuffer(0),
     baseRTT(-1), congWindow(INITIAL_WINDOW), inSlowStart(true),
-    safeBaseRTT(-1), measurements(0), minRTT(-1), minCongestedRTT(-1)
+    safeBaseRTT(-1), lastRTT(-1), measurements(0), minRTT(-1), minCongestedRTT(-1)
 {
   gettimeofday(&lastUpdate, NULL);
   gettimeofday(&lastSent, NULL);
@@ -178,6 +178,8 @@ void Congestion::gotPong()
   if (rtt < 1)
     rtt = 1;
 
+  lastRTT = rtt;
+
   // Try to estimate wire latency by tracking lowest seen latency
   if (rtt < baseRTT)
     safeBaseRTT = baseRTT = rtt;
@@ -312,6 +314,25 @@ size_t Congestion::getBandwidth()
   return bandwidth;
 }
 
+int Congestion::getRTT()
+{
+  if (lastRTT == (unsigned)-1)
+    return -1;
+  return lastRTT;
+}
+
+int Congestion::getBaseRTT()
+{
+  if (safeBaseRTT == (unsigned)-1)
+    return -1;
+  return safeBaseRTT;
+}
+
+unsigned Congestion::getCongestionWindow()
+{
+  return congWindow;
+}
+
 void Congestion::debugTrace(const char* filename, int fd)
 {
   (void)filename;
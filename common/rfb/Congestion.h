@@ -51,6 +51,19 @@ namespace rfb {
     // per second.
     size_t getBandwidth();
 
+    // getRTT() returns the most recently measured round trip time, and
+    // getBaseRTT() the lowest one (i.e. the estimated wire latency),
+    // both in milliseconds. They return -1 if nothing has been measured
+    // yet.
+    int getRTT();
+    int getBaseRTT();
+
+    // getCongestionWindow() returns the current congestion window, and
+    // getInFlight() the number of bytes that are believed to be on
+    // their way to the client.
+    unsigned getCongestionWindow();
+    unsigned getInFlight();
+
     // debugTrace() writes the current congestion window, as well as the
     // congestion window of the underlying TCP layer, to the specified
     // file
@@ -58,7 +71,6 @@ namespace rfb {
 
   protected:
     unsigned getExtraBuffer();
-    unsigned getInFlight();
 
     void updateCongestion();
 
@@ -73,6 +85,7 @@ namespace rfb {
     bool inSlowStart;
 
     unsigned safeBaseRTT;
+    unsigned lastRTT;
 
     struct RTTInfo {
       struct timeval tv;
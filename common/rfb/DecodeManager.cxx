@@ -24,6 +24,7 @@
 #include <string.h>
 
 #include <rfb/CConnection.h>
+#include <rfb/Configuration.h>
 #include <rfb/DecodeManager.h>
 #include <rfb/Decoder.h>
 #include <rfb/Exception.h>
@@ -40,10 +41,16 @@ using namespace rfb;
 
 static LogWriter vlog("DecodeManager");
 
+static IntParameter decodeThreads("DecodeThreads",
+                                  "Number of worker threads used to decode "
+                                  "framebuffer updates (-1: one per CPU "
+                                  "core)",
+                                  -1, -1);
+
 DecodeManager::DecodeManager(CConnection *conn) :
   conn(conn), threadException(NULL)
 {
-  size_t cpuCount;
+  int threadCount;
 
   memset(decoders, 0, sizeof(decoders));
 
@@ -53,21 +60,24 @@ DecodeManager::DecodeManager(CConnection *conn) :
   producerCond = new os::Condition(queueMutex);
   consumerCond = new os::Condition(queueMutex);
 
-  cpuCount = os::Thread::getSystemCPUCount();
-  if (cpuCount == 0) {
-    vlog.error("Unable to determine the number of CPU cores on this system");
-    cpuCount = 1;
-  } else {
-    vlog.info("Detected %d CPU core(s)", (int)cpuCount);
-    // No point creating more threads than this, they'll just end up
-    // wasting CPU fighting for locks
-    if (cpuCount > 4)
-      cpuCount = 4;
+  threadCount = decodeThreads;
+  if (threadCount < 0) {
+    threadCount = os::Thread::getSystemCPUCount();
+    if (threadCount == 0) {
+      vlog.error("Unable to determine the number of CPU cores on this system");
+      threadCount = 1;
+    } else {
+      vlog.info("Detected %d CPU core(s)", threadCount);
+    }
   }
 
-  vlog.info("Creating %d decoder thread(s)", (int)cpuCount);
+  // All decoding is done by the worker threads
+  if (threadCount == 0)
+    threadCount = 1;
+
+  vlog.info("Creating %d decoder thread(s)", threadCount);
 
-  while (cpuCount--) {
+  while (threadCount--) {
     // Twice as many possible entries in the queue as there
     // are worker threads to make sure they don't stall
     freeBuffers.push_back(new rdr::MemOutStream());
@@ -109,6 +119,7 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   int equiv;
 
   QueueEntry *entry;
+  std::list<QueueEntry*>::iterator iter;
 
   assert(pb != NULL);
 
@@ -161,17 +172,18 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   // Then try to put it on the queue
   entry = new QueueEntry;
 
-  entry->active = false;
   entry->rect = r;
   entry->encoding = encoding;
   entry->decoder = decoder;
   entry->server = &conn->server;
   entry->pb = pb;
   entry->bufferStream = bufferStream;
+  entry->blockers = 0;
 
   decoder->getAffectedRegion(r, bufferStream->data(),
                              bufferStream->length(), conn->server,
                              &entry->affectedRegion);
+  entry->affectedRect = entry->affectedRegion.get_bounding_rect();
 
   queueMutex->lock();
 
@@ -179,11 +191,25 @@ bool DecodeManager::decodeRect(const Rect& r, int encoding,
   // the front is still the same buffer
   freeBuffers.pop_front();
 
-  workQueue.push_back(entry);
+  // Figure out what this rect has to wait for once, here, so the
+  // worker threads never have to search the queue
+  for (iter = workQueue.begin(); iter != workQueue.end(); ++iter) {
+    if (!isDependent(entry, *iter))
+      continue;
 
-  // We only put a single entry on the queue so waking a single
-  // thread is sufficient
-  consumerCond->signal();
+    entry->blockers++;
+    (*iter)->dependents.push_back(entry);
+  }
+
+  entry->queuePos = workQueue.insert(workQueue.end(), entry);
+
+  if (entry->blockers == 0) {
+    readyQueue.push_back(entry);
+
+    // We only made a single entry ready so waking a single thread
+    // is sufficient
+    consumerCond->signal();
+  }
 
   queueMutex->unlock();
 
@@ -202,6 +228,39 @@ void DecodeManager::flush()
   throwThreadException();
 }
 
+// Checks if an entry must wait for an earlier one to be decoded
+// first. Must be called with the queue mutex held.
+bool DecodeManager::isDependent(const QueueEntry* entry,
+                                const QueueEntry* earlier)
+{
+  if (entry->encoding == earlier->encoding) {
+    // An ordered decoder must get its rectangles in the order they
+    // were received
+    if (entry->decoder->flags & DecoderOrdered)
+      return true;
+
+    // For a partially ordered decoder we must ask the decoder for
+    // each pair of rectangles
+    if ((entry->decoder->flags & DecoderPartiallyOrdered) &&
+        entry->decoder->doRectsConflict(entry->rect,
+                                        entry->bufferStream->data(),
+                                        entry->bufferStream->length(),
+                                        earlier->rect,
+                                        earlier->bufferStream->data(),
+                                        earlier->bufferStream->length(),
+                                        *entry->server))
+      return true;
+  }
+
+  // Overlapping rectangles must also be decoded in order. The
+  // affected region is usually just a single rect, so start by
+  // comparing the bounding rects.
+  if (!entry->affectedRect.overlaps(earlier->affectedRect))
+    return false;
+
+  return !entry->affectedRegion.intersect(earlier->affectedRegion).is_empty();
+}
+
 void DecodeManager::logStats()
 {
   size_t i;
@@ -302,17 +361,17 @@ void DecodeManager::DecodeThread::worker()
 
   while (!stopRequested) {
     DecodeManager::QueueEntry *entry;
+    std::vector<DecodeManager::QueueEntry*>::iterator iter;
 
-    // Look for an available entry in the work queue
-    entry = findEntry();
-    if (entry == NULL) {
-      // Wait and try again
+    // Wait for an entry that isn't blocked by any other
+    if (manager->readyQueue.empty()) {
       manager->consumerCond->wait();
       continue;
     }
 
     // This is ours now
-    entry->active = true;
+    entry = manager->readyQueue.front();
+    manager->readyQueue.pop_front();
 
     manager->queueMutex->unlock();
 
@@ -329,81 +388,25 @@ void DecodeManager::DecodeThread::worker()
 
     manager->queueMutex->lock();
 
+    // Release any rects that were only waiting for this one, waking
+    // up one thread for each
+    for (iter = entry->dependents.begin();
+         iter != entry->dependents.end(); ++iter) {
+      if (--(*iter)->blockers != 0)
+        continue;
+
+      manager->readyQueue.push_back(*iter);
+      manager->consumerCond->signal();
+    }
+
     // Remove the entry from the queue and give back the memory buffer
     manager->freeBuffers.push_back(entry->bufferStream);
-    manager->workQueue.remove(entry);
+    manager->workQueue.erase(entry->queuePos);
     delete entry;
 
     // Wake the main thread in case it is waiting for a memory buffer
     manager->producerCond->signal();
-    // This rect might have been blocking multiple other rects, so
-    // wake up every worker thread
-    if (manager->workQueue.size() > 1)
-      manager->consumerCond->broadcast();
   }
 
   manager->queueMutex->unlock();
 }
-
-DecodeManager::QueueEntry* DecodeManager::DecodeThread::findEntry()
-{
-  std::list<DecodeManager::QueueEntry*>::iterator iter;
-  Region lockedRegion;
-
-  if (manager->workQueue.empty())
-    return NULL;
-
-  if (!manager->workQueue.front()->active)
-    return manager->workQueue.front();
-
-  for (iter = manager->workQueue.begin();
-       iter != manager->workQueue.end();
-       ++iter) {
-    DecodeManager::QueueEntry* entry;
-
-    std::list<DecodeManager::QueueEntry*>::iterator iter2;
-
-    entry = *iter;
-
-    // Another thread working on this?
-    if (entry->active)
-      goto next;
-
-    // If this is an ordered decoder then make sure this is the first
-    // rectangle in the queue for that decoder
-    if (entry->decoder->flags & DecoderOrdered) {
-      for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
-        if (entry->encoding == (*iter2)->encoding)
-          goto next;
-      }
-    }
-
-    // For a partially ordered decoder we must ask the decoder for each
-    // pair of rectangles.
-    if (entry->decoder->flags & DecoderPartiallyOrdered) {
-      for (iter2 = manager->workQueue.begin(); iter2 != iter; ++iter2) {
-        if (entry->encoding != (*iter2)->encoding)
-          continue;
-        if (entry->decoder->doRectsConflict(entry->rect,
-                                            entry->bufferStream->data(),
-                                            entry->bufferStream->length(),
-                                            (*iter2)->rect,
-                                            (*iter2)->bufferStream->data(),
-                                            (*iter2)->bufferStream->length(),
-                                            *entry->server))
-          goto next;
-      }
-    }
-
-    // Check overlap with earlier rectangles
-    if (!lockedRegion.intersect(entry->affectedRegion).is_empty())
-      goto next;
-
-    return entry;
-
-next:
-    lockedRegion.assign_union(entry->affectedRegion);
-  }
-
-  return NULL;
-}
@@ -20,6 +20,7 @@
 #define __RFB_DECODEMANAGER_H__
 
 #include <list>
+#include <vector>
 
 #include <os/Thread.h>
 
@@ -72,7 +73,6 @@ namespace rfb {
     DecoderStats stats[encodingMax+1];
 
     struct QueueEntry {
-      bool active;
       Rect rect;
       int encoding;
       Decoder* decoder;
@@ -80,10 +80,23 @@ namespace rfb {
       ModifiablePixelBuffer* pb;
       rdr::MemOutStream* bufferStream;
       Region affectedRegion;
+      Rect affectedRect;
+
+      // Earlier entries that must be decoded before this one, and
+      // later entries waiting for this one
+      unsigned blockers;
+      std::vector<QueueEntry*> dependents;
+
+      std::list<QueueEntry*>::iterator queuePos;
     };
 
+    bool isDependent(const QueueEntry* entry, const QueueEntry* earlier);
+
     std::list<rdr::MemOutStream*> freeBuffers;
+    // Every entry not yet decoded, in the order they were received
     std::list<QueueEntry*> workQueue;
+    // Entries that can be decoded right away
+    std::list<QueueEntry*> readyQueue;
 
     os::Mutex* queueMutex;
     os::Condition* producerCond;
@@ -99,7 +112,6 @@ namespace rfb {
 
     protected:
       void worker();
-      DecodeManager::QueueEntry* findEntry();
 
     private:
       DecodeManager* manager;
@@ -0,0 +1,142 @@
+/* Copyright (C) 2026 TigerVNC Team
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <rfb/Configuration.h>
+#include <rfb/EncodeCache.h>
+#include <rfb/ServerCore.h>
+
+using namespace rfb;
+
+bool EncodeCache::Settings::operator==(const Settings& other) const
+{
+  return (pf == other.pf) && (encoders == other.encoders) &&
+         (allowLossy == other.allowLossy) &&
+         (compressLevel == other.compressLevel) &&
+         (qualityLevel == other.qualityLevel) &&
+         (fineQualityLevel == other.fineQualityLevel) &&
+         (subsampling == other.subsampling);
+}
+
+bool EncodeCache::Key::operator<(const Key& other) const
+{
+  if (pb != other.pb)
+    return pb < other.pb;
+  if (rect.tl.y != other.rect.tl.y)
+    return rect.tl.y < other.rect.tl.y;
+  if (rect.tl.x != other.rect.tl.x)
+    return rect.tl.x < other.rect.tl.x;
+  if (rect.br.y != other.rect.br.y)
+    return rect.br.y < other.rect.br.y;
+  return rect.br.x < other.rect.br.x;
+}
+
+EncodeCache::EncodeCache()
+  : enabled(false), generation(0), usedBytes(0)
+{
+}
+
+EncodeCache::~EncodeCache()
+{
+}
+
+void EncodeCache::setEnabled(bool enabled_)
+{
+  if (rfb::Server::encodeCacheSize == 0)
+    enabled_ = false;
+
+  if (!enabled_)
+    invalidate();
+
+  enabled = enabled_;
+}
+
+void EncodeCache::invalidate()
+{
+  generation++;
+
+  if (entries.empty())
+    return;
+
+  entries.clear();
+  usedBytes = 0;
+}
+
+bool EncodeCache::lookup(const PixelBuffer* pb, const Rect& rect,
+                         const Settings& settings, int* type,
+                         const uint8_t** data, size_t* length)
+{
+  Key key;
+  EntryMap::const_iterator iter;
+  std::list<Entry>::const_iterator entry;
+
+  if (!enabled)
+    return false;
+
+  key.pb = pb;
+  key.rect = rect;
+
+  iter = entries.find(key);
+  if (iter == entries.end())
+    return false;
+
+  for (entry = iter->second.begin(); entry != iter->second.end(); ++entry) {
+    if (!(entry->settings == settings))
+      continue;
+
+    *type = entry->type;
+    *data = entry->data.empty() ? NULL : &entry->data[0];
+    *length = entry->data.size();
+
+    return true;
+  }
+
+  return false;
+}
+
+void EncodeCache::insert(const PixelBuffer* pb, const Rect& rect,
+                         const Settings& settings, int type,
+                         const uint8_t* data, size_t length)
+{
+  Key key;
+  std::list<Entry>* list;
+
+  if (!enabled)
+    return;
+
+  // Everything is thrown away on the next change anyway, so just stop
+  // adding things once we're full
+  if ((usedBytes + length) / 1024 >
+      (size_t)(int)rfb::Server::encodeCacheSize)
+    return;
+
+  key.pb = pb;
+  key.rect = rect;
+
+  list = &entries[key];
+
+  list->push_back(Entry());
+  list->back().settings = settings;
+  list->back().type = type;
+  list->back().data.assign(data, data + length);
+
+  usedBytes += length;
+}
@@ -0,0 +1,110 @@
+/* Copyright (C) 2026 TigerVNC Team
+ * 
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// EncodeCache - Encoded rects shared between clients.
+//
+// Clients viewing the same framebuffer with the same encoding settings
+// will produce identical data for identical rects. This cache allows
+// the first client to encode a rect to share the result with the
+// others. Only data from stateless encoders can be shared.
+//
+// Everything in the cache belongs to the current generation of the
+// framebuffer, and is discarded as soon as invalidate() is called.
+//
+// THIS CLASS IS NOT THREAD-SAFE!
+//
+
+#ifndef __RFB_ENCODECACHE_H__
+#define __RFB_ENCODECACHE_H__
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <stdint.h>
+
+#include <rfb/PixelFormat.h>
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  class PixelBuffer;
+
+  class EncodeCache {
+  public:
+    // Everything apart from the pixels that affects the encoded data
+    struct Settings {
+      PixelFormat pf;
+      std::vector<int> encoders;
+      bool allowLossy;
+      int compressLevel;
+      int qualityLevel;
+      int fineQualityLevel;
+      int subsampling;
+
+      bool operator==(const Settings& other) const;
+    };
+
+    EncodeCache();
+    ~EncodeCache();
+
+    // setEnabled() turns the cache on or off. There is no point in
+    // keeping data around unless there are multiple clients.
+    void setEnabled(bool enabled);
+    bool isEnabled() const { return enabled; }
+
+    // invalidate() must be called whenever the contents of any buffer
+    // that might be encoded has changed
+    void invalidate();
+
+    bool lookup(const PixelBuffer* pb, const Rect& rect,
+                const Settings& settings, int* type,
+                const uint8_t** data, size_t* length);
+    void insert(const PixelBuffer* pb, const Rect& rect,
+                const Settings& settings, int type,
+                const uint8_t* data, size_t length);
+
+    unsigned long long getGeneration() const { return generation; }
+
+  protected:
+    struct Key {
+      const PixelBuffer* pb;
+      Rect rect;
+
+      bool operator<(const Key& other) const;
+    };
+
+    struct Entry {
+      Settings settings;
+      int type;
+      std::vector<uint8_t> data;
+    };
+
+    typedef std::map<Key, std::list<Entry> > EntryMap;
+
+    bool enabled;
+    unsigned long long generation;
+
+    EntryMap entries;
+    size_t usedBytes;
+  };
+
+}
+
+#endif
@@ -23,16 +23,29 @@
 #include <config.h>
 #endif
 
+#include <assert.h>
 #include <stdlib.h>
 
+#include <algorithm>
+#include <string.h>
+#include <sys/time.h>
+
+#include <rdr/Exception.h>
+#include <rdr/MemOutStream.h>
+
+#include <os/Mutex.h>
+
 #include <rfb/EncodeManager.h>
 #include <rfb/Encoder.h>
 #include <rfb/Palette.h>
 #include <rfb/SConnection.h>
 #include <rfb/SMsgWriter.h>
 #include <rfb/UpdateTracker.h>
+#include <rfb/blockCompare.h>
 #include <rfb/LogWriter.h>
 #include <rfb/Exception.h>
+#include <rfb/Configuration.h>
+#include <rfb/ServerCore.h>
 #include <rfb/util.h>
 
 #include <rfb/RawEncoder.h>
@@ -41,11 +54,16 @@
 #include <rfb/ZRLEEncoder.h>
 #include <rfb/TightEncoder.h>
 #include <rfb/TightJPEGEncoder.h>
+#ifdef HAVE_H264_ENCODER
+#include <rfb/H264Encoder.h>
+#endif
 
 using namespace rfb;
 
 static LogWriter vlog("EncodeManager");
 
+std::list<EncodeManager*> EncodeManager::managers;
+
 // Split each rectangle into smaller ones no larger than this area,
 // and no wider than this width.
 static const int SubRectMaxArea = 65536;
@@ -60,6 +78,38 @@ static const int SolidBlockMinArea = 2048;
 // How long we consider a region recently changed (in ms)
 static const int RecentChangeTimeout = 50;
 
+// Assumed performance of lossless refreshes until we have measured
+// it, roughly 5 MB/s of 32 bpp data compressed 2:1
+static const double DefaultRefreshRate = 2.5; // Pixels per microsecond
+static const double DefaultRefreshRatio = 2.0;
+// How many different ages of pending refresh areas we keep track of
+static const unsigned MaxRefreshGenerations = 16;
+
+// How often (in updates) to try an encoder that has not been measured
+// yet, and how often to retry one that isn't currently the cheapest
+static const unsigned AdaptiveProbeInterval = 16;
+static const unsigned AdaptiveExploreInterval = 256;
+// How often (in updates) the compression level is reconsidered
+static const unsigned AdaptiveLevelInterval = 16;
+// Weight of each new measurement of an encoder's cost
+static const double AdaptiveCostWeight = 0.125;
+
+// Smallest area that is considered for video encoding
+static const int VideoMinArea = 160 * 120;
+// How many updates per second an area needs to count as video, and
+// how long (in ms) we measure before deciding
+static const unsigned VideoMinRate = 10;
+static const unsigned VideoWindow = 1000;
+// A slow client might not ask for that many updates, so an area that
+// changes in every single one of at least this many also counts
+static const unsigned VideoMinFrames = 4;
+// How long (in ms) an area can stay unchanged before we forget it
+static const unsigned VideoTimeout = 1000;
+// How many areas we keep track of
+static const size_t MaxVideoCandidates = 16;
+// More pieces of changes than this and we don't bother joining them
+static const size_t MaxVideoSearchRects = 256;
+
 namespace rfb {
 
 enum EncoderClass {
@@ -69,6 +119,9 @@ enum EncoderClass {
   encoderTight,
   encoderTightJPEG,
   encoderZRLE,
+#ifdef HAVE_H264_ENCODER
+  encoderH264,
+#endif
   encoderClassMax,
 };
 
@@ -79,6 +132,8 @@ enum EncoderType {
   encoderIndexed,
   encoderIndexedRLE,
   encoderFullColour,
+  // Full colour in areas with text or UI elements
+  encoderFullColourText,
   encoderTypeMax,
 };
 
@@ -87,8 +142,53 @@ struct RectInfo {
   Palette palette;
 };
 
+struct EncodeManager::QueueEntry {
+  enum State {
+    Pending,
+    Analysing,
+    Analysed,
+    Encoding,
+    Done,
+  };
+
+  State state;
+  Rect rect;
+  const PixelBuffer* pb;
+  const PixelBuffer* key;
+  unsigned long long generation;
+  int type;
+  struct RectInfo info;
+  bool cached;
+  long long encodeTime;
+  rdr::MemOutStream* bufferStream;
+};
+
 };
 
+static Encoder *createEncoder(int klass, SConnection* conn)
+{
+  switch (klass) {
+  case encoderRaw:
+    return new RawEncoder(conn);
+  case encoderRRE:
+    return new RREEncoder(conn);
+  case encoderHextile:
+    return new HextileEncoder(conn);
+  case encoderTight:
+    return new TightEncoder(conn);
+  case encoderTightJPEG:
+    return new TightJPEGEncoder(conn);
+  case encoderZRLE:
+    return new ZRLEEncoder(conn);
+#ifdef HAVE_H264_ENCODER
+  case encoderH264:
+    return new H264Encoder(conn);
+#endif
+  }
+
+  return NULL;
+}
+
 static const char *encoderClassName(EncoderClass klass)
 {
   switch (klass) {
@@ -104,6 +204,10 @@ static const char *encoderClassName(EncoderClass klass)
     return "Tight (JPEG)";
   case encoderZRLE:
     return "ZRLE";
+#ifdef HAVE_H264_ENCODER
+  case encoderH264:
+    return "H.264";
+#endif
   case encoderClassMax:
     break;
   }
@@ -126,6 +230,8 @@ static const char *encoderTypeName(EncoderType type)
     return "Indexed RLE";
   case encoderFullColour:
     return "Full Colour";
+  case encoderFullColourText:
+    return "Full Colour (Text/UI)";
   case encoderTypeMax:
     break;
   }
@@ -133,20 +239,36 @@ static const char *encoderTypeName(EncoderType type)
   return "Unknown Encoder Type";
 }
 
+static unsigned long long usSince(const struct timeval *start)
+{
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  return (now.tv_sec - start->tv_sec) * 1000000ULL +
+         now.tv_usec - start->tv_usec;
+}
+
 EncodeManager::EncodeManager(SConnection* conn_)
-  : conn(conn_), recentChangeTimer(this)
+  : conn(conn_), recentChangeTimer(this), solidSearchSkipped(0),
+    bandwidth(0),
+    compressLevel(-1), windowTime(0), windowBytes(0),
+    refreshUpdate(false), refreshPixels(0), refreshBytes(0),
+    refreshEquivalent(0), refreshTime(0), refreshRate(0),
+    refreshRatio(0), losslessPixels(0), losslessDelay(0),
+    losslessMaxDelay(0), async(false),
+    updatePending(false), pendingRects(0),
+    readyCallback(NULL), notifyPending(false), cache(NULL),
+    cacheHits(0), cacheMisses(0), threadException(NULL),
+    wantedThreads(0), threadLimit(0)
 {
   StatsVector::iterator iter;
-
+  CostVector::iterator cost;
   encoders.resize(encoderClassMax, NULL);
   activeEncoders.resize(encoderTypeMax, encoderRaw);
 
-  encoders[encoderRaw] = new RawEncoder(conn);
-  encoders[encoderRRE] = new RREEncoder(conn);
-  encoders[encoderHextile] = new HextileEncoder(conn);
-  encoders[encoderTight] = new TightEncoder(conn);
-  encoders[encoderTightJPEG] = new TightJPEGEncoder(conn);
-  encoders[encoderZRLE] = new ZRLEEncoder(conn);
+  for (int klass = 0; klass < encoderClassMax; klass++)
+    encoders[klass] = createEncoder(klass, conn);
 
   updates = 0;
   memset(&copyStats, 0, sizeof(copyStats));
@@ -157,6 +279,32 @@ EncodeManager::EncodeManager(SConnection* conn_)
     for (iter2 = iter->begin();iter2 != iter->end();++iter2)
       memset(&*iter2, 0, sizeof(EncoderStats));
   }
+
+  costs.resize(encoderClassMax);
+  for (cost = costs.begin();cost != costs.end();++cost) {
+    CostVector::value_type::iterator cost2;
+    cost->resize(encoderTypeMax);
+    for (cost2 = cost->begin();cost2 != cost->end();++cost2)
+      memset(&*cost2, 0, sizeof(EncoderCost));
+  }
+
+  queueMutex = new os::Mutex();
+  producerCond = new os::Condition(queueMutex);
+  consumerCond = new os::Condition(queueMutex);
+
+  wantedThreads = rfb::Server::encodeThreads;
+  if (wantedThreads < 0)
+    wantedThreads = getCPUCount();
+
+  // Background encoding needs someone to do the work
+  if (rfb::Server::asyncEncoding && (wantedThreads == 0))
+    wantedThreads = 1;
+
+  managers.push_back(this);
+  rebalanceThreads();
+
+  async = rfb::Server::asyncEncoding;
+  adjustThreads();
 }
 
 EncodeManager::~EncodeManager()
@@ -165,10 +313,125 @@ EncodeManager::~EncodeManager()
 
   logStats();
 
+  while (!threads.empty()) {
+    delete threads.back();
+    threads.pop_back();
+  }
+
+  // The others can have our threads
+  managers.remove(this);
+  rebalanceThreads();
+
+  delete threadException;
+
+  while (!workQueue.empty()) {
+    freeBuffers.push_back(workQueue.front()->bufferStream);
+    delete workQueue.front();
+    workQueue.pop_front();
+  }
+
+  while (!freeBuffers.empty()) {
+    delete freeBuffers.back();
+    freeBuffers.pop_back();
+  }
+
+  delete consumerCond;
+  delete producerCond;
+  delete queueMutex;
+
   for (iter = encoders.begin();iter != encoders.end();iter++)
     delete *iter;
 }
 
+int EncodeManager::getCPUCount()
+{
+  static int cpuCount = 0;
+
+  if (cpuCount == 0) {
+    cpuCount = os::Thread::getSystemCPUCount();
+    if (cpuCount == 0) {
+      vlog.error("Unable to determine the number of CPU cores on this system");
+      cpuCount = 1;
+    }
+  }
+
+  return cpuCount;
+}
+
+void EncodeManager::rebalanceThreads()
+{
+  std::list<EncodeManager*>::iterator iter;
+  int maxThreads;
+  bool assigned;
+
+  // Every client would otherwise add its own set of threads, all of
+  // them competing for the same cores
+  maxThreads = getCPUCount();
+  for (iter = managers.begin(); iter != managers.end(); ++iter) {
+    if ((*iter)->wantedThreads > maxThreads)
+      maxThreads = (*iter)->wantedThreads;
+    (*iter)->threadLimit = 0;
+  }
+
+  // Hand them out one at a time, so that everyone gets a fair share
+  do {
+    assigned = false;
+    for (iter = managers.begin(); iter != managers.end(); ++iter) {
+      if (maxThreads == 0)
+        break;
+      if ((*iter)->threadLimit >= (*iter)->wantedThreads)
+        continue;
+      (*iter)->threadLimit++;
+      maxThreads--;
+      assigned = true;
+    }
+  } while (assigned);
+}
+
+void EncodeManager::adjustThreads()
+{
+  bool wasAsync;
+
+  if ((int)threads.size() != threadLimit) {
+    if (threadLimit < wantedThreads)
+      vlog.info("Other clients are using encoder threads, limiting "
+                "this one to %d", threadLimit);
+    else
+      vlog.info("Using %d encoder thread(s)", threadLimit);
+  }
+
+  while ((int)threads.size() > threadLimit) {
+    delete threads.back();
+    threads.pop_back();
+
+    delete freeBuffers.back();
+    freeBuffers.pop_back();
+    delete freeBuffers.back();
+    freeBuffers.pop_back();
+  }
+
+  while ((int)threads.size() < threadLimit) {
+    // Twice as many possible entries in the queue as there
+    // are worker threads to make sure they don't stall
+    freeBuffers.push_back(new rdr::MemOutStream());
+    freeBuffers.push_back(new rdr::MemOutStream());
+
+    threads.push_back(new EncodeThread(this));
+  }
+
+  wasAsync = async;
+  async = rfb::Server::asyncEncoding && !threads.empty();
+
+  if (async != wasAsync) {
+    if (async)
+      vlog.status("Encoder threads available again, encoding updates "
+                  "in the background");
+    else
+      vlog.status("All encoder threads are used by other clients, "
+                  "AsyncEncoding is off for this one");
+  }
+}
+
 void EncodeManager::logStats()
 {
   size_t i, j;
@@ -229,6 +492,11 @@ void EncodeManager::logStats()
       vlog.info("    %*s  %s (1:%g ratio)",
                 (int)strlen(encoderTypeName((EncoderType)j)), "",
                 iecPrefix(stats[i][j].bytes, "B").c_str(), ratio);
+      if (stats[i][j].time != 0) {
+        vlog.info("    %*s  %g ms encoding",
+                  (int)strlen(encoderTypeName((EncoderType)j)), "",
+                  stats[i][j].time / 1000.0);
+      }
     }
   }
 
@@ -239,6 +507,66 @@ void EncodeManager::logStats()
             siPrefix(pixels, "pixels").c_str());
   vlog.info("         %s (1:%g ratio)",
             iecPrefix(bytes, "B").c_str(), ratio);
+
+  if ((cacheHits != 0) || (cacheMisses != 0)) {
+    vlog.info("  Shared encode cache: %s, %s",
+              siPrefix(cacheHits, "hits").c_str(),
+              siPrefix(cacheMisses, "misses").c_str());
+  }
+
+  if ((heatMap.getChangedPixels(ChangeHeatMap::Static) != 0) ||
+      (heatMap.getChangedPixels(ChangeHeatMap::TextUI) != 0) ||
+      (heatMap.getChangedPixels(ChangeHeatMap::Motion) != 0)) {
+    vlog.info("  Changes: %s %s, %s %s, %s %s",
+              siPrefix(heatMap.getChangedPixels(ChangeHeatMap::Static),
+                       "pixels").c_str(),
+              ChangeHeatMap::className(ChangeHeatMap::Static),
+              siPrefix(heatMap.getChangedPixels(ChangeHeatMap::TextUI),
+                       "pixels").c_str(),
+              ChangeHeatMap::className(ChangeHeatMap::TextUI),
+              siPrefix(heatMap.getChangedPixels(ChangeHeatMap::Motion),
+                       "pixels").c_str(),
+              ChangeHeatMap::className(ChangeHeatMap::Motion));
+  }
+
+  if (solidSearchSkipped != 0) {
+    vlog.info("  Solid search skipped: %s",
+              siPrefix(solidSearchSkipped, "pixels").c_str());
+  }
+
+  if (losslessPixels != 0) {
+    vlog.info("  Lossless refresh: %s, %g ms average delay, %u ms max",
+              siPrefix(losslessPixels, "pixels").c_str(),
+              (double)losslessDelay / losslessPixels, losslessMaxDelay);
+  }
+
+  if (compressLevel != -1)
+    vlog.info("  Adaptive compression level: %d", compressLevel);
+}
+
+void EncodeManager::getTotals(Totals* totals) const
+{
+  size_t i, j;
+
+  totals->updates = updates;
+  totals->rects = copyStats.rects;
+  totals->pixels = copyStats.pixels;
+  totals->bytes = copyStats.bytes;
+  totals->equivalent = copyStats.equivalent;
+  totals->time = 0;
+  totals->losslessPixels = losslessPixels;
+  totals->losslessDelay = losslessDelay;
+  totals->losslessMaxDelay = losslessMaxDelay;
+
+  for (i = 0;i < stats.size();i++) {
+    for (j = 0;j < stats[i].size();j++) {
+      totals->rects += stats[i][j].rects;
+      totals->pixels += stats[i][j].pixels;
+      totals->bytes += stats[i][j].bytes;
+      totals->equivalent += stats[i][j].equivalent;
+      totals->time += stats[i][j].time;
+    }
+  }
 }
 
 bool EncodeManager::supported(int encoding)
@@ -255,6 +583,16 @@ bool EncodeManager::supported(int encoding)
   }
 }
 
+void EncodeManager::setEncodeCache(EncodeCache* cache_)
+{
+  cache = cache_;
+}
+
+void EncodeManager::setBandwidth(size_t bandwidth_)
+{
+  bandwidth = bandwidth_;
+}
+
 bool EncodeManager::needsLosslessRefresh(const Region& req)
 {
   return !lossyRegion.intersect(req).is_empty();
@@ -276,11 +614,21 @@ void EncodeManager::pruneLosslessRefresh(const Region& limits)
 {
   lossyRegion.assign_intersect(limits);
   pendingRefreshRegion.assign_intersect(limits);
+  pruneRefreshGenerations();
 }
 
 void EncodeManager::writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                                 const RenderedCursor* renderedCursor)
 {
+  heatMap.update(ui.changed, pb->getRect());
+
+  if (videoSupported())
+    updateVideoCandidates(ui.changed);
+
+#ifdef HAVE_H264_ENCODER
+  ((H264Encoder*)encoders[encoderH264])->pruneContexts();
+#endif
+
   doUpdate(true, ui.changed, ui.copied, ui.copy_delta, pb, renderedCursor);
 
   recentlyChangedRegion.assign_union(ui.changed);
@@ -291,20 +639,42 @@ void EncodeManager::writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
 
 void EncodeManager::writeLosslessRefresh(const Region& req, const PixelBuffer* pb,
                                          const RenderedCursor* renderedCursor,
-                                         size_t maxUpdateSize)
+                                         size_t maxUpdateSize,
+                                         int maxTime)
 {
-  doUpdate(false, getLosslessRefresh(req, maxUpdateSize),
+  doUpdate(false, getLosslessRefresh(req, maxUpdateSize, maxTime),
            Region(), Point(), pb, renderedCursor);
 }
 
 bool EncodeManager::handleTimeout(Timer* t)
 {
   if (t == &recentChangeTimer) {
+    Region stable;
+
     // Any lossy region that wasn't recently updated can
     // now be scheduled for a refresh
-    pendingRefreshRegion.assign_union(lossyRegion.subtract(recentlyChangedRegion));
+    stable = lossyRegion.subtract(recentlyChangedRegion);
+    stable.assign_subtract(pendingRefreshRegion);
+    // Anything in motion will most likely change again soon, so wait
+    // until it has calmed down
+    stable.assign_subtract(heatMap.getRegion(ChangeHeatMap::Motion));
     recentlyChangedRegion.clear();
 
+    if (!stable.is_empty()) {
+      pruneRefreshGenerations();
+
+      if (refreshGenerations.size() >= MaxRefreshGenerations) {
+        refreshGenerations.back().region.assign_union(stable);
+      } else {
+        RefreshGeneration generation;
+        generation.region = stable;
+        getMonotonicTime(&generation.since);
+        refreshGenerations.push_back(generation);
+      }
+
+      pendingRefreshRegion.assign_union(stable);
+    }
+
     // Will there be more to do? (i.e. do we need another round)
     if (!lossyRegion.subtract(pendingRefreshRegion).is_empty())
       return true;
@@ -320,9 +690,17 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
 {
     int nRects;
     Region changed, cursorRegion;
+    std::vector<Rect> video;
+    Region videoRegion;
 
     updates++;
 
+    refreshUpdate = !allowLossy;
+
+    // Nothing is queued between updates, so this is when the number
+    // of threads can change
+    adjustThreads();
+
     prepareEncoders(allowLossy);
 
     changed = changed_;
@@ -330,12 +708,27 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
     if (!conn->client.supportsEncoding(encodingCopyRect))
       changed.assign_union(copied);
 
+    /*
+     * Areas showing video are sent whole, as a single stream each,
+     * so split those out first.
+     */
+    if (allowLossy && videoSupported()) {
+      std::vector<Rect>::const_iterator rect;
+
+      findVideoRects(changed, pb->getRect(), &video);
+      for (rect = video.begin(); rect != video.end(); ++rect)
+        videoRegion.assign_union(Region(*rect));
+
+      changed.assign_subtract(videoRegion);
+    }
+
     /*
      * We need to render the cursor seperately as it has its own
      * magical pixel buffer, so split it out from the changed region.
      */
     if (renderedCursor != NULL) {
-      cursorRegion = changed.intersect(renderedCursor->getEffectiveRect());
+      cursorRegion = changed.union_(videoRegion);
+      cursorRegion.assign_intersect(renderedCursor->getEffectiveRect());
       changed.assign_subtract(renderedCursor->getEffectiveRect());
     }
 
@@ -345,10 +738,50 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
       nRects = 0;
       if (conn->client.supportsEncoding(encodingCopyRect))
         nRects += copied.numRects();
+      nRects += video.size();
       nRects += computeNumRects(changed);
       nRects += computeNumRects(cursorRegion);
     }
 
+    if (async) {
+      // Take a private copy of everything that will be encoded, so
+      // that the framebuffer can keep changing whilst the worker
+      // threads are busy with it
+      snapshot.setPF(pb->getPF());
+      snapshot.setSize(pb->width(), pb->height());
+      snapshotRegion(changed, pb);
+      snapshotRegion(videoRegion, pb);
+      if (renderedCursor != NULL)
+        snapshotRegion(cursorRegion, renderedCursor);
+
+      updatePending = true;
+      pendingRects = nRects;
+      pendingCopied.clear();
+      if (conn->client.supportsEncoding(encodingCopyRect)) {
+        pendingCopied = copied;
+        pendingCopyDelta = copyDelta;
+      }
+      pendingVideo = video;
+      pendingCursorRect.clear();
+      if (renderedCursor != NULL)
+        pendingCursorRect = renderedCursor->getEffectiveRect();
+
+      if (conn->client.supportsEncoding(pseudoEncodingLastRect))
+        writeSolidRects(&changed, &snapshot);
+
+      writeRects(changed, &snapshot, pb);
+      writeRects(cursorRegion, &snapshot, renderedCursor);
+
+      // The workers might already be done, in which case nobody else
+      // will tell the callback
+      queueMutex->lock();
+      notifyPending = true;
+      checkUpdateReady();
+      queueMutex->unlock();
+
+      return;
+    }
+
     conn->writer()->writeFramebufferUpdateStart(nRects);
 
     if (conn->client.supportsEncoding(encodingCopyRect))
@@ -361,18 +794,59 @@ void EncodeManager::doUpdate(bool allowLossy, const Region& changed_,
     if (conn->client.supportsEncoding(pseudoEncodingLastRect))
       writeSolidRects(&changed, pb);
 
+    writeVideoRects(video, pb,
+                    renderedCursor != NULL ?
+                      renderedCursor->getEffectiveRect() : Rect());
+
     writeRects(changed, pb);
     writeRects(cursorRegion, renderedCursor);
 
     conn->writer()->writeFramebufferUpdateEnd();
+
+    updateCosts();
+}
+
+bool EncodeManager::isUpdateReady()
+{
+  os::AutoMutex a(queueMutex);
+
+  return isQueueDone();
+}
+
+void EncodeManager::finishUpdate()
+{
+  assert(updatePending);
+
+  updatePending = false;
+
+  queueMutex->lock();
+  notifyPending = false;
+  queueMutex->unlock();
+
+  conn->writer()->writeFramebufferUpdateStart(pendingRects);
+
+  if (conn->client.supportsEncoding(encodingCopyRect))
+    writeCopyRects(pendingCopied, pendingCopyDelta);
+
+  // Has to go before anything queued, as that includes the cursor.
+  // Video is encoded here, on the main loop, as each stream has to be
+  // fed its frames in order.
+  writeVideoRects(pendingVideo, &snapshot, pendingCursorRect);
+  pendingVideo.clear();
+
+  flushSubRects();
+
+  conn->writer()->writeFramebufferUpdateEnd();
+
+  updateCosts();
 }
 
 void EncodeManager::prepareEncoders(bool allowLossy)
 {
   enum EncoderClass solid, bitmap, bitmapRLE;
-  enum EncoderClass indexed, indexedRLE, fullColour;
+  enum EncoderClass indexed, indexedRLE, fullColour, fullColourText;
 
-  bool allowJPEG;
+  bool allowJPEG, gray;
 
   int32_t preferred;
 
@@ -443,6 +917,13 @@ void EncodeManager::prepareEncoders(bool allowLossy)
   if (bitmapRLE == encoderRaw)
     bitmapRLE = bitmap;
 
+  // Text and UI elements suffer the most from lossy compression, and
+  // would need a refresh later anyway. JPEG is only picked if Tight
+  // is supported.
+  fullColourText = fullColour;
+  if (fullColour == encoderTightJPEG)
+    fullColourText = encoderTight;
+
   if (solid == encoderRaw) {
     if (encoders[encoderTight]->isSupported())
       solid = encoderTight;
@@ -455,10 +936,13 @@ void EncodeManager::prepareEncoders(bool allowLossy)
   }
 
   // JPEG is the only encoder that can reduce things to grayscale
+  gray = false;
   if ((conn->client.subsampling == subsampleGray) &&
       encoders[encoderTightJPEG]->isSupported() && allowLossy) {
     solid = bitmap = bitmapRLE = encoderTightJPEG;
     indexed = indexedRLE = fullColour = encoderTightJPEG;
+    fullColourText = encoderTightJPEG;
+    gray = true;
   }
 
   activeEncoders[encoderSolid] = solid;
@@ -467,74 +951,363 @@ void EncodeManager::prepareEncoders(bool allowLossy)
   activeEncoders[encoderIndexed] = indexed;
   activeEncoders[encoderIndexedRLE] = indexedRLE;
   activeEncoders[encoderFullColour] = fullColour;
+  activeEncoders[encoderFullColourText] = fullColourText;
+
+  // The above are only a starting point if we are allowed to pick
+  // encoders based on what they have cost us so far
+  if (rfb::Server::adaptiveEncoding && !gray && (bandwidth != 0)) {
+    adaptEncoders(allowJPEG &&
+                  encoders[encoderTightJPEG]->isSupported());
+  } else {
+    compressLevel = -1;
+  }
+
+  // Clients can only share data if everything here matches
+  cacheSettings.pf = conn->client.pf();
+  cacheSettings.encoders = activeEncoders;
+  cacheSettings.allowLossy = allowLossy;
+  cacheSettings.compressLevel = getCompressLevel();
+  cacheSettings.qualityLevel = conn->client.qualityLevel;
+  cacheSettings.fineQualityLevel = conn->client.fineQualityLevel;
+  cacheSettings.subsampling = conn->client.subsampling;
 
   for (iter = activeEncoders.begin(); iter != activeEncoders.end(); ++iter) {
-    Encoder *encoder;
+    std::list<EncodeThread*>::iterator thread;
+
+    configureEncoder(encoders[*iter], allowLossy);
+
+    // The worker threads have their own copies of unordered encoders
+    for (thread = threads.begin(); thread != threads.end(); ++thread) {
+      Encoder *encoder;
+
+      encoder = (*thread)->getEncoder(*iter);
+      if (encoder != NULL)
+        configureEncoder(encoder, allowLossy);
+    }
+  }
+}
+
+void EncodeManager::adaptEncoders(bool allowJPEG)
+{
+  bool probe, explore;
+
+  // The client's compression level is our starting point, with
+  // the same default as the Tight encoder if it has none
+  if (compressLevel == -1) {
+    compressLevel = conn->client.compressLevel;
+    if (compressLevel == -1)
+      compressLevel = 2;
+  }
+
+  probe = (updates % AdaptiveProbeInterval) == 0;
+  explore = (updates % AdaptiveExploreInterval) == 0;
+
+  // Solid rects are too cheap to be worth the effort
+  for (int type = encoderBitmap; type < encoderTypeMax; type++) {
+    std::vector<int> candidates;
+    int best;
+    bool untried;
+    double bestCost;
+
+    for (int klass = 0; klass < encoderClassMax; klass++) {
+      if (!encoders[klass]->isSupported())
+        continue;
+#ifdef HAVE_H264_ENCODER
+      // Only makes sense for whole areas of video
+      if (klass == encoderH264)
+        continue;
+#endif
+      // RRE is hopeless unless there are few runs of pixels
+      if ((klass == encoderRRE) &&
+          (type != encoderBitmapRLE) && (type != encoderIndexedRLE))
+        continue;
+      // JPEG has no benefit for anything with few colours
+      if ((klass == encoderTightJPEG) &&
+          ((type != encoderFullColour) || !allowJPEG))
+        continue;
+      candidates.push_back(klass);
+    }
+
+    best = -1;
+    untried = false;
+    bestCost = 0;
+
+    for (size_t i = 0; i < candidates.size(); i++) {
+      const EncoderCost* cost;
+      double expected;
+
+      cost = &costs[candidates[i]][type];
+
+      // Never tried? Then we have no idea, so give it a go
+      if (cost->samples == 0) {
+        if (probe) {
+          best = candidates[i];
+          untried = true;
+          break;
+        }
+        continue;
+      }
+
+      // Expected time (in us) until a pixel is on the client's screen
+      expected = cost->time + cost->bytes * 1000000.0 / bandwidth;
+      if ((best == -1) || (expected < bestCost)) {
+        best = candidates[i];
+        bestCost = expected;
+      }
+    }
+
+    // Measurements get outdated as content and settings change, so
+    // every once in a while we try one of the others
+    if (explore && !untried) {
+      best = candidates[(updates / AdaptiveExploreInterval) %
+                        candidates.size()];
+    }
+
+    if (best != -1)
+      activeEncoders[type] = best;
+  }
+}
+
+void EncodeManager::updateCosts()
+{
+  double netTime;
+
+  for (int klass = 0; klass < encoderClassMax; klass++) {
+    for (int type = 0; type < encoderTypeMax; type++) {
+      EncoderCost* cost;
+      double time, bytes;
+
+      cost = &costs[klass][type];
+      if (cost->pendingPixels == 0)
+        continue;
+
+      time = (double)cost->pendingTime / cost->pendingPixels;
+      bytes = (double)cost->pendingBytes / cost->pendingPixels;
+
+      if (cost->samples == 0) {
+        cost->time = time;
+        cost->bytes = bytes;
+      } else {
+        cost->time += (time - cost->time) * AdaptiveCostWeight;
+        cost->bytes += (bytes - cost->bytes) * AdaptiveCostWeight;
+      }
+      cost->samples++;
 
-    encoder = encoders[*iter];
+      windowTime += cost->pendingTime;
+      windowBytes += cost->pendingBytes;
 
-    encoder->setCompressLevel(conn->client.compressLevel);
+      cost->pendingPixels = 0;
+      cost->pendingBytes = 0;
+      cost->pendingTime = 0;
+    }
+  }
+
+  if ((refreshPixels != 0) && (refreshBytes != 0)) {
+    double rate, ratio;
+
+    rate = (double)refreshPixels / __rfbmax(refreshTime, 1ULL);
+    ratio = (double)refreshEquivalent / refreshBytes;
 
-    if (allowLossy) {
-      encoder->setQualityLevel(conn->client.qualityLevel);
-      encoder->setFineQualityLevel(conn->client.fineQualityLevel,
-                                   conn->client.subsampling);
+    if (refreshRate == 0) {
+      refreshRate = rate;
+      refreshRatio = ratio;
     } else {
-      int level = __rfbmax(conn->client.qualityLevel,
-                           encoder->losslessQuality);
-      encoder->setQualityLevel(level);
-      encoder->setFineQualityLevel(-1, subsampleUndefined);
+      refreshRate += (rate - refreshRate) * AdaptiveCostWeight;
+      refreshRatio += (ratio - refreshRatio) * AdaptiveCostWeight;
     }
+
+    refreshPixels = 0;
+    refreshBytes = 0;
+    refreshEquivalent = 0;
+    refreshTime = 0;
+  }
+
+  if ((compressLevel == -1) || (bandwidth == 0))
+    return;
+  if ((updates % AdaptiveLevelInterval) != 0)
+    return;
+  if ((windowTime == 0) || (windowBytes == 0))
+    return;
+
+  // Spend more effort on compression if the network is the
+  // bottleneck, and less if we are
+  netTime = windowBytes * 1000000.0 / bandwidth;
+  if ((netTime > windowTime * 2) && (compressLevel < 9)) {
+    compressLevel++;
+    vlog.debug("Raising compression level to %d", compressLevel);
+  } else if ((netTime * 2 < windowTime) && (compressLevel > 0)) {
+    compressLevel--;
+    vlog.debug("Lowering compression level to %d", compressLevel);
+  }
+
+  windowTime = 0;
+  windowBytes = 0;
+}
+
+int EncodeManager::getCompressLevel()
+{
+  if (compressLevel != -1)
+    return compressLevel;
+  return conn->client.compressLevel;
+}
+
+void EncodeManager::configureEncoder(Encoder* encoder, bool allowLossy)
+{
+  encoder->setCompressLevel(getCompressLevel());
+
+  if (allowLossy) {
+    encoder->setQualityLevel(conn->client.qualityLevel);
+    encoder->setFineQualityLevel(conn->client.fineQualityLevel,
+                                 conn->client.subsampling);
+  } else {
+    int level = __rfbmax(conn->client.qualityLevel,
+                         encoder->losslessQuality);
+    encoder->setQualityLevel(level);
+    encoder->setFineQualityLevel(-1, subsampleUndefined);
   }
 }
 
+// Orders rects by their distance to a point (usually the cursor)
+struct RectDistanceLess {
+  RectDistanceLess(const Point& p_) : p(p_) {}
+
+  long long distance(const Rect& r) const {
+    long long dx, dy;
+    dx = __rfbmax(__rfbmax(r.tl.x - p.x, p.x - r.br.x + 1), 0);
+    dy = __rfbmax(__rfbmax(r.tl.y - p.y, p.y - r.br.y + 1), 0);
+    return dx * dx + dy * dy;
+  }
+
+  bool operator()(const Rect& a, const Rect& b) const {
+    return distance(a) < distance(b);
+  }
+
+  Point p;
+};
+
 Region EncodeManager::getLosslessRefresh(const Region& req,
-                                         size_t maxUpdateSize)
+                                         size_t maxUpdateSize,
+                                         int maxTime)
 {
-  std::vector<Rect> rects;
+  std::list<RefreshGeneration>::const_iterator gen;
   Region refresh;
-  size_t area;
-
-  // We make a conservative guess at the compression ratio at 2:1
-  maxUpdateSize *= 2;
+  size_t maxPixels, area;
+  double rate, ratio;
+  int bpp;
+
+  bpp = conn->client.pf().bpp/8;
+
+  // Measure the limit in pixels, using how well lossless encoding has
+  // actually been compressing, or a conservative 2:1 guess
+  ratio = refreshRatio;
+  if (ratio == 0)
+    ratio = DefaultRefreshRatio;
+  maxPixels = maxUpdateSize * ratio / bpp;
+
+  // The encoders are also limited in how fast they can go, and we want
+  // to leave at least half of the time for real updates
+  if (maxTime > 0) {
+    size_t cpuPixels;
+
+    rate = refreshRate;
+    if (rate == 0)
+      rate = DefaultRefreshRate;
+    rate *= __rfbmax(threads.size(), (size_t)1);
+
+    cpuPixels = rate * maxTime * 1000 / 2;
+    if (cpuPixels < maxPixels)
+      maxPixels = cpuPixels;
+  }
 
-  // We will measure pixels, not bytes (assume 32 bpp)
-  maxUpdateSize /= 4;
+  pruneRefreshGenerations();
 
+  // Areas that have been waiting the longest go first, and within each
+  // of those the areas closest to where the user is looking
   area = 0;
-  pendingRefreshRegion.intersect(req).get_rects(&rects);
-  while (!rects.empty()) {
-    size_t idx;
-    Rect rect;
+  for (gen = refreshGenerations.begin();
+       gen != refreshGenerations.end(); ++gen) {
+    std::vector<Rect> rects;
+    std::vector<Rect>::iterator iter;
 
-    // Grab a random rect so we don't keep damaging and restoring the
-    // same rect over and over
-    idx = rand() % rects.size();
+    gen->region.intersect(req).get_rects(&rects);
+    if (rects.empty())
+      continue;
 
-    rect = rects[idx];
+    std::sort(rects.begin(), rects.end(),
+              RectDistanceLess(conn->client.cursorPos()));
 
-    // Add rects until we exceed the threshold, then include as much as
-    // possible of the final rect
-    if ((area + rect.area()) > maxUpdateSize) {
-      // Use the narrowest axis to avoid getting to thin rects
-      if (rect.width() > rect.height()) {
-        int width = (maxUpdateSize - area) / rect.height();
-        rect.br.x = rect.tl.x + __rfbmax(1, width);
-      } else {
-        int height = (maxUpdateSize - area) / rect.width();
-        rect.br.y = rect.tl.y + __rfbmax(1, height);
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+      Rect rect;
+
+      rect = *iter;
+
+      // Add rects until we exceed the threshold, then include as much
+      // as possible of the final rect
+      if ((area + rect.area()) > maxPixels) {
+        // Use the narrowest axis to avoid getting to thin rects
+        if (rect.width() > rect.height()) {
+          int width = (maxPixels - area) / rect.height();
+          rect.br.x = rect.tl.x + __rfbmax(1, width);
+        } else {
+          int height = (maxPixels - area) / rect.width();
+          rect.br.y = rect.tl.y + __rfbmax(1, height);
+        }
       }
+
+      area += rect.area();
       refresh.assign_union(Region(rect));
-      break;
+
+      if (area >= maxPixels)
+        return refresh;
     }
+  }
+
+  return refresh;
+}
+
+void EncodeManager::noteRefreshed(const Rect& rect)
+{
+  std::list<RefreshGeneration>::const_iterator gen;
+  struct timeval now;
+
+  getMonotonicTime(&now);
+
+  for (gen = refreshGenerations.begin();
+       gen != refreshGenerations.end(); ++gen) {
+    std::vector<Rect> rects;
+    std::vector<Rect>::const_iterator iter;
+    unsigned delay;
+
+    gen->region.intersect(Region(rect)).get_rects(&rects);
+    if (rects.empty())
+      continue;
+
+    // The area stopped changing at least RecentChangeTimeout before
+    // it was put in this generation
+    delay = msBetween(&gen->since, &now) + RecentChangeTimeout;
 
-    area += rect.area();
-    refresh.assign_union(Region(rect));
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+      losslessPixels += iter->area();
+      losslessDelay += (unsigned long long)iter->area() * delay;
+    }
 
-    rects.erase(rects.begin() + idx);
+    if (delay > losslessMaxDelay)
+      losslessMaxDelay = delay;
   }
+}
 
-  return refresh;
+void EncodeManager::pruneRefreshGenerations()
+{
+  std::list<RefreshGeneration>::iterator gen;
+
+  gen = refreshGenerations.begin();
+  while (gen != refreshGenerations.end()) {
+    gen->region.assign_intersect(pendingRefreshRegion);
+    if (gen->region.is_empty())
+      gen = refreshGenerations.erase(gen);
+    else
+      ++gen;
+  }
 }
 
 int EncodeManager::computeNumRects(const Region& changed)
@@ -571,13 +1344,17 @@ int EncodeManager::computeNumRects(const Region& changed)
   return numRects;
 }
 
-Encoder *EncodeManager::startRect(const Rect& rect, int type)
+Encoder *EncodeManager::startRect(const Rect& rect, int type, int klass)
 {
   Encoder *encoder;
-  int klass, equiv;
+  int equiv;
+
+  if (klass == -1)
+    klass = activeEncoders[type];
 
   activeType = type;
-  klass = activeEncoders[activeType];
+  activeClass = klass;
+  activeRect = rect;
 
   beforeLength = conn->getOutStream()->length();
 
@@ -596,6 +1373,11 @@ Encoder *EncodeManager::startRect(const Rect& rect, int type)
   else
     lossyRegion.assign_subtract(Region(rect));
 
+  // Only count what actually gets sent, as planned refreshes can
+  // still be cut short or overtaken by new content
+  if (refreshUpdate)
+    noteRefreshed(rect);
+
   // This was either a rect getting refreshed, or a rect that just got
   // new content. Either way we should not try to refresh it anymore.
   pendingRefreshRegion.assign_subtract(Region(rect));
@@ -603,7 +1385,7 @@ Encoder *EncodeManager::startRect(const Rect& rect, int type)
   return encoder;
 }
 
-void EncodeManager::endRect()
+void EncodeManager::endRect(long long encodeTime)
 {
   int klass;
   int length;
@@ -612,8 +1394,27 @@ void EncodeManager::endRect()
 
   length = conn->getOutStream()->length() - beforeLength;
 
-  klass = activeEncoders[activeType];
+  klass = activeClass;
   stats[klass][activeType].bytes += length;
+
+  // Only rects we actually encoded tell us anything about the cost
+  if (encodeTime >= 0) {
+    EncoderCost* cost;
+
+    stats[klass][activeType].time += encodeTime;
+
+    cost = &costs[klass][activeType];
+    cost->pendingPixels += activeRect.area();
+    cost->pendingBytes += length;
+    cost->pendingTime += encodeTime;
+
+    if (refreshUpdate) {
+      refreshPixels += activeRect.area();
+      refreshBytes += length;
+      refreshEquivalent += 12 + activeRect.area() * (conn->client.pf().bpp/8);
+      refreshTime += encodeTime;
+    }
+  }
 }
 
 void EncodeManager::writeCopyRects(const Region& copied, const Point& delta)
@@ -650,14 +1451,315 @@ void EncodeManager::writeCopyRects(const Region& copied, const Point& delta)
   pendingRefreshRegion.assign_subtract(copied);
 }
 
-void EncodeManager::writeSolidRects(Region *changed, const PixelBuffer* pb)
+bool EncodeManager::videoSupported()
 {
-  std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator rect;
+#ifdef HAVE_H264_ENCODER
+  if (!rfb::Server::h264Video)
+    return false;
+  if (!encoders[encoderH264]->isSupported())
+    return false;
+
+  // Rects might have to be sent some other way at the last moment,
+  // so we can't know the rect count up front
+  if (!conn->client.supportsEncoding(pseudoEncodingLastRect))
+    return false;
+
+  // Same rules as for JPEG
+  if (conn->client.pf().bpp < 16)
+    return false;
+  if (conn->client.subsampling == subsampleGray)
+    return false;
+
+  return true;
+#else
+  return false;
+#endif
+}
+
+static bool rectsTouch(const Rect& a, const Rect& b)
+{
+  return (a.tl.x <= b.br.x) && (b.tl.x <= a.br.x) &&
+         (a.tl.y <= b.br.y) && (b.tl.y <= a.br.y);
+}
+
+void EncodeManager::updateVideoCandidates(const Region& changed)
+{
+  std::vector<Rect> rects, areas;
+  std::vector<Rect>::const_iterator rect;
+  std::list<VideoCandidate>::iterator iter;
+
+  struct timeval now;
+
+  getMonotonicTime(&now);
+
+  // Changes are often reported in pieces, so join up everything
+  // that touches to get the areas that actually changed
+  changed.get_rects(&rects);
+  if (rects.size() > MaxVideoSearchRects) {
+    areas.push_back(changed.get_bounding_rect());
+  } else {
+    for (rect = rects.begin(); rect != rects.end(); ++rect) {
+      Rect area;
+      bool merged;
+
+      area = *rect;
+      do {
+        merged = false;
+        for (size_t i = 0; i < areas.size(); i++) {
+          if (!rectsTouch(area, areas[i]))
+            continue;
+          area = area.union_boundary(areas[i]);
+          areas.erase(areas.begin() + i);
+          merged = true;
+          break;
+        }
+      } while (merged);
+
+      areas.push_back(area);
+    }
+  }
 
-  changed->get_rects(&rects);
-  for (rect = rects.begin(); rect != rects.end(); ++rect)
+  for (rect = areas.begin(); rect != areas.end(); ++rect) {
+    std::list<VideoCandidate>::iterator best;
+    int bestOverlap;
+
+    if (rect->area() < VideoMinArea)
+      continue;
+
+    // Video players don't move much, but what changes in each frame
+    // can still vary a bit
+    best = videoCandidates.end();
+    bestOverlap = 0;
+    for (iter = videoCandidates.begin();
+         iter != videoCandidates.end(); ++iter) {
+      int overlap;
+
+      overlap = iter->rect.intersect(*rect).area();
+      if (overlap * 2 < __rfbmin(iter->rect.area(), rect->area()))
+        continue;
+      if (overlap > bestOverlap) {
+        best = iter;
+        bestOverlap = overlap;
+      }
+    }
+
+    if (best == videoCandidates.end()) {
+      VideoCandidate candidate;
+
+      if (videoCandidates.size() >= MaxVideoCandidates) {
+        std::list<VideoCandidate>::iterator oldest;
+
+        oldest = videoCandidates.begin();
+        for (iter = videoCandidates.begin();
+             iter != videoCandidates.end(); ++iter) {
+          if (isBefore(&iter->lastChange, &oldest->lastChange))
+            oldest = iter;
+        }
+        videoCandidates.erase(oldest);
+      }
+
+      candidate.rect = *rect;
+      candidate.video = false;
+      candidate.windowRect.clear();
+      candidate.windowStart = now;
+      candidate.windowFrames = 0;
+      candidate.windowUpdates = 0;
+      candidate.changed = false;
+
+      best = videoCandidates.insert(videoCandidates.end(), candidate);
+    }
+
+    best->windowRect = best->windowRect.union_boundary(*rect);
+    best->lastChange = now;
+    best->changed = true;
+  }
+
+  iter = videoCandidates.begin();
+  while (iter != videoCandidates.end()) {
+    unsigned elapsed;
+
+    if (msBetween(&iter->lastChange, &now) >= VideoTimeout) {
+      iter = videoCandidates.erase(iter);
+      continue;
+    }
+
+    iter->windowUpdates++;
+    if (iter->changed)
+      iter->windowFrames++;
+    iter->changed = false;
+
+    elapsed = msBetween(&iter->windowStart, &now);
+    if (elapsed >= VideoWindow) {
+      iter->video = (iter->windowFrames * 1000 >= VideoMinRate * elapsed) ||
+                    ((iter->windowFrames >= VideoMinFrames) &&
+                     (iter->windowFrames == iter->windowUpdates));
+
+      if (!iter->windowRect.is_empty())
+        iter->rect = iter->windowRect;
+
+      iter->windowRect.clear();
+      iter->windowStart = now;
+      iter->windowFrames = 0;
+      iter->windowUpdates = 0;
+    }
+
+    ++iter;
+  }
+}
+
+void EncodeManager::findVideoRects(const Region& changed,
+                                   const Rect& limits,
+                                   std::vector<Rect>* rects)
+{
+  std::list<VideoCandidate>::const_iterator iter;
+  std::vector<Rect>::const_iterator other;
+
+  rects->clear();
+
+  for (iter = videoCandidates.begin();
+       iter != videoCandidates.end(); ++iter) {
+    Rect rect;
+
+    if (!iter->video)
+      continue;
+
+    rect = iter->rect.intersect(limits);
+
+    // 4:2:0 needs even dimensions
+    rect.br.x -= rect.width() % 2;
+    rect.br.y -= rect.height() % 2;
+
+    if (rect.area() < VideoMinArea)
+      continue;
+
+    if (changed.intersect(rect).is_empty())
+      continue;
+
+    for (other = rects->begin(); other != rects->end(); ++other) {
+      if (other->overlaps(rect))
+        break;
+    }
+    if (other != rects->end())
+      continue;
+
+    rects->push_back(rect);
+  }
+}
+
+void EncodeManager::writeVideoRects(const std::vector<Rect>& rects,
+                                    const PixelBuffer* pb,
+                                    const Rect& cursorRect)
+{
+#ifdef HAVE_H264_ENCODER
+  std::vector<Rect>::const_iterator rect;
+  H264Encoder* encoder;
+  Region failed;
+
+  if (rects.empty())
+    return;
+
+  encoder = (H264Encoder*)encoders[encoderH264];
+  configureEncoder(encoder, true);
+
+  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+    PixelBuffer *ppb;
+    struct timeval start;
+
+    ppb = preparePixelBuffer(*rect, pb, false,
+                             &offsetPixelBuffer, &convertedPixelBuffer);
+
+    gettimeofday(&start, NULL);
+
+    // Nothing has been sent for the rect yet, so it can still go
+    // the normal way if the encoder has nothing for us
+    encoder->setRect(*rect);
+    if (!encoder->encodeFrame(ppb)) {
+      failed.assign_union(Region(*rect));
+      continue;
+    }
+
+    startRect(*rect, encoderFullColour, encoderH264);
+    encoder->writeRect(ppb, Palette());
+    endRect(usSince(&start));
+  }
+
+  // The cursor has already been dealt with
+  failed.assign_subtract(Region(cursorRect));
+  if (!failed.is_empty())
+    writeRects(failed, pb);
+#else
+  assert(rects.empty());
+  (void)pb;
+  (void)cursorRect;
+#endif
+}
+
+void EncodeManager::writeSolidRects(Region *changed, const PixelBuffer* pb)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator rect;
+
+  Region motion;
+
+  // Large solid areas are rare in anything that is in motion, so
+  // don't waste time looking there
+  motion = changed->intersect(heatMap.getRegion(ChangeHeatMap::Motion));
+  if (!motion.is_empty()) {
+    motion.get_rects(&rects);
+    for (rect = rects.begin(); rect != rects.end(); ++rect)
+      solidSearchSkipped += rect->area();
+  }
+
+  changed->subtract(motion).get_rects(&rects);
+  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+    buildSolidMap(*rect, pb);
     findSolidRect(*rect, changed, pb);
+  }
+}
+
+// Checks every block of the rect once, so that the search can find
+// out if an area is solid without looking at the same pixels again
+void EncodeManager::buildSolidMap(const Rect& rect, const PixelBuffer* pb)
+{
+  const uint8_t* buffer;
+  int stride, bpp;
+  int bh;
+
+  solidMapRect = rect;
+  solidMapWidth = (rect.width() + SolidSearchBlock - 1) / SolidSearchBlock;
+  bh = (rect.height() + SolidSearchBlock - 1) / SolidSearchBlock;
+
+  solidMap.resize(solidMapWidth * bh);
+
+  bpp = pb->getPF().bpp;
+  buffer = pb->getBuffer(rect, &stride);
+  stride *= bpp / 8;
+
+  for (int by = 0; by < bh; by++) {
+    int h;
+
+    h = __rfbmin(SolidSearchBlock, rect.height() - by * SolidSearchBlock);
+
+    for (int bx = 0; bx < solidMapWidth; bx++) {
+      SolidBlock* block;
+      const uint8_t* data;
+      int w;
+
+      block = &solidMap[by * solidMapWidth + bx];
+
+      w = __rfbmin(SolidSearchBlock, rect.width() - bx * SolidSearchBlock);
+
+      data = buffer + by * SolidSearchBlock * stride +
+             bx * SolidSearchBlock * (bpp / 8);
+
+      // Zeroed so the whole value can be compared
+      block->colour = 0;
+      memcpy(&block->colour, data, bpp / 8);
+
+      block->solid = checkSolidBlock(data, stride, w, h, bpp,
+                                     (const uint8_t*)&block->colour);
+    }
+  }
 }
 
 void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
@@ -688,8 +1790,6 @@ void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
       if (checkSolidTile(sr, colourValue, pb)) {
         Rect erb, erp;
 
-        Encoder *encoder;
-
         // We then try extending the area by adding more blocks
         // in both directions and pick the combination that gives
         // the largest area.
@@ -710,21 +1810,7 @@ void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
         }
 
         // Send solid-color rectangle.
-        encoder = startRect(erp, encoderSolid);
-        if (encoder->flags & EncoderUseNativePF) {
-          encoder->writeSolidRect(erp.width(), erp.height(),
-                                  pb->getPF(), colourValue);
-        } else {
-          uint32_t _buffer2;
-          uint8_t* converted = (uint8_t*)&_buffer2;
-
-          conn->client.pf().bufferFromBuffer(converted, pb->getPF(),
-                                         colourValue, 1);
-
-          encoder->writeSolidRect(erp.width(), erp.height(),
-                                  conn->client.pf(), converted);
-        }
-        endRect();
+        writeSolidRect(erp, colourValue, pb);
 
         changed->assign_subtract(Region(erp));
 
@@ -757,7 +1843,104 @@ void EncodeManager::findSolidRect(const Rect& rect, Region *changed,
   }
 }
 
-void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb)
+void EncodeManager::writeSolidRect(const Rect& rect,
+                                   const uint8_t* colourValue,
+                                   const PixelBuffer* pb)
+{
+  Encoder *encoder;
+  QueueEntry *entry;
+
+  if (!updatePending) {
+    encoder = startRect(rect, encoderSolid);
+    encodeSolidRect(encoder, rect, colourValue, pb);
+    endRect();
+    return;
+  }
+
+  // Solid rects are cheap, so we encode them right away and just let
+  // them wait in the queue until the update is sent
+  entry = new QueueEntry;
+
+  entry->state = QueueEntry::Done;
+  entry->rect = rect;
+  entry->pb = pb;
+  entry->key = pb;
+  entry->generation = 0;
+  entry->type = encoderSolid;
+  // Not really from the cache, but solid rects shouldn't go in to it
+  entry->cached = true;
+  entry->encodeTime = -1;
+
+  queueMutex->lock();
+  if (freeBuffers.empty())
+    freeBuffers.push_back(new rdr::MemOutStream());
+  entry->bufferStream = freeBuffers.front();
+  freeBuffers.pop_front();
+  queueMutex->unlock();
+
+  entry->bufferStream->clear();
+
+  encoder = encoders[activeEncoders[encoderSolid]];
+
+  encoder->setOutStream(entry->bufferStream);
+  try {
+    encodeSolidRect(encoder, rect, colourValue, pb);
+  } catch (...) {
+    encoder->setOutStream(NULL);
+    queueMutex->lock();
+    freeBuffers.push_back(entry->bufferStream);
+    queueMutex->unlock();
+    delete entry;
+    throw;
+  }
+  encoder->setOutStream(NULL);
+
+  queueMutex->lock();
+  workQueue.push_back(entry);
+  queueMutex->unlock();
+}
+
+void EncodeManager::encodeSolidRect(Encoder* encoder, const Rect& rect,
+                                    const uint8_t* colourValue,
+                                    const PixelBuffer* pb)
+{
+  if (encoder->flags & EncoderUseNativePF) {
+    encoder->writeSolidRect(rect.width(), rect.height(),
+                            pb->getPF(), colourValue);
+  } else {
+    uint32_t _buffer;
+    uint8_t* converted = (uint8_t*)&_buffer;
+
+    conn->client.pf().bufferFromBuffer(converted, pb->getPF(),
+                                       colourValue, 1);
+
+    encoder->writeSolidRect(rect.width(), rect.height(),
+                            conn->client.pf(), converted);
+  }
+}
+
+// Copies the given region of a buffer in to the snapshot used for
+// background encoding
+void EncodeManager::snapshotRegion(const Region& region,
+                                   const PixelBuffer* pb)
+{
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator rect;
+
+  region.get_rects(&rects);
+  for (rect = rects.begin(); rect != rects.end(); ++rect) {
+    const uint8_t* data;
+    int stride;
+
+    data = pb->getBuffer(*rect, &stride);
+    snapshot.imageRect(*rect, data, stride);
+  }
+}
+
+// Encodes the rects of the given region from pb. The data is shared
+// with other clients as belonging to key, if given, rather than to pb.
+void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb,
+                               const PixelBuffer* key)
 {
   std::vector<Rect> rects;
   std::vector<Rect>::const_iterator rect;
@@ -772,7 +1955,7 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb)
 
     // No split necessary?
     if (((w*h) < SubRectMaxArea) && (w < SubRectMaxWidth)) {
-      writeSubRect(*rect, pb);
+      writeSubRect(*rect, pb, key);
       continue;
     }
 
@@ -793,20 +1976,109 @@ void EncodeManager::writeRects(const Region& changed, const PixelBuffer* pb)
         if (sr.br.x > rect->br.x)
           sr.br.x = rect->br.x;
 
-        writeSubRect(sr, pb);
+        writeSubRect(sr, pb, key);
       }
     }
   }
+
+  // Background updates are sent by finishUpdate()
+  if (!updatePending)
+    flushSubRects();
 }
 
-void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
+void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb,
+                                 const PixelBuffer *key)
 {
   PixelBuffer *ppb;
 
   Encoder *encoder;
 
   struct RectInfo info;
+  int type;
+
+  struct timeval start;
+
+  if (key == NULL)
+    key = pb;
+
+  if (!threads.empty()) {
+    queueSubRect(rect, pb, key);
+    return;
+  }
+
+  if (writeCachedRect(rect, pb))
+    return;
+
+  ppb = preparePixelBuffer(rect, pb, true,
+                           &offsetPixelBuffer, &convertedPixelBuffer);
+
+  type = analyseSubRect(rect, ppb, &info);
+
+  gettimeofday(&start, NULL);
+
+  encoder = startRect(rect, type);
+
+  if (encoder->flags & EncoderUseNativePF)
+    ppb = preparePixelBuffer(rect, pb, false,
+                             &offsetPixelBuffer, &convertedPixelBuffer);
+
+  // Only stateless encoders produce data that other clients can use
+  if ((cache != NULL) && cache->isEnabled() &&
+      !(encoder->flags & EncoderOrdered)) {
+    cacheStream.clear();
+
+    encoder->setOutStream(&cacheStream);
+    try {
+      encoder->writeRect(ppb, info.palette);
+    } catch (...) {
+      encoder->setOutStream(NULL);
+      throw;
+    }
+    encoder->setOutStream(NULL);
+
+    conn->getOutStream()->writeBytes(cacheStream.data(),
+                                     cacheStream.length());
+
+    cache->insert(pb, rect, cacheSettings, type,
+                  (const uint8_t*)cacheStream.data(),
+                  cacheStream.length());
+  } else {
+    encoder->writeRect(ppb, info.palette);
+  }
+
+  endRect(usSince(&start));
+}
+
+bool EncodeManager::writeCachedRect(const Rect& rect, const PixelBuffer *pb)
+{
+  int type;
+  const uint8_t* data;
+  size_t length;
+
+  if ((cache == NULL) || !cache->isEnabled())
+    return false;
+
+  if (!cache->lookup(pb, rect, cacheSettings, &type, &data, &length)) {
+    cacheMisses++;
+    return false;
+  }
+
+  cacheHits++;
+
+  startRect(rect, type);
+  conn->getOutStream()->writeBytes(data, length);
+  endRect();
+
+  return true;
+}
+
+int EncodeManager::analyseSubRect(const Rect& rect, const PixelBuffer *ppb,
+                                  struct RectInfo *info)
+{
+  Encoder *encoder;
+
   unsigned int divisor, maxColours;
+  int level;
 
   bool useRLE;
   EncoderType type;
@@ -816,10 +2088,11 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
   //        compression setting means spending less effort in building
   //        a palette. It might be that they figured the increase in
   //        zlib setting compensated for the loss.
-  if (conn->client.compressLevel == -1)
+  level = getCompressLevel();
+  if (level == -1)
     divisor = 2 * 8;
   else
-    divisor = conn->client.compressLevel * 8;
+    divisor = level * 8;
   if (divisor < 4)
     divisor = 4;
 
@@ -827,7 +2100,7 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
 
   // Special exception inherited from the Tight encoder
   if (activeEncoders[encoderFullColour] == encoderTightJPEG) {
-    if ((conn->client.compressLevel != -1) && (conn->client.compressLevel < 2))
+    if ((level != -1) && (level < 2))
       maxColours = 24;
     else
       maxColours = 96;
@@ -843,17 +2116,15 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
   if (maxColours > encoder->maxPaletteSize)
     maxColours = encoder->maxPaletteSize;
 
-  ppb = preparePixelBuffer(rect, pb, true);
-
-  if (!analyseRect(ppb, &info, maxColours))
-    info.palette.clear();
+  if (!analyseRect(ppb, info, maxColours))
+    info->palette.clear();
 
   // Different encoders might have different RLE overhead, but
   // here we do a guess at RLE being the better choice if reduces
   // the pixel count by 50%.
-  useRLE = info.rleRuns <= (rect.area() * 2);
+  useRLE = info->rleRuns <= (rect.area() * 2);
 
-  switch (info.palette.size()) {
+  switch (info->palette.size()) {
   case 0:
     type = encoderFullColour;
     break;
@@ -873,27 +2144,91 @@ void EncodeManager::writeSubRect(const Rect& rect, const PixelBuffer *pb)
       type = encoderIndexed;
   }
 
-  encoder = startRect(rect, type);
+  // Refreshes are handled the same everywhere
+  if (refreshUpdate)
+    return type;
 
-  if (encoder->flags & EncoderUseNativePF)
-    ppb = preparePixelBuffer(rect, pb, false);
-
-  encoder->writeRect(ppb, info.palette);
+  switch (heatMap.classify(rect)) {
+  case ChangeHeatMap::TextUI:
+    if (type == encoderFullColour)
+      type = encoderFullColourText;
+    break;
+  case ChangeHeatMap::Motion:
+    // Mixing lossless and lossy rects makes video flicker, and the
+    // details will be gone in the next frame anyway
+    if (((type == encoderIndexed) || (type == encoderIndexedRLE)) &&
+        (activeEncoders[encoderFullColour] == encoderTightJPEG)) {
+      info->palette.clear();
+      type = encoderFullColour;
+    }
+    break;
+  default:
+    break;
+  }
 
-  endRect();
+  return type;
 }
 
 bool EncodeManager::checkSolidTile(const Rect& r, const uint8_t* colourValue,
                                    const PixelBuffer *pb)
 {
-  switch (pb->getPF().bpp) {
-  case 32:
-    return checkSolidTile(r, *(const uint32_t*)colourValue, pb);
-  case 16:
-    return checkSolidTile(r, *(const uint16_t*)colourValue, pb);
-  default:
-    return checkSolidTile(r, *(const uint8_t*)colourValue, pb);
+  uint32_t colour;
+  int bx0, by0, bx1, by1;
+
+  assert(r.enclosed_by(solidMapRect));
+
+  colour = 0;
+  memcpy(&colour, colourValue, pb->getPF().bpp / 8);
+
+  bx0 = (r.tl.x - solidMapRect.tl.x) / SolidSearchBlock;
+  by0 = (r.tl.y - solidMapRect.tl.y) / SolidSearchBlock;
+  bx1 = (r.br.x - solidMapRect.tl.x - 1) / SolidSearchBlock;
+  by1 = (r.br.y - solidMapRect.tl.y - 1) / SolidSearchBlock;
+
+  // Any block of a different colour is an immediate failure, and
+  // any of the same colour is already known to be fine
+  for (int by = by0; by <= by1; by++) {
+    for (int bx = bx0; bx <= bx1; bx++) {
+      const SolidBlock* block;
+
+      block = &solidMap[by * solidMapWidth + bx];
+      if (block->solid && (block->colour != colour))
+        return false;
+    }
   }
+
+  // So we only need to look at the pixels of the other blocks
+  for (int by = by0; by <= by1; by++) {
+    for (int bx = bx0; bx <= bx1; bx++) {
+      Rect br;
+
+      if (solidMap[by * solidMapWidth + bx].solid)
+        continue;
+
+      br.setXYWH(solidMapRect.tl.x + bx * SolidSearchBlock,
+                 solidMapRect.tl.y + by * SolidSearchBlock,
+                 SolidSearchBlock, SolidSearchBlock);
+
+      if (!checkSolidPixels(r.intersect(br), colourValue, pb))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool EncodeManager::checkSolidPixels(const Rect& r,
+                                     const uint8_t* colourValue,
+                                     const PixelBuffer *pb)
+{
+  const uint8_t* buffer;
+  int stride;
+
+  buffer = pb->getBuffer(r, &stride);
+
+  return checkSolidBlock(buffer, stride * (pb->getPF().bpp / 8),
+                         r.width(), r.height(), pb->getPF().bpp,
+                         colourValue);
 }
 
 void EncodeManager::extendSolidAreaByBlock(const Rect& r,
@@ -994,22 +2329,24 @@ void EncodeManager::extendSolidAreaByPixel(const Rect& r, const Rect& sr,
 
 PixelBuffer* EncodeManager::preparePixelBuffer(const Rect& rect,
                                                const PixelBuffer *pb,
-                                               bool convert)
+                                               bool convert,
+                                               OffsetPixelBuffer* offsetBuffer,
+                                               ManagedPixelBuffer* convertedBuffer)
 {
   const uint8_t* buffer;
   int stride;
 
   // Do wo need to convert the data?
   if (convert && conn->client.pf() != pb->getPF()) {
-    convertedPixelBuffer.setPF(conn->client.pf());
-    convertedPixelBuffer.setSize(rect.width(), rect.height());
+    convertedBuffer->setPF(conn->client.pf());
+    convertedBuffer->setSize(rect.width(), rect.height());
 
     buffer = pb->getBuffer(rect, &stride);
-    convertedPixelBuffer.imageRect(pb->getPF(),
-                                   convertedPixelBuffer.getRect(),
-                                   buffer, stride);
+    convertedBuffer->imageRect(pb->getPF(),
+                               convertedBuffer->getRect(),
+                               buffer, stride);
 
-    return &convertedPixelBuffer;
+    return convertedBuffer;
   }
 
   // Otherwise we still need to shift the coordinates. We have our own
@@ -1017,10 +2354,10 @@ PixelBuffer* EncodeManager::preparePixelBuffer(const Rect& rect,
 
   buffer = pb->getBuffer(rect, &stride);
 
-  offsetPixelBuffer.update(pb->getPF(), rect.width(), rect.height(),
-                           buffer, stride);
+  offsetBuffer->update(pb->getPF(), rect.width(), rect.height(),
+                       buffer, stride);
 
-  return &offsetPixelBuffer;
+  return offsetBuffer;
 }
 
 bool EncodeManager::analyseRect(const PixelBuffer *pb,
@@ -1047,49 +2384,493 @@ bool EncodeManager::analyseRect(const PixelBuffer *pb,
   }
 }
 
-void EncodeManager::OffsetPixelBuffer::update(const PixelFormat& pf,
-                                              int width, int height,
-                                              const uint8_t* data_,
-                                              int stride_)
+void EncodeManager::queueSubRect(const Rect& rect, const PixelBuffer *pb,
+                                 const PixelBuffer *key)
 {
-  format = pf;
-  // Forced cast. We never write anything though, so it should be safe.
-  setBuffer(width, height, (uint8_t*)data_, stride_);
+  QueueEntry *entry;
+
+  queueMutex->lock();
+
+  // Send off finished rects until there is room in the queue. Nothing
+  // can be sent for a background update until all of it is queued, so
+  // that queue has to grow instead.
+  while (freeBuffers.empty()) {
+    if (updatePending) {
+      freeBuffers.push_back(new rdr::MemOutStream());
+      break;
+    }
+    if (writeQueuedRect())
+      continue;
+    if (!helpQueue())
+      producerCond->wait();
+  }
+
+  entry = new QueueEntry;
+
+  entry->state = QueueEntry::Pending;
+  entry->rect = rect;
+  entry->pb = pb;
+  entry->key = key;
+  entry->generation = 0;
+  entry->type = encoderFullColour;
+  entry->cached = false;
+  entry->encodeTime = -1;
+  entry->bufferStream = freeBuffers.front();
+
+  freeBuffers.pop_front();
+
+  // Some other client might already have done the work for us
+  if ((cache != NULL) && cache->isEnabled()) {
+    const uint8_t* data;
+    size_t length;
+
+    entry->generation = cache->getGeneration();
+
+    if (cache->lookup(key, rect, cacheSettings, &entry->type,
+                      &data, &length)) {
+      cacheHits++;
+
+      entry->bufferStream->clear();
+      entry->bufferStream->writeBytes(data, length);
+      entry->cached = true;
+      entry->state = QueueEntry::Done;
+    } else {
+      cacheMisses++;
+    }
+  }
+
+  workQueue.push_back(entry);
+
+  // We only put a single entry on the queue so waking a single
+  // thread is sufficient
+  if (entry->state == QueueEntry::Pending)
+    consumerCond->signal();
+
+  queueMutex->unlock();
 }
 
-uint8_t* EncodeManager::OffsetPixelBuffer::getBufferRW(const Rect& /*r*/, int* /*stride*/)
+void EncodeManager::flushSubRects()
 {
-  throw rfb::Exception("Invalid write attempt to OffsetPixelBuffer");
+  if (threads.empty())
+    return;
+
+  queueMutex->lock();
+
+  // The rects must be sent in the order they were queued, so we wait
+  // for each one in turn
+  while (!workQueue.empty()) {
+    if (writeQueuedRect())
+      continue;
+    if (!helpQueue())
+      producerCond->wait();
+  }
+
+  queueMutex->unlock();
+
+  throwThreadException();
 }
 
-template<class T>
-inline bool EncodeManager::checkSolidTile(const Rect& r,
-                                          const T colourValue,
-                                          const PixelBuffer *pb)
+// Sends the first rect in the queue if it has been fully encoded.
+// Must be called with the queue mutex held. Will release the mutex
+// and throw if a worker thread has failed.
+bool EncodeManager::writeQueuedRect()
+{
+  QueueEntry *entry;
+
+  if (workQueue.empty())
+    return false;
+
+  entry = workQueue.front();
+  if (entry->state != QueueEntry::Done)
+    return false;
+
+  if (threadException != NULL) {
+    discardQueue();
+    queueMutex->unlock();
+    throwThreadException();
+  }
+
+  workQueue.pop_front();
+
+  queueMutex->unlock();
+
+  try {
+    Encoder *encoder;
+
+    encoder = startRect(entry->rect, entry->type);
+    conn->getOutStream()->writeBytes(entry->bufferStream->data(),
+                                     entry->bufferStream->length());
+    endRect(entry->encodeTime);
+
+    // The framebuffer might have changed since a background update
+    // was queued, in which case the data is of no use to others
+    if ((cache != NULL) && !entry->cached &&
+        !(encoder->flags & EncoderOrdered) &&
+        (cache->getGeneration() == entry->generation)) {
+      cache->insert(entry->key, entry->rect, cacheSettings, entry->type,
+                    (const uint8_t*)entry->bufferStream->data(),
+                    entry->bufferStream->length());
+    }
+  } catch (...) {
+    queueMutex->lock();
+    freeBuffers.push_back(entry->bufferStream);
+    delete entry;
+    discardQueue();
+    queueMutex->unlock();
+    throw;
+  }
+
+  queueMutex->lock();
+
+  freeBuffers.push_back(entry->bufferStream);
+  delete entry;
+
+  return true;
+}
+
+// Rather than just waiting for the worker threads, the main thread
+// can do some of the work itself. Must be called with the queue mutex
+// held. Returns false if there was nothing to do.
+bool EncodeManager::helpQueue()
 {
-  int w, h;
-  const T* buffer;
-  int stride, pad;
+  QueueEntry *entry;
 
-  w = r.width();
-  h = r.height();
+  // Someone else has already failed, so this is all going away
+  if (threadException != NULL)
+    return false;
 
-  buffer = (const T*)pb->getBuffer(r, &stride);
-  pad = stride - w;
+  entry = findQueueEntry();
+  if (entry == NULL)
+    return false;
 
-  while (h--) {
-    int w_ = w;
-    while (w_--) {
-      if (*buffer != colourValue)
-        return false;
-      buffer++;
+  // The main thread has no encoders of its own, but nothing else
+  // uses ours for stateless encoding
+  processQueueEntry(entry, encoders, &offsetPixelBuffer,
+                    &convertedPixelBuffer);
+
+  return true;
+}
+
+// Throws away everything in the queue, waiting for any entries that
+// worker threads are currently busy with. Must be called with the
+// queue mutex held.
+void EncodeManager::discardQueue()
+{
+  while (true) {
+    std::list<QueueEntry*>::iterator iter;
+
+    iter = workQueue.begin();
+    while (iter != workQueue.end()) {
+      if (((*iter)->state == QueueEntry::Analysing) ||
+          ((*iter)->state == QueueEntry::Encoding)) {
+        ++iter;
+        continue;
+      }
+
+      freeBuffers.push_back((*iter)->bufferStream);
+      delete *iter;
+      iter = workQueue.erase(iter);
     }
-    buffer += pad;
+
+    if (workQueue.empty())
+      break;
+
+    producerCond->wait();
+  }
+}
+
+// Checks if an analysed entry can be encoded right away. Must be
+// called with the queue mutex held.
+bool EncodeManager::isEntryReady(const QueueEntry* entry)
+{
+  std::list<QueueEntry*>::const_iterator iter;
+  int klass;
+
+  klass = activeEncoders[entry->type];
+
+  // Stateless encoders can handle rects in any order
+  if (!(encoders[klass]->flags & EncoderOrdered))
+    return true;
+
+  // Otherwise this must be the first rect in the queue for that
+  // encoder, which means that all earlier rects must have been
+  // analysed so we know which encoder they will use
+  for (iter = workQueue.begin(); *iter != entry; ++iter) {
+    if (((*iter)->state == QueueEntry::Pending) ||
+        ((*iter)->state == QueueEntry::Analysing))
+      return false;
+    if (((*iter)->state != QueueEntry::Done) &&
+        (activeEncoders[(*iter)->type] == klass))
+      return false;
   }
 
   return true;
 }
 
+// Checks if every queued rect has been encoded. Must be called with
+// the queue mutex held.
+bool EncodeManager::isQueueDone()
+{
+  std::list<QueueEntry*>::const_iterator iter;
+
+  for (iter = workQueue.begin(); iter != workQueue.end(); ++iter) {
+    if ((*iter)->state != QueueEntry::Done)
+      return false;
+  }
+
+  return true;
+}
+
+// Invokes the ready callback once for each background update, as
+// soon as it is fully encoded. Must be called with the queue mutex
+// held.
+void EncodeManager::checkUpdateReady()
+{
+  if (!notifyPending)
+    return;
+  if (!isQueueDone())
+    return;
+
+  notifyPending = false;
+
+  if (readyCallback != NULL)
+    readyCallback->updateReady();
+}
+
+void EncodeManager::setThreadException(const rdr::Exception& e)
+{
+  os::AutoMutex a(queueMutex);
+
+  if (threadException != NULL)
+    return;
+
+  threadException = new rdr::Exception("Exception on worker thread: %s", e.str());
+}
+
+void EncodeManager::throwThreadException()
+{
+  os::AutoMutex a(queueMutex);
+
+  if (threadException == NULL)
+    return;
+
+  rdr::Exception e(*threadException);
+
+  delete threadException;
+  threadException = NULL;
+
+  throw e;
+}
+
+EncodeManager::EncodeThread::EncodeThread(EncodeManager* manager)
+{
+  this->manager = manager;
+
+  stopRequested = false;
+
+  // Stateless encoders get a private instance per thread, whilst
+  // ordered ones are shared with the manager
+  encoders.resize(encoderClassMax, NULL);
+  for (int klass = 0; klass < encoderClassMax; klass++) {
+    if (manager->encoders[klass]->flags & EncoderOrdered)
+      continue;
+    encoders[klass] = createEncoder(klass, manager->conn);
+  }
+
+  start();
+}
+
+EncodeManager::EncodeThread::~EncodeThread()
+{
+  std::vector<Encoder*>::iterator iter;
+
+  stop();
+  wait();
+
+  for (iter = encoders.begin();iter != encoders.end();iter++)
+    delete *iter;
+}
+
+void EncodeManager::EncodeThread::stop()
+{
+  os::AutoMutex a(manager->queueMutex);
+
+  if (!isRunning())
+    return;
+
+  stopRequested = true;
+
+  // We can't wake just this thread, so wake everyone
+  manager->consumerCond->broadcast();
+}
+
+Encoder* EncodeManager::EncodeThread::getEncoder(int klass)
+{
+  return encoders[klass];
+}
+
+void EncodeManager::EncodeThread::worker()
+{
+  manager->queueMutex->lock();
+
+  while (!stopRequested) {
+    EncodeManager::QueueEntry *entry;
+
+    // Look for an available entry in the work queue
+    entry = manager->findQueueEntry();
+    if (entry == NULL) {
+      // Wait and try again
+      manager->consumerCond->wait();
+      continue;
+    }
+
+    manager->processQueueEntry(entry, encoders, &offsetPixelBuffer,
+                               &convertedPixelBuffer);
+  }
+
+  manager->queueMutex->unlock();
+}
+
+// Finds an entry that needs analysing or encoding, and claims it.
+// Must be called with the queue mutex held.
+EncodeManager::QueueEntry* EncodeManager::findQueueEntry()
+{
+  std::list<QueueEntry*>::iterator iter;
+
+  for (iter = workQueue.begin(); iter != workQueue.end(); ++iter) {
+    QueueEntry* entry;
+
+    entry = *iter;
+
+    if (entry->state == QueueEntry::Pending) {
+      entry->state = QueueEntry::Analysing;
+      return entry;
+    }
+
+    if ((entry->state == QueueEntry::Analysed) && isEntryReady(entry)) {
+      entry->state = QueueEntry::Encoding;
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+// Analyses and/or encodes an entry claimed by findQueueEntry(). Must
+// be called with the queue mutex held, but releases it whilst
+// working. Stateless encoders are taken from the given list, if
+// present there.
+void EncodeManager::processQueueEntry(QueueEntry* entry,
+                                      const std::vector<Encoder*>& encoders_,
+                                      OffsetPixelBuffer* offsetBuffer,
+                                      ManagedPixelBuffer* convertedBuffer)
+{
+  PixelBuffer *ppb;
+  bool encode;
+
+  // An entry still in need of analysis might be deferred, in which
+  // case it is no longer ours once it goes back on the queue
+  encode = entry->state == QueueEntry::Encoding;
+
+  queueMutex->unlock();
+
+  ppb = NULL;
+
+  try {
+    if (!encode) {
+      ppb = preparePixelBuffer(entry->rect, entry->pb, true,
+                               offsetBuffer, convertedBuffer);
+      entry->type = analyseSubRect(entry->rect, ppb, &entry->info);
+
+      // Try to continue with the encoding right away, so we can
+      // reuse the prepared pixel buffer
+      queueMutex->lock();
+      encode = isEntryReady(entry);
+      if (encode)
+        entry->state = QueueEntry::Encoding;
+      else
+        entry->state = QueueEntry::Analysed;
+      queueMutex->unlock();
+    }
+
+    if (encode)
+      encodeQueueEntry(entry, ppb, encoders_,
+                       offsetBuffer, convertedBuffer);
+  } catch (rdr::Exception& e) {
+    setThreadException(e);
+    encode = true;
+  } catch(...) {
+    assert(false);
+  }
+
+  queueMutex->lock();
+
+  if (encode) {
+    entry->state = QueueEntry::Done;
+    checkUpdateReady();
+  }
+
+  // Wake the main thread in case it is waiting for this rect
+  producerCond->signal();
+  // This rect might have been blocking multiple other rects, so
+  // wake up every worker thread
+  if (workQueue.size() > 1)
+    consumerCond->broadcast();
+}
+
+void EncodeManager::encodeQueueEntry(QueueEntry* entry, PixelBuffer* ppb,
+                                     const std::vector<Encoder*>& encoders_,
+                                     OffsetPixelBuffer* offsetBuffer,
+                                     ManagedPixelBuffer* convertedBuffer)
+{
+  Encoder *encoder;
+  int klass;
+
+  struct timeval start;
+
+  klass = activeEncoders[entry->type];
+
+  encoder = encoders_[klass];
+  if (encoder == NULL)
+    encoder = encoders[klass];
+
+  if ((ppb == NULL) || (encoder->flags & EncoderUseNativePF)) {
+    ppb = preparePixelBuffer(entry->rect, entry->pb,
+                             !(encoder->flags & EncoderUseNativePF),
+                             offsetBuffer, convertedBuffer);
+  }
+
+  entry->bufferStream->clear();
+
+  gettimeofday(&start, NULL);
+
+  encoder->setOutStream(entry->bufferStream);
+  try {
+    encoder->writeRect(ppb, entry->info.palette);
+  } catch (...) {
+    encoder->setOutStream(NULL);
+    throw;
+  }
+  encoder->setOutStream(NULL);
+
+  entry->encodeTime = usSince(&start);
+}
+
+void EncodeManager::OffsetPixelBuffer::update(const PixelFormat& pf,
+                                              int width, int height,
+                                              const uint8_t* data_,
+                                              int stride_)
+{
+  format = pf;
+  // Forced cast. We never write anything though, so it should be safe.
+  setBuffer(width, height, (uint8_t*)data_, stride_);
+}
+
+uint8_t* EncodeManager::OffsetPixelBuffer::getBufferRW(const Rect& /*r*/, int* /*stride*/)
+{
+  throw rfb::Exception("Invalid write attempt to OffsetPixelBuffer");
+}
+
 template<class T>
 inline bool EncodeManager::analyseRect(int width, int height,
                                        const T* buffer, int stride,
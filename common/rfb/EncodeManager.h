@@ -20,14 +20,30 @@
 #ifndef __RFB_ENCODEMANAGER_H__
 #define __RFB_ENCODEMANAGER_H__
 
+#include <list>
 #include <vector>
 
 #include <stdint.h>
 
+#include <os/Thread.h>
+
+#include <rdr/MemOutStream.h>
+
+#include <rfb/ChangeHeatMap.h>
+#include <rfb/EncodeCache.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/Region.h>
 #include <rfb/Timer.h>
 
+namespace os {
+  class Condition;
+  class Mutex;
+}
+
+namespace rdr {
+  struct Exception;
+}
+
 namespace rfb {
   class SConnection;
   class Encoder;
@@ -40,14 +56,46 @@ namespace rfb {
 
   class EncodeManager : public Timer::Callback {
   public:
+    // Told when a background update has been fully encoded. This is
+    // called from a worker thread, with internal locks held, so it
+    // must do nothing more than wake up the main thread.
+    class ReadyCallback {
+    public:
+      virtual ~ReadyCallback() {}
+      virtual void updateReady() = 0;
+    };
+
     EncodeManager(SConnection* conn);
     ~EncodeManager();
 
     void logStats();
 
+    // Running totals for everything sent so far, for live statistics
+    struct Totals {
+      unsigned updates;
+      unsigned long long rects;
+      unsigned long long pixels;
+      unsigned long long bytes;
+      unsigned long long equivalent;
+      unsigned long long time; // Microseconds spent in the encoders
+      // Lossless refreshes, and how long those areas stayed lossy
+      // (in pixel milliseconds, so divide by losslessPixels)
+      unsigned long long losslessPixels;
+      unsigned long long losslessDelay;
+      unsigned losslessMaxDelay;
+    };
+    void getTotals(Totals* totals) const;
+
     // Hack to let ConnParams calculate the client's preferred encoding
     static bool supported(int encoding);
 
+    // Share encoded data with other clients using the given cache
+    void setEncodeCache(EncodeCache* cache);
+
+    // Current estimate of the bandwidth to the client (in bytes per
+    // second), used when adaptively selecting encoders
+    void setBandwidth(size_t bandwidth);
+
     bool needsLosslessRefresh(const Region& req);
     int getNextLosslessRefresh(const Region& req);
 
@@ -56,9 +104,24 @@ namespace rfb {
     void writeUpdate(const UpdateInfo& ui, const PixelBuffer* pb,
                      const RenderedCursor* renderedCursor);
 
+    // Sends as much of the pending lossless refresh as can be sent in
+    // maxUpdateSize bytes, and encoded in maxTime milliseconds
     void writeLosslessRefresh(const Region& req, const PixelBuffer* pb,
                               const RenderedCursor* renderedCursor,
-                              size_t maxUpdateSize);
+                              size_t maxUpdateSize, int maxTime);
+
+    // With AsyncEncoding, writeUpdate() and writeLosslessRefresh()
+    // return as soon as the update has been handed to the worker
+    // threads, and nothing is sent until finishUpdate() is called.
+    // isUpdateReady() tells if that can be done without waiting, and
+    // any callback given to setReadyCallback() is invoked once it
+    // becomes true. The client's pixel format and encodings must not
+    // change whilst an update is pending.
+    bool isUpdatePending() const { return updatePending; }
+    bool isUpdateReady();
+    void finishUpdate();
+
+    void setReadyCallback(ReadyCallback* cb) { readyCallback = cb; }
 
   protected:
     virtual bool handleTimeout(Timer* t);
@@ -68,31 +131,67 @@ namespace rfb {
                   const PixelBuffer* pb,
                   const RenderedCursor* renderedCursor);
     void prepareEncoders(bool allowLossy);
+    void adaptEncoders(bool allowJPEG);
+    void updateCosts();
+
+    int getCompressLevel();
 
-    Region getLosslessRefresh(const Region& req, size_t maxUpdateSize);
+    Region getLosslessRefresh(const Region& req, size_t maxUpdateSize,
+                              int maxTime);
+    void noteRefreshed(const Rect& rect);
+    void pruneRefreshGenerations();
 
     int computeNumRects(const Region& changed);
 
-    Encoder *startRect(const Rect& rect, int type);
-    void endRect();
+    // Encodes with the given encoder class, rather than the one
+    // currently active for the type
+    Encoder *startRect(const Rect& rect, int type, int klass=-1);
+    void endRect(long long encodeTime=-1);
 
     void writeCopyRects(const Region& copied, const Point& delta);
+
+    bool videoSupported();
+    void updateVideoCandidates(const Region& changed);
+    void findVideoRects(const Region& changed, const Rect& limits,
+                        std::vector<Rect>* rects);
+    void writeVideoRects(const std::vector<Rect>& rects,
+                         const PixelBuffer* pb, const Rect& cursorRect);
     void writeSolidRects(Region *changed, const PixelBuffer* pb);
     void findSolidRect(const Rect& rect, Region *changed, const PixelBuffer* pb);
-    void writeRects(const Region& changed, const PixelBuffer* pb);
+    void buildSolidMap(const Rect& rect, const PixelBuffer* pb);
+    void writeSolidRect(const Rect& rect, const uint8_t* colourValue,
+                        const PixelBuffer* pb);
+    void encodeSolidRect(Encoder* encoder, const Rect& rect,
+                         const uint8_t* colourValue, const PixelBuffer* pb);
+    void writeRects(const Region& changed, const PixelBuffer* pb,
+                    const PixelBuffer* key=NULL);
+
+    void snapshotRegion(const Region& region, const PixelBuffer* pb);
+
+    void writeSubRect(const Rect& rect, const PixelBuffer *pb,
+                      const PixelBuffer *key);
+    bool writeCachedRect(const Rect& rect, const PixelBuffer *pb);
+    int analyseSubRect(const Rect& rect, const PixelBuffer *ppb,
+                       struct RectInfo *info);
 
-    void writeSubRect(const Rect& rect, const PixelBuffer *pb);
+    void configureEncoder(Encoder* encoder, bool allowLossy);
 
     bool checkSolidTile(const Rect& r, const uint8_t* colourValue,
                         const PixelBuffer *pb);
+    bool checkSolidPixels(const Rect& r, const uint8_t* colourValue,
+                          const PixelBuffer *pb);
     void extendSolidAreaByBlock(const Rect& r, const uint8_t* colourValue,
                                 const PixelBuffer *pb, Rect* er);
     void extendSolidAreaByPixel(const Rect& r, const Rect& sr,
                                 const uint8_t* colourValue,
                                 const PixelBuffer *pb, Rect* er);
 
+    class OffsetPixelBuffer;
+
     PixelBuffer* preparePixelBuffer(const Rect& rect,
-                                    const PixelBuffer *pb, bool convert);
+                                    const PixelBuffer *pb, bool convert,
+                                    OffsetPixelBuffer* offsetBuffer,
+                                    ManagedPixelBuffer* convertedBuffer);
 
     bool analyseRect(const PixelBuffer *pb,
                      struct RectInfo *info, int maxColours);
@@ -100,9 +199,6 @@ namespace rfb {
   protected:
     // Templated, optimised methods
     template<class T>
-    inline bool checkSolidTile(const Rect& r, const T,
-                               const PixelBuffer *pb);
-    template<class T>
     inline bool analyseRect(int width, int height,
                             const T* buffer, int stride,
                             struct RectInfo *info, int maxColours);
@@ -119,20 +215,79 @@ namespace rfb {
 
     Timer recentChangeTimer;
 
+    ChangeHeatMap heatMap;
+    unsigned long long solidSearchSkipped;
+
+    // Areas of pendingRefreshRegion, oldest first, along with when
+    // they stopped changing
+    struct RefreshGeneration {
+      Region region;
+      struct timeval since;
+    };
+    std::list<RefreshGeneration> refreshGenerations;
+
+    // Areas that have recently been changing as a whole, and that
+    // might be showing video
+    struct VideoCandidate {
+      Rect rect;
+      bool video;
+
+      // The current measurement window
+      Rect windowRect;
+      struct timeval windowStart;
+      unsigned windowFrames, windowUpdates;
+
+      struct timeval lastChange;
+      bool changed;
+    };
+    std::list<VideoCandidate> videoCandidates;
+
     struct EncoderStats {
       unsigned rects;
       unsigned long long bytes;
       unsigned long long pixels;
       unsigned long long equivalent;
+      unsigned long long time;
     };
     typedef std::vector< std::vector<struct EncoderStats> > StatsVector;
 
+    // Measured cost of each encoder for each type of rect, per pixel
+    struct EncoderCost {
+      double time;
+      double bytes;
+      unsigned samples;
+
+      // Collected during the current update
+      unsigned long long pendingPixels;
+      unsigned long long pendingBytes;
+      unsigned long long pendingTime;
+    };
+    typedef std::vector< std::vector<struct EncoderCost> > CostVector;
+
     unsigned updates;
     EncoderStats copyStats;
     StatsVector stats;
     int activeType;
+    int activeClass;
+    Rect activeRect;
     int beforeLength;
 
+    CostVector costs;
+    size_t bandwidth;
+    int compressLevel;
+    unsigned long long windowTime, windowBytes;
+
+    // Measured performance of lossless refreshes, collected for the
+    // current update and then folded in to the running estimates
+    bool refreshUpdate;
+    unsigned long long refreshPixels, refreshBytes;
+    unsigned long long refreshEquivalent, refreshTime;
+    double refreshRate; // Pixels per microsecond and encoder thread
+    double refreshRatio;
+
+    unsigned long long losslessPixels, losslessDelay;
+    unsigned losslessMaxDelay;
+
     class OffsetPixelBuffer : public FullFramePixelBuffer {
     public:
       OffsetPixelBuffer() {}
@@ -147,6 +302,108 @@ namespace rfb {
 
     OffsetPixelBuffer offsetPixelBuffer;
     ManagedPixelBuffer convertedPixelBuffer;
+
+    // Which of the SolidSearchBlock sized blocks of the rect currently
+    // being searched are of a single colour
+    struct SolidBlock {
+      uint32_t colour;
+      bool solid;
+    };
+
+    Rect solidMapRect;
+    int solidMapWidth;
+    std::vector<SolidBlock> solidMap;
+
+    // Background encoding of whole updates
+    bool async;
+    bool updatePending;
+    int pendingRects;
+    Region pendingCopied;
+    Point pendingCopyDelta;
+    std::vector<Rect> pendingVideo;
+    Rect pendingCursorRect;
+    ManagedPixelBuffer snapshot;
+
+    ReadyCallback* readyCallback;
+    bool notifyPending;
+
+    EncodeCache* cache;
+    EncodeCache::Settings cacheSettings;
+    rdr::MemOutStream cacheStream;
+    unsigned long long cacheHits, cacheMisses;
+
+  protected:
+    // Threaded encoding of sub-rects
+    struct QueueEntry;
+
+    void queueSubRect(const Rect& rect, const PixelBuffer *pb,
+                      const PixelBuffer *key);
+    void flushSubRects();
+
+    bool writeQueuedRect();
+    void discardQueue();
+
+    bool isEntryReady(const QueueEntry* entry);
+    bool isQueueDone();
+    void checkUpdateReady();
+
+    // Used by both the worker threads, and the main thread whilst it
+    // waits for them
+    QueueEntry* findQueueEntry();
+    void processQueueEntry(QueueEntry* entry,
+                           const std::vector<Encoder*>& encoders,
+                           OffsetPixelBuffer* offsetBuffer,
+                           ManagedPixelBuffer* convertedBuffer);
+    void encodeQueueEntry(QueueEntry* entry, PixelBuffer* ppb,
+                          const std::vector<Encoder*>& encoders,
+                          OffsetPixelBuffer* offsetBuffer,
+                          ManagedPixelBuffer* convertedBuffer);
+    bool helpQueue();
+
+    void setThreadException(const rdr::Exception& e);
+    void throwThreadException();
+
+    std::list<rdr::MemOutStream*> freeBuffers;
+    std::list<QueueEntry*> workQueue;
+
+    os::Mutex* queueMutex;
+    os::Condition* producerCond;
+    os::Condition* consumerCond;
+
+    class EncodeThread : public os::Thread {
+    public:
+      EncodeThread(EncodeManager* manager);
+      ~EncodeThread();
+
+      void stop();
+
+      Encoder* getEncoder(int klass);
+
+    protected:
+      void worker();
+
+    private:
+      EncodeManager* manager;
+
+      bool stopRequested;
+
+      std::vector<Encoder*> encoders;
+
+      OffsetPixelBuffer offsetPixelBuffer;
+      ManagedPixelBuffer convertedPixelBuffer;
+    };
+
+    std::list<EncodeThread*> threads;
+    rdr::Exception *threadException;
+
+    // The encoder threads are shared out between all clients, with
+    // changes taking effect at the start of the next update
+    static int getCPUCount();
+    static void rebalanceThreads();
+    void adjustThreads();
+
+    static std::list<EncodeManager*> managers;
+    int wantedThreads, threadLimit;
   };
 }
 
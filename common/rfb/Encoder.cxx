@@ -24,6 +24,7 @@
 #include <rfb/Encoder.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/Palette.h>
+#include <rfb/SConnection.h>
 
 using namespace rfb;
 
@@ -32,7 +33,7 @@ Encoder::Encoder(SConnection *conn_, int encoding_,
                  unsigned int maxPaletteSize_, int losslessQuality_) :
   encoding(encoding_), flags(flags_),
   maxPaletteSize(maxPaletteSize_), losslessQuality(losslessQuality_),
-  conn(conn_)
+  conn(conn_), outStream(NULL)
 {
 }
 
@@ -40,6 +41,11 @@ Encoder::~Encoder()
 {
 }
 
+void Encoder::setOutStream(rdr::OutStream* os)
+{
+  outStream = os;
+}
+
 void Encoder::writeSolidRect(int width, int height,
                              const PixelFormat& pf, const uint8_t* colour)
 {
@@ -85,3 +91,11 @@ void Encoder::writeSolidRect(const PixelBuffer* pb, const Palette& palette)
 
   writeSolidRect(pb->width(), pb->height(), pb->getPF(), buffer);
 }
+
+rdr::OutStream* Encoder::getOutStream()
+{
+  if (outStream != NULL)
+    return outStream;
+
+  return conn->getOutStream();
+}
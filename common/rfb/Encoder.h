@@ -24,6 +24,8 @@
 
 #include <rfb/Rect.h>
 
+namespace rdr { class OutStream; }
+
 namespace rfb {
   class SConnection;
   class PixelBuffer;
@@ -38,6 +40,9 @@ namespace rfb {
     EncoderUseNativePF = 1 << 0,
     // Encoder does not encode pixels perfectly accurate
     EncoderLossy = 1 << 1,
+    // Encoder keeps state between rects (e.g. zlib streams), so rects
+    // must be encoded in order and using the same instance
+    EncoderOrdered = 1 << 2,
   };
 
   class Encoder {
@@ -86,11 +91,19 @@ namespace rfb {
                                 const PixelFormat& pf,
                                 const uint8_t* colour)=0;
 
+    // setOutStream() makes the encoder write its data to the given
+    // stream instead of directly to the connection. Passing NULL
+    // restores the default behaviour.
+    void setOutStream(rdr::OutStream* os);
+
   protected:
     // Helper method for redirecting a single colour palette to the
     // short cut method.
     void writeSolidRect(const PixelBuffer* pb, const Palette& palette);
 
+    // The stream encoded data should be written to
+    rdr::OutStream* getOutStream();
+
   public:
     const int encoding;
     const enum EncoderFlags flags;
@@ -104,6 +117,9 @@ namespace rfb {
 
   protected:
     SConnection* conn;
+
+  private:
+    rdr::OutStream* outStream;
   };
 }
 
@@ -0,0 +1,230 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+
+#include <rdr/OutStream.h>
+#include <rfb/Exception.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/SConnection.h>
+#include <rfb/encodings.h>
+#include <rfb/util.h>
+#include <rfb/H264Encoder.h>
+#include <rfb/H264EncoderContext.h>
+
+using namespace rfb;
+
+static LogWriter vlog("H264Encoder");
+
+// Must match the decoder
+enum rectFlags {
+  resetContext       = 0x1,
+  resetAllContexts   = 0x2,
+};
+
+// How many streams we keep going at once
+static const size_t MaxContexts = 16;
+
+// How many streams the client keeps, it forgets the oldest one once
+// it has to create more than this
+static const unsigned ClientMaxContexts = 64;
+
+// How long an unused stream is kept around (ms)
+static const unsigned ContextTimeout = 10000;
+
+H264Encoder::H264Encoder(SConnection* conn) :
+  Encoder(conn, encodingH264,
+          (EncoderFlags)(EncoderUseNativePF | EncoderLossy | EncoderOrdered)),
+  qualityLevel(-1), contextSerial(0), framePending(false),
+  frameIsNew(false)
+{
+}
+
+H264Encoder::~H264Encoder()
+{
+  resetContexts();
+}
+
+bool H264Encoder::isSupported()
+{
+  if (!conn->client.supportsEncoding(encodingH264))
+    return false;
+
+  return H264EncoderContext::isAvailable();
+}
+
+void H264Encoder::setQualityLevel(int level)
+{
+  // Existing streams are recreated as they are used
+  qualityLevel = level;
+}
+
+int H264Encoder::getQualityLevel()
+{
+  return qualityLevel;
+}
+
+void H264Encoder::setRect(const Rect& r)
+{
+  rect = r;
+}
+
+void H264Encoder::pruneContexts()
+{
+  struct timeval now;
+
+  getMonotonicTime(&now);
+
+  while (!contexts.empty()) {
+    if (msBetween(&contexts.back().lastUsed, &now) < ContextTimeout)
+      break;
+
+    delete contexts.back().ctx;
+    contexts.pop_back();
+  }
+}
+
+bool H264Encoder::encodeFrame(const PixelBuffer* pb)
+{
+  H264EncoderContext* ctx;
+  bool isNew;
+
+  assert(pb->width() == rect.width());
+  assert(pb->height() == rect.height());
+
+  framePending = false;
+
+  ctx = getContext(rect, &isNew);
+  if (ctx == NULL)
+    return false;
+
+  bitstream.clear();
+  if (!ctx->encode(pb, &bitstream)) {
+    // The client hasn't seen whatever state the encoder is in now,
+    // so start over with a keyframe
+    dropContext(ctx);
+    return false;
+  }
+
+  framePending = true;
+  frameIsNew = isNew;
+
+  return true;
+}
+
+void H264Encoder::writeRect(const PixelBuffer* pb,
+                            const Palette& /*palette*/)
+{
+  rdr::OutStream* os;
+
+  if (!framePending) {
+    if (!encodeFrame(pb))
+      throw Exception("H264Encoder: Frame could not be encoded");
+  }
+
+  framePending = false;
+
+  os = getOutStream();
+
+  os->writeU32(bitstream.length());
+  // A new stream starts with a keyframe, but the client might still
+  // have an old stream for the same rect
+  os->writeU32(frameIsNew ? resetContext : 0);
+  os->writeBytes(bitstream.data(), bitstream.length());
+}
+
+void H264Encoder::writeSolidRect(int width, int height,
+                                 const PixelFormat& pf,
+                                 const uint8_t* colour)
+{
+  // Has to go through the stream like everything else
+  Encoder::writeSolidRect(width, height, pf, colour);
+}
+
+H264EncoderContext* H264Encoder::getContext(const Rect& r, bool* isNew)
+{
+  std::list<Context>::iterator iter;
+  Context entry;
+
+  *isNew = false;
+
+  for (iter = contexts.begin(); iter != contexts.end(); ++iter) {
+    if (!iter->ctx->isEqualRect(r))
+      continue;
+
+    // The client will have thrown its end away, or the quality has
+    // changed, so start over
+    if ((contextSerial - iter->serial >= ClientMaxContexts) ||
+        (iter->ctx->getQualityLevel() != qualityLevel)) {
+      delete iter->ctx;
+      contexts.erase(iter);
+      break;
+    }
+
+    getMonotonicTime(&iter->lastUsed);
+    contexts.splice(contexts.begin(), contexts, iter);
+
+    return contexts.front().ctx;
+  }
+
+  if (contexts.size() >= MaxContexts) {
+    delete contexts.back().ctx;
+    contexts.pop_back();
+  }
+
+  entry.ctx = H264EncoderContext::createContext(r, qualityLevel);
+  if (entry.ctx == NULL)
+    return NULL;
+
+  getMonotonicTime(&entry.lastUsed);
+  entry.serial = contextSerial++;
+
+  contexts.push_front(entry);
+
+  *isNew = true;
+
+  return entry.ctx;
+}
+
+void H264Encoder::dropContext(H264EncoderContext* ctx)
+{
+  std::list<Context>::iterator iter;
+
+  for (iter = contexts.begin(); iter != contexts.end(); ++iter) {
+    if (iter->ctx != ctx)
+      continue;
+
+    delete iter->ctx;
+    contexts.erase(iter);
+    return;
+  }
+}
+
+void H264Encoder::resetContexts()
+{
+  std::list<Context>::iterator iter;
+
+  for (iter = contexts.begin(); iter != contexts.end(); ++iter)
+    delete iter->ctx;
+  contexts.clear();
+}
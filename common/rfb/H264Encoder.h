@@ -0,0 +1,88 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+#ifndef __RFB_H264ENCODER_H__
+#define __RFB_H264ENCODER_H__
+
+#include <sys/time.h>
+
+#include <list>
+
+#include <rdr/MemOutStream.h>
+#include <rfb/Encoder.h>
+
+namespace rfb {
+  class H264EncoderContext;
+
+  // The client keeps one decoder per rect on screen, so each stream
+  // is tied to a specific rect. Call setRect() before writeRect() to
+  // say which one the pixels belong to.
+  //
+  // The encoder might not produce anything for a frame, so callers
+  // that can send the rect some other way should first call
+  // encodeFrame(), and only start the rect if that succeeds.
+  class H264Encoder : public Encoder {
+  public:
+    H264Encoder(SConnection* conn);
+    virtual ~H264Encoder();
+
+    virtual bool isSupported();
+
+    virtual void setQualityLevel(int level);
+    virtual int getQualityLevel();
+
+    void setRect(const Rect& r);
+
+    // Encodes the frame for the next writeRect(). Returns false if
+    // there is nothing to send, in which case the stream for the rect
+    // starts over next time.
+    bool encodeFrame(const PixelBuffer* pb);
+
+    // Drops streams that haven't been used in a while
+    void pruneContexts();
+
+    virtual void writeRect(const PixelBuffer* pb, const Palette& palette);
+    virtual void writeSolidRect(int width, int height,
+                                const PixelFormat& pf,
+                                const uint8_t* colour);
+
+  protected:
+    struct Context {
+      H264EncoderContext* ctx;
+      struct timeval lastUsed;
+      unsigned serial;
+    };
+
+    H264EncoderContext* getContext(const Rect& r, bool* isNew);
+    void dropContext(H264EncoderContext* ctx);
+    void resetContexts();
+
+  protected:
+    Rect rect;
+    int qualityLevel;
+
+    // Most recently used first
+    std::list<Context> contexts;
+    unsigned contextSerial;
+
+    // The length goes first, so the frame has to be buffered
+    rdr::MemOutStream bitstream;
+    bool framePending;
+    bool frameIsNew;
+  };
+}
+#endif
@@ -0,0 +1,280 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+extern "C" {
+#include <libavutil/opt.h>
+}
+
+#include <rdr/OutStream.h>
+#include <rfb/LogWriter.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/H264EncoderContext.h>
+
+using namespace rfb;
+
+static LogWriter vlog("H264EncoderContext");
+
+// The software encoders we know how to configure, best first.
+// Hardware encoders are deliberately left out, as their latency and
+// availability vary too much.
+static const char* codecNames[] = { "libx264", "libopenh264", NULL };
+
+// The stream is sent over a reliable connection, so keyframes are
+// only needed to bound the cost of a client joining late
+static const int KeyFrameInterval = 300;
+
+// Nominal frame rate, only used for rate control
+static const int NominalFrameRate = 30;
+
+// x264 constant rate factor for each quality level
+static const char* crfLevels[10] = {
+  "40", "36", "33", "30", "28", "26", "24", "22", "20", "18"
+};
+
+H264EncoderContext *H264EncoderContext::createContext(const Rect &r,
+                                                      int qualityLevel)
+{
+  H264EncoderContext *ret = new H264EncoderContext(r, qualityLevel);
+  if (!ret->initCodec()) {
+    delete ret;
+    return NULL;
+  }
+
+  return ret;
+}
+
+bool H264EncoderContext::isAvailable()
+{
+  static int available = -1;
+
+  if (available == -1)
+    available = (findCodec() != NULL);
+
+  return available;
+}
+
+const AVCodec* H264EncoderContext::findCodec()
+{
+  for (int i = 0; codecNames[i] != NULL; i++) {
+    const AVCodec *codec;
+
+    codec = avcodec_find_encoder_by_name(codecNames[i]);
+    if (codec != NULL)
+      return codec;
+  }
+
+  return NULL;
+}
+
+H264EncoderContext::H264EncoderContext(const Rect &r, int qualityLevel_)
+  : rect(r), qualityLevel(qualityLevel_), initialized(false),
+    avctx(NULL), frame(NULL), packet(NULL), sws(NULL), rgbBuffer(NULL),
+    frameCount(0)
+{
+}
+
+H264EncoderContext::~H264EncoderContext()
+{
+  freeCodec();
+}
+
+bool H264EncoderContext::initCodec()
+{
+  const AVCodec *codec;
+
+  // 4:2:0 needs even dimensions
+  assert((rect.width() % 2) == 0);
+  assert((rect.height() % 2) == 0);
+
+  codec = findCodec();
+  if (!codec) {
+    vlog.error("No H.264 encoder found");
+    return false;
+  }
+
+  avctx = avcodec_alloc_context3(codec);
+  if (!avctx) {
+    vlog.error("Could not allocate video codec context");
+    return false;
+  }
+
+  avctx->width = rect.width();
+  avctx->height = rect.height();
+  avctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  avctx->time_base.num = 1;
+  avctx->time_base.den = NominalFrameRate;
+  avctx->framerate.num = NominalFrameRate;
+  avctx->framerate.den = 1;
+  avctx->gop_size = KeyFrameInterval;
+  // Every frame must come out as soon as it goes in
+  avctx->max_b_frames = 0;
+  avctx->thread_type = FF_THREAD_SLICE;
+
+  if (strcmp(codec->name, "libx264") == 0) {
+    av_opt_set(avctx->priv_data, "preset", "ultrafast", 0);
+    av_opt_set(avctx->priv_data, "tune", "zerolatency", 0);
+    if ((qualityLevel >= 0) && (qualityLevel <= 9))
+      av_opt_set(avctx->priv_data, "crf", crfLevels[qualityLevel], 0);
+  } else {
+    int level;
+
+    // Rough equivalent of the above for encoders without a
+    // constant quality mode
+    level = qualityLevel;
+    if ((level < 0) || (level > 9))
+      level = 5;
+    avctx->bit_rate = (int64_t)rect.area() * NominalFrameRate *
+                      (level + 1) / 50;
+
+    // Every frame has to come out, whatever that does to the rate
+    if (strcmp(codec->name, "libopenh264") == 0)
+      av_opt_set_int(avctx->priv_data, "allow_skip_frames", 0, 0);
+  }
+
+  if (avcodec_open2(avctx, codec, NULL) < 0) {
+    vlog.error("Could not open codec %s", codec->name);
+    freeCodec();
+    return false;
+  }
+
+  frame = av_frame_alloc();
+  packet = av_packet_alloc();
+  if (!frame || !packet) {
+    vlog.error("Could not allocate video frame");
+    freeCodec();
+    return false;
+  }
+
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = rect.width();
+  frame->height = rect.height();
+  if (av_frame_get_buffer(frame, 0) < 0) {
+    vlog.error("Could not allocate video frame data");
+    freeCodec();
+    return false;
+  }
+
+  rgbBuffer = new uint8_t[rect.area() * 3];
+
+  vlog.debug("Created %s context for %dx%d at %d,%d", codec->name,
+             rect.width(), rect.height(), rect.tl.x, rect.tl.y);
+
+  initialized = true;
+  return true;
+}
+
+void H264EncoderContext::freeCodec()
+{
+  if (avctx)
+    avcodec_free_context(&avctx);
+  if (frame)
+    av_frame_free(&frame);
+  if (packet)
+    av_packet_free(&packet);
+  if (sws)
+    sws_freeContext(sws);
+  sws = NULL;
+  delete [] rgbBuffer;
+  rgbBuffer = NULL;
+
+  initialized = false;
+}
+
+bool H264EncoderContext::encode(const PixelBuffer* pb, rdr::OutStream* os)
+{
+  const uint8_t* buffer;
+  int stride;
+
+  const uint8_t* srcData[1];
+  int srcStride[1];
+
+  bool gotPacket;
+  int ret;
+
+  if (!initialized)
+    return false;
+
+  assert(pb->width() == rect.width());
+  assert(pb->height() == rect.height());
+
+  // swscale knows nothing about our pixel formats, so go via plain
+  // RGB first
+  buffer = pb->getBuffer(pb->getRect(), &stride);
+  pb->getPF().rgbFromBuffer(rgbBuffer, buffer,
+                            rect.width(), stride, rect.height());
+
+  sws = sws_getCachedContext(sws, rect.width(), rect.height(),
+                             AV_PIX_FMT_RGB24,
+                             rect.width(), rect.height(),
+                             AV_PIX_FMT_YUV420P,
+                             SWS_POINT, NULL, NULL, NULL);
+  if (!sws) {
+    vlog.error("Could not create colour conversion context");
+    return false;
+  }
+
+  if (av_frame_make_writable(frame) < 0) {
+    vlog.error("Could not make video frame writable");
+    return false;
+  }
+
+  srcData[0] = rgbBuffer;
+  srcStride[0] = rect.width() * 3;
+  sws_scale(sws, srcData, srcStride, 0, rect.height(),
+            frame->data, frame->linesize);
+
+  frame->pts = frameCount++;
+
+  ret = avcodec_send_frame(avctx, frame);
+  if (ret < 0) {
+    vlog.error("Error sending a frame for encoding");
+    return false;
+  }
+
+  gotPacket = false;
+  while (true) {
+    ret = avcodec_receive_packet(avctx, packet);
+    if ((ret == AVERROR(EAGAIN)) || (ret == AVERROR_EOF))
+      break;
+    if (ret < 0) {
+      vlog.error("Error during encoding");
+      return false;
+    }
+
+    os->writeBytes(packet->data, packet->size);
+    av_packet_unref(packet);
+
+    gotPacket = true;
+  }
+
+  // The client has to be able to show every frame right away, so an
+  // encoder that holds frames back is of no use to us
+  if (!gotPacket) {
+    vlog.debug("Encoder did not produce a frame");
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,79 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifndef __RFB_H264ENCODERCONTEXT_H__
+#define __RFB_H264ENCODERCONTEXT_H__
+
+#include <stdint.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <rfb/Rect.h>
+
+namespace rdr { class OutStream; }
+
+namespace rfb {
+  class PixelBuffer;
+
+  // One H.264 stream, for a single rect on screen. Uses libavcodec
+  // with one of the software encoders (libx264 or libopenh264).
+  class H264EncoderContext {
+    public:
+      // Returns NULL if no encoder could be set up
+      static H264EncoderContext *createContext(const Rect &r,
+                                               int qualityLevel);
+
+      // Is there any software H.264 encoder available at all?
+      static bool isAvailable();
+
+      ~H264EncoderContext();
+
+      // Encodes pb as the next frame of the stream, and writes the
+      // resulting H.264 bitstream (Annex B) to os. Returns false if
+      // nothing came out, e.g. if the encoder skipped the frame.
+      bool encode(const PixelBuffer* pb, rdr::OutStream* os);
+
+      inline bool isEqualRect(const Rect &r) const { return r == rect; }
+      inline int getQualityLevel() const { return qualityLevel; }
+
+    protected:
+      H264EncoderContext(const Rect &r, int qualityLevel);
+
+      bool initCodec();
+      void freeCodec();
+
+      static const AVCodec* findCodec();
+
+    private:
+      rfb::Rect rect;
+      int qualityLevel;
+      bool initialized;
+
+      AVCodecContext *avctx;
+      AVFrame* frame;
+      AVPacket* packet;
+      SwsContext* sws;
+      uint8_t* rgbBuffer;
+      int64_t frameCount;
+  };
+}
+
+#endif
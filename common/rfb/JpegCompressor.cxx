@@ -27,6 +27,7 @@
 #include <rfb/Rect.h>
 #include <rfb/PixelFormat.h>
 #include <rfb/ClientParams.h>
+#include <rfb/util.h>
 
 #include <stdio.h>
 extern "C" {
@@ -45,6 +46,10 @@ static const PixelFormat pfBGRX(32, 24, false, true, 255, 255, 255, 16, 8, 0);
 static const PixelFormat pfXRGB(32, 24, false, true, 255, 255, 255, 8, 16, 24);
 static const PixelFormat pfXBGR(32, 24, false, true, 255, 255, 255, 24, 16, 8);
 
+// How many rows are converted to RGB at a time for other formats. This
+// is as many as libjpeg needs for a full row of MCUs.
+static const int BandHeight = 16;
+
 //
 // Error manager implementation for the JPEG library
 //
@@ -115,7 +120,9 @@ JpegTermDestination(j_compress_ptr cinfo)
   jc->setptr(dest->chunkSize - dest->pub.free_in_buffer);
 }
 
-JpegCompressor::JpegCompressor(int bufferLen) : MemOutStream(bufferLen)
+JpegCompressor::JpegCompressor(int bufferLen)
+  : MemOutStream(bufferLen), scratch(NULL), scratchSize(0),
+    rowPointers(NULL), rowPointerCount(0)
 {
   cinfo = new jpeg_compress_struct;
 
@@ -153,6 +160,9 @@ JpegCompressor::~JpegCompressor(void)
   delete dest;
 
   delete cinfo;
+
+  delete [] scratch;
+  delete [] rowPointers;
 }
 
 void JpegCompressor::compress(const uint8_t *buf, volatile int stride,
@@ -162,15 +172,11 @@ void JpegCompressor::compress(const uint8_t *buf, volatile int stride,
   int w = r.width();
   int h = r.height();
   int pixelsize;
-  uint8_t * volatile srcBuf = NULL;
-  volatile bool srcBufIsTemp = false;
-  JSAMPROW * volatile rowPointer = NULL;
+  bool convert;
 
   if(setjmp(err->jmpBuffer)) {
     // this will execute if libjpeg has an error
     jpeg_abort_compress(cinfo);
-    if (srcBufIsTemp && srcBuf) delete[] srcBuf;
-    if (rowPointer) delete[] rowPointer;
     throw rdr::Exception("%s", err->lastError);
   }
 
@@ -191,21 +197,21 @@ void JpegCompressor::compress(const uint8_t *buf, volatile int stride,
   else if (pfXBGR == pf)
     cinfo->in_color_space = JCS_EXT_XBGR;
 
-  if (cinfo->in_color_space != JCS_RGB) {
-    srcBuf = (uint8_t *)buf;
+  if (cinfo->in_color_space != JCS_RGB)
     pixelsize = 4;
-  }
 #endif
 
   if (stride == 0)
     stride = w;
 
-  if (cinfo->in_color_space == JCS_RGB) {
-    srcBuf = new uint8_t[w * h * pixelsize];
-    srcBufIsTemp = true;
-    pf.rgbFromBuffer(srcBuf, (const uint8_t *)buf, w, stride, h);
-    stride = w;
-  }
+  // Anything else is converted a band at a time, just ahead of
+  // libjpeg, so that the copy stays in the cache
+  convert = cinfo->in_color_space == JCS_RGB;
+
+  if (convert)
+    allocateScratch(w * BandHeight * pixelsize, BandHeight);
+  else
+    allocateScratch(0, h);
 
   cinfo->input_components = pixelsize;
 
@@ -239,19 +245,52 @@ void JpegCompressor::compress(const uint8_t *buf, volatile int stride,
     cinfo->comp_info[0].v_samp_factor = 1;
   }
 
-  rowPointer = new JSAMPROW[h];
-  for (int dy = 0; dy < h; dy++)
-    rowPointer[dy] = (JSAMPROW)(&srcBuf[dy * stride * pixelsize]);
+  if (convert) {
+    for (int dy = 0; dy < BandHeight; dy++)
+      rowPointers[dy] = &scratch[dy * w * pixelsize];
+  } else {
+    for (int dy = 0; dy < h; dy++)
+      rowPointers[dy] = (uint8_t*)&buf[dy * stride * pixelsize];
+  }
 
   jpeg_start_compress(cinfo, TRUE);
-  while (cinfo->next_scanline < cinfo->image_height)
-    jpeg_write_scanlines(cinfo, &rowPointer[cinfo->next_scanline],
-      cinfo->image_height - cinfo->next_scanline);
+
+  while (cinfo->next_scanline < cinfo->image_height) {
+    int y, rows;
+    JSAMPARRAY rowp;
+
+    y = cinfo->next_scanline;
+
+    if (convert) {
+      // Whatever libjpeg didn't take last time is converted again
+      rows = __rfbmin(h - y, BandHeight);
+      pf.rgbFromBuffer(scratch, &buf[y * stride * (pf.bpp/8)],
+                       w, stride, rows);
+      rowp = (JSAMPARRAY)rowPointers;
+    } else {
+      rows = h - y;
+      rowp = (JSAMPARRAY)&rowPointers[y];
+    }
+
+    jpeg_write_scanlines(cinfo, rowp, rows);
+  }
 
   jpeg_finish_compress(cinfo);
+}
 
-  if (srcBufIsTemp) delete[] srcBuf;
-  delete[] rowPointer;
+void JpegCompressor::allocateScratch(size_t size, int rows)
+{
+  if (size > scratchSize) {
+    delete [] scratch;
+    scratch = new uint8_t[size];
+    scratchSize = size;
+  }
+
+  if (rows > rowPointerCount) {
+    delete [] rowPointers;
+    rowPointers = new uint8_t*[rows];
+    rowPointerCount = rows;
+  }
 }
 
 void JpegCompressor::writeBytes(const void* /*data*/, int /*length*/)
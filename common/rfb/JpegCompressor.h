@@ -47,6 +47,10 @@ namespace rfb {
 
     void writeBytes(const void*, int);
 
+  private:
+
+    void allocateScratch(size_t size, int rows);
+
   private:
 
     struct jpeg_compress_struct *cinfo;
@@ -54,6 +58,12 @@ namespace rfb {
     struct JPEG_ERROR_MGR *err;
     struct JPEG_DEST_MGR *dest;
 
+    // Reused between calls, only ever grows
+    uint8_t *scratch;
+    size_t scratchSize;
+    uint8_t **rowPointers;
+    int rowPointerCount;
+
   };
 
 } // end of namespace rfb
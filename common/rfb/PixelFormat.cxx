@@ -30,6 +30,7 @@
 #include <rdr/OutStream.h>
 #include <rfb/Exception.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/pixelConvert.h>
 
 #ifdef _WIN32
 #define strcasecmp _stricmp
@@ -393,6 +394,9 @@ void PixelFormat::bufferFromBuffer(uint8_t* dst, const PixelFormat &srcPF,
       dst += dstStride * bpp/8;
       src += srcStride * srcPF.bpp/8;
     }
+  } else if (vectorBufferFromBuffer(dst, srcPF, src, w, h,
+                                    dstStride, srcStride)) {
+    // Done
   } else if (is888() && srcPF.is888()) {
     // Optimised common case A: byte shuffling (e.g. endian conversion)
     uint8_t *d[4], *s[4];
@@ -498,6 +502,123 @@ void PixelFormat::bufferFromBuffer(uint8_t* dst, const PixelFormat &srcPF,
   }
 }
 
+bool PixelFormat::vectorBufferFromBuffer(uint8_t* dst,
+                                         const PixelFormat &srcPF,
+                                         const uint8_t* src, int w, int h,
+                                         int dstStride, int srcStride) const
+{
+  PixelConvertParams params;
+  const int* shifts[3];
+  const int* maxes[3];
+  int c;
+
+  if (pixelConvertImpl == NULL)
+    return false;
+
+  // Byte order of 32 bit pixels is dealt with by looking at each byte
+  // separately, and the vector code assumes the host is little endian
+  // for the others
+
+  if (is888() && srcPF.is888()) {
+    uint8_t order[4];
+    int dstPad, srcPad;
+
+    if (pixelConvertImpl->shuffle == NULL)
+      return false;
+
+    order[byteOffset(redShift)] = srcPF.byteOffset(srcPF.redShift);
+    order[byteOffset(greenShift)] = srcPF.byteOffset(srcPF.greenShift);
+    order[byteOffset(blueShift)] = srcPF.byteOffset(srcPF.blueShift);
+
+    dstPad = 6 - byteOffset(redShift) - byteOffset(greenShift) -
+             byteOffset(blueShift);
+    srcPad = 6 - srcPF.byteOffset(srcPF.redShift) -
+             srcPF.byteOffset(srcPF.greenShift) -
+             srcPF.byteOffset(srcPF.blueShift);
+    order[dstPad] = srcPad;
+
+    pixelConvertImpl->shuffle(dst, src, w, h, dstStride, srcStride, order);
+    return true;
+  }
+
+  params.srcBpp = srcPF.bpp;
+  params.dstBpp = bpp;
+
+  shifts[0] = &srcPF.redShift;
+  shifts[1] = &srcPF.greenShift;
+  shifts[2] = &srcPF.blueShift;
+  maxes[0] = &srcPF.redMax;
+  maxes[1] = &srcPF.greenMax;
+  maxes[2] = &srcPF.blueMax;
+  if (srcPF.is888()) {
+    params.srcSwap = false;
+    for (c = 0; c < 3; c++) {
+      params.srcShift[c] = srcPF.byteOffset(*shifts[c]) * 8;
+      params.srcMax[c] = 255;
+    }
+  } else {
+    params.srcSwap = srcPF.endianMismatch;
+    for (c = 0; c < 3; c++) {
+      params.srcShift[c] = *shifts[c];
+      params.srcMax[c] = *maxes[c];
+    }
+  }
+
+  shifts[0] = &redShift;
+  shifts[1] = &greenShift;
+  shifts[2] = &blueShift;
+  maxes[0] = &redMax;
+  maxes[1] = &greenMax;
+  maxes[2] = &blueMax;
+  if (is888()) {
+    params.dstSwap = false;
+    for (c = 0; c < 3; c++) {
+      params.dstShift[c] = byteOffset(*shifts[c]) * 8;
+      params.dstMax[c] = 255;
+    }
+  } else {
+    params.dstSwap = endianMismatch;
+    for (c = 0; c < 3; c++) {
+      params.dstShift[c] = *shifts[c];
+      params.dstMax[c] = *maxes[c];
+    }
+  }
+
+  if (srcPF.is888() && ((bpp == 8) || (bpp == 16))) {
+    if (pixelConvertImpl->from888 == NULL)
+      return false;
+    pixelConvertImpl->from888(dst, src, w, h, dstStride, srcStride, params);
+    return true;
+  }
+
+  if (is888() && ((srcPF.bpp == 8) || (srcPF.bpp == 16))) {
+    if (pixelConvertImpl->to888 == NULL)
+      return false;
+    pixelConvertImpl->to888(dst, src, w, h, dstStride, srcStride, params);
+    return true;
+  }
+
+  // Channels of the same depth are just moved around, as converting
+  // them up to 8 bits and back again gives the original value
+  if ((bpp == srcPF.bpp) && ((bpp == 8) || (bpp == 16)) &&
+      (redMax == srcPF.redMax) && (greenMax == srcPF.greenMax) &&
+      (blueMax == srcPF.blueMax)) {
+    if (pixelConvertImpl->repack == NULL)
+      return false;
+    pixelConvertImpl->repack(dst, src, w, h, dstStride, srcStride, params);
+    return true;
+  }
+
+  return false;
+}
+
+int PixelFormat::byteOffset(int shift) const
+{
+  if (bigEndian)
+    return (24 - shift)/8;
+  return shift/8;
+}
+
 
 void PixelFormat::print(char* str, int len) const
 {
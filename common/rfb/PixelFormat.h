@@ -94,6 +94,14 @@ namespace rfb {
     bool isSane(void);
 
   private:
+    // Vectorised versions of the optimised methods below, returns
+    // false if there is none for this conversion
+    bool vectorBufferFromBuffer(uint8_t* dst, const PixelFormat &srcPF,
+                                const uint8_t* src, int w, int h,
+                                int dstStride, int srcStride) const;
+    // Where the channel at the given shift is in a 32 bit pixel
+    int byteOffset(int shift) const;
+
     // Templated, optimised methods
     template<class T>
     void directBufferFromBufferFrom888(T* dst, const PixelFormat &srcPF,
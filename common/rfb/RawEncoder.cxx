@@ -55,7 +55,7 @@ void RawEncoder::writeRect(const PixelBuffer* pb,
 
   buffer = pb->getBuffer(pb->getRect(), &stride);
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   h = pb->height();
   line_bytes = pb->width() * pb->getPF().bpp/8;
@@ -73,7 +73,7 @@ void RawEncoder::writeSolidRect(int width, int height,
   rdr::OutStream* os;
   int pixels, pixel_size;
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   pixels = width*height;
   pixel_size = pf.bpp/8;
@@ -48,12 +48,65 @@ rfb::IntParameter rfb::Server::maxIdleTime
 rfb::IntParameter rfb::Server::compareFB
 ("CompareFB",
  "Perform pixel comparison on framebuffer to reduce unnecessary updates "
- "(0: never, 1: always, 2: auto)",
+ "(0: never, 1: always, 2: auto, 3: always using hashes, 4: auto using "
+ "hashes)",
  2);
+rfb::IntParameter rfb::Server::compareThreads
+("CompareThreads",
+ "Number of extra threads used for the pixel comparison "
+ "(-1: one per CPU core)",
+ 0, -1);
+rfb::BoolParameter rfb::Server::detectScroll
+("DetectScroll",
+ "Look for scrolled or moved content during the pixel comparison and "
+ "send it as a copy",
+ false);
+rfb::IntParameter rfb::Server::zlibThreads
+("ZlibThreads",
+ "Number of extra threads used to compress large amounts of zlib "
+ "data, shared by all clients and encodings (-1: one per CPU core)",
+ 0, -1);
+rfb::IntParameter rfb::Server::encodeThreads
+("EncodeThreads",
+ "Number of worker threads used to encode framebuffer updates for each "
+ "client, with no more than the number of CPU cores shared out between all "
+ "clients (0: encode on the main thread, -1: one per CPU core)",
+ 0, -1);
+rfb::IntParameter rfb::Server::encodeCacheSize
+("EncodeCacheSize",
+ "Maximum amount of memory (in KiB) used to share encoded data between "
+ "clients (0 disables sharing)",
+ 32768, 0);
+rfb::BoolParameter rfb::Server::adaptiveEncoding
+("AdaptiveEncoding",
+ "Select encoders and compression level based on the measured cost of "
+ "encoding and sending each type of rectangle",
+ false);
+rfb::BoolParameter rfb::Server::asyncEncoding
+("AsyncEncoding",
+ "Encode framebuffer updates in the background on the encoder threads, so "
+ "the main loop can carry on whilst an update is being prepared. Areas sent "
+ "as H.264 video are still encoded on the main loop",
+ false);
+rfb::BoolParameter rfb::Server::h264Video
+("H264Video",
+ "Use H.264 for areas of the screen that change like video, if the client "
+ "supports it",
+ false);
 rfb::IntParameter rfb::Server::frameRate
 ("FrameRate",
  "The maximum number of updates per second sent to each client",
  60);
+rfb::BoolParameter rfb::Server::adaptiveFrameRate
+("AdaptiveFrameRate",
+ "Lower the update rate when no client can keep up with it, or when "
+ "the application keeps redrawing unchanged content",
+ false);
+rfb::IntParameter rfb::Server::telemetryInterval
+("TelemetryInterval",
+ "Log latency and throughput statistics for each client every s seconds "
+ "(zero means never)",
+ 0, 0);
 rfb::BoolParameter rfb::Server::protocol3_3
 ("Protocol3.3",
  "Always use protocol version 3.3 for backwards compatibility with "
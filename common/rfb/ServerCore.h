@@ -36,7 +36,17 @@ namespace rfb {
     static IntParameter maxConnectionTime;
     static IntParameter maxIdleTime;
     static IntParameter compareFB;
+    static IntParameter compareThreads;
+    static BoolParameter detectScroll;
+    static IntParameter zlibThreads;
+    static IntParameter encodeThreads;
+    static IntParameter encodeCacheSize;
+    static BoolParameter adaptiveEncoding;
+    static BoolParameter asyncEncoding;
+    static BoolParameter h264Video;
     static IntParameter frameRate;
+    static BoolParameter adaptiveFrameRate;
+    static IntParameter telemetryInterval;
     static BoolParameter protocol3_3;
     static BoolParameter alwaysShared;
     static BoolParameter neverShared;
@@ -31,6 +31,7 @@
 #include <rfb/SConnection.h>
 #include <rfb/TightEncoder.h>
 #include <rfb/TightConstants.h>
+#include <rfb/ServerCore.h>
 
 using namespace rfb;
 
@@ -61,8 +62,11 @@ static const TightConf conf[10] = {
 };
 
 TightEncoder::TightEncoder(SConnection* conn) :
-  Encoder(conn, encodingTight, EncoderPlain, 256)
+  Encoder(conn, encodingTight, EncoderOrdered, 256)
 {
+  for (int i = 0; i < 4; i++)
+    zlibStreams[i].setThreadCount(rfb::Server::zlibThreads);
+
   setCompressLevel(-1);
 }
 
@@ -108,7 +112,7 @@ void TightEncoder::writeSolidRect(int /*width*/, int /*height*/,
 {
   rdr::OutStream* os;
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU8(tightFill << 4);
   writePixels(colour, pf, 1, os);
@@ -169,7 +173,7 @@ void TightEncoder::writeFullColourRect(const PixelBuffer* pb)
   const uint8_t* buffer;
   int stride, h;
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU8(streamId << 4);
 
@@ -242,7 +246,7 @@ rdr::OutStream* TightEncoder::getZlibOutStream(int streamId, int level, size_t l
   // Minimum amount of data to be compressed. This value should not be
   // changed, doing so will break compatibility with existing clients.
   if (length < 12)
-    return conn->getOutStream();
+    return getOutStream();
 
   assert(streamId >= 0);
   assert(streamId < 4);
@@ -267,7 +271,7 @@ void TightEncoder::flushZlibOutStream(rdr::OutStream* os_)
   zos->flush();
   zos->setUnderlying(NULL);
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   writeCompact(os, memStream.length());
   os->writeBytes(memStream.data(), memStream.length());
@@ -290,7 +294,7 @@ void TightEncoder::writeMonoRect(int width, int height,
 
   assert(palette.size() == 2);
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU8((streamId | tightExplicitFilter) << 4);
   os->writeU8(tightFilterPalette);
@@ -377,7 +381,7 @@ void TightEncoder::writeIndexedRect(int width, int height,
   assert(palette.size() > 0);
   assert(palette.size() <= 256);
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU8((streamId | tightExplicitFilter) << 4);
   os->writeU8(tightFilterPalette);
@@ -142,7 +142,7 @@ void TightJPEGEncoder::writeRect(const PixelBuffer* pb,
   jc.compress(buffer, stride, pb->getRect(),
               pb->getPF(), quality, subsampling);
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU8(tightJpeg << 4);
 
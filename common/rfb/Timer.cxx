@@ -55,32 +55,36 @@ inline static int diffTimeMillis(timeval later, timeval earlier) {
   return ((later.tv_sec - earlier.tv_sec) * 1000) + ((later.tv_usec - earlier.tv_usec) / 1000);
 }
 
-std::list<Timer*> Timer::pending;
+std::vector<Timer*> Timer::heap;
+unsigned long long Timer::nextSequence = 0;
 
 int Timer::checkTimeouts() {
   timeval start;
 
-  if (pending.empty())
+  if (heap.empty())
     return 0;
 
-  gettimeofday(&start, 0);
-  while (pending.front()->isBefore(start)) {
+  getMonotonicTime(&start);
+  while (!heap.empty() && heap.front()->isBefore(start)) {
     Timer* timer;
     timeval before;
 
-    timer = pending.front();
-    pending.pop_front();
+    timer = heap.front();
+    removeTimer(timer);
 
-    gettimeofday(&before, 0);
+    getMonotonicTime(&before);
     if (timer->cb->handleTimeout(timer)) {
       timeval now;
 
-      gettimeofday(&now, 0);
+      // The handler might have restarted the timer itself
+      if (timer->isStarted())
+        continue;
+
+      getMonotonicTime(&now);
 
       timer->dueTime = addMillis(timer->dueTime, timer->timeoutMs);
       if (timer->isBefore(now)) {
-        // Time has jumped forwards, or we're not getting enough
-        // CPU time for the timers
+        // We're not getting enough CPU time for the timers
 
         timer->dueTime = addMillis(before, timer->timeoutMs);
         if (timer->isBefore(now))
@@ -88,44 +92,97 @@ int Timer::checkTimeouts() {
       }
 
       insertTimer(timer);
-    } else if (pending.empty()) {
-      return 0;
     }
   }
+
+  if (heap.empty())
+    return 0;
+
   return getNextTimeout();
 }
 
 int Timer::getNextTimeout() {
-  timeval now;
-  gettimeofday(&now, 0);
-  int toWait = __rfbmax(1, pending.front()->getRemainingMs());
-  if (toWait > pending.front()->timeoutMs) {
-    if (toWait - pending.front()->timeoutMs < 1000) {
-      vlog.info("gettimeofday is broken...");
-      return toWait;
-    }
-    // Time has jumped backwards!
-    vlog.info("time has moved backwards!");
-    pending.front()->dueTime = now;
-    toWait = 1;
-  }
-  return toWait;
+  if (heap.empty())
+    return 0;
+  return __rfbmax(1, heap.front()->getRemainingMs());
 }
 
 void Timer::insertTimer(Timer* t) {
-  std::list<Timer*>::iterator i;
-  for (i=pending.begin(); i!=pending.end(); i++) {
-    if (t->isBefore((*i)->dueTime)) {
-      pending.insert(i, t);
-      return;
-    }
+  t->sequence = nextSequence++;
+  t->heapIndex = heap.size();
+  heap.push_back(t);
+  siftUp(t->heapIndex);
+}
+
+void Timer::removeTimer(Timer* t) {
+  int index;
+  Timer* last;
+
+  index = t->heapIndex;
+  t->heapIndex = -1;
+
+  last = heap.back();
+  heap.pop_back();
+  if (last == t)
+    return;
+
+  // Fill the hole with the last entry, which can then need to move
+  // in either direction
+  heap[index] = last;
+  last->heapIndex = index;
+  siftUp(index);
+  siftDown(last->heapIndex);
+}
+
+void Timer::siftUp(int index) {
+  Timer* t;
+
+  t = heap[index];
+  while (index > 0) {
+    int parent;
+
+    parent = (index - 1) / 2;
+    if (!t->isBefore(heap[parent]))
+      break;
+
+    heap[index] = heap[parent];
+    heap[index]->heapIndex = index;
+    index = parent;
   }
-  pending.push_back(t);
+
+  heap[index] = t;
+  t->heapIndex = index;
+}
+
+void Timer::siftDown(int index) {
+  Timer* t;
+  int size;
+
+  t = heap[index];
+  size = heap.size();
+  while (true) {
+    int child;
+
+    child = index * 2 + 1;
+    if (child >= size)
+      break;
+    if ((child + 1 < size) && heap[child + 1]->isBefore(heap[child]))
+      child++;
+    if (!heap[child]->isBefore(t))
+      break;
+
+    heap[index] = heap[child];
+    heap[index]->heapIndex = index;
+    index = child;
+  }
+
+  heap[index] = t;
+  t->heapIndex = index;
 }
 
 void Timer::start(int timeoutMs_) {
   timeval now;
-  gettimeofday(&now, 0);
+  getMonotonicTime(&now);
   stop();
   timeoutMs = timeoutMs_;
   // The rest of the code assumes non-zero timeout
@@ -136,16 +193,12 @@ void Timer::start(int timeoutMs_) {
 }
 
 void Timer::stop() {
-  pending.remove(this);
+  if (heapIndex != -1)
+    removeTimer(this);
 }
 
 bool Timer::isStarted() {
-  std::list<Timer*>::iterator i;
-  for (i=pending.begin(); i!=pending.end(); i++) {
-    if (*i == this)
-      return true;
-  }
-  return false;
+  return heapIndex != -1;
 }
 
 int Timer::getTimeoutMs() {
@@ -154,7 +207,7 @@ int Timer::getTimeoutMs() {
 
 int Timer::getRemainingMs() {
   timeval now;
-  gettimeofday(&now, 0);
+  getMonotonicTime(&now);
   return __rfbmax(0, diffTimeMillis(dueTime, now));
 }
 
@@ -163,3 +216,11 @@ bool Timer::isBefore(timeval other) {
     ((dueTime.tv_sec == other.tv_sec) &&
      (dueTime.tv_usec < other.tv_usec));
 }
+
+bool Timer::isBefore(const Timer* other) const {
+  if (dueTime.tv_sec != other->dueTime.tv_sec)
+    return dueTime.tv_sec < other->dueTime.tv_sec;
+  if (dueTime.tv_usec != other->dueTime.tv_usec)
+    return dueTime.tv_usec < other->dueTime.tv_usec;
+  return sequence < other->sequence;
+}
@@ -20,7 +20,7 @@
 #ifndef __RFB_TIMER_H__
 #define __RFB_TIMER_H__
 
-#include <list>
+#include <vector>
 #include <sys/time.h>
 
 namespace rfb {
@@ -37,6 +37,9 @@ namespace rfb {
 
      For classes that can be derived it's best to use MethodTimer which can call a specific
      method on the class, thus avoiding conflicts when subclassing.
+
+     All times are measured using a monotonic clock, so timers are not affected by
+     changes to the system time.
   */
 
   struct Timer {
@@ -59,11 +62,11 @@ namespace rfb {
 
     // getNextTimeout()
     //   Returns the number of milliseconds until the next timeout, without dispatching
-    //   any elapsed Timers.
+    //   any elapsed Timers. Returns 0 if there are no active Timers.
     static int getNextTimeout();
 
     // Create a Timer with the specified callback handler
-    Timer(Callback* cb_) {cb = cb_;}
+    Timer(Callback* cb_) : timeoutMs(0), cb(cb_), heapIndex(-1), sequence(0) {}
     ~Timer() {stop();}
 
     // startTimer
@@ -98,9 +101,21 @@ namespace rfb {
     int timeoutMs;
     Callback* cb;
 
+    // Position in the heap, or -1 if the Timer isn't active
+    int heapIndex;
+    // Keeps Timers with the same due time in the order they were started
+    unsigned long long sequence;
+
+    bool isBefore(const Timer* other) const;
+
     static void insertTimer(Timer* t);
-    // The list of currently active Timers, ordered by time left until timeout.
-    static std::list<Timer*> pending;
+    static void removeTimer(Timer* t);
+    static void siftUp(int index);
+    static void siftDown(int index);
+
+    // The currently active Timers, as a binary min-heap ordered by due time
+    static std::vector<Timer*> heap;
+    static unsigned long long nextSequence;
   };
 
   template<class T> class MethodTimer
@@ -55,7 +55,11 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
     inProcessMessages(false),
     pendingSyncFence(false), syncFence(false), fenceFlags(0),
     fenceDataLen(0), fenceData(NULL), congestionTimer(this),
-    losslessTimer(this), server(server_),
+    losslessTimer(this), encodeTimer(this), lastEncodeTime(0),
+    pendingFrame(false), framesSkipped(0),
+    pingsSent(0), pongsReceived(0), frameAckPing(0),
+    frameUnacked(false), frameDelayed(false), frameAckInterval(0),
+    server(server_),
     updateRenderedCursor(false), removeRenderedCursor(false),
     continuousUpdates(false), encodeManager(this), idleTimer(this),
     pointerEventTime(0), clientHasCursor(false)
@@ -63,6 +67,11 @@ VNCSConnectionST::VNCSConnectionST(VNCServerST* server_, network::Socket *s,
   setStreams(&sock->inStream(), &sock->outStream());
   peerEndpoint = sock->getPeerEndpoint();
 
+  gettimeofday(&lastFrameAck, NULL);
+
+  encodeManager.setEncodeCache(server->getEncodeCache());
+  encodeManager.setReadyCallback(this);
+
   // Kick off the idle timer
   if (rfb::Server::idleTimeout) {
     // minimum of 15 seconds while authenticating
@@ -210,6 +219,10 @@ void VNCSConnectionST::pixelBufferChange()
 {
   try {
     if (!authenticated()) return;
+
+    // Anything already being encoded refers to the old framebuffer
+    writePendingUpdate();
+
     if (client.width() && client.height() &&
         (server->getPixelBuffer()->width() != client.width() ||
          server->getPixelBuffer()->height() != client.height()))
@@ -463,8 +476,17 @@ void VNCSConnectionST::clientInit(bool shared)
   server->clientReady(this, shared);
 }
 
+void VNCSConnectionST::setEncodings(int nEncodings, const int32_t* encodings)
+{
+  // The encoders must not see their settings change in the middle of
+  // an update
+  writePendingUpdate();
+  SConnection::setEncodings(nEncodings, encodings);
+}
+
 void VNCSConnectionST::setPixelFormat(const PixelFormat& pf)
 {
+  writePendingUpdate();
   SConnection::setPixelFormat(pf);
   char buffer[256];
   pf.print(buffer, 256);
@@ -692,9 +714,13 @@ void VNCSConnectionST::fence(uint32_t flags, unsigned len, const char data[])
       return;
     }
 
-    // We handle everything synchronously so we trivially honor these modes
+    // We handle everything synchronously so we trivially honor these
+    // modes, once any update still being encoded has been sent
     flags = flags & (fenceFlagBlockBefore | fenceFlagBlockAfter);
 
+    if (flags & fenceFlagBlockBefore)
+      writePendingUpdate();
+
     writer()->writeFence(flags, len, data);
     return;
   }
@@ -710,6 +736,9 @@ void VNCSConnectionST::fence(uint32_t flags, unsigned len, const char data[])
     break;
   case 1:
     congestion.gotPong();
+    pongsReceived++;
+    if (frameUnacked && ((int)(pongsReceived - frameAckPing) >= 0))
+      frameAcked();
     break;
   default:
     vlog.error("Fence response of unexpected type received");
@@ -797,7 +826,8 @@ bool VNCSConnectionST::handleTimeout(Timer* t)
 {
   try {
     if ((t == &congestionTimer) ||
-        (t == &losslessTimer))
+        (t == &losslessTimer) ||
+        (t == &encodeTimer))
       writeFramebufferUpdate();
   } catch (rdr::Exception& e) {
     close(e.str());
@@ -809,6 +839,12 @@ bool VNCSConnectionST::handleTimeout(Timer* t)
   return false;
 }
 
+void VNCSConnectionST::updateReady()
+{
+  // The main loop will call writeFramebufferUpdate() for us
+  server->wakeup();
+}
+
 bool VNCSConnectionST::isShiftPressed()
 {
     std::map<uint32_t, uint32_t>::const_iterator iter;
@@ -840,6 +876,37 @@ void VNCSConnectionST::writeRTTPing()
                        sizeof(type), &type);
 
   congestion.sentPing();
+  pingsSent++;
+}
+
+// Called once the client has responded to the ping following an
+// update, i.e. once it has fully processed that update
+void VNCSConnectionST::frameAcked()
+{
+  unsigned interval;
+
+  interval = msSince(&lastFrameAck);
+  gettimeofday(&lastFrameAck, NULL);
+
+  // The time between acknowledgements only says something about the
+  // client if it had frames waiting for it. Otherwise we let the
+  // estimate decay towards zero.
+  if (frameDelayed) {
+    if (frameAckInterval == 0)
+      frameAckInterval = interval;
+    else
+      frameAckInterval = (frameAckInterval * 7 + interval) / 8;
+  } else {
+    frameAckInterval = frameAckInterval * 7 / 8;
+  }
+
+  frameUnacked = false;
+  frameDelayed = false;
+}
+
+int VNCSConnectionST::getFrameInterval()
+{
+  return frameAckInterval;
 }
 
 bool VNCSConnectionST::isCongested()
@@ -868,6 +935,43 @@ bool VNCSConnectionST::isCongested()
   return true;
 }
 
+std::string VNCSConnectionST::getTelemetry()
+{
+  EncodeManager::Totals totals;
+  double encodeMs, ratio, losslessMs;
+  char buffer[512];
+
+  encodeManager.getTotals(&totals);
+
+  encodeMs = 0;
+  if (totals.updates != 0)
+    encodeMs = (double)totals.time / totals.updates / 1000.0;
+
+  ratio = 0;
+  if (totals.bytes != 0)
+    ratio = (double)totals.equivalent / totals.bytes;
+
+  losslessMs = 0;
+  if (totals.losslessPixels != 0)
+    losslessMs = (double)totals.losslessDelay / totals.losslessPixels;
+
+  congestion.updatePosition(sock->outStream().length());
+
+  snprintf(buffer, sizeof(buffer),
+           "client=%s rtt=%d base_rtt=%d bandwidth=%lu cwnd=%u "
+           "in_flight=%u frames=%u skipped=%u encode_ms=%.3f "
+           "rects=%llu pixels=%llu bytes=%llu ratio=%.2f "
+           "lossless_pixels=%llu lossless_ms=%.1f lossless_max_ms=%u",
+           peerEndpoint.c_str(), congestion.getRTT(),
+           congestion.getBaseRTT(),
+           (unsigned long)congestion.getBandwidth(),
+           congestion.getCongestionWindow(), congestion.getInFlight(),
+           totals.updates, framesSkipped, encodeMs,
+           totals.rects, totals.pixels, totals.bytes, ratio,
+           totals.losslessPixels, losslessMs, totals.losslessMaxDelay);
+
+  return buffer;
+}
 
 void VNCSConnectionST::writeFramebufferUpdate()
 {
@@ -887,13 +991,33 @@ void VNCSConnectionST::writeFramebufferUpdate()
 
   if (state() != RFBSTATE_NORMAL)
     return;
+
+  // Nothing else can be sent until the encoder threads are done with
+  // the previous update
+  if (encodeManager.isUpdatePending()) {
+    if (!encodeManager.isUpdateReady()) {
+      waitForPendingUpdate();
+      return;
+    }
+
+    getOutStream()->cork(true);
+    writePendingUpdate();
+    getOutStream()->cork(false);
+  }
+
   if (requested.is_empty() && !continuousUpdates)
     return;
 
   // Check that we actually have some space on the link and retry in a
   // bit if things are congested.
-  if (isCongested())
+  if (isCongested()) {
+    if (pendingFrame) {
+      framesSkipped++;
+      pendingFrame = false;
+      frameDelayed = true;
+    }
     return;
+  }
 
   // Updates often consists of many small writes, and in continuous
   // mode, we will also have small fence messages around the update. We
@@ -913,6 +1037,43 @@ void VNCSConnectionST::writeFramebufferUpdate()
   congestion.updatePosition(sock->outStream().length());
 }
 
+// Sends the update that the encoder threads are working on, waiting
+// for them if necessary
+void VNCSConnectionST::writePendingUpdate()
+{
+  if (!encodeManager.isUpdatePending())
+    return;
+
+  encodeTimer.stop();
+
+  lastEncodeTime = msSince(&encodeStart);
+
+  encodeManager.finishUpdate();
+
+  writeRTTPing();
+}
+
+// Normally the encode manager tells us when the update is ready, but
+// if the server cannot wake up the main loop then we have to check
+// periodically. The update will most likely take about as long as
+// the previous one did.
+void VNCSConnectionST::waitForPendingUpdate()
+{
+  unsigned interval;
+
+  if (server->getWakeupFd() != -1)
+    return;
+
+  if (encodeTimer.isStarted())
+    return;
+
+  interval = lastEncodeTime / 2;
+  if (interval < 1)
+    interval = 1;
+
+  encodeTimer.start(interval);
+}
+
 void VNCSConnectionST::writeNoDataUpdate()
 {
   if (!writer()->needNoDataUpdate())
@@ -1023,11 +1184,25 @@ void VNCSConnectionST::writeDataUpdate()
 
   // We have something to send, so let's get to it
 
+  pendingFrame = false;
+
   writeRTTPing();
 
+  // The ping after this update tells us when the client is done
+  // with it
+  if (!frameUnacked) {
+    frameUnacked = true;
+    frameAckPing = pingsSent + 1;
+  }
+
+  encodeManager.setBandwidth(congestion.getBandwidth());
+  gettimeofday(&encodeStart, NULL);
   encodeManager.writeUpdate(ui, server->getPixelBuffer(), cursor);
 
-  writeRTTPing();
+  if (encodeManager.isUpdatePending())
+    waitForPendingUpdate();
+  else
+    writeRTTPing();
 
   // The request might be for just part of the screen, so we cannot
   // just clear the entire update tracker.
@@ -1094,18 +1269,20 @@ void VNCSConnectionST::writeLosslessRefresh()
   // FIXME: Bandwidth estimation without congestion control
   bandwidth = congestion.getBandwidth();
 
-  // FIXME: Hard coded value for maximum CPU throughput
-  if (bandwidth > 5000000)
-    bandwidth = 5000000;
-
+  // The encode manager also limits this by how fast it has been
+  // able to encode lossless refreshes so far
   maxUpdateSize = bandwidth * nextUpdate / 1000;
 
   writeRTTPing();
 
+  gettimeofday(&encodeStart, NULL);
   encodeManager.writeLosslessRefresh(req, server->getPixelBuffer(),
-                                     cursor, maxUpdateSize);
+                                     cursor, maxUpdateSize, nextUpdate);
 
-  writeRTTPing();
+  if (encodeManager.isUpdatePending())
+    waitForPendingUpdate();
+  else
+    writeRTTPing();
 
   requested.clear();
 }
@@ -38,7 +38,8 @@ namespace rfb {
   class VNCServerST;
 
   class VNCSConnectionST : private SConnection,
-                           public Timer::Callback {
+                           public Timer::Callback,
+                           public EncodeManager::ReadyCallback {
   public:
     VNCSConnectionST(VNCServerST* server_, network::Socket* s, bool reverse);
     virtual ~VNCSConnectionST();
@@ -107,13 +108,29 @@ namespace rfb {
 
     // Change tracking
 
-    void add_changed(const Region& region) { updates.add_changed(region); }
+    void add_changed(const Region& region) {
+      updates.add_changed(region);
+      if (!region.is_empty())
+        pendingFrame = true;
+    }
     void add_copied(const Region& dest, const Point& delta) {
       updates.add_copied(dest, delta);
+      if (!dest.is_empty())
+        pendingFrame = true;
     }
 
     const char* getPeerEndpoint() const {return peerEndpoint.c_str();}
 
+    // getTelemetry() returns a single line of key=value pairs describing
+    // the latency, throughput and encoding behaviour of the connection
+    // so far.
+    std::string getTelemetry();
+
+    // getFrameInterval() returns how often, in milliseconds, the client
+    // has recently been able to accept new frames. Returns 0 if it is
+    // keeping up with everything we send it, or if we cannot tell.
+    int getFrameInterval();
+
   private:
     // SConnection callbacks
 
@@ -122,6 +139,7 @@ namespace rfb {
     virtual void authSuccess();
     virtual void queryConnection(const char* userName);
     virtual void clientInit(bool shared);
+    virtual void setEncodings(int nEncodings, const int32_t* encodings);
     virtual void setPixelFormat(const PixelFormat& pf);
     virtual void pointerEvent(const Point& pos, int buttonMask);
     virtual void keyEvent(uint32_t keysym, uint32_t keycode, bool down);
@@ -142,6 +160,9 @@ namespace rfb {
     // Timer callbacks
     virtual bool handleTimeout(Timer* t);
 
+    // EncodeManager callback, called from a worker thread
+    virtual void updateReady();
+
     // Internal methods
 
     bool isShiftPressed();
@@ -149,11 +170,14 @@ namespace rfb {
     // Congestion control
     void writeRTTPing();
     bool isCongested();
+    void frameAcked();
 
     // writeFramebufferUpdate() attempts to write a framebuffer update to the
     // client.
 
     void writeFramebufferUpdate();
+    void writePendingUpdate();
+    void waitForPendingUpdate();
     void writeNoDataUpdate();
     void writeDataUpdate();
     void writeLosslessRefresh();
@@ -179,6 +203,24 @@ namespace rfb {
     Congestion congestion;
     Timer congestionTimer;
     Timer losslessTimer;
+    Timer encodeTimer;
+
+    // How long background encoding took last time, for when we have
+    // to poll for it
+    struct timeval encodeStart;
+    unsigned lastEncodeTime;
+
+    // Frames that were delayed as the client was congested
+    bool pendingFrame;
+    unsigned framesSkipped;
+
+    // How fast the client acknowledges frames, measured using the
+    // ping sent after each update
+    unsigned pingsSent, pongsReceived;
+    unsigned frameAckPing;
+    bool frameUnacked, frameDelayed;
+    struct timeval lastFrameAck;
+    unsigned frameAckInterval;
 
     VNCServerST* server;
     SimpleUpdateTracker updates;
@@ -23,6 +23,8 @@
 #ifndef __RFB_VNCSERVER_H__
 #define __RFB_VNCSERVER_H__
 
+#include <string>
+
 #include <network/Socket.h>
 
 #include <rfb/UpdateTracker.h>
@@ -108,6 +110,17 @@ namespace rfb {
     // setLEDState() tells the server what the current lock keys LED
     // state is
     virtual void setLEDState(unsigned int state) = 0;
+
+    // getTelemetry() returns the current latency and throughput
+    // statistics, with one line of key=value pairs per client
+    virtual std::string getTelemetry() = 0;
+
+    // getWakeupFd() returns a descriptor that becomes readable when
+    // the server needs the main loop to call processWakeup(), or -1
+    // if not supported. Unlike the client sockets, this must be
+    // watched even when there are no clients.
+    virtual int getWakeupFd() const = 0;
+    virtual void processWakeup() = 0;
   };
 }
 #endif
@@ -53,7 +53,15 @@
 #endif
 
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include <rfb/ComparingUpdateTracker.h>
 #include <rfb/Exception.h>
@@ -72,6 +80,10 @@ using namespace rfb;
 static LogWriter slog("VNCServerST");
 static LogWriter connectionsLog("Connections");
 
+// Limits for the adaptive frame rate
+static const unsigned MaxFrameBackoff = 3;
+static const int MaxFrameInterval = 1000;
+
 //
 // -=- VNCServerST Implementation
 //
@@ -82,14 +94,32 @@ VNCServerST::VNCServerST(const char* name_, SDesktop* desktop_)
   : blHosts(&blacklist), desktop(desktop_), desktopStarted(false),
     blockCounter(0), pb(0), ledState(ledUnknown),
     name(name_), pointerClient(0), clipboardClient(0),
-    comparer(0), cursor(new Cursor(0, 0, Point(), NULL)),
+    comparer(0), updates(0), encodeTime(0),
+    damageInterval(0), damageGap(true), fruitlessFrames(0),
+    cursor(new Cursor(0, 0, Point(), NULL)),
     renderedCursorInvalid(false),
     keyRemapper(&KeyRemapper::defInstance),
     idleTimer(this), disconnectTimer(this), connectTimer(this),
-    frameTimer(this)
+    frameTimer(this), telemetryTimer(this)
 {
   slog.debug("creating single-threaded server %s", name.c_str());
 
+  getMonotonicTime(&lastDamage);
+
+  wakeupPipe[0] = wakeupPipe[1] = -1;
+#ifndef WIN32
+  if (pipe(wakeupPipe) == 0) {
+    for (int i = 0; i < 2; i++) {
+      fcntl(wakeupPipe[i], F_SETFL,
+            fcntl(wakeupPipe[i], F_GETFL) | O_NONBLOCK);
+      fcntl(wakeupPipe[i], F_SETFD, FD_CLOEXEC);
+    }
+  } else {
+    slog.error("Unable to create wakeup pipe: %s", strerror(errno));
+    wakeupPipe[0] = wakeupPipe[1] = -1;
+  }
+#endif
+
   // FIXME: Do we really want to kick off these right away?
   if (rfb::Server::maxIdleTime)
     idleTimer.start(secsToMillis(rfb::Server::maxIdleTime));
@@ -118,11 +148,17 @@ VNCServerST::~VNCServerST()
   // Stop the desktop object if active, *only* after deleting all clients!
   stopDesktop();
 
-  if (comparer)
-    comparer->logStats();
+  logStats();
   delete comparer;
 
   delete cursor;
+
+#ifndef WIN32
+  if (wakeupPipe[0] != -1) {
+    close(wakeupPipe[0]);
+    close(wakeupPipe[1]);
+  }
+#endif
 }
 
 
@@ -189,8 +225,7 @@ void VNCServerST::removeSocket(network::Socket* sock) {
       if (authClientCount() == 0)
         stopDesktop();
 
-      if (comparer)
-        comparer->logStats();
+      logStats();
 
       // Adjust the exit timers
       connectTimer.stop();
@@ -231,6 +266,40 @@ void VNCServerST::processSocketWriteEvent(network::Socket* sock)
   throw rdr::Exception("invalid Socket in VNCServerST");
 }
 
+void VNCServerST::processWakeup()
+{
+#ifndef WIN32
+  char buf[64];
+
+  if (wakeupPipe[0] == -1)
+    return;
+
+  while (read(wakeupPipe[0], buf, sizeof(buf)) > 0)
+    ;
+#endif
+
+  // Clients without a finished update will just ignore this
+  std::list<VNCSConnectionST*>::iterator ci;
+  for (ci = clients.begin(); ci != clients.end(); ci++)
+    (*ci)->writeFramebufferUpdateOrClose();
+}
+
+void VNCServerST::wakeup()
+{
+#ifndef WIN32
+  char c = 0;
+
+  if (wakeupPipe[1] == -1)
+    return;
+
+  // A full pipe is fine, as the main loop will wake up regardless
+  if (write(wakeupPipe[1], &c, 1) < 0) {
+    if ((errno != EAGAIN) && (errno != EINTR))
+      slog.error("Unable to write to wakeup pipe: %s", strerror(errno));
+  }
+#endif
+}
+
 // VNCServer methods
 
 void VNCServerST::blockUpdates()
@@ -255,8 +324,7 @@ void VNCServerST::unblockUpdates()
 
 void VNCServerST::setPixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
 {
-  if (comparer)
-    comparer->logStats();
+  logStats();
 
   pb = pb_;
   delete comparer;
@@ -278,7 +346,9 @@ void VNCServerST::setPixelBuffer(PixelBuffer* pb_, const ScreenSet& layout)
 
   // Assume the framebuffer contents wasn't saved and reset everything
   // that tracks its contents
-  comparer = new ComparingUpdateTracker(pb);
+  comparer = new ComparingUpdateTracker(pb, rfb::Server::compareThreads,
+                                        rfb::Server::compareFB >= 3);
+  encodeCache.invalidate();
   renderedCursorInvalid = true;
   add_changed(pb->getRect());
 
@@ -385,6 +455,21 @@ void VNCServerST::bell()
   }
 }
 
+std::string VNCServerST::getTelemetry()
+{
+  std::string result;
+  std::list<VNCSConnectionST*>::iterator ci;
+
+  for (ci = clients.begin(); ci != clients.end(); ci++) {
+    if (!(*ci)->authenticated())
+      continue;
+    result += (*ci)->getTelemetry();
+    result += "\n";
+  }
+
+  return result;
+}
+
 void VNCServerST::setName(const char* name_)
 {
   name = name_;
@@ -400,7 +485,9 @@ void VNCServerST::add_changed(const Region& region)
   if (comparer == NULL)
     return;
 
+  noteDamage();
   comparer->add_changed(region);
+  encodeCache.invalidate();
   startFrameClock();
 }
 
@@ -409,7 +496,9 @@ void VNCServerST::add_copied(const Region& dest, const Point& delta)
   if (comparer == NULL)
     return;
 
+  noteDamage();
   comparer->add_copied(dest, delta);
+  encodeCache.invalidate();
   startFrameClock();
 }
 
@@ -620,14 +709,17 @@ bool VNCServerST::handleTimeout(Timer* t)
 {
   if (t == &frameTimer) {
     // We keep running until we go a full interval without any updates
-    if (comparer->is_empty())
+    if (comparer->is_empty()) {
+      fruitlessFrames = 0;
       return false;
+    }
 
     writeUpdate();
 
-    // If this is the first iteration then we need to adjust the timeout
-    if (frameTimer.getTimeoutMs() != 1000/rfb::Server::frameRate) {
-      frameTimer.start(1000/rfb::Server::frameRate);
+    // If this is the first iteration, or the pace has changed, then
+    // we need to adjust the timeout
+    if (frameTimer.getTimeoutMs() != frameInterval()) {
+      frameTimer.start(frameInterval());
       return false;
     }
 
@@ -641,6 +733,28 @@ bool VNCServerST::handleTimeout(Timer* t)
   } else if (t == &connectTimer) {
     slog.info("MaxConnectionTime reached, exiting");
     desktop->terminate();
+  } else if (t == &telemetryTimer) {
+    std::list<VNCSConnectionST*>::iterator ci;
+
+    for (ci = clients.begin(); ci != clients.end(); ci++) {
+      if (!(*ci)->authenticated())
+        continue;
+      slog.info("Telemetry: %s", (*ci)->getTelemetry().c_str());
+    }
+
+    if (authClientCount() == 0)
+      return false;
+    if (rfb::Server::telemetryInterval == 0)
+      return false;
+
+    // The interval might have been changed at runtime
+    if (telemetryTimer.getTimeoutMs() !=
+        secsToMillis(rfb::Server::telemetryInterval)) {
+      telemetryTimer.start(secsToMillis(rfb::Server::telemetryInterval));
+      return false;
+    }
+
+    return true;
   }
 
   return false;
@@ -699,6 +813,9 @@ void VNCServerST::clientReady(VNCSConnectionST* client, bool shared)
       }
     }
   }
+
+  if (rfb::Server::telemetryInterval && !telemetryTimer.isStarted())
+    telemetryTimer.start(secsToMillis(rfb::Server::telemetryInterval));
 }
 
 // -=- Internal methods
@@ -758,23 +875,115 @@ void VNCServerST::startFrameClock()
   // The first iteration will be just half a frame as we get a very
   // unstable update rate if we happen to be perfectly in sync with
   // the application's update rate
-  frameTimer.start(1000/rfb::Server::frameRate/2);
+  frameTimer.start(frameInterval()/2);
 }
 
 void VNCServerST::stopFrameClock()
 {
   frameTimer.stop();
+
+  // Whatever happens until the clock is restarted says nothing about
+  // how often the application updates the screen
+  damageGap = true;
 }
 
-int VNCServerST::msToNextUpdate()
+// frameInterval() determines how often the frame clock should run,
+// which normally is what the FrameRate parameter says
+int VNCServerST::frameInterval()
+{
+  int interval, clientInterval;
+  std::list<VNCSConnectionST*>::iterator ci;
+
+  interval = 1000/rfb::Server::frameRate;
+
+  if (!rfb::Server::adaptiveFrameRate)
+    return interval;
+
+  // Frames where all the damage turned out to be unchanged pixels are
+  // wasted effort, so back off whilst the application keeps doing
+  // that, coalescing its damage over several frames
+  interval <<= __rfbmin(fruitlessFrames, MaxFrameBackoff);
+
+  // There is no point in producing frames faster than even the
+  // fastest client can accept them, as the other clients will just
+  // have to skip them. A client that keeps up reports 0.
+  clientInterval = 0;
+  for (ci = clients.begin(); ci != clients.end(); ++ci) {
+    int ms;
+
+    if (!(*ci)->authenticated())
+      continue;
+
+    ms = (*ci)->getFrameInterval();
+    if ((clientInterval == 0) || (ms < clientInterval))
+      clientInterval = ms;
+    if (clientInterval == 0)
+      break;
+  }
+
+  if (clientInterval > interval)
+    interval = clientInterval;
+
+  if (interval > MaxFrameInterval)
+    interval = MaxFrameInterval;
+
+  return interval;
+}
+
+// noteDamage() keeps track of how often the application updates the
+// screen, by measuring the time between the first damage of each frame
+void VNCServerST::noteDamage()
 {
-  // FIXME: If the application is updating slower than frameRate then
-  //        we could allow the clients more time here
+  struct timeval now;
+  unsigned interval;
+
+  if (!comparer->is_empty())
+    return;
 
-  if (!frameTimer.isStarted())
-    return 1000/rfb::Server::frameRate/2;
+  getMonotonicTime(&now);
+  interval = msBetween(&lastDamage, &now);
+  lastDamage = now;
+
+  // Pauses in the application's updates are not part of its pace
+  if (damageGap || (interval > (unsigned)MaxFrameInterval)) {
+    damageGap = false;
+    return;
+  }
+
+  if (damageInterval == 0)
+    damageInterval = interval;
   else
+    damageInterval = (damageInterval * 7 + interval) / 8;
+}
+
+int VNCServerST::msToNextUpdate()
+{
+  int interval;
+
+  if (frameTimer.isStarted())
     return frameTimer.getRemainingMs();
+
+  interval = frameInterval()/2;
+
+  // If the application is updating slower than our frame rate then
+  // the clients have until its next expected update
+  if (rfb::Server::adaptiveFrameRate && (damageInterval > 0)) {
+    struct timeval now;
+    int untilDamage;
+
+    getMonotonicTime(&now);
+    untilDamage = (int)damageInterval - (int)msBetween(&lastDamage, &now);
+
+    // It is only a guess, so don't hold clients back for more than a
+    // frame on it
+    if (untilDamage > frameInterval())
+      untilDamage = frameInterval();
+
+    if (untilDamage > interval)
+      return untilDamage;
+  }
+
+  return interval;
 }
 
 // writeUpdate() is called on a regular interval in order to see what
@@ -788,6 +997,7 @@ void VNCServerST::writeUpdate()
 {
   UpdateInfo ui;
   Region toCheck;
+  struct timeval start, end;
 
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
 
@@ -806,24 +1016,63 @@ void VNCServerST::writeUpdate()
       renderedCursorInvalid = true;
   }
 
-  pb->grabRegion(toCheck);
+  if (!toCheck.is_empty())
+    encodeCache.invalidate();
 
   if (getComparerState())
     comparer->enable();
   else
     comparer->disable();
+  comparer->setDetectScroll(rfb::Server::detectScroll);
 
-  if (comparer->compare())
+  // The comparer takes care of grabbing the new data, as it can
+  // overlap that with the comparison
+  if (comparer->grabAndCompare(toCheck))
     comparer->getUpdateInfo(&ui, pb->getRect());
 
+  if (!toCheck.is_empty()) {
+    if (ui.is_empty())
+      fruitlessFrames++;
+    else
+      fruitlessFrames = 0;
+  }
+
   comparer->clear();
 
+  // Sharing encoded data is only worth it with several clients
+  encodeCache.setEnabled(clients.size() > 1);
+
+  gettimeofday(&start, NULL);
+
   for (ci = clients.begin(); ci != clients.end(); ci = ci_next) {
     ci_next = ci; ci_next++;
     (*ci)->add_copied(ui.copied, ui.copy_delta);
     (*ci)->add_changed(ui.changed);
     (*ci)->writeFramebufferUpdateOrClose();
   }
+
+  gettimeofday(&end, NULL);
+
+  updates++;
+  encodeTime += (end.tv_sec - start.tv_sec) * 1000000ULL +
+                end.tv_usec - start.tv_usec;
+}
+
+void VNCServerST::logStats()
+{
+  if (comparer == NULL)
+    return;
+
+  comparer->logStats();
+
+  if (updates != 0) {
+    slog.info("%s encoded in %g ms (%g ms per update)",
+              siPrefix(updates, "updates").c_str(),
+              encodeTime / 1000.0,
+              (double)encodeTime / updates / 1000.0);
+  }
+
+  updates = encodeTime = 0;
 }
 
 // checkUpdate() is called by clients to see if it is safe to read from
@@ -851,6 +1100,7 @@ const RenderedCursor* VNCServerST::getRenderedCursor()
   if (renderedCursorInvalid) {
     renderedCursor.update(pb, cursor, cursorPos);
     renderedCursorInvalid = false;
+    encodeCache.invalidate();
   }
 
   return &renderedCursor;
@@ -860,7 +1110,7 @@ bool VNCServerST::getComparerState()
 {
   if (rfb::Server::compareFB == 0)
     return false;
-  if (rfb::Server::compareFB != 2)
+  if ((rfb::Server::compareFB != 2) && (rfb::Server::compareFB != 4))
     return true;
 
   std::list<VNCSConnectionST*>::iterator ci, ci_next;
@@ -30,6 +30,7 @@
 #include <rfb/VNCServer.h>
 #include <rfb/Blacklist.h>
 #include <rfb/Cursor.h>
+#include <rfb/EncodeCache.h>
 #include <rfb/Timer.h>
 #include <rfb/ScreenSet.h>
 
@@ -105,6 +106,11 @@ namespace rfb {
 
     virtual void bell();
 
+    virtual std::string getTelemetry();
+
+    virtual int getWakeupFd() const { return wakeupPipe[0]; }
+    virtual void processWakeup();
+
     // VNCServerST-only methods
 
     // Methods to get the currently set server state
@@ -152,6 +158,14 @@ namespace rfb {
     // side rendered cursor buffer
     const RenderedCursor* getRenderedCursor();
 
+    // getEncodeCache() returns the encoded data shared by all clients
+    EncodeCache* getEncodeCache() { return &encodeCache; }
+
+    // wakeup() makes the wakeup descriptor readable, e.g. when
+    // background encoding has finished. It is safe to call from any
+    // thread.
+    void wakeup();
+
   protected:
 
     // Timer callbacks
@@ -168,7 +182,10 @@ namespace rfb {
     bool needRenderedCursor();
     void startFrameClock();
     void stopFrameClock();
+    int frameInterval();
+    void noteDamage();
     void writeUpdate();
+    void logStats();
 
     bool getComparerState();
 
@@ -192,6 +209,15 @@ namespace rfb {
     std::list<network::Socket*> closingSockets;
 
     ComparingUpdateTracker* comparer;
+    EncodeCache encodeCache;
+
+    unsigned long long updates, encodeTime;
+
+    // Adaptive frame rate state
+    struct timeval lastDamage;
+    unsigned damageInterval;
+    bool damageGap;
+    unsigned fruitlessFrames;
 
     Point cursorPos;
     Cursor* cursor;
@@ -205,6 +231,9 @@ namespace rfb {
     Timer connectTimer;
 
     Timer frameTimer;
+    Timer telemetryTimer;
+
+    int wakeupPipe[2];
   };
 
 };
@@ -28,16 +28,18 @@
 #include <rfb/SConnection.h>
 #include <rfb/ZRLEEncoder.h>
 #include <rfb/Configuration.h>
+#include <rfb/ServerCore.h>
 
 using namespace rfb;
 
 IntParameter zlibLevel("ZlibLevel","Zlib compression level",-1);
 
 ZRLEEncoder::ZRLEEncoder(SConnection* conn)
-  : Encoder(conn, encodingZRLE, EncoderPlain, 127),
+  : Encoder(conn, encodingZRLE, EncoderOrdered, 127),
   zos(0,zlibLevel), mos(129*1024)
 {
   zos.setUnderlying(&mos);
+  zos.setThreadCount(rfb::Server::zlibThreads);
 }
 
 ZRLEEncoder::~ZRLEEncoder()
@@ -86,7 +88,7 @@ void ZRLEEncoder::writeRect(const PixelBuffer* pb, const Palette& palette)
 
   zos.flush();
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU32(mos.length());
   os->writeBytes(mos.data(), mos.length());
@@ -111,7 +113,7 @@ void ZRLEEncoder::writeSolidRect(int width, int height,
 
   zos.flush();
 
-  os = conn->getOutStream();
+  os = getOutStream();
 
   os->writeU32(mos.length());
   os->writeBytes(mos.data(), mos.length());
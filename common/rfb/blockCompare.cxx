@@ -0,0 +1,595 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <rfb/blockCompare.h>
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_NEON_SIMD
+#include <arm_neon.h>
+#endif
+
+using namespace rfb;
+
+// Every implementation works one row at a time, keeping track of the
+// first and last differing byte of the row, and then copies only the
+// bytes that differ. Identical rows are therefore only ever read once.
+
+static inline void compareRowBytes(uint8_t* oldRow, const uint8_t* newRow,
+                                   int start, int end,
+                                   int* first, int* last)
+{
+  for (int x = start; x < end; x++) {
+    if (oldRow[x] == newRow[x])
+      continue;
+
+    if (*first < 0)
+      *first = x;
+    *last = x;
+
+    oldRow[x] = newRow[x];
+  }
+}
+
+static inline bool finishRow(int y, int first, int last,
+                             int* left, int* right,
+                             int* top, int* bottom)
+{
+  if (first < 0)
+    return false;
+
+  if (first < *left)
+    *left = first;
+  if (last + 1 > *right)
+    *right = last + 1;
+  if (*top < 0)
+    *top = y;
+  *bottom = y + 1;
+
+  return true;
+}
+
+static bool compareBlockScalar(uint8_t* oldData, int oldStride,
+                               const uint8_t* newData, int newStride,
+                               int width, int height, Rect* changed)
+{
+  int left, right, top, bottom;
+
+  left = width;
+  right = 0;
+  top = -1;
+  bottom = 0;
+
+  for (int y = 0; y < height; y++) {
+    uint8_t* oldRow = oldData + y * oldStride;
+    const uint8_t* newRow = newData + y * newStride;
+    int first, last;
+
+    if (memcmp(oldRow, newRow, width) == 0)
+      continue;
+
+    first = last = -1;
+    compareRowBytes(oldRow, newRow, 0, width, &first, &last);
+    finishRow(y, first, last, &left, &right, &top, &bottom);
+  }
+
+  if (top < 0)
+    return false;
+
+  changed->setXYWH(left, top, right - left, bottom - top);
+  return true;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static inline void compareRowSSE2(uint8_t* oldRow, const uint8_t* newRow,
+                                  int start, int end,
+                                  int* first, int* last)
+{
+  int x;
+
+  for (x = start; x + 16 <= end; x += 16) {
+    __m128i o, n;
+    unsigned mask;
+
+    o = _mm_loadu_si128((const __m128i*)(oldRow + x));
+    n = _mm_loadu_si128((const __m128i*)(newRow + x));
+
+    mask = _mm_movemask_epi8(_mm_cmpeq_epi8(o, n)) ^ 0xffff;
+    if (mask == 0)
+      continue;
+
+    if (*first < 0)
+      *first = x + __builtin_ctz(mask);
+    *last = x + 31 - __builtin_clz(mask);
+
+    _mm_storeu_si128((__m128i*)(oldRow + x), n);
+  }
+
+  compareRowBytes(oldRow, newRow, x, end, first, last);
+}
+
+__attribute__((target("sse2")))
+static bool compareBlockSSE2(uint8_t* oldData, int oldStride,
+                             const uint8_t* newData, int newStride,
+                             int width, int height, Rect* changed)
+{
+  int left, right, top, bottom;
+
+  left = width;
+  right = 0;
+  top = -1;
+  bottom = 0;
+
+  for (int y = 0; y < height; y++) {
+    int first, last;
+
+    first = last = -1;
+    compareRowSSE2(oldData + y * oldStride, newData + y * newStride,
+                   0, width, &first, &last);
+    finishRow(y, first, last, &left, &right, &top, &bottom);
+  }
+
+  if (top < 0)
+    return false;
+
+  changed->setXYWH(left, top, right - left, bottom - top);
+  return true;
+}
+
+__attribute__((target("avx2")))
+static bool compareBlockAVX2(uint8_t* oldData, int oldStride,
+                             const uint8_t* newData, int newStride,
+                             int width, int height, Rect* changed)
+{
+  int left, right, top, bottom;
+
+  left = width;
+  right = 0;
+  top = -1;
+  bottom = 0;
+
+  for (int y = 0; y < height; y++) {
+    uint8_t* oldRow = oldData + y * oldStride;
+    const uint8_t* newRow = newData + y * newStride;
+    int first, last;
+    int x;
+
+    first = last = -1;
+
+    for (x = 0; x + 32 <= width; x += 32) {
+      __m256i o, n;
+      unsigned mask;
+
+      o = _mm256_loadu_si256((const __m256i*)(oldRow + x));
+      n = _mm256_loadu_si256((const __m256i*)(newRow + x));
+
+      mask = ~(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(o, n));
+      if (mask == 0)
+        continue;
+
+      if (first < 0)
+        first = x + __builtin_ctz(mask);
+      last = x + 31 - __builtin_clz(mask);
+
+      _mm256_storeu_si256((__m256i*)(oldRow + x), n);
+    }
+
+    compareRowSSE2(oldRow, newRow, x, width, &first, &last);
+    finishRow(y, first, last, &left, &right, &top, &bottom);
+  }
+
+  if (top < 0)
+    return false;
+
+  changed->setXYWH(left, top, right - left, bottom - top);
+  return true;
+}
+
+#endif
+
+#ifdef HAVE_NEON_SIMD
+
+static bool compareBlockNEON(uint8_t* oldData, int oldStride,
+                             const uint8_t* newData, int newStride,
+                             int width, int height, Rect* changed)
+{
+  int left, right, top, bottom;
+
+  left = width;
+  right = 0;
+  top = -1;
+  bottom = 0;
+
+  for (int y = 0; y < height; y++) {
+    uint8_t* oldRow = oldData + y * oldStride;
+    const uint8_t* newRow = newData + y * newStride;
+    int first, last;
+    int x;
+
+    first = last = -1;
+
+    for (x = 0; x + 16 <= width; x += 16) {
+      uint8x16_t o, n;
+      int i;
+
+      o = vld1q_u8(oldRow + x);
+      n = vld1q_u8(newRow + x);
+
+      if (vmaxvq_u8(veorq_u8(o, n)) == 0)
+        continue;
+
+      // NEON has no cheap movemask, but this is the rare case
+      for (i = 0; oldRow[x + i] == newRow[x + i]; i++)
+        ;
+      if (first < 0)
+        first = x + i;
+      for (i = 15; oldRow[x + i] == newRow[x + i]; i--)
+        ;
+      last = x + i;
+
+      vst1q_u8(oldRow + x, n);
+    }
+
+    compareRowBytes(oldRow, newRow, x, width, &first, &last);
+    finishRow(y, first, last, &left, &right, &top, &bottom);
+  }
+
+  if (top < 0)
+    return false;
+
+  changed->setXYWH(left, top, right - left, bottom - top);
+  return true;
+}
+
+#endif
+
+const BlockCompareImpl* rfb::getBlockCompareImpls()
+{
+  static BlockCompareImpl impls[4];
+  int count;
+
+  count = 0;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impls[count].name = "AVX2";
+    impls[count].func = compareBlockAVX2;
+    count++;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    impls[count].name = "SSE2";
+    impls[count].func = compareBlockSSE2;
+    count++;
+  }
+#endif
+
+#ifdef HAVE_NEON_SIMD
+  impls[count].name = "NEON";
+  impls[count].func = compareBlockNEON;
+  count++;
+#endif
+
+  impls[count].name = "scalar";
+  impls[count].func = compareBlockScalar;
+  count++;
+
+  impls[count].name = NULL;
+  impls[count].func = NULL;
+
+  return impls;
+}
+
+// The solid checks compare each row against a pattern made up of the
+// colour repeated over SolidPatternSize bytes. Every pixel size
+// divides that evenly, and rows always start on a pixel, so the
+// pattern lines up with any offset that is a multiple of its size.
+
+static const int SolidPatternSize = 32;
+
+typedef bool (*SolidCheckFunc)(const uint8_t* data, int stride,
+                               int length, int height,
+                               const uint8_t* pattern);
+
+static inline bool checkSolidTail(const uint8_t* row, int x, int length,
+                                  const uint8_t* pattern)
+{
+  uint32_t pattern32;
+
+  memcpy(&pattern32, pattern, sizeof(pattern32));
+
+  for (; x + 4 <= length; x += 4) {
+    uint32_t v;
+    memcpy(&v, row + x, sizeof(v));
+    if (v != pattern32)
+      return false;
+  }
+
+  for (; x < length; x++) {
+    if (row[x] != pattern[x % SolidPatternSize])
+      return false;
+  }
+
+  return true;
+}
+
+static bool checkSolidRowsScalar(const uint8_t* data, int stride,
+                                 int length, int height,
+                                 const uint8_t* pattern)
+{
+  // Only the first row is checked against the pattern, after which
+  // the others can simply be compared to it
+  if (!checkSolidTail(data, 0, length, pattern))
+    return false;
+
+  for (int y = 1; y < height; y++) {
+    if (memcmp(data + y * stride, data, length) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static bool checkSolidRowsSSE2(const uint8_t* data, int stride,
+                               int length, int height,
+                               const uint8_t* pattern)
+{
+  __m128i p;
+
+  p = _mm_loadu_si128((const __m128i*)pattern);
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = data + y * stride;
+    int x;
+
+    for (x = 0; x + 16 <= length; x += 16) {
+      __m128i v;
+
+      v = _mm_loadu_si128((const __m128i*)(row + x));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, p)) != 0xffff)
+        return false;
+    }
+
+    if (!checkSolidTail(row, x, length, pattern))
+      return false;
+  }
+
+  return true;
+}
+
+__attribute__((target("avx2")))
+static bool checkSolidRowsAVX2(const uint8_t* data, int stride,
+                               int length, int height,
+                               const uint8_t* pattern)
+{
+  __m256i p;
+
+  p = _mm256_loadu_si256((const __m256i*)pattern);
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = data + y * stride;
+    int x;
+
+    for (x = 0; x + 32 <= length; x += 32) {
+      __m256i v;
+
+      v = _mm256_loadu_si256((const __m256i*)(row + x));
+      if (~_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, p)) != 0)
+        return false;
+    }
+
+    if (x + 16 <= length) {
+      __m128i v;
+
+      v = _mm_loadu_si128((const __m128i*)(row + x));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(p))) != 0xffff)
+        return false;
+
+      x += 16;
+    }
+
+    if (!checkSolidTail(row, x, length, pattern))
+      return false;
+  }
+
+  return true;
+}
+
+#endif
+
+#ifdef HAVE_NEON_SIMD
+
+static bool checkSolidRowsNEON(const uint8_t* data, int stride,
+                               int length, int height,
+                               const uint8_t* pattern)
+{
+  uint8x16_t p;
+
+  p = vld1q_u8(pattern);
+
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = data + y * stride;
+    int x;
+
+    for (x = 0; x + 16 <= length; x += 16) {
+      if (vmaxvq_u8(veorq_u8(vld1q_u8(row + x), p)) != 0)
+        return false;
+    }
+
+    if (!checkSolidTail(row, x, length, pattern))
+      return false;
+  }
+
+  return true;
+}
+
+#endif
+
+static SolidCheckFunc getSolidCheckFunc()
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return checkSolidRowsAVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return checkSolidRowsSSE2;
+#endif
+
+#ifdef HAVE_NEON_SIMD
+  return checkSolidRowsNEON;
+#endif
+
+  return checkSolidRowsScalar;
+}
+
+static const SolidCheckFunc checkSolidRows = getSolidCheckFunc();
+
+static void fillSolidPattern(uint8_t* pattern, int bpp,
+                             const uint8_t* colour)
+{
+  int bytesPerPixel;
+
+  bytesPerPixel = bpp / 8;
+  for (int i = 0; i < SolidPatternSize; i += bytesPerPixel)
+    memcpy(pattern + i, colour, bytesPerPixel);
+}
+
+bool rfb::checkSolidBlock(const uint8_t* data, int stride,
+                          int width, int height, int bpp,
+                          const uint8_t* colour)
+{
+  uint8_t pattern[SolidPatternSize];
+
+  fillSolidPattern(pattern, bpp, colour);
+
+  return checkSolidRows(data, stride, width * (bpp / 8), height, pattern);
+}
+
+bool rfb::checkSolidBlockScalar(const uint8_t* data, int stride,
+                                int width, int height, int bpp,
+                                const uint8_t* colour)
+{
+  uint8_t pattern[SolidPatternSize];
+
+  fillSolidPattern(pattern, bpp, colour);
+
+  return checkSolidRowsScalar(data, stride, width * (bpp / 8), height,
+                              pattern);
+}
+
+// The hash is based on the same principles as xxHash64, but with the
+// final merge of the lanes simplified, as the values never leave this
+// process
+
+static const uint64_t PRIME1 = 11400714785074694791ULL;
+static const uint64_t PRIME2 = 14029467366897019727ULL;
+static const uint64_t PRIME3 = 1609587929392839161ULL;
+static const uint64_t PRIME4 = 9650029242287828579ULL;
+static const uint64_t PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t* p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t hashRound(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME2;
+  acc = rotl(acc, 31);
+  acc *= PRIME1;
+  return acc;
+}
+
+uint64_t rfb::hashBytes(const uint8_t* data, size_t length)
+{
+  const uint8_t* end;
+  uint64_t h;
+
+  end = data + length;
+
+  if (length >= 32) {
+    uint64_t v1, v2, v3, v4;
+
+    v1 = PRIME1 + PRIME2;
+    v2 = PRIME2;
+    v3 = 0;
+    v4 = 0 - PRIME1;
+
+    do {
+      v1 = hashRound(v1, read64(data));
+      v2 = hashRound(v2, read64(data + 8));
+      v3 = hashRound(v3, read64(data + 16));
+      v4 = hashRound(v4, read64(data + 24));
+      data += 32;
+    } while (data + 32 <= end);
+
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+  } else {
+    h = PRIME5;
+  }
+
+  h += length;
+
+  while (data + 8 <= end) {
+    h ^= hashRound(0, read64(data));
+    h = rotl(h, 27) * PRIME1 + PRIME4;
+    data += 8;
+  }
+
+  while (data < end) {
+    h ^= *data * PRIME5;
+    h = rotl(h, 11) * PRIME1;
+    data++;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+
+  if (h == 0)
+    h = 1;
+
+  return h;
+}
+
+// The list is sorted with the fastest implementation first
+const BlockCompareFunc rfb::compareBlock = getBlockCompareImpls()[0].func;
@@ -0,0 +1,73 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// blockCompare.h - finding changes between two framebuffer blocks,
+//                  and finding blocks of a single colour
+//
+
+#ifndef __RFB_BLOCKCOMPARE_H__
+#define __RFB_BLOCKCOMPARE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <rfb/Rect.h>
+
+namespace rfb {
+
+  // Compares width bytes over height rows of the two buffers, and
+  // updates oldData with anything that differs in newData. Returns
+  // true if there were differences, in which case changed is set to
+  // the bounding box of them in bytes and rows. Strides are in bytes.
+  typedef bool (*BlockCompareFunc)(uint8_t* oldData, int oldStride,
+                                   const uint8_t* newData, int newStride,
+                                   int width, int height, Rect* changed);
+
+  // The fastest implementation available on this CPU
+  extern const BlockCompareFunc compareBlock;
+
+  // All implementations usable on this CPU, terminated by an entry
+  // with a NULL name. Only intended for testing and benchmarking.
+  struct BlockCompareImpl {
+    const char* name;
+    BlockCompareFunc func;
+  };
+
+  const BlockCompareImpl* getBlockCompareImpls();
+
+  // Checks if every pixel in the block is identical to the given
+  // colour. Width is in pixels and the stride in bytes.
+  bool checkSolidBlock(const uint8_t* data, int stride,
+                       int width, int height, int bpp,
+                       const uint8_t* colour);
+
+  // As above, but always uses the plain C implementation. Only
+  // intended for testing and benchmarking.
+  bool checkSolidBlockScalar(const uint8_t* data, int stride,
+                             int width, int height, int bpp,
+                             const uint8_t* colour);
+
+  // Fast, non-cryptographic, hash of some data, for detecting
+  // changes. Never returns zero, so that can be used to mark unknown
+  // contents.
+  uint64_t hashBytes(const uint8_t* data, size_t length);
+
+}
+
+#endif
@@ -0,0 +1,849 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stddef.h>
+
+#include <rfb/pixelConvert.h>
+
+// The vector code reads pixels straight from memory, so it is only
+// usable on little endian hosts
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON) && \
+    defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define HAVE_NEON_SIMD
+#include <arm_neon.h>
+#endif
+
+using namespace rfb;
+
+// The channel conversions have to give exactly the same result as the
+// lookup tables in PixelFormat. Going down to fewer bits is
+// (v * max + 128) / 255, where the division can be done as
+// (x + (x >> 8) + 1) >> 8 for every x that can occur. Going up is
+// v * 255 / max, which is the same as (v * mul) >> (bits + 7) with
+// mul being 255 << (bits + 7) divided by max and rounded up.
+
+static inline int channelBits(int max)
+{
+  int bits;
+
+  bits = 0;
+  while (max) {
+    bits++;
+    max >>= 1;
+  }
+
+  return bits;
+}
+
+static inline int upconvMul(int max)
+{
+  int bits;
+
+  bits = channelBits(max);
+
+  return ((255 << (bits + 7)) + max - 1) / max;
+}
+
+static inline uint32_t readPixel(const uint8_t* src, int bpp, bool swap)
+{
+  uint32_t p;
+
+  switch (bpp) {
+  case 8:
+    return src[0];
+  case 16:
+    if (swap)
+      return src[0] << 8 | src[1];
+    return src[1] << 8 | src[0];
+  }
+
+  p = src[3];
+  p = p << 8 | src[2];
+  p = p << 8 | src[1];
+  p = p << 8 | src[0];
+
+  return p;
+}
+
+static inline void writePixel(uint8_t* dst, int bpp, bool swap, uint32_t p)
+{
+  switch (bpp) {
+  case 8:
+    dst[0] = p;
+    return;
+  case 16:
+    if (swap) {
+      dst[0] = p >> 8;
+      dst[1] = p;
+    } else {
+      dst[0] = p;
+      dst[1] = p >> 8;
+    }
+    return;
+  }
+
+  dst[0] = p;
+  dst[1] = p >> 8;
+  dst[2] = p >> 16;
+  dst[3] = p >> 24;
+}
+
+// Handles whatever is left of a row once the vector code is done
+
+static void convertTail(uint8_t* dst, const uint8_t* src, int count,
+                        const PixelConvertParams& params)
+{
+  while (count--) {
+    uint32_t s, d;
+    int c;
+
+    s = readPixel(src, params.srcBpp, params.srcSwap);
+
+    d = 0;
+    for (c = 0; c < 3; c++) {
+      unsigned v;
+
+      v = (s >> params.srcShift[c]) & params.srcMax[c];
+      if (params.srcMax[c] == 255 && params.dstMax[c] != 255)
+        v = (v * params.dstMax[c] + 128) / 255;
+      else if (params.dstMax[c] == 255 && params.srcMax[c] != 255)
+        v = v * 255 / params.srcMax[c];
+
+      d |= v << params.dstShift[c];
+    }
+
+    writePixel(dst, params.dstBpp, params.dstSwap, d);
+
+    dst += params.dstBpp/8;
+    src += params.srcBpp/8;
+  }
+}
+
+static void shuffleTail(uint8_t* dst, const uint8_t* src, int count,
+                        const uint8_t order[4])
+{
+  while (count--) {
+    dst[0] = src[order[0]];
+    dst[1] = src[order[1]];
+    dst[2] = src[order[2]];
+    dst[3] = src[order[3]];
+    dst += 4;
+    src += 4;
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// SSE2 and SSSE3 versions, handling 8 pixels (4 when shuffling) per
+// iteration
+
+__attribute__((target("sse2")))
+static inline __m128i loadSSE2(const uint8_t* src, int bpp, bool swap)
+{
+  __m128i s;
+
+  if (bpp == 8)
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)src),
+                             _mm_setzero_si128());
+
+  s = _mm_loadu_si128((const __m128i*)src);
+  if (swap)
+    s = _mm_or_si128(_mm_slli_epi16(s, 8), _mm_srli_epi16(s, 8));
+
+  return s;
+}
+
+__attribute__((target("sse2")))
+static inline void storeSSE2(uint8_t* dst, int bpp, bool swap, __m128i d)
+{
+  if (bpp == 8) {
+    _mm_storel_epi64((__m128i*)dst, _mm_packus_epi16(d, d));
+    return;
+  }
+
+  if (swap)
+    d = _mm_or_si128(_mm_slli_epi16(d, 8), _mm_srli_epi16(d, 8));
+  _mm_storeu_si128((__m128i*)dst, d);
+}
+
+__attribute__((target("sse2")))
+static void from888SSE2(uint8_t* dst, const uint8_t* src,
+                        int w, int h, int dstStride, int srcStride,
+                        const PixelConvertParams& params)
+{
+  __m128i srcCount[3], dstCount[3], max[3];
+  const __m128i byteMask = _mm_set1_epi32(0xff);
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i one = _mm_set1_epi16(1);
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = _mm_cvtsi32_si128(params.srcShift[c]);
+    dstCount[c] = _mm_cvtsi32_si128(params.dstShift[c]);
+    max[c] = _mm_set1_epi16(params.dstMax[c]);
+  }
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      __m128i lo, hi, d;
+
+      lo = _mm_loadu_si128((const __m128i*)(src + x*4));
+      hi = _mm_loadu_si128((const __m128i*)(src + x*4 + 16));
+
+      d = _mm_setzero_si128();
+      for (c = 0; c < 3; c++) {
+        __m128i v;
+
+        v = _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(lo, srcCount[c]),
+                                          byteMask),
+                            _mm_and_si128(_mm_srl_epi32(hi, srcCount[c]),
+                                          byteMask));
+
+        v = _mm_add_epi16(_mm_mullo_epi16(v, max[c]), half);
+        v = _mm_add_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), one);
+        v = _mm_srli_epi16(v, 8);
+
+        d = _mm_or_si128(d, _mm_sll_epi16(v, dstCount[c]));
+      }
+
+      storeSSE2(dst + x*params.dstBpp/8, params.dstBpp, params.dstSwap, d);
+    }
+
+    convertTail(dst + x*params.dstBpp/8, src + x*4, w - x, params);
+
+    dst += dstStride * params.dstBpp/8;
+    src += srcStride * 4;
+  }
+}
+
+__attribute__((target("sse2")))
+static void to888SSE2(uint8_t* dst, const uint8_t* src,
+                      int w, int h, int dstStride, int srcStride,
+                      const PixelConvertParams& params)
+{
+  __m128i srcCount[3], dstCount[3], max[3], mul[3], mulCount[3];
+  const __m128i zero = _mm_setzero_si128();
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = _mm_cvtsi32_si128(params.srcShift[c]);
+    dstCount[c] = _mm_cvtsi32_si128(params.dstShift[c]);
+    max[c] = _mm_set1_epi16(params.srcMax[c]);
+    mul[c] = _mm_set1_epi16(upconvMul(params.srcMax[c]));
+    mulCount[c] = _mm_cvtsi32_si128(channelBits(params.srcMax[c]) - 1);
+  }
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      __m128i s, lo, hi;
+
+      s = loadSSE2(src + x*params.srcBpp/8, params.srcBpp, params.srcSwap);
+
+      lo = hi = zero;
+      for (c = 0; c < 3; c++) {
+        __m128i v;
+
+        v = _mm_and_si128(_mm_srl_epi16(s, srcCount[c]), max[c]);
+        v = _mm_mulhi_epu16(_mm_slli_epi16(v, 8), mul[c]);
+        v = _mm_srl_epi16(v, mulCount[c]);
+
+        lo = _mm_or_si128(lo, _mm_sll_epi32(_mm_unpacklo_epi16(v, zero),
+                                            dstCount[c]));
+        hi = _mm_or_si128(hi, _mm_sll_epi32(_mm_unpackhi_epi16(v, zero),
+                                            dstCount[c]));
+      }
+
+      _mm_storeu_si128((__m128i*)(dst + x*4), lo);
+      _mm_storeu_si128((__m128i*)(dst + x*4 + 16), hi);
+    }
+
+    convertTail(dst + x*4, src + x*params.srcBpp/8, w - x, params);
+
+    dst += dstStride * 4;
+    src += srcStride * params.srcBpp/8;
+  }
+}
+
+__attribute__((target("sse2")))
+static void repackSSE2(uint8_t* dst, const uint8_t* src,
+                       int w, int h, int dstStride, int srcStride,
+                       const PixelConvertParams& params)
+{
+  __m128i srcCount[3], dstCount[3], max[3];
+  int bytes;
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = _mm_cvtsi32_si128(params.srcShift[c]);
+    dstCount[c] = _mm_cvtsi32_si128(params.dstShift[c]);
+    max[c] = _mm_set1_epi16(params.srcMax[c]);
+  }
+
+  bytes = params.srcBpp/8;
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      __m128i s, d;
+
+      s = loadSSE2(src + x*bytes, params.srcBpp, params.srcSwap);
+
+      d = _mm_setzero_si128();
+      for (c = 0; c < 3; c++) {
+        __m128i v;
+        v = _mm_and_si128(_mm_srl_epi16(s, srcCount[c]), max[c]);
+        d = _mm_or_si128(d, _mm_sll_epi16(v, dstCount[c]));
+      }
+
+      storeSSE2(dst + x*bytes, params.dstBpp, params.dstSwap, d);
+    }
+
+    convertTail(dst + x*bytes, src + x*bytes, w - x, params);
+
+    dst += dstStride * bytes;
+    src += srcStride * bytes;
+  }
+}
+
+__attribute__((target("ssse3")))
+static void shuffleSSSE3(uint8_t* dst, const uint8_t* src,
+                         int w, int h, int dstStride, int srcStride,
+                         const uint8_t order[4])
+{
+  uint8_t index[16];
+  __m128i mask;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    index[i] = (i & ~3) + order[i & 3];
+  mask = _mm_loadu_si128((const __m128i*)index);
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 4 <= w; x += 4) {
+      __m128i s;
+      s = _mm_loadu_si128((const __m128i*)(src + x*4));
+      _mm_storeu_si128((__m128i*)(dst + x*4), _mm_shuffle_epi8(s, mask));
+    }
+
+    shuffleTail(dst + x*4, src + x*4, w - x, order);
+
+    dst += dstStride * 4;
+    src += srcStride * 4;
+  }
+}
+
+// AVX2 versions, handling 16 pixels (8 when shuffling) per iteration.
+// Packing and unpacking work within each 128 bit lane, so the results
+// have to be permuted back in to pixel order.
+
+__attribute__((target("avx2")))
+static inline __m256i loadAVX2(const uint8_t* src, int bpp, bool swap)
+{
+  __m256i s;
+
+  if (bpp == 8)
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)src));
+
+  s = _mm256_loadu_si256((const __m256i*)src);
+  if (swap)
+    s = _mm256_or_si256(_mm256_slli_epi16(s, 8), _mm256_srli_epi16(s, 8));
+
+  return s;
+}
+
+__attribute__((target("avx2")))
+static inline void storeAVX2(uint8_t* dst, int bpp, bool swap, __m256i d)
+{
+  if (bpp == 8) {
+    d = _mm256_permute4x64_epi64(_mm256_packus_epi16(d, d), 0x08);
+    _mm_storeu_si128((__m128i*)dst, _mm256_castsi256_si128(d));
+    return;
+  }
+
+  if (swap)
+    d = _mm256_or_si256(_mm256_slli_epi16(d, 8), _mm256_srli_epi16(d, 8));
+  _mm256_storeu_si256((__m256i*)dst, d);
+}
+
+__attribute__((target("avx2")))
+static void from888AVX2(uint8_t* dst, const uint8_t* src,
+                        int w, int h, int dstStride, int srcStride,
+                        const PixelConvertParams& params)
+{
+  __m128i srcCount[3], dstCount[3];
+  __m256i max[3];
+  const __m256i byteMask = _mm256_set1_epi32(0xff);
+  const __m256i half = _mm256_set1_epi16(128);
+  const __m256i one = _mm256_set1_epi16(1);
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = _mm_cvtsi32_si128(params.srcShift[c]);
+    dstCount[c] = _mm_cvtsi32_si128(params.dstShift[c]);
+    max[c] = _mm256_set1_epi16(params.dstMax[c]);
+  }
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 16 <= w; x += 16) {
+      __m256i lo, hi, d;
+
+      lo = _mm256_loadu_si256((const __m256i*)(src + x*4));
+      hi = _mm256_loadu_si256((const __m256i*)(src + x*4 + 32));
+
+      d = _mm256_setzero_si256();
+      for (c = 0; c < 3; c++) {
+        __m256i v;
+
+        v = _mm256_packs_epi32(_mm256_and_si256(_mm256_srl_epi32(lo, srcCount[c]),
+                                                byteMask),
+                               _mm256_and_si256(_mm256_srl_epi32(hi, srcCount[c]),
+                                                byteMask));
+
+        v = _mm256_add_epi16(_mm256_mullo_epi16(v, max[c]), half);
+        v = _mm256_add_epi16(_mm256_add_epi16(v, _mm256_srli_epi16(v, 8)), one);
+        v = _mm256_srli_epi16(v, 8);
+
+        d = _mm256_or_si256(d, _mm256_sll_epi16(v, dstCount[c]));
+      }
+
+      d = _mm256_permute4x64_epi64(d, 0xd8);
+
+      storeAVX2(dst + x*params.dstBpp/8, params.dstBpp, params.dstSwap, d);
+    }
+
+    convertTail(dst + x*params.dstBpp/8, src + x*4, w - x, params);
+
+    dst += dstStride * params.dstBpp/8;
+    src += srcStride * 4;
+  }
+}
+
+__attribute__((target("avx2")))
+static void to888AVX2(uint8_t* dst, const uint8_t* src,
+                      int w, int h, int dstStride, int srcStride,
+                      const PixelConvertParams& params)
+{
+  __m128i srcCount[3], dstCount[3], mulCount[3];
+  __m256i max[3], mul[3];
+  const __m256i zero = _mm256_setzero_si256();
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = _mm_cvtsi32_si128(params.srcShift[c]);
+    dstCount[c] = _mm_cvtsi32_si128(params.dstShift[c]);
+    max[c] = _mm256_set1_epi16(params.srcMax[c]);
+    mul[c] = _mm256_set1_epi16(upconvMul(params.srcMax[c]));
+    mulCount[c] = _mm_cvtsi32_si128(channelBits(params.srcMax[c]) - 1);
+  }
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 16 <= w; x += 16) {
+      __m256i s, lo, hi;
+
+      s = loadAVX2(src + x*params.srcBpp/8, params.srcBpp, params.srcSwap);
+
+      lo = hi = zero;
+      for (c = 0; c < 3; c++) {
+        __m256i v;
+
+        v = _mm256_and_si256(_mm256_srl_epi16(s, srcCount[c]), max[c]);
+        v = _mm256_mulhi_epu16(_mm256_slli_epi16(v, 8), mul[c]);
+        v = _mm256_srl_epi16(v, mulCount[c]);
+
+        lo = _mm256_or_si256(lo, _mm256_sll_epi32(_mm256_unpacklo_epi16(v, zero),
+                                                  dstCount[c]));
+        hi = _mm256_or_si256(hi, _mm256_sll_epi32(_mm256_unpackhi_epi16(v, zero),
+                                                  dstCount[c]));
+      }
+
+      _mm256_storeu_si256((__m256i*)(dst + x*4),
+                          _mm256_permute2x128_si256(lo, hi, 0x20));
+      _mm256_storeu_si256((__m256i*)(dst + x*4 + 32),
+                          _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+
+    convertTail(dst + x*4, src + x*params.srcBpp/8, w - x, params);
+
+    dst += dstStride * 4;
+    src += srcStride * params.srcBpp/8;
+  }
+}
+
+__attribute__((target("avx2")))
+static void repackAVX2(uint8_t* dst, const uint8_t* src,
+                       int w, int h, int dstStride, int srcStride,
+                       const PixelConvertParams& params)
+{
+  __m128i srcCount[3], dstCount[3];
+  __m256i max[3];
+  int bytes;
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = _mm_cvtsi32_si128(params.srcShift[c]);
+    dstCount[c] = _mm_cvtsi32_si128(params.dstShift[c]);
+    max[c] = _mm256_set1_epi16(params.srcMax[c]);
+  }
+
+  bytes = params.srcBpp/8;
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 16 <= w; x += 16) {
+      __m256i s, d;
+
+      s = loadAVX2(src + x*bytes, params.srcBpp, params.srcSwap);
+
+      d = _mm256_setzero_si256();
+      for (c = 0; c < 3; c++) {
+        __m256i v;
+        v = _mm256_and_si256(_mm256_srl_epi16(s, srcCount[c]), max[c]);
+        d = _mm256_or_si256(d, _mm256_sll_epi16(v, dstCount[c]));
+      }
+
+      storeAVX2(dst + x*bytes, params.dstBpp, params.dstSwap, d);
+    }
+
+    convertTail(dst + x*bytes, src + x*bytes, w - x, params);
+
+    dst += dstStride * bytes;
+    src += srcStride * bytes;
+  }
+}
+
+__attribute__((target("avx2")))
+static void shuffleAVX2(uint8_t* dst, const uint8_t* src,
+                        int w, int h, int dstStride, int srcStride,
+                        const uint8_t order[4])
+{
+  uint8_t index[32];
+  __m256i mask;
+  int i;
+
+  // The shuffle cannot cross lanes, so the index is relative to each
+  // 16 byte half
+  for (i = 0; i < 32; i++)
+    index[i] = (i & 12) + order[i & 3];
+  mask = _mm256_loadu_si256((const __m256i*)index);
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      __m256i s;
+      s = _mm256_loadu_si256((const __m256i*)(src + x*4));
+      _mm256_storeu_si256((__m256i*)(dst + x*4),
+                          _mm256_shuffle_epi8(s, mask));
+    }
+
+    shuffleTail(dst + x*4, src + x*4, w - x, order);
+
+    dst += dstStride * 4;
+    src += srcStride * 4;
+  }
+}
+
+#endif
+
+#ifdef HAVE_NEON_SIMD
+
+// NEON versions, handling 8 pixels (4 when shuffling) per iteration.
+// The structure loads and stores split 32 bit pixels in to one
+// vector per byte, which saves most of the shifting.
+
+static inline uint16x8_t loadNEON(const uint8_t* src, int bpp, bool swap)
+{
+  uint8x16_t s;
+
+  if (bpp == 8)
+    return vmovl_u8(vld1_u8(src));
+
+  s = vld1q_u8(src);
+  if (swap)
+    s = vrev16q_u8(s);
+
+  return vreinterpretq_u16_u8(s);
+}
+
+static inline void storeNEON(uint8_t* dst, int bpp, bool swap, uint16x8_t d)
+{
+  uint8x16_t b;
+
+  if (bpp == 8) {
+    vst1_u8(dst, vmovn_u16(d));
+    return;
+  }
+
+  b = vreinterpretq_u8_u16(d);
+  if (swap)
+    b = vrev16q_u8(b);
+  vst1q_u8(dst, b);
+}
+
+static void from888NEON(uint8_t* dst, const uint8_t* src,
+                        int w, int h, int dstStride, int srcStride,
+                        const PixelConvertParams& params)
+{
+  int16x8_t dstCount[3];
+  uint8x8_t max[3];
+  const uint16x8_t half = vdupq_n_u16(128);
+  const uint16x8_t one = vdupq_n_u16(1);
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    dstCount[c] = vdupq_n_s16(params.dstShift[c]);
+    max[c] = vdup_n_u8(params.dstMax[c]);
+  }
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      uint8x8x4_t s;
+      uint16x8_t d;
+
+      s = vld4_u8(src + x*4);
+
+      d = vdupq_n_u16(0);
+      for (c = 0; c < 3; c++) {
+        uint16x8_t v;
+
+        v = vaddq_u16(vmull_u8(s.val[params.srcShift[c]/8], max[c]), half);
+        v = vaddq_u16(vaddq_u16(v, vshrq_n_u16(v, 8)), one);
+        v = vshrq_n_u16(v, 8);
+
+        d = vorrq_u16(d, vshlq_u16(v, dstCount[c]));
+      }
+
+      storeNEON(dst + x*params.dstBpp/8, params.dstBpp, params.dstSwap, d);
+    }
+
+    convertTail(dst + x*params.dstBpp/8, src + x*4, w - x, params);
+
+    dst += dstStride * params.dstBpp/8;
+    src += srcStride * 4;
+  }
+}
+
+static void to888NEON(uint8_t* dst, const uint8_t* src,
+                      int w, int h, int dstStride, int srcStride,
+                      const PixelConvertParams& params)
+{
+  int16x8_t srcCount[3];
+  int32x4_t mulCount[3];
+  uint16x8_t max[3];
+  uint16x4_t mul[3];
+  int pad;
+  int c;
+
+  pad = 6;
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = vdupq_n_s16(-params.srcShift[c]);
+    max[c] = vdupq_n_u16(params.srcMax[c]);
+    mul[c] = vdup_n_u16(upconvMul(params.srcMax[c]));
+    mulCount[c] = vdupq_n_s32(-(channelBits(params.srcMax[c]) + 7));
+    pad -= params.dstShift[c]/8;
+  }
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      uint16x8_t s;
+      uint8x8x4_t d;
+
+      s = loadNEON(src + x*params.srcBpp/8, params.srcBpp, params.srcSwap);
+
+      for (c = 0; c < 3; c++) {
+        uint16x8_t v;
+        uint32x4_t lo, hi;
+
+        v = vandq_u16(vshlq_u16(s, srcCount[c]), max[c]);
+
+        lo = vshlq_u32(vmull_u16(vget_low_u16(v), mul[c]), mulCount[c]);
+        hi = vshlq_u32(vmull_u16(vget_high_u16(v), mul[c]), mulCount[c]);
+
+        d.val[params.dstShift[c]/8] =
+          vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+      }
+      d.val[pad] = vdup_n_u8(0);
+
+      vst4_u8(dst + x*4, d);
+    }
+
+    convertTail(dst + x*4, src + x*params.srcBpp/8, w - x, params);
+
+    dst += dstStride * 4;
+    src += srcStride * params.srcBpp/8;
+  }
+}
+
+static void repackNEON(uint8_t* dst, const uint8_t* src,
+                       int w, int h, int dstStride, int srcStride,
+                       const PixelConvertParams& params)
+{
+  int16x8_t srcCount[3], dstCount[3];
+  uint16x8_t max[3];
+  int bytes;
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    srcCount[c] = vdupq_n_s16(-params.srcShift[c]);
+    dstCount[c] = vdupq_n_s16(params.dstShift[c]);
+    max[c] = vdupq_n_u16(params.srcMax[c]);
+  }
+
+  bytes = params.srcBpp/8;
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 8 <= w; x += 8) {
+      uint16x8_t s, d;
+
+      s = loadNEON(src + x*bytes, params.srcBpp, params.srcSwap);
+
+      d = vdupq_n_u16(0);
+      for (c = 0; c < 3; c++) {
+        uint16x8_t v;
+        v = vandq_u16(vshlq_u16(s, srcCount[c]), max[c]);
+        d = vorrq_u16(d, vshlq_u16(v, dstCount[c]));
+      }
+
+      storeNEON(dst + x*bytes, params.dstBpp, params.dstSwap, d);
+    }
+
+    convertTail(dst + x*bytes, src + x*bytes, w - x, params);
+
+    dst += dstStride * bytes;
+    src += srcStride * bytes;
+  }
+}
+
+static void shuffleNEON(uint8_t* dst, const uint8_t* src,
+                        int w, int h, int dstStride, int srcStride,
+                        const uint8_t order[4])
+{
+  uint8_t index[16];
+  uint8x16_t mask;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    index[i] = (i & ~3) + order[i & 3];
+  mask = vld1q_u8(index);
+
+  while (h--) {
+    int x;
+
+    for (x = 0; x + 4 <= w; x += 4)
+      vst1q_u8(dst + x*4, vqtbl1q_u8(vld1q_u8(src + x*4), mask));
+
+    shuffleTail(dst + x*4, src + x*4, w - x, order);
+
+    dst += dstStride * 4;
+    src += srcStride * 4;
+  }
+}
+
+#endif
+
+const PixelConvertImpl* rfb::getPixelConvertImpls()
+{
+  static PixelConvertImpl impls[5];
+  static bool initialised = false;
+  int count;
+
+  if (initialised)
+    return impls;
+
+  count = 0;
+
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    impls[count].name = "AVX2";
+    impls[count].shuffle = shuffleAVX2;
+    impls[count].from888 = from888AVX2;
+    impls[count].to888 = to888AVX2;
+    impls[count].repack = repackAVX2;
+    count++;
+  }
+  if (__builtin_cpu_supports("ssse3")) {
+    impls[count].name = "SSSE3";
+    impls[count].shuffle = shuffleSSSE3;
+    impls[count].from888 = from888SSE2;
+    impls[count].to888 = to888SSE2;
+    impls[count].repack = repackSSE2;
+    count++;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    impls[count].name = "SSE2";
+    impls[count].shuffle = NULL;
+    impls[count].from888 = from888SSE2;
+    impls[count].to888 = to888SSE2;
+    impls[count].repack = repackSSE2;
+    count++;
+  }
+#endif
+
+#ifdef HAVE_NEON_SIMD
+  impls[count].name = "NEON";
+  impls[count].shuffle = shuffleNEON;
+  impls[count].from888 = from888NEON;
+  impls[count].to888 = to888NEON;
+  impls[count].repack = repackNEON;
+  count++;
+#endif
+
+  impls[count].name = "scalar";
+  impls[count].shuffle = NULL;
+  impls[count].from888 = NULL;
+  impls[count].to888 = NULL;
+  impls[count].repack = NULL;
+  count++;
+
+  impls[count].name = NULL;
+
+  initialised = true;
+
+  return impls;
+}
+
+const PixelConvertImpl* rfb::pixelConvertImpl = getPixelConvertImpls();
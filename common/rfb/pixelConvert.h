@@ -0,0 +1,80 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+//
+// pixelConvert.h - vectorised pixel format conversion, used by
+//                  PixelFormat::bufferFromBuffer()
+//
+
+#ifndef __RFB_PIXELCONVERT_H__
+#define __RFB_PIXELCONVERT_H__
+
+#include <stdint.h>
+
+namespace rfb {
+
+  // Describes a conversion between two pixel layouts. Pixels are
+  // always read from and written to memory as little endian values,
+  // and then byte swapped if the swap flag is set. A 32 bit side
+  // always has a max of 255 and byte aligned shifts. Strides are in
+  // pixels.
+  struct PixelConvertParams {
+    int srcBpp, dstBpp;
+    bool srcSwap, dstSwap;
+    int srcShift[3], srcMax[3];
+    int dstShift[3], dstMax[3];
+  };
+
+  // Rearranges the bytes of 32 bit pixels, so that byte i of every
+  // destination pixel is byte order[i] of the source pixel
+  typedef void (*PixelShuffleFunc)(uint8_t* dst, const uint8_t* src,
+                                   int w, int h,
+                                   int dstStride, int srcStride,
+                                   const uint8_t order[4]);
+
+  typedef void (*PixelConvertFunc)(uint8_t* dst, const uint8_t* src,
+                                   int w, int h,
+                                   int dstStride, int srcStride,
+                                   const PixelConvertParams& params);
+
+  // A set of conversion functions. Any of them can be NULL, in which
+  // case PixelFormat will use its plain C code for that conversion.
+  struct PixelConvertImpl {
+    const char* name;
+    // 32 bit 888 to 32 bit 888
+    PixelShuffleFunc shuffle;
+    // 32 bit 888 to 8 or 16 bit
+    PixelConvertFunc from888;
+    // 8 or 16 bit to 32 bit 888
+    PixelConvertFunc to888;
+    // 8 or 16 bit to the same size, with identical channel depths
+    PixelConvertFunc repack;
+  };
+
+  // All implementations usable on this CPU, fastest first and
+  // terminated by an entry with a NULL name. The last real entry is
+  // always the plain C code.
+  const PixelConvertImpl* getPixelConvertImpls();
+
+  // The implementation currently used by PixelFormat. Only intended
+  // to be changed for testing and benchmarking.
+  extern const PixelConvertImpl* pixelConvertImpl;
+
+}
+
+#endif
@@ -27,6 +27,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#endif
 
 #include <rfb/util.h>
 
@@ -586,6 +591,29 @@ namespace rfb {
     return msBetween(then, &now);
   }
 
+  void getMonotonicTime(struct timeval *tv)
+  {
+#ifdef WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+
+    if (frequency.QuadPart == 0)
+      QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+
+    tv->tv_sec = counter.QuadPart / frequency.QuadPart;
+    tv->tv_usec = (counter.QuadPart % frequency.QuadPart) * 1000000 /
+                  frequency.QuadPart;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    tv->tv_sec = ts.tv_sec;
+    tv->tv_usec = ts.tv_nsec / 1000;
+#endif
+  }
+
   bool isBefore(const struct timeval *first,
                 const struct timeval *second)
   {
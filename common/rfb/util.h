@@ -90,6 +90,10 @@ namespace rfb {
   // Returns time elapsed since given moment in milliseconds.
   unsigned msSince(const struct timeval *then);
 
+  // Like gettimeofday(), but using a clock that never jumps. Only
+  // useful for comparing with other such times.
+  void getMonotonicTime(struct timeval *tv);
+
   // Returns true if first happened before seconds
   bool isBefore(const struct timeval *first,
                 const struct timeval *second);
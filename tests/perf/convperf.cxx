@@ -26,6 +26,7 @@
 #include <time.h>
 
 #include <rfb/PixelFormat.h>
+#include <rfb/pixelConvert.h>
 
 #include "util.h"
 
@@ -39,6 +40,8 @@ typedef void (*testfn) (rfb::PixelFormat&, rfb::PixelFormat&, uint8_t*, uint8_t*
 struct TestEntry {
   const char *label;
   testfn fn;
+  // Run once for every available conversion implementation
+  bool perImpl;
 };
 
 static void testMemcpy(rfb::PixelFormat &dstpf,
@@ -100,10 +103,10 @@ static void doTest(testfn fn, rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf)
 }
 
 struct TestEntry tests[] = {
-  {"memcpy", testMemcpy},
-  {"bufferFromBuffer", testBuffer},
-  {"rgbFromBuffer", testToRGB},
-  {"bufferFromRGB", testFromRGB},
+  {"memcpy", testMemcpy, false},
+  {"bufferFromBuffer", testBuffer, true},
+  {"rgbFromBuffer", testToRGB, false},
+  {"bufferFromRGB", testFromRGB, false},
 };
 
 static void doTests(rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf)
@@ -117,8 +120,21 @@ static void doTests(rfb::PixelFormat &dstpf, rfb::PixelFormat &srcpf)
   printf("%s,%s", srcb, dstb);
 
   for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
-    printf(",");
-    doTest(tests[i].fn, dstpf, srcpf);
+    const rfb::PixelConvertImpl *impl, *orig;
+
+    if (!tests[i].perImpl) {
+      printf(",");
+      doTest(tests[i].fn, dstpf, srcpf);
+      continue;
+    }
+
+    orig = rfb::pixelConvertImpl;
+    for (impl = rfb::getPixelConvertImpls();impl->name != NULL;impl++) {
+      rfb::pixelConvertImpl = impl;
+      printf(",");
+      doTest(tests[i].fn, dstpf, srcpf);
+    }
+    rfb::pixelConvertImpl = orig;
   }
 
   printf("\n");
@@ -155,8 +171,17 @@ int main(int /*argc*/, char** /*argv*/)
   printf("#\n");
 
   printf("Source format,Destination Format");
-  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++)
-    printf(",%s", tests[i].label);
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
+    const rfb::PixelConvertImpl *impl;
+
+    if (!tests[i].perImpl) {
+      printf(",%s", tests[i].label);
+      continue;
+    }
+
+    for (impl = rfb::getPixelConvertImpls();impl->name != NULL;impl++)
+      printf(",%s (%s)", tests[i].label, impl->name);
+  }
   printf("\n");
 
   rfb::PixelFormat dstpf, srcpf;
@@ -30,6 +30,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/time.h>
 
@@ -40,11 +41,17 @@
 #include <rfb/CConnection.h>
 #include <rfb/CMsgReader.h>
 #include <rfb/CMsgWriter.h>
+#include <rfb/Configuration.h>
 #include <rfb/PixelBuffer.h>
 #include <rfb/PixelFormat.h>
+#include <rfb/util.h>
 
 #include "util.h"
 
+static rfb::IntParameter maxThreads("maxthreads",
+                                    "Compare the throughput of 1 up to "
+                                    "this many decoder threads", 0);
+
 // FIXME: Files are always in this format
 static const rfb::PixelFormat filePF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
 
@@ -73,12 +80,14 @@ public:
   virtual void setCursorPos(const rfb::Point&);
   virtual void framebufferUpdateStart();
   virtual void framebufferUpdateEnd();
+  virtual bool dataRect(const rfb::Rect&, int);
   virtual void setColourMapEntries(int, int, uint16_t*);
   virtual void bell();
   virtual void serverCutText(const char*);
 
 public:
   double cpuTime;
+  unsigned long long pixels;
 
 protected:
   rdr::FileInStream *in;
@@ -114,6 +123,7 @@ void DummyOutStream::overrun(size_t needed)
 CConn::CConn(const char *filename)
 {
   cpuTime = 0.0;
+  pixels = 0;
 
   in = new rdr::FileInStream(filename);
   out = new DummyOutStream;
@@ -169,6 +179,16 @@ void CConn::framebufferUpdateEnd()
   cpuTime += getCpuCounter();
 }
 
+bool CConn::dataRect(const rfb::Rect& r, int encoding)
+{
+  if (!CConnection::dataRect(r, encoding))
+    return false;
+
+  pixels += r.area();
+
+  return true;
+}
+
 void CConn::setColourMapEntries(int, int, uint16_t*)
 {
 }
@@ -185,6 +205,7 @@ struct stats
 {
   double decodeTime;
   double realTime;
+  unsigned long long pixels;
 };
 
 static struct stats runTest(const char *fn)
@@ -216,6 +237,7 @@ static struct stats runTest(const char *fn)
   s.decodeTime = cc->cpuTime;
   s.realTime = (double)stop.tv_sec - start.tv_sec;
   s.realTime += ((double)stop.tv_usec - start.tv_usec)/1000000.0;
+  s.pixels = cc->pixels;
 
   delete cc;
 
@@ -242,6 +264,59 @@ static void sort(double *array, int count)
 
 static const int runCount = 9;
 
+static void runThreadTests(const char *fn)
+{
+  int i, threads;
+  struct stats runs[runCount];
+  double values[runCount];
+  double median, baseline;
+
+  printf("Threads  Real time  Throughput     Speed-up\n");
+
+  baseline = 0;
+  threads = 1;
+  while (true) {
+    char buffer[16];
+
+    snprintf(buffer, sizeof(buffer), "%d", threads);
+    rfb::Configuration::setParam("DecodeThreads", buffer);
+
+    // Warmup
+    runTest(fn);
+
+    for (i = 0;i < runCount;i++)
+      runs[i] = runTest(fn);
+
+    for (i = 0;i < runCount;i++)
+      values[i] = runs[i].realTime;
+
+    sort(values, runCount);
+    median = values[runCount/2];
+
+    if (threads == 1)
+      baseline = median;
+
+    printf("%7d  %7.3f s  %-13s  %.2fx\n", threads, median,
+           rfb::siPrefix((long long)(runs[0].pixels / median), "pix/s").c_str(),
+           baseline / median);
+
+    if (threads >= maxThreads)
+      break;
+
+    threads *= 2;
+    if (threads > maxThreads)
+      threads = maxThreads;
+  }
+}
+
+static void usage(const char *argv0)
+{
+  fprintf(stderr, "Syntax: %s [options] <rfb file>\n", argv0);
+  fprintf(stderr, "Options:\n");
+  rfb::Configuration::listParams(79, 14);
+  exit(1);
+}
+
 int main(int argc, char **argv)
 {
   int i;
@@ -249,18 +324,45 @@ int main(int argc, char **argv)
   double values[runCount], dev[runCount];
   double median, meddev;
 
-  if (argc != 2) {
-    printf("Syntax: %s <rfb file>\n", argv[0]);
-    return 1;
+  const char *fn;
+
+  fn = NULL;
+  for (i = 1; i < argc; i++) {
+    if (rfb::Configuration::setParam(argv[i]))
+      continue;
+
+    if (argv[i][0] == '-') {
+      if (i + 1 < argc) {
+        if (rfb::Configuration::setParam(&argv[i][1], argv[i + 1])) {
+          i++;
+          continue;
+        }
+      }
+      usage(argv[0]);
+    }
+
+    if (fn != NULL)
+      usage(argv[0]);
+
+    fn = argv[i];
+  }
+
+  if (fn == NULL) {
+    fprintf(stderr, "No file specified!\n\n");
+    usage(argv[0]);
+  }
+
+  if (maxThreads > 0) {
+    runThreadTests(fn);
+    return 0;
   }
 
   // Warmup
-  runTest(argv[1]);
+  runTest(fn);
 
   // Multiple runs to get a good average
   for (i = 0;i < runCount;i++)
-    runs[i] = runTest(argv[1]);
-
+    runs[i] = runTest(fn);
   // Calculate median and median deviation for CPU usage
   for (i = 0;i < runCount;i++)
     values[i] = runs[i].decodeTime;
@@ -24,6 +24,9 @@
  * the ServerInit message. Mostly this consists of FramebufferUpdate
  * message using the HexTile encoding. Screen size and pixel format
  * are not encoded in the file and must be specified by the user.
+ *
+ * It can also measure the H.264 encoder on synthetic video at a few
+ * common resolutions, in which case no file is needed.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -37,6 +40,8 @@
 #include <math.h>
 #include <sys/time.h>
 
+#include <vector>
+
 #include <rdr/Exception.h>
 #include <rdr/OutStream.h>
 #include <rdr/FileInStream.h>
@@ -51,6 +56,10 @@
 #include <rfb/EncodeManager.h>
 #include <rfb/SConnection.h>
 #include <rfb/SMsgWriter.h>
+#ifdef HAVE_H264_ENCODER
+#include <rfb/H264Encoder.h>
+#include <rfb/Palette.h>
+#endif
 
 #include "util.h"
 
@@ -60,19 +69,31 @@ static rfb::IntParameter count("count", "Number of benchmark iterations", 9);
 
 static rfb::StringParameter format("format", "Pixel format (e.g. bgr888)", "");
 
+static rfb::IntParameter compress("compress",
+                                  "Compression level requested from the "
+                                  "server",
+                                  2, 0, 9);
+static rfb::IntParameter quality("quality",
+                                 "JPEG quality level requested from the "
+                                 "server (-1: lossless only)",
+                                 8, -1, 9);
+
 static rfb::BoolParameter translate("translate",
                                     "Translate 8-bit and 16-bit datasets into 24-bit",
                                     true);
 
+static rfb::BoolParameter h264("h264",
+                               "Measure the H.264 encoder on synthetic "
+                               "video instead of replaying a file",
+                               false);
+
 // The frame buffer (and output) is always this format
 static const rfb::PixelFormat fbPF(32, 24, false, true, 255, 255, 255, 0, 8, 16);
 
 // Encodings to use
 static const int32_t encodings[] = {
   rfb::encodingTight, rfb::encodingCopyRect, rfb::encodingRRE,
-  rfb::encodingHextile, rfb::encodingZRLE, rfb::pseudoEncodingLastRect,
-  rfb::pseudoEncodingQualityLevel0 + 8,
-  rfb::pseudoEncodingCompressLevel0 + 2};
+  rfb::encodingHextile, rfb::encodingZRLE, rfb::pseudoEncodingLastRect};
 
 class DummyOutStream : public rdr::OutStream {
 public:
@@ -192,7 +213,13 @@ CConn::CConn(const char *filename)
 
   sc = new SConn();
   sc->client.setPF((bool)translate ? fbPF : pf);
-  sc->setEncodings(sizeof(encodings) / sizeof(*encodings), encodings);
+
+  std::vector<int32_t> encs(encodings,
+                            encodings + sizeof(encodings) / sizeof(*encodings));
+  if (quality >= 0)
+    encs.push_back(rfb::pseudoEncodingQualityLevel0 + quality);
+  encs.push_back(rfb::pseudoEncodingCompressLevel0 + compress);
+  sc->setEncodings(encs.size(), &encs[0]);
 }
 
 CConn::~CConn()
@@ -385,6 +412,109 @@ static struct stats runTest(const char *fn)
   return s;
 }
 
+#ifdef HAVE_H264_ENCODER
+static const int videoSizes[][2] = {
+  { 640, 360 }, { 1280, 720 }, { 1920, 1080 } };
+
+static const int videoFrames = 60;
+
+// Something that moves, and has both smooth and sharp parts
+static void drawVideoFrame(rfb::ManagedPixelBuffer* pb, int frame)
+{
+  uint8_t* buffer;
+  int stride;
+  uint8_t* line;
+
+  int w, h;
+
+  w = pb->width();
+  h = pb->height();
+
+  buffer = pb->getBufferRW(pb->getRect(), &stride);
+  line = new uint8_t[w * 3];
+
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; x++) {
+      int bx, by;
+
+      line[x*3 + 0] = (x + frame * 4) * 255 / w;
+      line[x*3 + 1] = (y + frame * 2) * 255 / h;
+      line[x*3 + 2] = ((x + y) / 2 + frame * 8) & 0xff;
+
+      // A bouncing box with a checkerboard pattern
+      bx = x - (frame * 7) % (w - w/4);
+      by = y - (frame * 5) % (h - h/4);
+      if ((bx >= 0) && (bx < w/4) && (by >= 0) && (by < h/4)) {
+        uint8_t c = (((bx / 8) + (by / 8)) % 2) ? 255 : 0;
+        line[x*3 + 0] = line[x*3 + 1] = line[x*3 + 2] = c;
+      }
+    }
+
+    pb->getPF().bufferFromRGB(buffer + y * stride * pb->getPF().bpp/8,
+                              line, w);
+  }
+
+  delete [] line;
+
+  pb->commitBufferRW(pb->getRect());
+}
+
+static int runH264Test()
+{
+  printf("Resolution,Bits/frame,Encode ms/frame\n");
+
+  for (size_t i = 0; i < sizeof(videoSizes)/sizeof(videoSizes[0]); i++) {
+    SConn* sc;
+    rfb::H264Encoder* encoder;
+    rfb::ManagedPixelBuffer pb(fbPF, videoSizes[i][0], videoSizes[i][1]);
+
+    size_t before, bytes;
+    double time;
+
+    sc = new SConn();
+    encoder = new rfb::H264Encoder(sc);
+
+    // Same quality as the replayed files
+    encoder->setQualityLevel(quality);
+    encoder->setRect(pb.getRect());
+
+    bytes = 0;
+    time = 0;
+
+    try {
+      // The first frame is a keyframe, which is not what we want
+      // to measure
+      drawVideoFrame(&pb, 0);
+      encoder->writeRect(&pb, rfb::Palette());
+
+      for (int frame = 1; frame <= videoFrames; frame++) {
+        drawVideoFrame(&pb, frame);
+
+        before = sc->getOutStream()->length();
+
+        startCpuCounter();
+        encoder->writeRect(&pb, rfb::Palette());
+        endCpuCounter();
+
+        time += getCpuCounter();
+        bytes += sc->getOutStream()->length() - before;
+      }
+    } catch (rdr::Exception& e) {
+      fprintf(stderr, "Failed to encode video: %s\n", e.str());
+      exit(1);
+    }
+
+    printf("%dx%d,%g,%g\n", videoSizes[i][0], videoSizes[i][1],
+           (double)bytes * 8 / videoFrames, time * 1000 / videoFrames);
+
+    delete encoder;
+    delete sc;
+  }
+
+  return 0;
+}
+#endif
+
 static void sort(double *array, int count)
 {
   bool sorted;
@@ -438,6 +568,15 @@ int main(int argc, char **argv)
     fn = argv[i];
   }
 
+  if (h264) {
+#ifdef HAVE_H264_ENCODER
+    return runH264Test();
+#else
+    fprintf(stderr, "H.264 encoding is not supported by this build!\n");
+    return 1;
+#endif
+  }
+
   int runCount = count;
   struct stats *runs = new struct stats[runCount];
   double *values = new double[runCount];
@@ -0,0 +1,206 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program measures how the cost of waking up for activity on a
+ * single connection grows with the number of other, idle connections,
+ * using network::SocketMonitor and, for comparison, a select() loop
+ * like the one x0vncserver used to have.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include <network/SocketMonitor.h>
+
+#include "util.h"
+
+static const int iterations = 20000;
+
+static const int idleCounts[] = { 0, 100, 1000, 5000, 10000 };
+
+static int activeFds[2];
+static int* idleFds;
+
+static void ping()
+{
+  char c = 0;
+  if (write(activeFds[1], &c, 1) != 1) {
+    perror("write");
+    exit(1);
+  }
+}
+
+static void pong()
+{
+  char c;
+  if (read(activeFds[0], &c, 1) != 1) {
+    perror("read");
+    exit(1);
+  }
+}
+
+static double testMonitor(int idle)
+{
+  network::SocketMonitor monitor;
+
+  monitor.add(activeFds[0]);
+  for (int i = 0;i < idle;i++)
+    monitor.add(idleFds[i*2]);
+
+  startCpuCounter();
+
+  for (int i = 0;i < iterations;i++) {
+    ping();
+
+    // The first waits also report the initial state of the idle
+    // sockets (i.e. writable)
+    do {
+      monitor.wait(-1);
+    } while (!monitor.isReadable(activeFds[0]));
+
+    pong();
+    monitor.checkReadable(activeFds[0]);
+  }
+
+  endCpuCounter();
+
+  return getCpuCounter();
+}
+
+static double testSelect(int idle)
+{
+  startCpuCounter();
+
+  for (int i = 0;i < iterations;i++) {
+    fd_set rfds, wfds;
+
+    ping();
+
+    // Everything has to be described again on every wait
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+    FD_SET(activeFds[0], &rfds);
+    for (int j = 0;j < idle;j++)
+      FD_SET(idleFds[j*2], &rfds);
+
+    if (select(FD_SETSIZE, &rfds, &wfds, NULL, NULL) < 0) {
+      perror("select");
+      exit(1);
+    }
+
+    if (!FD_ISSET(activeFds[0], &rfds)) {
+      fprintf(stderr, "Active socket not reported as readable\n");
+      exit(1);
+    }
+
+    pong();
+  }
+
+  endCpuCounter();
+
+  return getCpuCounter();
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  struct rlimit limit;
+  int maxIdle;
+
+  time_t t;
+  char datebuffer[256];
+
+  size_t i;
+
+  maxIdle = idleCounts[sizeof(idleCounts)/sizeof(idleCounts[0]) - 1];
+
+  // Every idle connection needs two descriptors
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    getrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < (rlim_t)maxIdle * 2 + 16)
+      maxIdle = (limit.rlim_cur - 16) / 2;
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, activeFds) != 0) {
+    perror("socketpair");
+    return 1;
+  }
+
+  idleFds = new int[maxIdle * 2];
+  for (int j = 0;j < maxIdle;j++) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, &idleFds[j*2]) != 0) {
+      perror("socketpair");
+      return 1;
+    }
+  }
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Socket Monitor Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Wake ups per test: %d\n", iterations);
+  printf("#\n");
+  printf("# Note: Results are CPU us/wake up, select() is limited to "
+         "descriptors below %d\n", FD_SETSIZE);
+  printf("#\n");
+
+  {
+    network::SocketMonitor monitor;
+    printf("Idle connections,select,SocketMonitor (%s)\n",
+           monitor.getMethod());
+  }
+
+  for (i = 0;i < sizeof(idleCounts)/sizeof(idleCounts[0]);i++) {
+    int idle;
+
+    idle = idleCounts[i];
+    if (idle > maxIdle) {
+      if ((i > 0) && (idleCounts[i-1] >= maxIdle))
+        break;
+      idle = maxIdle;
+    }
+
+    printf("%d,", idle);
+
+    if ((idle == 0) || (idleFds[idle*2 - 2] < FD_SETSIZE))
+      printf("%g", testSelect(idle) * 1e6 / iterations);
+
+    printf(",%g\n", testMonitor(idle) * 1e6 / iterations);
+  }
+
+  for (int j = 0;j < maxIdle * 2;j++)
+    close(idleFds[j]);
+  delete [] idleFds;
+
+  close(activeFds[0]);
+  close(activeFds[1]);
+
+  return 0;
+}
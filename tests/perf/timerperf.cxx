@@ -0,0 +1,212 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+/*
+ * This program measures the cost of the basic operations on rfb::Timer
+ * with a large number of active timers, similar to a server with
+ * hundreds of connected clients.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <rfb/Timer.h>
+
+#include "util.h"
+
+static const int timerCount = 10000;
+static const int runs = 10;
+
+class CountingCallback : public rfb::Timer::Callback {
+public:
+  CountingCallback() : count(0) {}
+  virtual bool handleTimeout(rfb::Timer* /*t*/) { count++; return false; }
+
+  int count;
+};
+
+static CountingCallback callback;
+static rfb::Timer* timers[timerCount];
+
+// Long enough that nothing expires during the test
+static int randomTimeout()
+{
+  return 60000 + rand() % 60000;
+}
+
+static void waitMs(int ms)
+{
+#ifdef WIN32
+  Sleep(ms);
+#else
+  usleep(ms * 1000);
+#endif
+}
+
+static void stopAll()
+{
+  for (int i = 0;i < timerCount;i++)
+    timers[i]->stop();
+}
+
+static double testStart()
+{
+  startCpuCounter();
+  for (int i = 0;i < timerCount;i++)
+    timers[i]->start(randomTimeout());
+  endCpuCounter();
+
+  stopAll();
+
+  return getCpuCounter();
+}
+
+static double testRestart()
+{
+  for (int i = 0;i < timerCount;i++)
+    timers[i]->start(randomTimeout());
+
+  startCpuCounter();
+  for (int i = 0;i < timerCount;i++)
+    timers[rand() % timerCount]->start(randomTimeout());
+  endCpuCounter();
+
+  stopAll();
+
+  return getCpuCounter();
+}
+
+static double testStop()
+{
+  for (int i = 0;i < timerCount;i++)
+    timers[i]->start(randomTimeout());
+
+  // Stop in a different order than started
+  startCpuCounter();
+  for (int i = 0;i < timerCount;i++)
+    timers[(i * 7919) % timerCount]->stop();
+  endCpuCounter();
+
+  return getCpuCounter();
+}
+
+static double testCheck()
+{
+  for (int i = 0;i < timerCount;i++)
+    timers[i]->start(randomTimeout());
+
+  // Nothing is due, so this is just the cost of finding that out
+  startCpuCounter();
+  for (int i = 0;i < timerCount;i++)
+    rfb::Timer::checkTimeouts();
+  endCpuCounter();
+
+  stopAll();
+
+  return getCpuCounter();
+}
+
+static double testDispatch()
+{
+  for (int i = 0;i < timerCount;i++)
+    timers[i]->start(1 + rand() % 5);
+
+  waitMs(10);
+
+  callback.count = 0;
+
+  startCpuCounter();
+  rfb::Timer::checkTimeouts();
+  endCpuCounter();
+
+  if (callback.count != timerCount) {
+    fprintf(stderr, "Only %d of %d timers dispatched\n",
+            callback.count, timerCount);
+    exit(1);
+  }
+
+  return getCpuCounter();
+}
+
+struct TestEntry {
+  const char *label;
+  double (*fn)();
+};
+
+static const TestEntry tests[] = {
+  {"start", testStart},
+  {"restart", testRestart},
+  {"stop", testStop},
+  {"check", testCheck},
+  {"dispatch", testDispatch},
+};
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  time_t t;
+  char datebuffer[256];
+
+  size_t i;
+
+  for (i = 0;i < timerCount;i++)
+    timers[i] = new rfb::Timer(&callback);
+
+  time(&t);
+  strftime(datebuffer, sizeof(datebuffer), "%Y-%m-%d %H:%M UTC", gmtime(&t));
+
+  printf("# Timer Performance Test %s\n", datebuffer);
+  printf("#\n");
+  printf("# Active timers: %d\n", timerCount);
+  printf("# Runs: %d\n", runs);
+  printf("#\n");
+  printf("# Note: Results are ns/operation, best of all runs\n");
+  printf("#\n");
+
+  printf("Operation,Time\n");
+
+  for (i = 0;i < sizeof(tests)/sizeof(tests[0]);i++) {
+    double best;
+
+    best = 0;
+    for (int run = 0;run < runs;run++) {
+      double time;
+
+      time = tests[i].fn();
+      if ((run == 0) || (time < best))
+        best = time;
+    }
+
+    printf("%s,%g\n", tests[i].label, best * 1e9 / timerCount);
+  }
+
+  for (i = 0;i < timerCount;i++)
+    delete timers[i];
+
+  return 0;
+}
@@ -0,0 +1,149 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <sys/time.h>
+
+#include <rfb/ChangeHeatMap.h>
+
+static const rfb::Rect screen(0, 0, 1000, 600);
+
+// Time only moves when we say so
+class TestHeatMap : public rfb::ChangeHeatMap {
+public:
+  TestHeatMap() { clock.tv_sec = 1000; clock.tv_usec = 0; }
+
+  void advance(unsigned ms) {
+    clock.tv_usec += ms * 1000;
+    clock.tv_sec += clock.tv_usec / 1000000;
+    clock.tv_usec %= 1000000;
+  }
+
+protected:
+  virtual void getTime(struct timeval* now) const { *now = clock; }
+
+private:
+  struct timeval clock;
+};
+
+static void check(const char* name, rfb::ChangeHeatMap::Class expected,
+                  rfb::ChangeHeatMap::Class actual)
+{
+  printf("%s: ", name);
+
+  if (actual != expected) {
+    printf("FAILED: got %s, expected %s\n",
+           rfb::ChangeHeatMap::className(actual),
+           rfb::ChangeHeatMap::className(expected));
+    return;
+  }
+
+  printf("OK\n");
+}
+
+static void testUntouched()
+{
+  TestHeatMap map;
+
+  map.update(rfb::Region(), screen);
+
+  check("Untouched area", rfb::ChangeHeatMap::Static,
+        map.classify(rfb::Rect(100, 100, 200, 200)));
+}
+
+static void testOneOff()
+{
+  TestHeatMap map;
+
+  map.update(rfb::Region(rfb::Rect(100, 100, 400, 400)), screen);
+
+  check("Single change", rfb::ChangeHeatMap::Static,
+        map.classify(rfb::Rect(100, 100, 400, 400)));
+}
+
+static void testTyping()
+{
+  TestHeatMap map;
+
+  for (int i = 0; i < 10; i++) {
+    map.update(rfb::Region(rfb::Rect(70 + i * 8, 70, 78 + i * 8, 86)),
+               screen);
+    map.advance(50);
+  }
+
+  check("Typing", rfb::ChangeHeatMap::TextUI,
+        map.classify(rfb::Rect(64, 64, 128, 128)));
+  check("Next to typing", rfb::ChangeHeatMap::Static,
+        map.classify(rfb::Rect(300, 300, 400, 400)));
+}
+
+static void testVideo()
+{
+  TestHeatMap map;
+  rfb::Region region;
+
+  for (int i = 0; i < 10; i++) {
+    map.update(rfb::Region(rfb::Rect(200, 100, 520, 340)), screen);
+    map.advance(20);
+  }
+
+  check("Video", rfb::ChangeHeatMap::Motion,
+        map.classify(rfb::Rect(300, 200, 310, 210)));
+
+  region = map.getRegion(rfb::ChangeHeatMap::Motion);
+  printf("Video region: ");
+  if (region.get_bounding_rect() != rfb::Rect(192, 128, 512, 320))
+    printf("FAILED\n");
+  else
+    printf("OK\n");
+
+  // Stopped for a while
+  map.advance(300);
+  check("Paused video", rfb::ChangeHeatMap::Static,
+        map.classify(rfb::Rect(300, 200, 310, 210)));
+}
+
+static void testResize()
+{
+  TestHeatMap map;
+
+  for (int i = 0; i < 10; i++) {
+    map.update(rfb::Region(rfb::Rect(200, 100, 520, 340)), screen);
+    map.advance(20);
+  }
+
+  map.update(rfb::Region(), rfb::Rect(0, 0, 800, 600));
+
+  check("Resized", rfb::ChangeHeatMap::Static,
+        map.classify(rfb::Rect(300, 200, 310, 210)));
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  testUntouched();
+  testOneOff();
+  testTyping();
+  testVideo();
+  testResize();
+
+  return 0;
+}
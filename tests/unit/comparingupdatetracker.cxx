@@ -0,0 +1,833 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <rfb/ComparingUpdateTracker.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/blockCompare.h>
+
+#define BLOCK_SIZE 64
+
+// The original memcmp() based version of
+// ComparingUpdateTracker::compareRect(), used as a reference
+static void referenceCompareRect(const rfb::Rect& r,
+                                 rfb::PixelBuffer* fb,
+                                 rfb::ManagedPixelBuffer* oldFb,
+                                 rfb::Region* newChanged)
+{
+  int bytesPerPixel = fb->getPF().bpp/8;
+  int oldStride;
+  uint8_t* oldData = oldFb->getBufferRW(r, &oldStride);
+  int oldStrideBytes = oldStride * bytesPerPixel;
+
+  int minCompareWidthInPixels = BLOCK_SIZE / 8;
+  int minCompareWidthInBytes = minCompareWidthInPixels * bytesPerPixel;
+
+  for (int blockTop = r.tl.y; blockTop < r.br.y; blockTop += BLOCK_SIZE)
+  {
+    rfb::Rect pos(r.tl.x, blockTop, r.br.x,
+                  std::min(r.br.y, blockTop+BLOCK_SIZE));
+    int fbStride;
+    const uint8_t* newBlockPtr = fb->getBuffer(pos, &fbStride);
+    int newStrideBytes = fbStride * bytesPerPixel;
+
+    uint8_t* oldBlockPtr = oldData;
+    int blockBottom = std::min(blockTop+BLOCK_SIZE, r.br.y);
+
+    for (int blockLeft = r.tl.x; blockLeft < r.br.x; blockLeft += BLOCK_SIZE)
+    {
+      const uint8_t* newPtr = newBlockPtr;
+      uint8_t* oldPtr = oldBlockPtr;
+
+      int blockRight = std::min(blockLeft+BLOCK_SIZE, r.br.x);
+      int blockWidthInBytes = (blockRight-blockLeft) * bytesPerPixel;
+
+      for (int y = blockTop; y < blockBottom; y++)
+      {
+        if (memcmp(oldPtr, newPtr, blockWidthInBytes) != 0)
+        {
+          int changeHeight = blockBottom - y;
+          int changeLeft = blockLeft;
+          int changeRight = blockRight;
+
+          {
+            const uint8_t* newRowPtr = newPtr + ((changeHeight - 1) * newStrideBytes);
+            const uint8_t* oldRowPtr = oldPtr + ((changeHeight - 1) * oldStrideBytes);
+            while (changeHeight > 1 && memcmp(oldRowPtr, newRowPtr, blockWidthInBytes) == 0)
+            {
+              newRowPtr -= newStrideBytes;
+              oldRowPtr -= oldStrideBytes;
+
+              changeHeight--;
+            }
+          }
+
+          {
+            const uint8_t* newColumnPtr = newPtr;
+            const uint8_t* oldColumnPtr = oldPtr;
+            while (changeLeft + minCompareWidthInPixels < changeRight)
+            {
+              const uint8_t* newRowPtr = newColumnPtr;
+              const uint8_t* oldRowPtr = oldColumnPtr;
+              for (int row = 0; row < changeHeight; row++)
+              {
+                if (memcmp(oldRowPtr, newRowPtr, minCompareWidthInBytes) != 0)
+                  goto endOfChangeLeft;
+
+                newRowPtr += newStrideBytes;
+                oldRowPtr += oldStrideBytes;
+              }
+
+              newColumnPtr += minCompareWidthInBytes;
+              oldColumnPtr += minCompareWidthInBytes;
+
+              changeLeft += minCompareWidthInPixels;
+            }
+          }
+        endOfChangeLeft:
+
+          {
+            const uint8_t* newColumnPtr = newPtr + blockWidthInBytes;
+            const uint8_t* oldColumnPtr = oldPtr + blockWidthInBytes;
+            while (changeLeft + minCompareWidthInPixels < changeRight)
+            {
+              newColumnPtr -= minCompareWidthInBytes;
+              oldColumnPtr -= minCompareWidthInBytes;
+
+              const uint8_t* newRowPtr = newColumnPtr;
+              const uint8_t* oldRowPtr = oldColumnPtr;
+              for (int row = 0; row < changeHeight; row++)
+              {
+                if (memcmp(oldRowPtr, newRowPtr, minCompareWidthInBytes) != 0)
+                  goto endOfChangeRight;
+
+                newRowPtr += newStrideBytes;
+                oldRowPtr += oldStrideBytes;
+              }
+
+              changeRight -= minCompareWidthInPixels;
+            }
+          }
+        endOfChangeRight:
+
+          newChanged->assign_union(rfb::Region(rfb::Rect(changeLeft, y, changeRight, y + changeHeight)));
+
+          for (int row = 0; row < changeHeight; row++)
+          {
+            memcpy(oldPtr, newPtr, blockWidthInBytes);
+            newPtr += newStrideBytes;
+            oldPtr += oldStrideBytes;
+          }
+
+          break;
+        }
+
+        newPtr += newStrideBytes;
+        oldPtr += oldStrideBytes;
+      }
+
+      oldBlockPtr += blockWidthInBytes;
+      newBlockPtr += blockWidthInBytes;
+    }
+
+    oldData += oldStrideBytes * BLOCK_SIZE;
+  }
+
+  oldFb->commitBufferRW(r);
+}
+
+static bool blockTest(const rfb::BlockCompareImpl* impl,
+                      int width, int height, int changes)
+{
+  const int stride = 300;
+  uint8_t oldData[stride * (BLOCK_SIZE + 1)];
+  uint8_t newData[stride * (BLOCK_SIZE + 1)];
+  uint8_t origData[stride * (BLOCK_SIZE + 1)];
+  int left, right, top, bottom;
+  bool found;
+  rfb::Rect changed;
+
+  for (int i = 0; i < (int)sizeof(oldData); i++)
+    oldData[i] = newData[i] = rand();
+
+  for (int i = 0; i < changes; i++)
+    newData[(rand() % height) * stride + rand() % width] ^= 1 + rand() % 255;
+
+  // Anything outside the block must be left alone
+  newData[width] ^= 0xff;
+  newData[height * stride] ^= 0xff;
+
+  memcpy(origData, oldData, sizeof(oldData));
+
+  left = width;
+  right = 0;
+  top = height;
+  bottom = 0;
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      if (oldData[y * stride + x] == newData[y * stride + x])
+        continue;
+
+      left = std::min(left, x);
+      right = std::max(right, x + 1);
+      top = std::min(top, y);
+      bottom = std::max(bottom, y + 1);
+    }
+  }
+
+  found = impl->func(oldData, stride, newData, stride,
+                     width, height, &changed);
+
+  if (found != (right != 0))
+    return false;
+  if (found && (changed != rfb::Rect(left, top, right, bottom)))
+    return false;
+
+  for (int y = 0; y < BLOCK_SIZE + 1; y++) {
+    for (int x = 0; x < stride; x++) {
+      int i;
+
+      i = y * stride + x;
+
+      if ((x < width) && (y < height)) {
+        if (oldData[i] != newData[i])
+          return false;
+      } else {
+        if (oldData[i] != origData[i])
+          return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+static void blockTests()
+{
+  const rfb::BlockCompareImpl* impl;
+
+  for (impl = rfb::getBlockCompareImpls(); impl->name != NULL; impl++) {
+    bool ok;
+
+    printf("compareBlock (%s): ", impl->name);
+
+    ok = true;
+    for (int i = 0; i < 5000; i++) {
+      int width, height, changes;
+
+      width = 1 + rand() % (BLOCK_SIZE * 4);
+      height = 1 + rand() % BLOCK_SIZE;
+
+      switch (rand() % 4) {
+      case 0:
+        changes = 0;
+        break;
+      case 1:
+        changes = 1;
+        break;
+      default:
+        changes = rand() % 50;
+      }
+
+      if (!blockTest(impl, width, height, changes)) {
+        ok = false;
+        break;
+      }
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    fflush(stdout);
+  }
+}
+
+typedef bool (*SolidCheckFunc)(const uint8_t*, int, int, int, int,
+                               const uint8_t*);
+
+static bool solidTest(SolidCheckFunc func, int bpp,
+                      int width, int height, bool solid)
+{
+  const int stride = 300 * 4;
+  uint8_t data[stride * (BLOCK_SIZE + 1)];
+  uint8_t colour[4];
+  int bytesPerPixel;
+
+  bytesPerPixel = bpp / 8;
+
+  for (int i = 0; i < 4; i++)
+    colour[i] = rand();
+
+  // Random data around the block, to make sure it is ignored
+  for (int i = 0; i < (int)sizeof(data); i++)
+    data[i] = rand();
+
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++)
+      memcpy(data + y * stride + x * bytesPerPixel, colour, bytesPerPixel);
+  }
+
+  if (!solid) {
+    int x, y;
+
+    x = rand() % width;
+    y = rand() % height;
+
+    data[y * stride + x * bytesPerPixel + rand() % bytesPerPixel] ^=
+      1 + rand() % 255;
+  }
+
+  return func(data, stride, width, height, bpp, colour) == solid;
+}
+
+static void solidTests()
+{
+  const struct {
+    const char* name;
+    SolidCheckFunc func;
+  } funcs[] = {
+    { "best", rfb::checkSolidBlock },
+    { "scalar", rfb::checkSolidBlockScalar },
+  };
+
+  for (size_t i = 0; i < sizeof(funcs) / sizeof(funcs[0]); i++) {
+    bool ok;
+
+    printf("checkSolidBlock (%s): ", funcs[i].name);
+
+    ok = true;
+    for (int j = 0; j < 5000; j++) {
+      int bpp, width, height;
+
+      bpp = 8 << (rand() % 3);
+      width = 1 + rand() % (BLOCK_SIZE * 4);
+      height = 1 + rand() % BLOCK_SIZE;
+
+      if (!solidTest(funcs[i].func, bpp, width, height, rand() % 2)) {
+        ok = false;
+        break;
+      }
+    }
+
+    printf("%s\n", ok ? "OK" : "FAILED");
+    fflush(stdout);
+  }
+}
+
+static void damage(rfb::ManagedPixelBuffer* pb, rfb::Region* changed)
+{
+  int stride;
+  uint8_t* data;
+  int bpp;
+
+  bpp = pb->getPF().bpp/8;
+  data = pb->getBufferRW(pb->getRect(), &stride);
+
+  for (int i = rand() % 4; i > 0; i--) {
+    rfb::Rect r;
+    int pixels;
+
+    r.tl.x = rand() % pb->width();
+    r.tl.y = rand() % pb->height();
+    r.br.x = std::min(pb->width(), r.tl.x + 1 + rand() % 100);
+    r.br.y = std::min(pb->height(), r.tl.y + 1 + rand() % 100);
+
+    // Sometimes a solid change, sometimes just a few pixels
+    if (rand() % 2)
+      pixels = r.area();
+    else
+      pixels = rand() % 10;
+
+    for (int p = 0; p < pixels; p++) {
+      int x, y;
+
+      if (pixels == r.area()) {
+        x = r.tl.x + p % r.width();
+        y = r.tl.y + p / r.width();
+      } else {
+        x = r.tl.x + rand() % r.width();
+        y = r.tl.y + rand() % r.height();
+      }
+
+      data[(y * stride + x) * bpp + rand() % bpp] ^= 1 + rand() % 255;
+    }
+
+    // Applications often report more than they really change
+    r.tl.x = std::max(0, r.tl.x - rand() % 20);
+    r.tl.y = std::max(0, r.tl.y - rand() % 20);
+
+    changed->assign_union(r);
+  }
+
+  pb->commitBufferRW(pb->getRect());
+}
+
+static void trackerTest(int bpp, int threads)
+{
+  rfb::PixelFormat pf;
+  int depth;
+
+  printf("ComparingUpdateTracker (%d bpp, %d threads): ", bpp, threads);
+
+  depth = bpp == 32 ? 24 : bpp;
+  pf = rfb::PixelFormat(bpp, depth, false, true,
+                        (1 << (depth/3)) - 1, (1 << (depth/3)) - 1,
+                        (1 << (depth/3)) - 1,
+                        0, depth/3, depth/3*2);
+
+  rfb::ManagedPixelBuffer fb(pf, 300, 400);
+  rfb::ManagedPixelBuffer oldFb(pf, 300, 400);
+
+  int stride;
+  uint8_t* data = fb.getBufferRW(fb.getRect(), &stride);
+  for (int i = 0; i < stride * fb.height() * bpp/8; i++)
+    data[i] = rand();
+  fb.commitBufferRW(fb.getRect());
+
+  oldFb.imageRect(fb.getRect(), fb.getBuffer(fb.getRect(), &stride),
+                  stride);
+
+  rfb::ComparingUpdateTracker tracker(&fb, threads);
+
+  // The first round just takes a copy of the framebuffer
+  tracker.compare();
+  tracker.clear();
+
+  for (int i = 0; i < 2000; i++) {
+    rfb::Region changed, expected;
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::iterator iter;
+    rfb::UpdateInfo ui;
+
+    damage(&fb, &changed);
+
+    changed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter)
+      referenceCompareRect(*iter, &fb, &oldFb, &expected);
+
+    tracker.add_changed(changed);
+    tracker.compare();
+    tracker.getUpdateInfo(&ui, fb.getRect());
+    tracker.clear();
+
+    if (ui.changed != expected) {
+      printf("FAILED\n");
+      fflush(stdout);
+      return;
+    }
+  }
+
+  printf("OK\n");
+  fflush(stdout);
+}
+
+// A framebuffer that only gets new contents when asked to grab them
+class GrabbingPixelBuffer : public rfb::ManagedPixelBuffer {
+public:
+  GrabbingPixelBuffer(const rfb::PixelFormat& pf,
+                      rfb::ManagedPixelBuffer* screen_)
+    : rfb::ManagedPixelBuffer(pf, screen_->width(), screen_->height()),
+      screen(screen_) {}
+
+  virtual void grabRegion(const rfb::Region& region)
+  {
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::iterator i;
+    const uint8_t* data;
+    int stride;
+
+    region.get_rects(&rects);
+    for (i = rects.begin(); i != rects.end(); ++i) {
+      data = screen->getBuffer(*i, &stride);
+      imageRect(*i, data, stride);
+    }
+  }
+
+private:
+  rfb::ManagedPixelBuffer* screen;
+};
+
+static void grabTest(int threads, bool useHashes)
+{
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+
+  printf("ComparingUpdateTracker grab (%d threads%s): ",
+         threads, useHashes ? ", hashes" : "");
+
+  rfb::ManagedPixelBuffer screen(pf, 300, 400);
+  rfb::ManagedPixelBuffer prevScreen(pf, 300, 400);
+  GrabbingPixelBuffer fb(pf, &screen);
+  rfb::ManagedPixelBuffer oldFb(pf, 300, 400);
+
+  int stride;
+  uint8_t* data = screen.getBufferRW(screen.getRect(), &stride);
+  for (int i = 0; i < stride * screen.height() * 4; i++)
+    data[i] = rand();
+  screen.commitBufferRW(screen.getRect());
+
+  fb.grabRegion(screen.getRect());
+  oldFb.imageRect(screen.getRect(), data, stride);
+
+  rfb::ComparingUpdateTracker tracker(&fb, threads, useHashes);
+
+  tracker.compare();
+  tracker.clear();
+
+  for (int i = 0; i < 500; i++) {
+    rfb::Region changed, expected;
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::iterator iter;
+    rfb::UpdateInfo ui;
+    std::vector<bool> reported;
+    const uint32_t *screenData, *prevData;
+    int prevStride;
+
+    screenData = (const uint32_t*)screen.getBuffer(screen.getRect(),
+                                                   &stride);
+    prevScreen.imageRect(screen.getRect(), screenData, stride);
+
+    damage(&screen, &changed);
+
+    changed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter)
+      referenceCompareRect(*iter, &screen, &oldFb, &expected);
+
+    tracker.add_changed(changed);
+    tracker.grabAndCompare(changed);
+    tracker.getUpdateInfo(&ui, fb.getRect());
+    tracker.clear();
+
+    if (useHashes) {
+      // Hashes only find changed rows, so just check that nothing
+      // that changed is missing
+      if (!ui.changed.subtract(changed).is_empty()) {
+        printf("FAILED\n");
+        fflush(stdout);
+        return;
+      }
+
+      reported.assign(screen.width() * screen.height(), false);
+      ui.changed.get_rects(&rects);
+      for (iter = rects.begin(); iter != rects.end(); ++iter) {
+        for (int y = iter->tl.y; y < iter->br.y; y++) {
+          for (int x = iter->tl.x; x < iter->br.x; x++)
+            reported[y * screen.width() + x] = true;
+        }
+      }
+
+      screenData = (const uint32_t*)screen.getBuffer(screen.getRect(),
+                                                     &stride);
+      prevData = (const uint32_t*)prevScreen.getBuffer(screen.getRect(),
+                                                       &prevStride);
+      for (int y = 0; y < screen.height(); y++) {
+        for (int x = 0; x < screen.width(); x++) {
+          if (reported[y * screen.width() + x])
+            continue;
+          if (screenData[y * stride + x] != prevData[y * prevStride + x]) {
+            printf("FAILED\n");
+            fflush(stdout);
+            return;
+          }
+        }
+      }
+
+      changed.get_rects(&rects);
+    } else if (ui.changed != expected) {
+      printf("FAILED\n");
+      fflush(stdout);
+      return;
+    }
+
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+      int fbStride, screenStride;
+      const uint8_t *fbData, *screenData;
+
+      fbData = fb.getBuffer(*iter, &fbStride);
+      screenData = screen.getBuffer(*iter, &screenStride);
+      for (int y = 0; y < iter->height(); y++) {
+        if (memcmp(fbData + y * fbStride * 4,
+                   screenData + y * screenStride * 4,
+                   iter->width() * 4) != 0) {
+          printf("FAILED\n");
+          fflush(stdout);
+          return;
+        }
+      }
+    }
+  }
+
+  printf("OK\n");
+  fflush(stdout);
+}
+
+static void hashTest(int bpp, int threads)
+{
+  rfb::PixelFormat pf;
+  int depth;
+
+  printf("ComparingUpdateTracker hashes (%d bpp, %d threads): ",
+         bpp, threads);
+
+  depth = bpp == 32 ? 24 : bpp;
+  pf = rfb::PixelFormat(bpp, depth, false, true,
+                        (1 << (depth/3)) - 1, (1 << (depth/3)) - 1,
+                        (1 << (depth/3)) - 1,
+                        0, depth/3, depth/3*2);
+
+  rfb::ManagedPixelBuffer fb(pf, 300, 400);
+  rfb::ManagedPixelBuffer prevFb(pf, 300, 400);
+
+  int stride;
+  uint8_t* data = fb.getBufferRW(fb.getRect(), &stride);
+  for (int i = 0; i < stride * fb.height() * bpp/8; i++)
+    data[i] = rand();
+  fb.commitBufferRW(fb.getRect());
+
+  rfb::ComparingUpdateTracker tracker(&fb, threads, true);
+
+  tracker.compare();
+  tracker.clear();
+
+  for (int i = 0; i < 300; i++) {
+    rfb::Region changed;
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::iterator iter;
+    rfb::UpdateInfo ui;
+    std::vector<bool> reported;
+    int prevStride;
+    const uint8_t* prevData;
+
+    prevFb.imageRect(fb.getRect(), fb.getBuffer(fb.getRect(), &stride),
+                     stride);
+
+    if (rand() % 4 == 0) {
+      rfb::Rect dest;
+      rfb::Point delta;
+
+      delta = rfb::Point(rand() % 41 - 20, rand() % 41 - 20);
+      dest = rfb::Rect(rand() % 200, rand() % 300, 0, 0);
+      dest.br = dest.tl.translate(rfb::Point(1 + rand() % 100,
+                                             1 + rand() % 100));
+      dest = dest.intersect(fb.getRect())
+                 .intersect(fb.getRect().translate(delta));
+
+      if (!dest.is_empty()) {
+        fb.copyRect(dest, delta);
+        prevFb.copyRect(dest, delta);
+        tracker.add_copied(dest, delta);
+      }
+    }
+
+    damage(&fb, &changed);
+
+    tracker.add_changed(changed);
+    tracker.compare();
+    tracker.getUpdateInfo(&ui, fb.getRect());
+    tracker.clear();
+
+    // Must not report more than we said
+    if (!ui.changed.subtract(changed).is_empty()) {
+      printf("FAILED\n");
+      fflush(stdout);
+      return;
+    }
+
+    // ...but also not miss anything
+    reported.assign(fb.width() * fb.height(), false);
+    ui.changed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter) {
+      for (int y = iter->tl.y; y < iter->br.y; y++) {
+        for (int x = iter->tl.x; x < iter->br.x; x++)
+          reported[y * fb.width() + x] = true;
+      }
+    }
+
+    data = (uint8_t*)fb.getBuffer(fb.getRect(), &stride);
+    prevData = prevFb.getBuffer(prevFb.getRect(), &prevStride);
+    for (int y = 0; y < fb.height(); y++) {
+      for (int x = 0; x < fb.width(); x++) {
+        if (memcmp(data + (y * stride + x) * bpp/8,
+                   prevData + (y * prevStride + x) * bpp/8,
+                   bpp/8) == 0)
+          continue;
+        if (reported[y * fb.width() + x])
+          continue;
+
+        printf("FAILED\n");
+        fflush(stdout);
+        return;
+      }
+    }
+  }
+
+  printf("OK\n");
+  fflush(stdout);
+}
+
+static void scrollTest(bool vertical)
+{
+  rfb::PixelFormat pf(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+  int scrolls;
+
+  printf("ComparingUpdateTracker scrolling (%s): ",
+         vertical ? "vertical" : "horizontal");
+
+  rfb::ManagedPixelBuffer fb(pf, 300, 400);
+  rfb::ManagedPixelBuffer client(pf, 300, 400);
+
+  int stride;
+  uint8_t* data = fb.getBufferRW(fb.getRect(), &stride);
+  for (int i = 0; i < stride * fb.height() * 4; i++)
+    data[i] = rand();
+  fb.commitBufferRW(fb.getRect());
+
+  rfb::ComparingUpdateTracker tracker(&fb);
+  tracker.setDetectScroll(true);
+
+  tracker.compare();
+  tracker.clear();
+
+  scrolls = 0;
+  for (int i = 0; i < 200; i++) {
+    rfb::Region changed;
+    std::vector<rfb::Rect> rects;
+    std::vector<rfb::Rect>::iterator iter;
+    rfb::UpdateInfo ui;
+    rfb::Rect area, exposed;
+    rfb::Point delta;
+    int shift;
+
+    client.imageRect(fb.getRect(), fb.getBuffer(fb.getRect(), &stride),
+                     stride);
+
+    // Scroll some area, and fill in what was revealed
+    area = rfb::Rect(rand() % 100, rand() % 100,
+                     200 + rand() % 100, 200 + rand() % 200);
+    shift = (rand() % 2 ? 1 : -1) * (1 + rand() % 50);
+    if (vertical) {
+      delta = rfb::Point(0, shift);
+      if (shift > 0)
+        exposed = rfb::Rect(area.tl.x, area.tl.y, area.br.x, area.tl.y + shift);
+      else
+        exposed = rfb::Rect(area.tl.x, area.br.y + shift, area.br.x, area.br.y);
+    } else {
+      delta = rfb::Point(shift, 0);
+      if (shift > 0)
+        exposed = rfb::Rect(area.tl.x, area.tl.y, area.tl.x + shift, area.br.y);
+      else
+        exposed = rfb::Rect(area.br.x + shift, area.tl.y, area.br.x, area.br.y);
+    }
+
+    fb.copyRect(area.intersect(area.translate(delta)), delta);
+
+    data = fb.getBufferRW(exposed, &stride);
+    for (int y = 0; y < exposed.height(); y++) {
+      for (int x = 0; x < exposed.width() * 4; x++)
+        data[y * stride * 4 + x] = rand();
+    }
+    fb.commitBufferRW(exposed);
+
+    // Add some noise that isn't a scroll
+    damage(&fb, &changed);
+
+    changed.assign_union(area);
+    tracker.add_changed(changed);
+    tracker.compare();
+    tracker.getUpdateInfo(&ui, fb.getRect());
+    tracker.clear();
+
+    if (!ui.copied.is_empty())
+      scrolls++;
+
+    // Apply the update like a client would, and check the result
+    ui.copied.get_rects(&rects, ui.copy_delta.x <= 0, ui.copy_delta.y <= 0);
+    for (iter = rects.begin(); iter != rects.end(); ++iter)
+      client.copyRect(*iter, ui.copy_delta);
+
+    ui.changed.get_rects(&rects);
+    for (iter = rects.begin(); iter != rects.end(); ++iter)
+      client.imageRect(*iter, fb.getBuffer(*iter, &stride), stride);
+
+    const uint8_t* fbData;
+    const uint8_t* clientData;
+    int clientStride;
+
+    fbData = fb.getBuffer(fb.getRect(), &stride);
+    clientData = client.getBuffer(client.getRect(), &clientStride);
+    for (int y = 0; y < fb.height(); y++) {
+      if (memcmp(fbData + y * stride * 4, clientData + y * clientStride * 4,
+                 fb.width() * 4) != 0) {
+        printf("FAILED\n");
+        fflush(stdout);
+        return;
+      }
+    }
+  }
+
+  // Most scrolls should have been found
+  if (scrolls < 150) {
+    printf("FAILED (only %d scrolls)\n", scrolls);
+    fflush(stdout);
+    return;
+  }
+
+  printf("OK\n");
+  fflush(stdout);
+}
+
+static void trackerTests()
+{
+  trackerTest(8, 0);
+  trackerTest(16, 0);
+  trackerTest(32, 0);
+
+  trackerTest(32, 3);
+
+  hashTest(8, 0);
+  hashTest(16, 0);
+  hashTest(32, 0);
+
+  hashTest(32, 3);
+
+  grabTest(0, false);
+  grabTest(3, false);
+  grabTest(3, true);
+
+  scrollTest(true);
+  scrollTest(false);
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  srand(0);
+
+  blockTests();
+  solidTests();
+  trackerTests();
+
+  return 0;
+}
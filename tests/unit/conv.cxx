@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include <rfb/PixelFormat.h>
+#include <rfb/pixelConvert.h>
 
 static const uint8_t pixelRed = 0xf1;
 static const uint8_t pixelGreen = 0xc3;
@@ -172,6 +173,52 @@ static bool testBuffer(const rfb::PixelFormat &dstpf,
   return true;
 }
 
+static bool testVector(const rfb::PixelFormat &dstpf,
+                       const rfb::PixelFormat &srcpf)
+{
+  const rfb::PixelConvertImpl *impls, *scalar, *orig;
+  int i, width;
+  uint8_t bufIn[fbMalloc], bufOut[fbMalloc], bufExpected[fbMalloc];
+  bool ok;
+
+  // Every vectorised implementation must give exactly the same result
+  // as the plain C code, for every possible value and also for the
+  // left over pixels at the end of each row
+
+  impls = rfb::getPixelConvertImpls();
+  for (scalar = impls;scalar[1].name != NULL;scalar++)
+    ;
+
+  srand(0);
+  for (i = 0;i < fbMalloc;i++)
+    bufIn[i] = rand();
+
+  orig = rfb::pixelConvertImpl;
+  ok = true;
+
+  for (width = 1;width <= fbWidth;width++) {
+    rfb::pixelConvertImpl = scalar;
+    memset(bufExpected, 0, sizeof(bufExpected));
+    dstpf.bufferFromBuffer(bufExpected + 1, srcpf, bufIn + 1,
+                           width, fbHeight, fbWidth, fbWidth);
+
+    for (i = 0;impls[i].name != NULL;i++) {
+      rfb::pixelConvertImpl = &impls[i];
+      memset(bufOut, 0, sizeof(bufOut));
+      dstpf.bufferFromBuffer(bufOut + 1, srcpf, bufIn + 1,
+                             width, fbHeight, fbWidth, fbWidth);
+      if (memcmp(bufOut, bufExpected, sizeof(bufOut)) != 0) {
+        printf("(%s, width %d) ", impls[i].name, width);
+        ok = false;
+      }
+    }
+  }
+
+  rfb::pixelConvertImpl = orig;
+
+  return ok;
+}
+
 static bool testRGB(const rfb::PixelFormat &dstpf,
                     const rfb::PixelFormat &srcpf)
 {
@@ -263,6 +310,7 @@ static bool testPixelRGB(const rfb::PixelFormat &dstpf,
 struct TestEntry tests[] = {
   {"Pixel from pixel", testPixel},
   {"Buffer from buffer", testBuffer},
+  {"Buffer from buffer (vectorised)", testVector},
   {"Buffer to/from RGB", testRGB},
   {"Pixel to/from RGB", testPixelRGB},
 };
@@ -320,6 +368,9 @@ int main(int /*argc*/, char** /*argv*/)
   srcpf.parse("rgb888");
   doTests(dstpf, srcpf);
 
+  srcpf.parse("bgr888");
+  doTests(dstpf, srcpf);
+
   srcpf.parse("bgr565");
   doTests(dstpf, srcpf);
 
@@ -355,6 +406,12 @@ int main(int /*argc*/, char** /*argv*/)
 
   doTests(srcpf, dstpf);
 
+  dstpf = rfb::PixelFormat(32, 24, false, true, 255, 255, 255, 0, 8, 16);
+
+  doTests(dstpf, srcpf);
+
+  doTests(srcpf, dstpf);
+
   // Pesky case that is very asymetrical
   dstpf = rfb::PixelFormat(32, 24, false, true, 255, 255, 255, 0, 8, 16);
   srcpf = rfb::PixelFormat(32, 24, true, true, 255, 255, 255, 0, 24, 8);
@@ -0,0 +1,293 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <rdr/Exception.h>
+#include <rdr/MemInStream.h>
+#include <rdr/MemOutStream.h>
+#include <rdr/ZlibOutStream.h>
+
+#include <rfb/CConnection.h>
+#include <rfb/Configuration.h>
+#include <rfb/DecodeManager.h>
+#include <rfb/PixelBuffer.h>
+#include <rfb/encodings.h>
+
+static const rfb::PixelFormat testPF(32, 24, false, true,
+                                     255, 255, 255, 16, 8, 0);
+
+static const int fbWidth = 256;
+static const int fbHeight = 256;
+
+class TestConn : public rfb::CConnection {
+public:
+  TestConn(rdr::InStream* is) {
+    setStreams(is, &out);
+    server.setPF(testPF);
+  }
+
+  virtual void initDone() {}
+  virtual void setCursor(int, int, const rfb::Point&, const uint8_t*) {}
+  virtual void setCursorPos(const rfb::Point&) {}
+  virtual void setColourMapEntries(int, int, uint16_t*) {}
+  virtual void bell() {}
+  virtual void serverCutText(const char*) {}
+
+private:
+  rdr::MemOutStream out;
+};
+
+struct TestRect {
+  rfb::Rect rect;
+  int encoding;
+  rfb::Point src;
+  uint8_t colour[4];
+};
+
+// Generates the wire data for the rects, and applies them one at a
+// time to a reference framebuffer
+class TestStream {
+public:
+  TestStream() : zos(NULL, 6), ref(testPF, fbWidth, fbHeight) {
+    uint8_t black[4] = { 0 };
+    ref.fillRect(ref.getRect(), black);
+  }
+
+  void addRaw(const rfb::Rect& r, const uint8_t colour[4]) {
+    add(r, rfb::encodingRaw, rfb::Point(), colour);
+    for (int i = 0; i < r.area(); i++)
+      data.writeBytes(colour, 4);
+    ref.fillRect(r, colour);
+  }
+
+  void addCopy(const rfb::Rect& r, const rfb::Point& src) {
+    uint8_t none[4] = { 0 };
+    add(r, rfb::encodingCopyRect, src, none);
+    data.writeU16(src.x);
+    data.writeU16(src.y);
+    ref.copyRect(r, r.tl.subtract(src));
+  }
+
+  // Raw tiles sharing one zlib stream, so they can only be decoded
+  // in the order they were sent
+  void addZRLE(const rfb::Rect& r, const uint8_t colour[4]) {
+    rdr::MemOutStream mos;
+    int tiles;
+
+    add(r, rfb::encodingZRLE, rfb::Point(), colour);
+
+    zos.setUnderlying(&mos);
+    tiles = ((r.width() + 63) / 64) * ((r.height() + 63) / 64);
+    assert(tiles == 1);
+    zos.writeU8(0);
+    for (int i = 0; i < r.area(); i++)
+      zos.writeBytes(colour, 3);
+    zos.flush();
+    zos.setUnderlying(NULL);
+
+    data.writeU32(mos.length());
+    data.writeBytes(mos.data(), mos.length());
+
+    ref.fillRect(r, colour);
+  }
+
+  bool decode(int threads);
+
+private:
+  void add(const rfb::Rect& r, int encoding, const rfb::Point& src,
+           const uint8_t colour[4]) {
+    TestRect tr;
+    tr.rect = r;
+    tr.encoding = encoding;
+    tr.src = src;
+    memcpy(tr.colour, colour, 4);
+    rects.push_back(tr);
+  }
+
+  std::vector<TestRect> rects;
+  rdr::MemOutStream data;
+  rdr::ZlibOutStream zos;
+  rfb::ManagedPixelBuffer ref;
+};
+
+bool TestStream::decode(int threads)
+{
+  char buffer[16];
+  uint8_t black[4] = { 0 };
+  rfb::ManagedPixelBuffer pb(testPF, fbWidth, fbHeight);
+  const uint8_t *a, *b;
+  int strideA, strideB;
+
+  snprintf(buffer, sizeof(buffer), "%d", threads);
+  rfb::Configuration::setParam("DecodeThreads", buffer);
+
+  pb.fillRect(pb.getRect(), black);
+
+  rdr::MemInStream is(data.data(), data.length());
+  TestConn conn(&is);
+
+  try {
+    rfb::DecodeManager manager(&conn);
+
+    for (size_t i = 0; i < rects.size(); i++) {
+      if (!manager.decodeRect(rects[i].rect, rects[i].encoding, &pb))
+        return false;
+    }
+
+    manager.flush();
+  } catch (rdr::Exception& e) {
+    printf("%s\n", e.str());
+    return false;
+  }
+
+  a = pb.getBuffer(pb.getRect(), &strideA);
+  b = ref.getBuffer(ref.getRect(), &strideB);
+  for (int y = 0; y < fbHeight; y++) {
+    if (memcmp(a + y * strideA * 4, b + y * strideB * 4,
+               fbWidth * 4) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+static void randomColour(uint8_t colour[4])
+{
+  rfb::Pixel p;
+
+  p = testPF.pixelFromRGB((uint8_t)rand(), (uint8_t)rand(),
+                          (uint8_t)rand());
+  testPF.bufferFromPixel(colour, p);
+}
+
+static rfb::Rect randomRect(int maxSize)
+{
+  rfb::Rect r;
+
+  r.tl.x = rand() % (fbWidth - 1);
+  r.tl.y = rand() % (fbHeight - 1);
+  r.br.x = r.tl.x + 1 + rand() % maxSize;
+  r.br.y = r.tl.y + 1 + rand() % maxSize;
+
+  return r.intersect(rfb::Rect(0, 0, fbWidth, fbHeight));
+}
+
+static void check(const char* name, TestStream* stream)
+{
+  static const int threadCounts[] = { 1, 2, 4, 8 };
+  bool ok;
+
+  ok = true;
+  for (size_t i = 0; i < sizeof(threadCounts)/sizeof(threadCounts[0]); i++) {
+    if (!stream->decode(threadCounts[i])) {
+      printf("%s: FAILED with %d threads\n", name, threadCounts[i]);
+      ok = false;
+    }
+  }
+
+  if (ok)
+    printf("%s: OK\n", name);
+}
+
+static void testOverlap()
+{
+  TestStream stream;
+  uint8_t colour[4];
+
+  // Rects painting over each other have to end up in the order they
+  // were received
+  srand(1);
+  for (int i = 0; i < 200; i++) {
+    randomColour(colour);
+    stream.addRaw(randomRect(128), colour);
+  }
+
+  check("Overlap", &stream);
+}
+
+static void testCopy()
+{
+  TestStream stream;
+  uint8_t colour[4];
+
+  // A copy has to wait for whatever painted its source, and anything
+  // painting over its source has to wait for the copy
+  srand(2);
+  for (int i = 0; i < 200; i++) {
+    rfb::Rect r;
+
+    r = randomRect(64);
+    if (i % 3 == 0) {
+      rfb::Point src;
+
+      src.x = rand() % (fbWidth - r.width() + 1);
+      src.y = rand() % (fbHeight - r.height() + 1);
+
+      stream.addCopy(r, src);
+    } else {
+      randomColour(colour);
+      stream.addRaw(r, colour);
+    }
+  }
+
+  check("Copy", &stream);
+}
+
+static void testOrdered()
+{
+  TestStream stream;
+  uint8_t colour[4];
+
+  // None of these overlap, but the ZRLE rects still depend on each
+  // other, whilst the raw ones in between are free to go
+  srand(3);
+  for (int y = 0; y < fbHeight; y += 32) {
+    for (int x = 0; x < fbWidth; x += 32) {
+      randomColour(colour);
+      if ((x / 32 + y / 32) % 2 == 0) {
+        // Reuse colours so that the compressed data refers back to
+        // earlier rects
+        colour[0] = colour[1] = colour[2] = (x + y) % 64;
+        stream.addZRLE(rfb::Rect(x, y, x + 32, y + 32), colour);
+      } else {
+        stream.addRaw(rfb::Rect(x, y, x + 32, y + 32), colour);
+      }
+    }
+  }
+
+  check("Ordered decoder", &stream);
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  testOverlap();
+  testCopy();
+  testOrdered();
+
+  return 0;
+}
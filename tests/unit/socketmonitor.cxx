@@ -0,0 +1,310 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <network/SocketMonitor.h>
+
+static void check(const char* name, bool ok)
+{
+  printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+}
+
+static void setNonBlocking(int fd)
+{
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void drain(int fd)
+{
+  char buf[4096];
+  while (read(fd, buf, sizeof(buf)) > 0)
+    ;
+}
+
+static void testEdgeRead()
+{
+  network::SocketMonitor monitor;
+  int fds[2];
+  bool ok;
+
+  if (pipe(fds) != 0) {
+    check("Edge read", false);
+    return;
+  }
+  setNonBlocking(fds[0]);
+
+  monitor.add(fds[0]);
+
+  monitor.wait(0);
+  ok = monitor.isMonitored(fds[0]) && !monitor.isReadable(fds[0]);
+
+  // Readable once data arrives, and stays readable even though the
+  // kernel doesn't report it again
+  if (write(fds[1], "abcd", 4) != 4)
+    ok = false;
+  monitor.wait(100);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+  monitor.wait(0);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+
+  // Still data left, so still readable
+  char c;
+  if (read(fds[0], &c, 1) != 1)
+    ok = false;
+  monitor.checkReadable(fds[0]);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+
+  drain(fds[0]);
+  monitor.checkReadable(fds[0]);
+  if (monitor.isReadable(fds[0]))
+    ok = false;
+  monitor.wait(0);
+  if (monitor.isReadable(fds[0]))
+    ok = false;
+
+  // And the edge is armed again for the next write
+  if (write(fds[1], "efgh", 4) != 4)
+    ok = false;
+  monitor.wait(100);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+
+  check("Edge read", ok);
+
+  monitor.remove(fds[0]);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void testEdgeWrite()
+{
+  network::SocketMonitor monitor;
+  int fds[2];
+  bool ok;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+    check("Edge write", false);
+    return;
+  }
+  setNonBlocking(fds[0]);
+  setNonBlocking(fds[1]);
+
+  monitor.add(fds[0]);
+  ok = monitor.isWritable(fds[0]);
+
+  // Fill the socket until it blocks
+  char buf[4096] = { 0 };
+  while (write(fds[0], buf, sizeof(buf)) > 0)
+    ;
+  monitor.clearWritable(fds[0]);
+  if (monitor.isWritable(fds[0]))
+    ok = false;
+
+  monitor.wait(0);
+  if (monitor.isWritable(fds[0]))
+    ok = false;
+
+  // Space again once the peer has read everything
+  drain(fds[1]);
+  monitor.wait(100);
+  if (!monitor.isWritable(fds[0]))
+    ok = false;
+
+  check("Edge write", ok);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void testLevel()
+{
+  network::SocketMonitor monitor;
+  int fds[2];
+  bool ok;
+
+  if (pipe(fds) != 0) {
+    check("Level triggered", false);
+    return;
+  }
+  setNonBlocking(fds[0]);
+
+  monitor.add(fds[0], false);
+  ok = !monitor.isWritable(fds[0]);
+
+  if (write(fds[1], "abcd", 4) != 4)
+    ok = false;
+  monitor.wait(100);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+
+  // Someone else consumed the data, which we must notice without
+  // being told
+  drain(fds[0]);
+  monitor.wait(0);
+  if (monitor.isReadable(fds[0]))
+    ok = false;
+
+  check("Level triggered", ok);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void testHangUp()
+{
+  network::SocketMonitor monitor;
+  int fds[2];
+  bool ok;
+
+  if (pipe(fds) != 0) {
+    check("Hang up", false);
+    return;
+  }
+
+  monitor.add(fds[0]);
+
+  // A closed peer has to be discovered by reading
+  close(fds[1]);
+  monitor.wait(100);
+  ok = monitor.isReadable(fds[0]);
+
+  check("Hang up", ok);
+
+  close(fds[0]);
+}
+
+static void testRemove()
+{
+  network::SocketMonitor monitor;
+  int fds[2], fd;
+  bool ok;
+
+  if (pipe(fds) != 0) {
+    check("Remove", false);
+    return;
+  }
+  setNonBlocking(fds[0]);
+
+  monitor.add(fds[0]);
+  ok = write(fds[1], "abcd", 4) == 4;
+  monitor.wait(100);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+
+  // Forgets everything about the descriptor, including that it was
+  // readable, so wait() has to block again
+  monitor.remove(fds[0]);
+  if (monitor.isMonitored(fds[0]) || monitor.isReadable(fds[0]) ||
+      monitor.isWritable(fds[0]))
+    ok = false;
+  if (!monitor.wait(0))
+    ok = false;
+  if (monitor.isReadable(fds[0]))
+    ok = false;
+
+  // Descriptor numbers get reused, so a new socket with the same
+  // number must start out fresh
+  fd = fds[0];
+  close(fds[0]);
+  close(fds[1]);
+
+  if (pipe(fds) != 0) {
+    check("Remove", false);
+    return;
+  }
+  if (fds[0] != fd)
+    ok = false;
+
+  monitor.add(fds[0]);
+  monitor.wait(0);
+  if (monitor.isReadable(fds[0]))
+    ok = false;
+  if (write(fds[1], "abcd", 4) != 4)
+    ok = false;
+  monitor.wait(100);
+  if (!monitor.isReadable(fds[0]))
+    ok = false;
+
+  check("Remove", ok);
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+static void testMany()
+{
+  network::SocketMonitor monitor;
+  int fds[200][2];
+  int count, i;
+  bool ok;
+
+  for (count = 0; count < 200; count++) {
+    if (pipe(fds[count]) != 0)
+      break;
+    monitor.add(fds[count][0]);
+  }
+
+  ok = count > 0;
+
+  for (i = 0; i < count; i += 3) {
+    if (write(fds[i][1], "a", 1) != 1)
+      ok = false;
+  }
+
+  monitor.wait(100);
+
+  for (i = 0; i < count; i++) {
+    if (monitor.isReadable(fds[i][0]) != (i % 3 == 0))
+      ok = false;
+  }
+
+  check("Many", ok);
+
+  for (i = 0; i < count; i++) {
+    monitor.remove(fds[i][0]);
+    close(fds[i][0]);
+    close(fds[i][1]);
+  }
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  network::SocketMonitor monitor;
+
+  printf("Using %s\n", monitor.getMethod());
+
+  testEdgeRead();
+  testEdgeWrite();
+  testLevel();
+  testHangUp();
+  testRemove();
+  testMany();
+
+  return 0;
+}
@@ -0,0 +1,225 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <rfb/Timer.h>
+
+// Records the order the timers fire in
+class TestCallback : public rfb::Timer::Callback {
+public:
+  TestCallback() : repeats(0), victim(NULL) {}
+
+  virtual bool handleTimeout(rfb::Timer* t) {
+    fired.push_back(t);
+    if (victim != NULL)
+      victim->stop();
+    if (repeats > 0) {
+      repeats--;
+      return true;
+    }
+    return false;
+  }
+
+  std::vector<rfb::Timer*> fired;
+  int repeats;
+  rfb::Timer* victim;
+};
+
+static void runTimers(int ms)
+{
+  usleep(ms * 1000);
+  rfb::Timer::checkTimeouts();
+}
+
+static void check(const char* name, bool ok)
+{
+  printf("%s: %s\n", name, ok ? "OK" : "FAILED");
+}
+
+static void testOrder()
+{
+  TestCallback cb;
+  rfb::Timer a(&cb), b(&cb), c(&cb), d(&cb);
+
+  c.start(60);
+  a.start(20);
+  d.start(80);
+  b.start(40);
+
+  runTimers(120);
+
+  check("Order", (cb.fired.size() == 4) &&
+                 (cb.fired[0] == &a) && (cb.fired[1] == &b) &&
+                 (cb.fired[2] == &c) && (cb.fired[3] == &d));
+}
+
+static void testSameTime()
+{
+  TestCallback cb;
+  std::vector<rfb::Timer*> timers;
+  bool ok;
+
+  // Timers due at the same time fire in the order they were started
+  for (int i = 0; i < 20; i++) {
+    timers.push_back(new rfb::Timer(&cb));
+    timers.back()->start(10);
+  }
+
+  runTimers(50);
+
+  ok = cb.fired == timers;
+  check("Same time", ok);
+
+  for (size_t i = 0; i < timers.size(); i++)
+    delete timers[i];
+}
+
+static void testMany()
+{
+  TestCallback cb;
+  std::vector<rfb::Timer*> timers;
+  bool ok;
+
+  // Enough to exercise the heap, with every other one cancelled
+  srand(1);
+  for (int i = 0; i < 200; i++) {
+    timers.push_back(new rfb::Timer(&cb));
+    timers.back()->start(1 + rand() % 100);
+  }
+  for (size_t i = 0; i < timers.size(); i += 2)
+    timers[i]->stop();
+
+  runTimers(150);
+
+  ok = cb.fired.size() == timers.size() / 2;
+  for (size_t i = 0; i < cb.fired.size(); i++) {
+    if (cb.fired[i]->isStarted())
+      ok = false;
+    if ((i > 0) &&
+        (cb.fired[i]->getTimeoutMs() < cb.fired[i-1]->getTimeoutMs()))
+      ok = false;
+  }
+  for (size_t i = 0; i < timers.size(); i += 2) {
+    for (size_t j = 0; j < cb.fired.size(); j++) {
+      if (cb.fired[j] == timers[i])
+        ok = false;
+    }
+  }
+  check("Many", ok);
+
+  for (size_t i = 0; i < timers.size(); i++)
+    delete timers[i];
+}
+
+static void testCancel()
+{
+  TestCallback cb, killer;
+  rfb::Timer a(&killer), b(&cb), c(&cb);
+
+  // Stopping a timer that is also due from another one's handler
+  killer.victim = &b;
+  a.start(10);
+  b.start(20);
+  c.start(30);
+
+  runTimers(60);
+
+  check("Cancel from handler", (killer.fired.size() == 1) &&
+                               (cb.fired.size() == 1) &&
+                               (cb.fired[0] == &c) && !b.isStarted());
+}
+
+static void testRestart()
+{
+  TestCallback cb;
+  rfb::Timer a(&cb), b(&cb);
+
+  // Restarting moves a timer, rather than adding it twice
+  a.start(20);
+  b.start(40);
+  a.start(60);
+
+  runTimers(100);
+
+  check("Restart", (cb.fired.size() == 2) &&
+                   (cb.fired[0] == &b) && (cb.fired[1] == &a));
+}
+
+static void testRepeat()
+{
+  TestCallback cb;
+  rfb::Timer a(&cb);
+  int i;
+
+  cb.repeats = 2;
+  a.start(10);
+
+  for (i = 0; i < 10; i++)
+    runTimers(20);
+
+  check("Repeat", (cb.fired.size() == 3) && !a.isStarted());
+}
+
+static void testNextTimeout()
+{
+  TestCallback cb;
+  rfb::Timer a(&cb), b(&cb);
+  int next;
+  bool ok;
+
+  ok = rfb::Timer::getNextTimeout() == 0;
+
+  a.start(500);
+  b.start(200);
+  next = rfb::Timer::getNextTimeout();
+  if ((next <= 0) || (next > 200))
+    ok = false;
+
+  b.stop();
+  next = rfb::Timer::getNextTimeout();
+  if ((next <= 200) || (next > 500))
+    ok = false;
+
+  a.stop();
+  if (rfb::Timer::getNextTimeout() != 0)
+    ok = false;
+
+  check("Next timeout", ok);
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  testOrder();
+  testSameTime();
+  testMany();
+  testCancel();
+  testRestart();
+  testRepeat();
+  testNextTimeout();
+
+  return 0;
+}
@@ -0,0 +1,194 @@
+/* Copyright (C) 2026 TigerVNC Team
+ *
+ * This is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307,
+ * USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include <os/Thread.h>
+#include <rdr/Exception.h>
+#include <rdr/MemInStream.h>
+#include <rdr/MemOutStream.h>
+#include <rdr/ZlibInStream.h>
+#include <rdr/ZlibOutStream.h>
+
+// Something that compresses, but not too well
+static void fillData(uint8_t* data, size_t length, unsigned seed)
+{
+  srand(seed);
+  for (size_t i = 0; i < length; i++) {
+    if ((i % 4096) < 1024)
+      data[i] = rand();
+    else
+      data[i] = (i / 7) ^ (i / 1000);
+  }
+}
+
+// Every flush has to decode on its own, as that is how the clients
+// will see the stream
+static bool checkStream(int threads, bool corked, const char** error)
+{
+  static const size_t sizes[] = { 100, 600000, 20, 300000, 1500000, 5 };
+  static const int levels[] = { 6, 1, 9, 6, 9, 0 };
+  static const size_t count = sizeof(sizes) / sizeof(sizes[0]);
+
+  rdr::MemOutStream compressed;
+  rdr::ZlibOutStream zos;
+  rdr::ZlibInStream zis;
+  std::vector<size_t> ends;
+  uint8_t* in[count];
+  bool ok;
+
+  *error = NULL;
+
+  zos.setThreadCount(threads);
+  zos.setUnderlying(&compressed);
+
+  for (size_t i = 0; i < count; i++) {
+    in[i] = new uint8_t[sizes[i]];
+    fillData(in[i], sizes[i], i);
+
+    zos.setCompressionLevel(levels[i]);
+    if (corked)
+      zos.cork(true);
+    zos.writeBytes(in[i], sizes[i]);
+    if (corked)
+      zos.cork(false);
+    zos.flush();
+
+    ends.push_back(compressed.length());
+  }
+
+  ok = true;
+  try {
+    size_t start;
+
+    start = 0;
+    for (size_t i = 0; i < count; i++) {
+      rdr::MemInStream mis((const uint8_t*)compressed.data() + start,
+                           ends[i] - start);
+      uint8_t* out;
+
+      zis.setUnderlying(&mis, ends[i] - start);
+
+      if (!zis.hasData(sizes[i])) {
+        ok = false;
+        break;
+      }
+
+      out = new uint8_t[sizes[i]];
+      zis.readBytes(out, sizes[i]);
+      if (memcmp(in[i], out, sizes[i]) != 0)
+        ok = false;
+      delete [] out;
+
+      zis.flushUnderlying();
+      if (mis.avail() != 0)
+        ok = false;
+
+      start = ends[i];
+    }
+  } catch (rdr::Exception& e) {
+    static char msg[256];
+    snprintf(msg, sizeof(msg), "%s", e.str());
+    *error = msg;
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++)
+    delete [] in[i];
+
+  return ok;
+}
+
+static void testStream(const char* name, int threads, bool corked)
+{
+  const char* error;
+
+  printf("%s: ", name);
+
+  if (!checkStream(threads, corked, &error)) {
+    if (error != NULL)
+      printf("FAILED: %s\n", error);
+    else
+      printf("FAILED\n");
+    return;
+  }
+
+  printf("OK\n");
+}
+
+class StreamThread : public os::Thread {
+public:
+  StreamThread(int threads_) : threads(threads_), ok(false) {}
+  bool isOk() const { return ok; }
+protected:
+  virtual void worker() {
+    const char* error;
+    ok = checkStream(threads, false, &error);
+  }
+private:
+  int threads;
+  bool ok;
+};
+
+// Several streams using the shared threads at the same time
+static void testShared(const char* name)
+{
+  StreamThread* threads[4];
+  bool ok;
+
+  printf("%s: ", name);
+
+  for (int i = 0; i < 4; i++) {
+    threads[i] = new StreamThread(i + 1);
+    threads[i]->start();
+  }
+
+  ok = true;
+  for (int i = 0; i < 4; i++) {
+    threads[i]->wait();
+    if (!threads[i]->isOk())
+      ok = false;
+    delete threads[i];
+  }
+
+  if (!ok) {
+    printf("FAILED\n");
+    return;
+  }
+
+  printf("OK\n");
+}
+
+int main(int /*argc*/, char** /*argv*/)
+{
+  testStream("Serial", 0, false);
+  testStream("Serial corked", 0, true);
+  testStream("Parallel", 3, false);
+  testStream("Parallel corked", 3, true);
+  testShared("Shared");
+
+  return 0;
+}
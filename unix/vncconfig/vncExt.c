@@ -308,6 +308,39 @@ Bool XVncExtApproveConnect(Display* dpy, void* opaqueId, int approve)
   return True;
 }
 
+char* XVncExtGetTelemetry(Display* dpy)
+{
+  xVncExtGetTelemetryReq* req;
+  xVncExtGetTelemetryReply rep;
+  char* text = 0;
+
+  if (!checkExtension(dpy)) return 0;
+
+  LockDisplay(dpy);
+  GetReq(VncExtGetTelemetry, req);
+  req->reqType = codes->major_opcode;
+  req->vncExtReqType = X_VncExtGetTelemetry;
+  if (!_XReply(dpy, (xReply *)&rep, 0, xFalse)) {
+    UnlockDisplay(dpy);
+    SyncHandle();
+    return 0;
+  }
+  if (rep.success) {
+    text = (char*)Xmalloc(rep.textLen+1);
+    if (!text) {
+      _XEatData(dpy, (rep.textLen+3)&~3);
+      UnlockDisplay(dpy);
+      SyncHandle();
+      return 0;
+    }
+    _XReadPad(dpy, text, rep.textLen);
+    text[rep.textLen] = 0;
+  }
+  UnlockDisplay(dpy);
+  SyncHandle();
+  return text;
+}
+
 
 static Bool XVncExtQueryConnectNotifyWireToEvent(Display* dpy, XEvent* e,
                                                     xEvent* w)
@@ -30,6 +30,7 @@ extern "C" {
 #define X_VncExtConnect 7
 #define X_VncExtGetQueryConnect 8
 #define X_VncExtApproveConnect 9
+#define X_VncExtGetTelemetry 10
 
 #define VncExtQueryConnectNotify 2
 #define VncExtQueryConnectMask (1 << VncExtQueryConnectNotify)
@@ -50,6 +51,7 @@ Bool XVncExtConnect(Display* dpy, const char* hostAndPort);
 Bool XVncExtGetQueryConnect(Display* dpy, char** addr,
                             char** user, int* timeout, void** opaqueId);
 Bool XVncExtApproveConnect(Display* dpy, void* opaqueId, int approve);
+char* XVncExtGetTelemetry(Display* dpy);
 
 
 typedef struct {
@@ -234,6 +236,28 @@ typedef struct {
 #define sz_xVncExtApproveConnectReq 12
 
 
+typedef struct {
+  CARD8 reqType;       /* always VncExtReqCode */
+  CARD8 vncExtReqType; /* always VncExtGetTelemetry */
+  CARD16 length B16;
+} xVncExtGetTelemetryReq;
+#define sz_xVncExtGetTelemetryReq 4
+
+typedef struct {
+ BYTE type; /* X_Reply */
+ BYTE success;
+ CARD16 sequenceNumber B16;
+ CARD32 length B32;
+ CARD32 textLen B32;
+ CARD32 pad0 B32;
+ CARD32 pad1 B32;
+ CARD32 pad2 B32;
+ CARD32 pad3 B32;
+ CARD32 pad4 B32;
+} xVncExtGetTelemetryReply;
+#define sz_xVncExtGetTelemetryReply 32
+
+
 
 typedef struct {
   BYTE type;    /* always eventBase + VncExtQueryConnectNotify */
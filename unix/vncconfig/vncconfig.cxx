@@ -185,6 +185,7 @@ static void usage()
   fprintf(stderr,"       %s [parameters] -list\n", programName);
   fprintf(stderr,"       %s [parameters] -get <param>\n", programName);
   fprintf(stderr,"       %s [parameters] -desc <param>\n",programName);
+  fprintf(stderr,"       %s [parameters] -telemetry\n",programName);
   fprintf(stderr,"\n"
           "Parameters can be turned on with -<param> or off with -<param>=0\n"
           "Parameters which take a value can be specified as "
@@ -270,6 +271,14 @@ int main(int argc, char** argv)
           fprintf(stderr,"getting description for param %s failed\n",argv[i]);
         }
         XFree(desc);
+      } else if (strcmp(argv[i], "-telemetry") == 0) {
+        char* text = XVncExtGetTelemetry(dpy);
+        if (text) {
+          printf("%s",text);
+        } else {
+          fprintf(stderr,"getting telemetry failed\n");
+        }
+        XFree(text);
       } else if (strcmp(argv[i], "-list") == 0) {
         int nParams;
         char** list = XVncExtListParams(dpy, &nParams);
@@ -114,6 +114,11 @@ void Image::get(Window wnd, int x, int y, int w, int h,
   XGetSubImage(dpy, wnd, x, y, w, h, AllPlanes, ZPixmap, xim, dst_x, dst_y);
 }
 
+void Image::getRows(Window wnd, int x, int y, int h, int dst_y)
+{
+  get(wnd, x, y, xim->width, h, 0, dst_y);
+}
+
 //
 // Copying pixels from one image to another.
 //
@@ -337,6 +342,20 @@ void ShmImage::get(Window wnd, int x, int y, int w, int h,
   }
 }
 
+void ShmImage::getRows(Window wnd, int x, int y, int h, int dst_y)
+{
+  XImage strip;
+
+  // A copy of the image description that only covers the rows we
+  // want. The X server then writes directly in to that part of the
+  // shared memory segment, and leaves the other rows alone.
+  strip = *xim;
+  strip.height = h;
+  strip.data = xim->data + dst_y * xim->bytes_per_line;
+
+  XShmGetImage(dpy, wnd, &strip, x, y, AllPlanes);
+}
+
 //
 // ImageFactory class implementation
 //
@@ -49,6 +49,10 @@ public:
   virtual void get(Window wnd, int x, int y, int w, int h,
                    int dst_x = 0, int dst_y = 0);
 
+  // Get h complete rows of the image, starting at row dst_y, from the
+  // area of the window starting at x, y.
+  virtual void getRows(Window wnd, int x, int y, int h, int dst_y);
+
   // Copying pixels from one image to another.
   virtual void updateRect(XImage *src, int dst_x = 0, int dst_y = 0);
   virtual void updateRect(Image *src, int dst_x = 0, int dst_y = 0);
@@ -108,6 +112,7 @@ public:
   virtual void get(Window wnd, int x = 0, int y = 0);
   virtual void get(Window wnd, int x, int y, int w, int h,
                    int dst_x = 0, int dst_y = 0);
+  virtual void getRows(Window wnd, int x, int y, int h, int dst_y);
 
 protected:
 
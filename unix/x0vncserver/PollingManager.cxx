@@ -28,10 +28,13 @@
 #include <string.h>
 #include <time.h>
 #include <X11/Xlib.h>
+#include <os/Mutex.h>
 #include <rfb/LogWriter.h>
 #include <rfb/VNCServer.h>
 #include <rfb/Configuration.h>
 #include <rfb/ServerCore.h>
+#include <rfb/blockCompare.h>
+#include <rfb/util.h>
 
 #include <x0vncserver/PollingManager.h>
 
@@ -39,6 +42,11 @@ using namespace rfb;
 
 static LogWriter vlog("PollingMgr");
 
+BoolParameter fullPolling("FullPolling",
+                          "Fetch and compare the entire screen on every "
+                          "polling cycle, rather than a few rows at a time",
+                          false);
+
 const int PollingManager::m_pollingOrder[32] = {
    0, 16,  8, 24,  4, 20, 12, 28,
   10, 26, 18,  2, 22,  6, 30, 14,
@@ -50,7 +58,7 @@ const int PollingManager::m_pollingOrder[32] = {
 // Constructor.
 //
 // Note that dpy and image should remain valid during the object
-// lifetime, while factory is used only in the constructor itself.
+// lifetime, while factory is copied for any images created later.
 //
 
 PollingManager::PollingManager(Display *dpy, const Image *image,
@@ -67,7 +75,12 @@ PollingManager::PollingManager(Display *dpy, const Image *image,
     m_heightTiles((image->xim->height + 31) / 32),
     m_numTiles(((image->xim->width + 31) / 32) *
                ((image->xim->height + 31) / 32)),
-    m_pollingStep(0)
+    m_pollingStep(0),
+    m_factory(factory),
+    m_fullPolling(fullPolling),
+    m_captureImage(0),
+    m_bandHeight(0), m_bandCount(0), m_nextBand(0), m_pendingBands(0),
+    m_capturedRows(0)
 {
   // Create additional images used in polling algorithm, warn if
   // underlying class names are different from the class name of the
@@ -85,14 +98,28 @@ PollingManager::PollingManager(Display *dpy, const Image *image,
 
   m_changeFlags = new bool[m_numTiles];
   memset(m_changeFlags, 0, m_numTiles * sizeof(bool));
+
+  m_queueMutex = new os::Mutex();
+  m_producerCond = new os::Condition(m_queueMutex);
+  m_consumerCond = new os::Condition(m_queueMutex);
 }
 
 PollingManager::~PollingManager()
 {
+  while (!m_threads.empty()) {
+    delete m_threads.back();
+    m_threads.pop_back();
+  }
+
+  delete m_consumerCond;
+  delete m_producerCond;
+  delete m_queueMutex;
+
   delete[] m_changeFlags;
 
   delete m_rowImage;
   delete m_columnImage;
+  delete m_captureImage;
 }
 
 //
@@ -129,7 +156,10 @@ void PollingManager::poll(VNCServer *server)
   debugBeforePoll();
 #endif
 
-  pollScreen(server);
+  if (m_fullPolling)
+    pollFullScreen(server);
+  else
+    pollScreen(server);
 
 #ifdef DEBUG
   debugAfterPoll();
@@ -188,6 +218,145 @@ bool PollingManager::pollScreen(VNCServer *server)
   return (nTilesChanged != 0);
 }
 
+bool PollingManager::pollFullScreen(VNCServer *server)
+{
+  rfb::Region changed;
+  int band, top, captureHeight;
+
+  if (!server)
+    return false;
+
+  // Nothing is allocated until we know that polling is needed, as
+  // the screen might be tracked some other way
+  if (m_captureImage == 0)
+    startFullPolling();
+
+  m_queueMutex->lock();
+
+  // Use more bands than threads, as changes are rarely spread out
+  // evenly over the screen
+  m_bandCount = (m_threads.size() + 1) * 4;
+  m_bandHeight = (m_height + m_bandCount - 1) / m_bandCount;
+  m_bandHeight = (m_bandHeight + 31) / 32 * 32;
+  m_bandChanged.assign(m_bandCount, rfb::Region());
+  m_nextBand = 0;
+  m_pendingBands = m_bandCount;
+  m_capturedRows = 0;
+
+  // Fetching the screen in one go is the cheapest, but with compare
+  // threads we fetch it one band at a time so that they can get
+  // started on the first bands whilst we wait for the rest
+  if (m_threads.empty())
+    captureHeight = m_height;
+  else
+    captureHeight = m_bandHeight;
+
+  for (top = 0; top < m_height; top += captureHeight) {
+    int h = __rfbmin(captureHeight, m_height - top);
+
+    m_queueMutex->unlock();
+    m_captureImage->getRows(DefaultRootWindow(m_dpy),
+                            m_offsetLeft, m_offsetTop + top, h, top);
+    m_queueMutex->lock();
+
+    m_capturedRows = top + h;
+    m_consumerCond->broadcast();
+  }
+
+  // Help out whilst we wait
+  while (m_nextBand < m_bandCount) {
+    band = m_nextBand++;
+
+    m_queueMutex->unlock();
+    compareBand(band);
+    m_queueMutex->lock();
+
+    m_pendingBands--;
+  }
+
+  while (m_pendingBands > 0)
+    m_producerCond->wait();
+
+  m_queueMutex->unlock();
+
+  for (band = 0; band < m_bandCount; band++)
+    changed.assign_union(m_bandChanged[band]);
+
+  if (changed.is_empty())
+    return false;
+
+  server->add_changed(changed);
+
+  return true;
+}
+
+void PollingManager::startFullPolling()
+{
+  int threadCount;
+
+  m_captureImage = m_factory.newImage(m_dpy, m_width, m_height);
+
+  threadCount = rfb::Server::compareThreads;
+  if (threadCount < 0) {
+    threadCount = os::Thread::getSystemCPUCount();
+    if (threadCount == 0) {
+      vlog.error("Unable to determine the number of CPU cores on this system");
+      threadCount = 1;
+    }
+    // The calling thread also does its share of the work
+    threadCount--;
+  }
+
+  if (threadCount > 0)
+    vlog.debug("Creating %d polling thread(s)", threadCount);
+
+  while (threadCount-- > 0)
+    m_threads.push_back(new CompareThread(this));
+}
+
+//
+// Compare one band of the captured image with the primary image, one
+// tile at a time. Anything that differs is copied to the primary image
+// and the precise area of the change is noted.
+//
+
+void PollingManager::compareBand(int band)
+{
+  int top, bottom;
+  rfb::Region *changed;
+
+  top = band * m_bandHeight;
+  bottom = __rfbmin(top + m_bandHeight, m_height);
+
+  changed = &m_bandChanged[band];
+
+  for (int y = top; y < bottom; y += 32) {
+    int h = __rfbmin(32, bottom - y);
+    for (int x = 0; x < m_width; x += 32) {
+      int w = __rfbmin(32, m_width - x);
+      Rect diff;
+
+      if (!compareBlock((uint8_t*)m_image->locatePixel(x, y),
+                        m_image->xim->bytes_per_line,
+                        (const uint8_t*)m_captureImage->locatePixel(x, y),
+                        m_captureImage->xim->bytes_per_line,
+                        w * m_bytesPerPixel, h, &diff))
+        continue;
+
+      changed->assign_union(rfb::Region(Rect(x + diff.tl.x / m_bytesPerPixel,
+                                        y + diff.tl.y,
+                                        x + (diff.br.x + m_bytesPerPixel - 1) /
+                                            m_bytesPerPixel,
+                                        y + diff.br.y)));
+    }
+  }
+}
+
+bool PollingManager::bandCaptured(int band) const
+{
+  return __rfbmin((band + 1) * m_bandHeight, m_height) <= m_capturedRows;
+}
+
 int PollingManager::checkRow(int x, int y, int w)
 {
   // If necessary, expand the row to the left, to the tile border.
@@ -374,3 +543,56 @@ PollingManager::printChanges(const char *header) const
   fprintf(stderr, "\n");
 }
 
+
+PollingManager::CompareThread::CompareThread(PollingManager *manager)
+  : m_manager(manager), m_stopRequested(false)
+{
+  start();
+}
+
+PollingManager::CompareThread::~CompareThread()
+{
+  stop();
+  wait();
+}
+
+void PollingManager::CompareThread::stop()
+{
+  os::AutoMutex a(m_manager->m_queueMutex);
+
+  if (!isRunning())
+    return;
+
+  m_stopRequested = true;
+
+  // We can't wake just this thread, so wake everyone
+  m_manager->m_consumerCond->broadcast();
+}
+
+void PollingManager::CompareThread::worker()
+{
+  m_manager->m_queueMutex->lock();
+
+  while (!m_stopRequested) {
+    int band;
+
+    if ((m_manager->m_nextBand >= m_manager->m_bandCount) ||
+        !m_manager->bandCaptured(m_manager->m_nextBand)) {
+      // Wait and try again
+      m_manager->m_consumerCond->wait();
+      continue;
+    }
+
+    band = m_manager->m_nextBand++;
+
+    m_manager->m_queueMutex->unlock();
+    m_manager->compareBand(band);
+    m_manager->m_queueMutex->lock();
+
+    m_manager->m_pendingBands--;
+    if (m_manager->m_pendingBands == 0)
+      m_manager->m_producerCond->signal();
+  }
+
+  m_manager->m_queueMutex->unlock();
+}
@@ -23,7 +23,12 @@
 #ifndef __POLLINGMANAGER_H__
 #define __POLLINGMANAGER_H__
 
+#include <list>
+#include <vector>
+
 #include <X11/Xlib.h>
+#include <os/Thread.h>
+#include <rfb/Region.h>
 #include <rfb/VNCServer.h>
 
 #include <x0vncserver/Image.h>
@@ -32,6 +37,11 @@
 #include <x0vncserver/TimeMillis.h>
 #endif
 
+namespace os {
+  class Condition;
+  class Mutex;
+}
+
 class PollingManager {
 
 public:
@@ -42,11 +52,20 @@ public:
 
   void poll(rfb::VNCServer *server);
 
+  // Returns true if every poll() fetches the entire screen in to the
+  // primary image, making any further grabs unnecessary.
+  bool isFullCapture() const { return m_captureImage != 0; }
+
 protected:
 
   // Screen polling. Returns true if some changes were detected.
   bool pollScreen(rfb::VNCServer *server);
 
+  // Full screen polling. Fetches the entire screen and compares it in
+  // bands, possibly using several threads. Returns true if some
+  // changes were detected.
+  bool pollFullScreen(rfb::VNCServer *server);
+
   Display *m_dpy;
 
   const Image *m_image;
@@ -107,6 +126,44 @@ private:
   unsigned int m_pollingStep;
   static const int m_pollingOrder[];
 
+  // Full screen polling. m_captureImage gets the new screen contents,
+  // which are then compared with, and copied to, the primary image.
+  // It is only allocated, along with the threads, on the first poll.
+  ImageFactory m_factory;
+  bool m_fullPolling;
+  Image *m_captureImage;
+
+  void startFullPolling();
+  void compareBand(int band);
+  bool bandCaptured(int band) const;
+
+  os::Mutex *m_queueMutex;
+  os::Condition *m_producerCond;
+  os::Condition *m_consumerCond;
+
+  int m_bandHeight;
+  int m_bandCount, m_nextBand, m_pendingBands;
+  int m_capturedRows;
+  std::vector<rfb::Region> m_bandChanged;
+
+  class CompareThread : public os::Thread {
+  public:
+    CompareThread(PollingManager *manager);
+    ~CompareThread();
+
+    void stop();
+
+  protected:
+    void worker();
+
+  private:
+    PollingManager *m_manager;
+
+    bool m_stopRequested;
+  };
+
+  std::list<CompareThread*> m_threads;
+
 #ifdef DEBUG
 private:
 
@@ -27,6 +27,7 @@
 #include <unistd.h>
 
 #include <rfb/LogWriter.h>
+#include <rfb/util.h>
 
 #include <x0vncserver/XDesktop.h>
 
@@ -66,6 +67,11 @@ BoolParameter rawKeyboard("RawKeyboard",
                           "Send keyboard events straight through and "
                           "avoid mapping them to the current keyboard "
                           "layout", false);
+BoolParameter coalesceDamage("CoalesceDamage",
+                             "Collect screen changes in the X server and "
+                             "fetch them once per polling cycle, instead "
+                             "of getting an event for every drawing "
+                             "operation", false);
 IntParameter queryConnectTimeout("QueryConnectTimeout",
                                  "Number of seconds to show the Accept Connection dialog before "
                                  "rejecting the connection",
@@ -82,8 +88,12 @@ XDesktop::XDesktop(Display* dpy_, Geometry *geometry_)
   : dpy(dpy_), geometry(geometry_), pb(0), server(0),
     queryConnectDialog(0), queryConnectSock(0),
     oldButtonMask(0), haveXtest(false), haveDamage(false),
-    maxButtons(0), running(false), ledMasks(), ledState(0),
-    codeMap(0), codeMapLen(0)
+    maxButtons(0), running(false),
+#ifdef HAVE_XDAMAGE
+    useDamageRegion(false), damagePending(false),
+    damageEvents(0), damageRects(0),
+#endif
+    ledMasks(), ledState(0), codeMap(0), codeMapLen(0)
 {
   int major, minor;
 
@@ -178,6 +188,10 @@ XDesktop::XDesktop(Display* dpy_, Geometry *geometry_)
   if (XFixesQueryExtension(dpy, &xfixesEventBase, &xfixesErrorBase)) {
     XFixesSelectCursorInput(dpy, DefaultRootWindow(dpy),
                             XFixesDisplayCursorNotifyMask);
+#ifdef HAVE_XDAMAGE
+    if (haveDamage && coalesceDamage)
+      useDamageRegion = true;
+#endif
   } else {
 #endif
     vlog.info("XFIXES extension not present");
@@ -217,6 +231,10 @@ XDesktop::~XDesktop() {
 void XDesktop::poll() {
   if (pb and not haveDamage)
     pb->poll(server);
+#ifdef HAVE_XDAMAGE
+  if (running && damagePending)
+    fetchDamage();
+#endif
   if (running) {
     Window root, child;
     int x, y, wx, wy;
@@ -253,8 +271,19 @@ void XDesktop::start(VNCServer* vs) {
 
 #ifdef HAVE_XDAMAGE
   if (haveDamage) {
-    damage = XDamageCreate(dpy, DefaultRootWindow(dpy),
-                           XDamageReportRawRectangles);
+    if (useDamageRegion) {
+#ifdef HAVE_XFIXES
+      damage = XDamageCreate(dpy, DefaultRootWindow(dpy),
+                             XDamageReportNonEmpty);
+      damageRegion = XFixesCreateRegion(dpy, NULL, 0);
+#endif
+    } else {
+      damage = XDamageCreate(dpy, DefaultRootWindow(dpy),
+                             XDamageReportRawRectangles);
+    }
+    damagePending = false;
+    damageEvents = damageRects = 0;
+    getMonotonicTime(&damageStart);
   }
 #endif
 
@@ -281,8 +310,25 @@ void XDesktop::stop() {
   deleteAddedKeysyms(dpy);
 
 #ifdef HAVE_XDAMAGE
-  if (haveDamage)
+  if (haveDamage) {
+    struct timeval now;
+    unsigned elapsed;
+
     XDamageDestroy(dpy, damage);
+#ifdef HAVE_XFIXES
+    if (useDamageRegion)
+      XFixesDestroyRegion(dpy, damageRegion);
+#endif
+
+    getMonotonicTime(&now);
+    elapsed = msBetween(&damageStart, &now);
+    if ((damageEvents != 0) && (elapsed != 0)) {
+      vlog.info("Damage: %u events, %u rects (%g events/s, %g rects/s)",
+                damageEvents, damageRects,
+                damageEvents * 1000.0 / elapsed,
+                damageRects * 1000.0 / elapsed);
+    }
+  }
 #endif
 
   delete queryConnectDialog;
@@ -784,6 +830,39 @@ unsigned int XDesktop::setScreenLayout(int fb_width, int fb_height,
 }
 
 
+#ifdef HAVE_XDAMAGE
+void XDesktop::fetchDamage() {
+#ifdef HAVE_XFIXES
+  XRectangle* rects;
+  int nRects;
+  rfb::Region changed;
+
+  damagePending = false;
+
+  // Move the damage to our region, which also resets the damage
+  // object so that we get a new event for the next change
+  XDamageSubtract(dpy, damage, None, damageRegion);
+
+  rects = XFixesFetchRegion(dpy, damageRegion, &nRects);
+  if (rects == NULL)
+    return;
+
+  for (int i = 0; i < nRects; i++) {
+    Rect rect;
+    rect.setXYWH(rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+    changed.assign_union(rect);
+  }
+
+  XFree(rects);
+
+  changed.translate(Point(-geometry->offsetLeft(),
+                          -geometry->offsetTop()));
+  server->add_changed(changed);
+  damageRects += changed.numRects();
+#endif
+}
+#endif
+
 bool XDesktop::handleGlobalEvent(XEvent* ev) {
   if (ev->type == xkbEventBase + XkbEventCode) {
     XkbEvent *kb = (XkbEvent *)ev;
@@ -811,11 +890,20 @@ bool XDesktop::handleGlobalEvent(XEvent* ev) {
     if (!running)
       return true;
 
+    damageEvents++;
+
+    // Only tells us that there is something to fetch
+    if (useDamageRegion) {
+      damagePending = true;
+      return true;
+    }
+
     dev = (XDamageNotifyEvent*)ev;
     rect.setXYWH(dev->area.x, dev->area.y, dev->area.width, dev->area.height);
     rect = rect.translate(Point(-geometry->offsetLeft(),
                                 -geometry->offsetTop()));
     server->add_changed(rect);
+    damageRects++;
 
     return true;
 #endif
@@ -29,6 +29,9 @@
 #ifdef HAVE_XDAMAGE
 #include <X11/extensions/Xdamage.h>
 #endif
+#ifdef HAVE_XFIXES
+#include <X11/extensions/Xfixes.h>
+#endif
 
 #include <vncconfig/QueryConnectDialog.h>
 
@@ -87,6 +90,17 @@ protected:
 #ifdef HAVE_XDAMAGE
   Damage damage;
   int xdamageEventBase;
+  // Damage is collected in a region in the X server, and fetched
+  // once per poll()
+  bool useDamageRegion;
+#ifdef HAVE_XFIXES
+  XserverRegion damageRegion;
+#endif
+  bool damagePending;
+  // Logged when the desktop stops, to compare the two ways of
+  // getting the damage
+  unsigned damageEvents, damageRects;
+  struct timeval damageStart;
 #endif
   int xkbEventBase;
 #ifdef HAVE_XFIXES
@@ -103,6 +117,9 @@ protected:
   unsigned codeMapLen;
   bool setCursor();
   rfb::ScreenSet computeScreenLayout();
+#ifdef HAVE_XDAMAGE
+  void fetchDamage();
+#endif
 };
 
 #endif // __XDESKTOP_H__
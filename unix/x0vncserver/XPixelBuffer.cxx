@@ -36,6 +36,8 @@ XPixelBuffer::XPixelBuffer(Display *dpy, ImageFactory &factory,
                            const Rect &rect)
   : FullFramePixelBuffer(),
     m_poller(0),
+    m_polling(false),
+    m_polledFullScreen(false),
     m_dpy(dpy),
     m_image(factory.newImage(dpy, rect.width(), rect.height())),
     m_offsetLeft(rect.tl.x),
@@ -75,10 +77,58 @@ void
 XPixelBuffer::grabRegion(const rfb::Region& region)
 {
   std::vector<Rect> rects;
-  std::vector<Rect>::const_iterator i;
+  std::vector<Rect>::const_iterator i, first;
+  Rect strip;
+  int area;
+
+  // Nothing to do if the poller has already fetched everything
+  if (m_polledFullScreen)
+    return;
+
+  // Every grab is a round trip to the X server, so rects that are
+  // close to each other vertically are fetched as a single strip of
+  // whole rows when they cover enough of it
+
   region.get_rects(&rects);
+
+  first = rects.begin();
+  area = 0;
   for (i = rects.begin(); i != rects.end(); i++) {
-    grabRect(*i);
+    if ((i != first) && (i->tl.y > strip.br.y)) {
+      grabStrip(strip, first, i, area);
+      first = i;
+      area = 0;
+    }
+
+    if (i == first)
+      strip = Rect(0, i->tl.y, width(), i->br.y);
+    else
+      strip.br.y = __rfbmax(strip.br.y, i->br.y);
+    area += i->area();
   }
+
+  if (first != rects.end())
+    grabStrip(strip, first, rects.end(), area);
+}
+
+void
+XPixelBuffer::grabStrip(const rfb::Rect& strip,
+                        std::vector<rfb::Rect>::const_iterator first,
+                        std::vector<rfb::Rect>::const_iterator last,
+                        int area)
+{
+  std::vector<Rect>::const_iterator i;
+
+  // Fetching more than asked for would update parts of the image that
+  // the poller has yet to compare, hiding those changes from it
+  if (!m_polling && (area * 4 > strip.area())) {
+    m_image->getRows(DefaultRootWindow(m_dpy),
+                     m_offsetLeft, m_offsetTop + strip.tl.y,
+                     strip.height(), strip.tl.y);
+    return;
+  }
+
+  for (i = first; i != last; i++)
+    grabRect(*i);
 }
 
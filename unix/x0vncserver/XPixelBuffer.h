@@ -23,6 +23,8 @@
 #ifndef __XPIXELBUFFER_H__
 #define __XPIXELBUFFER_H__
 
+#include <vector>
+
 #include <rfb/PixelBuffer.h>
 #include <rfb/VNCServer.h>
 #include <x0vncserver/Image.h>
@@ -42,19 +44,34 @@ public:
   const Image *getImage() const { return m_image; }
 
   // Detect changed pixels, notify the server.
-  inline void poll(rfb::VNCServer *server) { m_poller->poll(server); }
+  inline void poll(rfb::VNCServer *server) {
+    m_poller->poll(server);
+    m_polling = true;
+    m_polledFullScreen = m_poller->isFullCapture();
+  }
 
   // Override PixelBuffer::grabRegion().
   virtual void grabRegion(const rfb::Region& region);
 
 protected:
   PollingManager *m_poller;
+  // The poller finds changes by comparing the screen with the image
+  bool m_polling;
+  // The poller keeps the entire image up to date
+  bool m_polledFullScreen;
 
   Display *m_dpy;
   Image* m_image;
   int m_offsetLeft;
   int m_offsetTop;
 
+  // Grab a strip of whole rows, or just the given rects in it if
+  // they only cover a small part of it or the poller is in use.
+  void grabStrip(const rfb::Rect& strip,
+                 std::vector<rfb::Rect>::const_iterator first,
+                 std::vector<rfb::Rect>::const_iterator last,
+                 int area);
+
   // Copy pixels from the screen to the pixel buffer,
   // for the specified rectangular area of the buffer.
   inline void grabRect(const rfb::Rect &r) {
@@ -36,6 +36,7 @@
 #include <rfb/VNCServerST.h>
 #include <rfb/Configuration.h>
 #include <rfb/Timer.h>
+#include <network/SocketMonitor.h>
 #include <network/TcpSocket.h>
 #include <network/UnixSocket.h>
 
@@ -327,35 +328,36 @@ int main(int argc, char** argv)
 
     PollingScheduler sched((int)pollingCycle, (int)maxProcessorUsage);
 
+    // Sockets are registered once and then only report changes, so
+    // idle clients cost next to nothing per iteration
+    SocketMonitor monitor;
+
+    monitor.add(ConnectionNumber(dpy), false);
+    for (std::list<SocketListener*>::iterator i = listeners.begin();
+         i != listeners.end();
+         i++)
+      monitor.add((*i)->getFd(), false);
+    if (server.getWakeupFd() != -1)
+      monitor.add(server.getWakeupFd(), false);
+
+    vlog.debug("Using %s to wait for events", monitor.getMethod());
+
     while (!caughtSignal) {
       int wait_ms;
-      struct timeval tv;
-      fd_set rfds, wfds;
       std::list<Socket*> sockets;
       std::list<Socket*>::iterator i;
 
       // Process any incoming X events
       TXWindow::handleXEvents(dpy);
 
-      FD_ZERO(&rfds);
-      FD_ZERO(&wfds);
-
-      FD_SET(ConnectionNumber(dpy), &rfds);
-      for (std::list<SocketListener*>::iterator i = listeners.begin();
-           i != listeners.end();
-           i++)
-        FD_SET((*i)->getFd(), &rfds);
-
       server.getSockets(&sockets);
       int clients_connected = 0;
       for (i = sockets.begin(); i != sockets.end(); i++) {
         if ((*i)->isShutdown()) {
+          monitor.remove((*i)->getFd());
           server.removeSocket(*i);
           delete (*i);
         } else {
-          FD_SET((*i)->getFd(), &rfds);
-          if ((*i)->outStream().hasBufferedData())
-            FD_SET((*i)->getFd(), &wfds);
           clients_connected++;
         }
       }
@@ -374,32 +376,24 @@ int main(int argc, char** argv)
 
       soonestTimeout(&wait_ms, Timer::checkTimeouts());
 
-      tv.tv_sec = wait_ms / 1000;
-      tv.tv_usec = (wait_ms % 1000) * 1000;
-
       // Do the wait...
       sched.sleepStarted();
-      int n = select(FD_SETSIZE, &rfds, &wfds, 0,
-                     wait_ms ? &tv : NULL);
+      bool ok = monitor.wait(wait_ms ? wait_ms : -1);
       sched.sleepFinished();
 
-      if (n < 0) {
-        if (errno == EINTR) {
-          vlog.debug("Interrupted select() system call");
-          continue;
-        } else {
-          throw rdr::SystemException("select", errno);
-        }
-      }
+      // Interrupted by a signal
+      if (!ok)
+        continue;
 
       // Accept new VNC connections
       for (std::list<SocketListener*>::iterator i = listeners.begin();
            i != listeners.end();
            i++) {
-        if (FD_ISSET((*i)->getFd(), &rfds)) {
+        if (monitor.isReadable((*i)->getFd())) {
           Socket* sock = (*i)->accept();
           if (sock) {
             server.addSocket(sock);
+            monitor.add(sock->getFd());
           } else {
             vlog.status("Client connection rejected");
           }
@@ -408,6 +402,11 @@ int main(int argc, char** argv)
 
       Timer::checkTimeouts();
 
+      // Background encoding has finished for some client
+      if ((server.getWakeupFd() != -1) &&
+          monitor.isReadable(server.getWakeupFd()))
+        server.processWakeup();
+
       // Client list could have been changed.
       server.getSockets(&sockets);
 
@@ -417,10 +416,21 @@ int main(int argc, char** argv)
 
       // Process events on existing VNC connections
       for (i = sockets.begin(); i != sockets.end(); i++) {
-        if (FD_ISSET((*i)->getFd(), &rfds))
+        int fd = (*i)->getFd();
+
+        if (monitor.isReadable(fd)) {
           server.processSocketReadEvent(*i);
-        if (FD_ISSET((*i)->getFd(), &wfds))
-          server.processSocketWriteEvent(*i);
+          monitor.checkReadable(fd);
+        }
+
+        if ((*i)->outStream().hasBufferedData()) {
+          if (monitor.isWritable(fd))
+            server.processSocketWriteEvent(*i);
+          // Still data left means the socket is full, so wait until
+          // the kernel says there is room again
+          if ((*i)->outStream().hasBufferedData())
+            monitor.clearWritable(fd);
+        }
       }
 
       if (desktop.isRunning() && sched.goodTimeToPoll()) {
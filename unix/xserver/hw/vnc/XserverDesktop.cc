@@ -92,10 +92,15 @@ XserverDesktop::XserverDesktop(int screenIndex_,
        i++) {
     vncSetNotifyFd((*i)->getFd(), screenIndex, true, false);
   }
+
+  if (server->getWakeupFd() != -1)
+    vncSetNotifyFd(server->getWakeupFd(), screenIndex, true, false);
 }
 
 XserverDesktop::~XserverDesktop()
 {
+  if (server->getWakeupFd() != -1)
+    vncRemoveNotifyFd(server->getWakeupFd());
   while (!listeners.empty()) {
     vncRemoveNotifyFd(listeners.back()->getFd());
     delete listeners.back();
@@ -214,6 +219,11 @@ void XserverDesktop::bell()
   server->bell();
 }
 
+std::string XserverDesktop::getTelemetry()
+{
+  return server->getTelemetry();
+}
+
 void XserverDesktop::setLEDState(unsigned int state)
 {
   server->setLEDState(state);
@@ -296,6 +306,11 @@ void XserverDesktop::handleSocketEvent(int fd, bool read, bool write)
 {
   try {
     if (read) {
+      if (fd == server->getWakeupFd()) {
+        server->processWakeup();
+        return;
+      }
+
       if (handleListenerEvent(fd, &listeners, server))
         return;
     }
@@ -63,6 +63,7 @@ public:
   void announceClipboard(bool available);
   void sendClipboardData(const char* data);
   void bell();
+  std::string getTelemetry();
   void setLEDState(unsigned int state);
   void setDesktopName(const char* name);
   void setCursor(int width, int height, int hotX, int hotY,
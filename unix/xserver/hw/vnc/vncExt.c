@@ -204,6 +204,44 @@ static int SProcVncExtGetParam(ClientPtr client)
   return ProcVncExtGetParam(client);
 }
 
+static int ProcVncExtGetTelemetry(ClientPtr client)
+{
+  char* text;
+  size_t len;
+  xVncExtGetTelemetryReply rep;
+
+  REQUEST_SIZE_MATCH(xVncExtGetTelemetryReq);
+
+  text = vncGetTelemetry();
+  len = text ? strlen(text) : 0;
+
+  rep.type = X_Reply;
+  rep.sequenceNumber = client->sequence;
+  rep.success = 0;
+  if (text)
+    rep.success = 1;
+  rep.length = (len + 3) >> 2;
+  rep.textLen = len;
+  if (client->swapped) {
+    swaps(&rep.sequenceNumber);
+    swapl(&rep.length);
+    swapl(&rep.textLen);
+  }
+  WriteToClient(client, sizeof(xVncExtGetTelemetryReply), (char *)&rep);
+  if (text)
+    WriteToClient(client, len, text);
+  free(text);
+  return (client->noClientException);
+}
+
+static int SProcVncExtGetTelemetry(ClientPtr client)
+{
+  REQUEST(xVncExtGetTelemetryReq);
+  swaps(&stuff->length);
+  REQUEST_SIZE_MATCH(xVncExtGetTelemetryReq);
+  return ProcVncExtGetTelemetry(client);
+}
+
 static int ProcVncExtGetParamDesc(ClientPtr client)
 {
   char* param;
@@ -458,6 +496,8 @@ static int ProcVncExtDispatch(ClientPtr client)
     return ProcVncExtGetQueryConnect(client);
   case X_VncExtApproveConnect:
     return ProcVncExtApproveConnect(client);
+  case X_VncExtGetTelemetry:
+    return ProcVncExtGetTelemetry(client);
   default:
     return BadRequest;
   }
@@ -483,6 +523,8 @@ static int SProcVncExtDispatch(ClientPtr client)
     return SProcVncExtGetQueryConnect(client);
   case X_VncExtApproveConnect:
     return SProcVncExtApproveConnect(client);
+  case X_VncExtGetTelemetry:
+    return SProcVncExtGetTelemetry(client);
   default:
     return BadRequest;
   }
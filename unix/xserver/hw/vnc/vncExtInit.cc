@@ -388,6 +388,16 @@ void vncBell()
     desktop[scr]->bell();
 }
 
+char* vncGetTelemetry()
+{
+  std::string telemetry;
+
+  for (int scr = 0; scr < vncGetScreenCount(); scr++)
+    telemetry += desktop[scr]->getTelemetry();
+
+  return strdup(telemetry.c_str());
+}
+
 void vncSetLEDState(unsigned long leds)
 {
   unsigned int state;
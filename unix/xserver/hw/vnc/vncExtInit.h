@@ -65,6 +65,8 @@ void vncApproveConnection(uint32_t opaqueId, int approve);
 
 void vncBell(void);
 
+char* vncGetTelemetry(void);
+
 void vncSetLEDState(unsigned long leds);
 
 // Must match rfb::ShortRect in common/rfb/Region.h, and BoxRec in the
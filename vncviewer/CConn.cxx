@@ -349,6 +349,9 @@ void CConn::framebufferUpdateStart()
 {
   CConnection::framebufferUpdateStart();
 
+  // The previous update might still be on its way to the screen
+  desktop->waitForUpload();
+
   // For bandwidth estimate
   gettimeofday(&updateStartTime, NULL);
   updateStartPos = sock->inStream().pos();
@@ -599,5 +602,9 @@ void CConn::handleUpdateTimeout(void *data)
 
   self->desktop->updateWindow();
 
+  // We are in the middle of an update, so decoding will resume as
+  // soon as we return and must not touch what is being uploaded
+  self->desktop->waitForUpload();
+
   Fl::repeat_timeout(1.0, handleUpdateTimeout, data);
 }
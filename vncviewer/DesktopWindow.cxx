@@ -311,6 +311,12 @@ void DesktopWindow::updateWindow()
 }
 
 
+void DesktopWindow::waitForUpload()
+{
+  viewport->waitForUpload();
+}
+
+
 void DesktopWindow::resizeFramebuffer(int new_w, int new_h)
 {
   bool maximized;
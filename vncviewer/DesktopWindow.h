@@ -49,6 +49,10 @@ public:
   // Flush updates to screen
   void updateWindow();
 
+  // Wait until the framebuffer can be modified again after
+  // updateWindow(). Must be called before any more decoding.
+  void waitForUpload();
+
   // Updated session title
   void setName(const char *name);
 
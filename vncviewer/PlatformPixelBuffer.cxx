@@ -23,6 +23,8 @@
 #include <assert.h>
 #include <stdlib.h>
 
+#include <vector>
+
 #if !defined(WIN32) && !defined(__APPLE__)
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -32,19 +34,30 @@
 #include <FL/x.H>
 
 #include <rfb/LogWriter.h>
+#include <rfb/util.h>
 #include <rdr/Exception.h>
 
 #include "PlatformPixelBuffer.h"
 
 static rfb::LogWriter vlog("PlatformPixelBuffer");
 
+#if !defined(WIN32) && !defined(__APPLE__)
+// Every upload has some fixed overhead, which we consider to be worth
+// this many pixels when deciding if it is better to upload the
+// bounding rectangle of the damage rather than each part of it
+static const int UploadRectCost = 4096;
+
+std::list<PlatformPixelBuffer*> PlatformPixelBuffer::shmBuffers;
+#endif
+
 PlatformPixelBuffer::PlatformPixelBuffer(int width, int height) :
   FullFramePixelBuffer(rfb::PixelFormat(32, 24, false, true,
                                         255, 255, 255, 16, 8, 0),
                        0, 0, NULL, 0),
   Surface(width, height)
 #if !defined(WIN32) && !defined(__APPLE__)
-  , shminfo(NULL), xim(NULL)
+  , shminfo(NULL), xim(NULL), pendingUploads(0),
+  damagedPixels(0), uploadedPixels(0), uploads(0)
 #endif
 {
 #if !defined(WIN32) && !defined(__APPLE__)
@@ -59,6 +72,13 @@ PlatformPixelBuffer::PlatformPixelBuffer(int width, int height) :
       throw rdr::Exception("malloc");
 
     vlog.debug("Using standard XImage");
+  } else {
+    // Tells us when the X server is done with an upload. FLTK can
+    // only tell handlers apart by function, so there is just one for
+    // all buffers.
+    if (shmBuffers.empty())
+      Fl::add_system_handler(handleSystemEvent, NULL);
+    shmBuffers.push_back(this);
   }
 
   setBuffer(width, height, (uint8_t*)xim->data,
@@ -74,7 +94,14 @@ PlatformPixelBuffer::PlatformPixelBuffer(int width, int height) :
 PlatformPixelBuffer::~PlatformPixelBuffer()
 {
 #if !defined(WIN32) && !defined(__APPLE__)
+  logStats();
+
   if (shminfo) {
+    waitForUpload();
+    shmBuffers.remove(this);
+    if (shmBuffers.empty())
+      Fl::remove_system_handler(handleSystemEvent);
+
     vlog.debug("Freeing shared memory XImage");
     XShmDetach(fl_display, shminfo);
     shmdt(shminfo->shmaddr);
@@ -98,39 +125,84 @@ void PlatformPixelBuffer::commitBufferRW(const rfb::Rect& r)
   mutex.unlock();
 }
 
-rfb::Rect PlatformPixelBuffer::getDamage(void)
+rfb::Region PlatformPixelBuffer::getDamage(void)
 {
-  rfb::Rect r;
+  rfb::Region r;
 
   mutex.lock();
-  r = damage.get_bounding_rect();
+  r = damage;
   damage.clear();
   mutex.unlock();
 
 #if !defined(WIN32) && !defined(__APPLE__)
-  if (r.width() == 0 || r.height() == 0)
+  if (r.is_empty())
     return r;
 
+  std::vector<rfb::Rect> rects;
+  std::vector<rfb::Rect>::const_iterator iter;
+  unsigned long long area;
+  rfb::Rect bounds;
+
   GC gc;
 
+  r.get_rects(&rects);
+
+  area = 0;
+  for (iter = rects.begin(); iter != rects.end(); ++iter)
+    area += iter->area();
+
+  damagedPixels += area;
+
+  // Merge everything in to a single upload if the extra pixels are
+  // cheaper than the extra requests
+  bounds = r.get_bounding_rect();
+  if ((unsigned long long)bounds.area() <=
+      area + (rects.size() - 1) * UploadRectCost) {
+    rects.assign(1, bounds);
+    area = bounds.area();
+  }
+
+  uploadedPixels += area;
+  uploads += rects.size();
+
   gc = XCreateGC(fl_display, pixmap, 0, NULL);
-  if (shminfo) {
-    XShmPutImage(fl_display, pixmap, gc, xim,
-                 r.tl.x, r.tl.y, r.tl.x, r.tl.y,
-                 r.width(), r.height(), False);
-    // Need to make sure the X server has finished reading the
-    // shared memory before we return
-    XSync(fl_display, False);
-  } else {
-    XPutImage(fl_display, pixmap, gc, xim,
-              r.tl.x, r.tl.y, r.tl.x, r.tl.y, r.width(), r.height());
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    if (shminfo) {
+      // The X server reads the shared memory in the background, and
+      // sends an event once it is done
+      XShmPutImage(fl_display, pixmap, gc, xim,
+                   iter->tl.x, iter->tl.y, iter->tl.x, iter->tl.y,
+                   iter->width(), iter->height(), True);
+      pendingUploads++;
+    } else {
+      XPutImage(fl_display, pixmap, gc, xim,
+                iter->tl.x, iter->tl.y, iter->tl.x, iter->tl.y,
+                iter->width(), iter->height());
+    }
   }
   XFreeGC(fl_display, gc);
+
+  // Get the X server started whilst we go back to decoding
+  XFlush(fl_display);
 #endif
 
   return r;
 }
 
+void PlatformPixelBuffer::waitForUpload(void)
+{
+#if !defined(WIN32) && !defined(__APPLE__)
+  // Events that FLTK has already seen were counted by
+  // handleSystemEvent(), so we only need to wait for the rest
+  while (pendingUploads > 0) {
+    XEvent event;
+
+    XIfEvent(fl_display, &event, isUploadDone, (XPointer)this);
+    pendingUploads--;
+  }
+#endif
+}
+
 #if !defined(WIN32) && !defined(__APPLE__)
 
 static bool caughtError;
@@ -142,6 +214,60 @@ static int XShmAttachErrorHandler(Display* /*dpy*/,
   return 0;
 }
 
+int PlatformPixelBuffer::handleSystemEvent(void* event,
+                                           void* /*data*/)
+{
+  std::list<PlatformPixelBuffer*>::iterator iter;
+
+  for (iter = shmBuffers.begin(); iter != shmBuffers.end(); ++iter) {
+    PlatformPixelBuffer *self;
+
+    self = *iter;
+
+    if (!isUploadDone(fl_display, (XEvent*)event, (XPointer)self))
+      continue;
+
+    if (self->pendingUploads > 0)
+      self->pendingUploads--;
+
+    return 1;
+  }
+
+  return 0;
+}
+
+Bool PlatformPixelBuffer::isUploadDone(Display* dpy, XEvent* event,
+                                       XPointer arg)
+{
+  PlatformPixelBuffer *self = (PlatformPixelBuffer*)arg;
+  XShmCompletionEvent *ev;
+
+  if (event->type != XShmGetEventBase(dpy) + ShmCompletion)
+    return False;
+
+  ev = (XShmCompletionEvent*)event;
+  if (ev->drawable != self->pixmap)
+    return False;
+  if (ev->shmseg != self->shminfo->shmseg)
+    return False;
+
+  return True;
+}
+
+void PlatformPixelBuffer::logStats()
+{
+  if (damagedPixels == 0)
+    return;
+
+  vlog.info("Upload statistics:");
+  vlog.info("  Damaged: %s",
+            rfb::siPrefix(damagedPixels, "pixels").c_str());
+  vlog.info("  Uploaded: %s, %s (%g%% of damage)",
+            rfb::siPrefix(uploads, "rects").c_str(),
+            rfb::siPrefix(uploadedPixels, "pixels").c_str(),
+            100.0 * uploadedPixels / damagedPixels);
+}
+
 bool PlatformPixelBuffer::setupShm(int width, int height)
 {
   int major, minor;
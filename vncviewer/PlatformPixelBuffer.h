@@ -42,7 +42,11 @@ public:
 
   virtual void commitBufferRW(const rfb::Rect& r);
 
-  rfb::Rect getDamage(void);
+  // getDamage() returns the region changed since the last call, and
+  // starts copying it to the Surface. The framebuffer must not be
+  // modified again until waitForUpload() has been called.
+  rfb::Region getDamage(void);
+  void waitForUpload(void);
 
   using rfb::FullFramePixelBuffer::width;
   using rfb::FullFramePixelBuffer::height;
@@ -55,9 +59,23 @@ protected:
 protected:
   bool setupShm(int width, int height);
 
+  static int handleSystemEvent(void* event, void* data);
+  static Bool isUploadDone(Display* dpy, XEvent* event, XPointer arg);
+
+  // Every buffer using shared memory, so that completion events can
+  // be matched up with the right one. Several exist whilst resizing.
+  static std::list<PlatformPixelBuffer*> shmBuffers;
+
+  void logStats();
+
 protected:
   XShmSegmentInfo *shminfo;
   XImage *xim;
+
+  unsigned pendingUploads;
+
+  unsigned long long damagedPixels, uploadedPixels;
+  unsigned uploads;
 #endif
 };
 
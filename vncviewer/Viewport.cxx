@@ -230,10 +230,22 @@ const rfb::PixelFormat &Viewport::getPreferredPF()
 
 void Viewport::updateWindow()
 {
-  Rect r;
+  Region r;
+  std::vector<Rect> rects;
+  std::vector<Rect>::const_iterator iter;
 
   r = frameBuffer->getDamage();
-  damage(FL_DAMAGE_USER1, r.tl.x + x(), r.tl.y + y(), r.width(), r.height());
+
+  r.get_rects(&rects);
+  for (iter = rects.begin(); iter != rects.end(); ++iter) {
+    damage(FL_DAMAGE_USER1, iter->tl.x + x(), iter->tl.y + y(),
+           iter->width(), iter->height());
+  }
+}
+
+void Viewport::waitForUpload()
+{
+  frameBuffer->waitForUpload();
 }
 
 static const char * dotcursor_xpm[] = {
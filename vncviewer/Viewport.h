@@ -47,6 +47,10 @@ public:
   // Flush updates to screen
   void updateWindow();
 
+  // Wait until the framebuffer can be modified again after
+  // updateWindow()
+  void waitForUpload();
+
   // New image for the locally rendered cursor
   void setCursor(int width, int height, const rfb::Point& hotspot,
                  const uint8_t* data);